@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "hash.h"
+
+namespace helpers {
+
+    /** Hash map from fixed size binary keys, such as SHA1 or MD5 hashes, to values.
+
+        A replacement for std::unordered_map when the keys are plain arrays of bytes. Instead of allocating a node per entry, the entries are stored in a single open addressing table with linear probing. Next to the table, each slot has a control byte, which is 0 for empty slots and otherwise contains the top 7 bits of the key's hash (with the highest bit set), so that probing only compares keys whose control bytes match. The keys are hashed with HashBytes and compared with BytesEqual, which uses SSE2 if available.
+
+        The table is at most 3/4 full and doubles its capacity when the limit is reached. Entries cannot be erased. The interface follows std::unordered_map, but iterators and references are invalidated by every insertion which grows the table.
+     */
+    template<typename KEY, typename VALUE>
+    class FixedKeyMap {
+        static_assert(std::is_trivially_copyable<KEY>::value, "Keys must be plain arrays of bytes");
+    public:
+
+        typedef std::pair<KEY, VALUE> value_type;
+
+        template<bool CONST>
+        class Iterator : public std::iterator<std::forward_iterator_tag, value_type> {
+        public:
+            typedef typename std::conditional<CONST, FixedKeyMap const, FixedKeyMap>::type Map;
+            typedef typename std::conditional<CONST, value_type const, value_type>::type Entry;
+
+            Entry & operator * () const {
+                return map_->slots_[i_];
+            }
+
+            Entry * operator -> () const {
+                return & map_->slots_[i_];
+            }
+
+            Iterator & operator ++ () {
+                ++i_;
+                skipEmpty();
+                return *this;
+            }
+
+            bool operator == (Iterator const & other) const {
+                return i_ == other.i_;
+            }
+
+            bool operator != (Iterator const & other) const {
+                return i_ != other.i_;
+            }
+
+        private:
+            friend class FixedKeyMap;
+
+            Iterator(Map * map, size_t i):
+                map_(map),
+                i_(i) {
+            }
+
+            void skipEmpty() {
+                while (i_ < map_->control_.size() && map_->control_[i_] == EMPTY)
+                    ++i_;
+            }
+
+            Map * map_;
+            size_t i_;
+        };
+
+        typedef Iterator<false> iterator;
+        typedef Iterator<true> const_iterator;
+
+        FixedKeyMap(size_t capacity = 16):
+            size_(0) {
+            resize(CapacityFor(capacity));
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+        bool empty() const {
+            return size_ == 0;
+        }
+
+        /** Makes sure that given number of entries can be stored without growing the table.
+         */
+        void reserve(size_t n) {
+            size_t c = CapacityFor(n);
+            if (c > control_.size())
+                resize(c);
+        }
+
+        void clear() {
+            std::vector<uint8_t>(control_.size(), EMPTY).swap(control_);
+            std::vector<value_type>(control_.size()).swap(slots_);
+            size_ = 0;
+        }
+
+        iterator begin() {
+            iterator result(this, 0);
+            result.skipEmpty();
+            return result;
+        }
+
+        iterator end() {
+            return iterator(this, control_.size());
+        }
+
+        const_iterator begin() const {
+            const_iterator result(this, 0);
+            result.skipEmpty();
+            return result;
+        }
+
+        const_iterator end() const {
+            return const_iterator(this, control_.size());
+        }
+
+        iterator find(KEY const & key) {
+            size_t i = slotOf(key);
+            return control_[i] == EMPTY ? end() : iterator(this, i);
+        }
+
+        const_iterator find(KEY const & key) const {
+            size_t i = slotOf(key);
+            return control_[i] == EMPTY ? end() : const_iterator(this, i);
+        }
+
+        size_t count(KEY const & key) const {
+            return control_[slotOf(key)] == EMPTY ? 0 : 1;
+        }
+
+        /** Inserts the entry unless its key is already present.
+
+            Returns iterator to the entry with the key and whether it was inserted.
+         */
+        std::pair<iterator, bool> insert(value_type const & entry) {
+            size_t h = HashBytes(& entry.first, sizeof(KEY));
+            size_t i = slotOf(entry.first, h);
+            if (control_[i] != EMPTY)
+                return std::make_pair(iterator(this, i), false);
+            if ((size_ + 1) * 4 > control_.size() * 3) {
+                resize(control_.size() * 2);
+                i = slotOf(entry.first, h);
+            }
+            control_[i] = Fingerprint(h);
+            slots_[i] = entry;
+            ++size_;
+            return std::make_pair(iterator(this, i), true);
+        }
+
+        /** Returns the value of given key, inserting default value if the key is not present.
+         */
+        VALUE & operator [] (KEY const & key) {
+            return insert(value_type(key, VALUE())).first->second;
+        }
+
+    private:
+
+        static constexpr uint8_t EMPTY = 0;
+
+        static uint8_t Fingerprint(size_t h) {
+            return static_cast<uint8_t>((h >> 57) | 0x80);
+        }
+
+        /** Returns the smallest power of two capacity which holds n entries.
+         */
+        static size_t CapacityFor(size_t n) {
+            size_t result = 16;
+            while (result * 3 < n * 4)
+                result *= 2;
+            return result;
+        }
+
+        size_t slotOf(KEY const & key) const {
+            return slotOf(key, HashBytes(& key, sizeof(KEY)));
+        }
+
+        /** Returns the slot which contains the key, or the empty slot where the key should be inserted.
+         */
+        size_t slotOf(KEY const & key, size_t h) const {
+            size_t mask = control_.size() - 1;
+            uint8_t f = Fingerprint(h);
+            size_t i = h & mask;
+            while (true) {
+                uint8_t c = control_[i];
+                if (c == EMPTY)
+                    return i;
+                if (c == f && BytesEqual<sizeof(KEY)>(& slots_[i].first, & key))
+                    return i;
+                i = (i + 1) & mask;
+            }
+        }
+
+        void resize(size_t capacity) {
+            assert((capacity & (capacity - 1)) == 0);
+            std::vector<uint8_t> oldControl(capacity, EMPTY);
+            std::vector<value_type> oldSlots(capacity);
+            oldControl.swap(control_);
+            oldSlots.swap(slots_);
+            for (size_t j = 0; j < oldControl.size(); ++j) {
+                if (oldControl[j] == EMPTY)
+                    continue;
+                size_t i = HashBytes(& oldSlots[j].first, sizeof(KEY)) & (capacity - 1);
+                while (control_[i] != EMPTY)
+                    i = (i + 1) & (capacity - 1);
+                control_[i] = oldControl[j];
+                slots_[i] = std::move(oldSlots[j]);
+            }
+        }
+
+        std::vector<uint8_t> control_;
+        std::vector<value_type> slots_;
+        size_t size_;
+    }; // FixedKeyMap
+
+    template<typename KEY, typename VALUE>
+    constexpr uint8_t FixedKeyMap<KEY, VALUE>::EMPTY;
+
+} // namespace helpers
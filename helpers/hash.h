@@ -1,12 +1,69 @@
 #pragma once
 
+#include <cstdint>
 #include <cstring>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "helpers.h"
+#include "hex.h"
 #include "strings.h"
 
 namespace helpers {
 
+	/** Finalizer of the 64bit murmur3 hash, a bijection in which every input bit affects every output bit.
+	 */
+	inline uint64_t MixBits(uint64_t x) {
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdull;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53ull;
+		x ^= x >> 33;
+		return x;
+	}
+
+	/** Hashes given bytes.
+
+	    The bytes are read in 64bit words, each of which is mixed into the result, so that all bytes of the input affect all bits of the hash. 
+	 */
+	inline size_t HashBytes(void const * data, size_t size) {
+		unsigned char const * x = static_cast<unsigned char const *>(data);
+		uint64_t result = 0x9e3779b97f4a7c15ull ^ size;
+		for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), x += sizeof(uint64_t)) {
+			uint64_t w;
+			memcpy(& w, x, sizeof(w));
+			result = MixBits(result ^ w);
+		}
+		if (size > 0) {
+			uint64_t w = 0;
+			memcpy(& w, x, size);
+			result = MixBits(result ^ w);
+		}
+		return result;
+	}
+
+	/** Compares two byte arrays of size known at compile time.
+
+	    When available, 16 bytes are compared at once using SSE2, the rest with memcmp of constant size, which the compiler inlines. 
+	 */
+	template<size_t SIZE>
+	inline bool BytesEqual(void const * a, void const * b) {
+		unsigned char const * x = static_cast<unsigned char const *>(a);
+		unsigned char const * y = static_cast<unsigned char const *>(b);
+		size_t i = 0;
+#if defined(__SSE2__)
+		for (; i + 16 <= SIZE; i += 16) {
+			__m128i xx = _mm_loadu_si128(reinterpret_cast<__m128i const *>(x + i));
+			__m128i yy = _mm_loadu_si128(reinterpret_cast<__m128i const *>(y + i));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(xx, yy)) != 0xffff)
+				return false;
+		}
+#endif
+		return memcmp(x + i, y + i, SIZE - i) == 0;
+	}
+
 
 	/** A memory efficient representation of hashes. 
 
@@ -29,12 +86,6 @@ namespace helpers {
 			fromString(from);
 		}
 
-		/** Copy constructor, simple memcpy's the byte array. 
-		 */
-		Hash(Hash const & from) {
-			memcpy(&bytes_, &from.bytes_, BYTES);
-		}
-
 		/** Size of the hash in bytes. 
 		 */
 		size_t rawSize() const {
@@ -47,13 +98,6 @@ namespace helpers {
 			return BYTES * 2;
 		}
 
-		/** Sets the hash to given hash. 
-		 */
-		Hash & operator = (Hash & from) {
-			memcpy(&bytes_, &from.bytes_, BYTES);
-			return *this;
-		}
-
 		/** Sets the hash to given string representing hexadecimal value of the appropriate length.
 		 */
 		Hash & operator = (std::string const & from) {
@@ -64,13 +108,13 @@ namespace helpers {
 		/** Compares two hashes. 
 		 */
 		bool operator == (Hash const & other) const {
-			return memcmp(&bytes_, &other.bytes_, BYTES * 2) == 0;
+			return BytesEqual<BYTES>(bytes_, other.bytes_);
 		}
 
 		/** Compares two hashes.
 		 */
 		bool operator != (Hash const & other) const {
-			return memcmp(&bytes_, &other.bytes_, BYTES * 2) != 0;
+			return ! BytesEqual<BYTES>(bytes_, other.bytes_);
 		}
 
 		/** Returns a pointer to the hash internal array. 
@@ -84,27 +128,17 @@ namespace helpers {
 		/** Sends the hash as a hexadecimal string to the given output stream. 
 		 */
 		friend std::ostream & operator << (std::ostream & s, Hash const & h) {
-			for (size_t i = 0; i < BYTES; ++i) {
-				unsigned x = (h.bytes_[i] >> 4);
-				if (x > 9)
-					s << static_cast<char> ('a' + (x - 10));
-				else
-					s << static_cast<char>('0' + x);
-				x = h.bytes_[i] & 0x0f;
-				if (x > 9)
-					s << static_cast<char> ('a' + (x - 10));
-				else
-					s << static_cast<char>('0' + x);
-			}
+			char buffer[BYTES * 2];
+			HexEncode(h.bytes_, BYTES, buffer);
+			s.write(buffer, BYTES * 2);
 			return s;
 		}
 
 		/** Fills the hash from given string of appropriate size. 
 		 */
 		void fromString(std::string const & from) {
-            assert(from.size() == 2 * BYTES);
-			for (size_t i = 0; i < BYTES; ++i)
-				bytes_[i] = (HexCharToNumber(from[i * 2]) << 8) + HexCharToNumber(from[i * 2 + 1]);
+			if (from.size() != 2 * BYTES || ! HexDecode(from.c_str(), BYTES, bytes_))
+				ERROR("Invalid hexadecimal hash: " << from);
 		}
 
 		/** Array storing the hash value. 
@@ -129,20 +163,7 @@ namespace std {
 	template<unsigned BYTES>
 	struct hash<helpers::Hash<BYTES>> {
 		size_t operator() (helpers::Hash<BYTES> const & h) const {
-			size_t result = 0;
-			unsigned i = 0;
-			/*hash<unsigned> hu{};
-
-              while (i + sizeof(unsigned) <= BYTES) {
-				result += hu(*reinterpret_cast<unsigned const *>(h.raw() + i));
-				i += sizeof(unsigned);
-                } */
-			hash<unsigned char> hc{};
-			while (i < BYTES) {
-				result += hc(*(h.raw() + i));
-				++i;
-			}
-			return result;
+			return helpers::HashBytes(h.raw(), BYTES);
 		}
 
 	};
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace helpers {
+
+    /** Converts given value (0 - 15) to lowercase hexadecimal digit.
+     */
+    inline char NumberToHexChar(unsigned what) {
+        return static_cast<char>(what + '0' + (what > 9 ? 'a' - '0' - 10 : 0));
+    }
+
+#if defined(__SSE2__)
+
+    /** Converts 16 hexadecimal digits to their values, setting valid to false if any of the characters is not a hexadecimal digit.
+     */
+    inline __m128i HexDigitsToNibbles(__m128i x, bool & valid) {
+        __m128i digits = _mm_sub_epi8(x, _mm_set1_epi8('0'));
+        __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1)));
+        // lowercase the letters
+        __m128i l = _mm_or_si128(x, _mm_set1_epi8(0x20));
+        __m128i letters = _mm_sub_epi8(l, _mm_set1_epi8('a' - 10));
+        __m128i isLetter = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(l, _mm_set1_epi8('f' + 1)));
+        if (_mm_movemask_epi8(_mm_or_si128(isDigit, isLetter)) != 0xffff)
+            valid = false;
+        return _mm_or_si128(_mm_and_si128(isDigit, digits), _mm_and_si128(isLetter, letters));
+    }
+
+    /** Combines pairs of nibbles (high nibble first) into bytes, which are stored in the lower 8 bytes of the result.
+     */
+    inline __m128i NibblesToBytes(__m128i x) {
+        // in each 16bit lane, the high nibble is in the low byte and the low nibble in the high byte
+        __m128i hi = _mm_slli_epi16(_mm_and_si128(x, _mm_set1_epi16(0x00ff)), 4);
+        __m128i lo = _mm_srli_epi16(x, 8);
+        return _mm_packus_epi16(_mm_or_si128(hi, lo), _mm_setzero_si128());
+    }
+
+    /** Converts 16 nibbles (high nibble of each byte first) to lowercase hexadecimal digits.
+     */
+    inline __m128i NibblesToHexDigits(__m128i x) {
+        __m128i isLetter = _mm_cmpgt_epi8(x, _mm_set1_epi8(9));
+        return _mm_add_epi8(_mm_add_epi8(x, _mm_set1_epi8('0')), _mm_and_si128(isLetter, _mm_set1_epi8('a' - '0' - 10)));
+    }
+
+#endif
+
+    /** Decodes given number of bytes from twice as many hexadecimal digits (both upper and lower case digits are accepted).
+
+        Returns false if any of the characters is not a hexadecimal digit. The input must contain at least 2 * bytes characters, as the digits are read without checking for the end of the string. With SSE2, 16 digits are decoded at once.
+     */
+    inline bool HexDecode(char const * from, size_t bytes, unsigned char * to) {
+        bool valid = true;
+        size_t i = 0;
+#if defined(__SSE2__)
+        for (; i + 8 <= bytes; i += 8) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(from + 2 * i));
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(to + i), NibblesToBytes(HexDigitsToNibbles(x, valid)));
+        }
+        if (i + 4 <= bytes) {
+            __m128i x = _mm_loadl_epi64(reinterpret_cast<__m128i const *>(from + 2 * i));
+            // only 8 characters are loaded, fill the rest with valid digits
+            x = _mm_or_si128(x, _mm_set_epi32(0x30303030, 0x30303030, 0, 0));
+            uint32_t result = _mm_cvtsi128_si32(NibblesToBytes(HexDigitsToNibbles(x, valid)));
+            memcpy(to + i, & result, sizeof(result));
+            i += 4;
+        }
+#endif
+        // the remaining digits are walked by pointer so that the loop bound does not depend on 2 * i not overflowing
+        char const * digits = from + 2 * i;
+        for (; i < bytes; ++i, digits += 2) {
+            unsigned char x[2];
+            for (unsigned j = 0; j < 2; ++j) {
+                char c = digits[j];
+                if (c >= '0' && c <= '9') {
+                    x[j] = c - '0';
+                } else {
+                    c |= 0x20;
+                    if (c >= 'a' && c <= 'f') {
+                        x[j] = c - 'a' + 10;
+                    } else {
+                        x[j] = 0;
+                        valid = false;
+                    }
+                }
+            }
+            to[i] = static_cast<unsigned char>((x[0] << 4) | x[1]);
+        }
+        return valid;
+    }
+
+    /** Encodes given number of bytes as twice as many lowercase hexadecimal digits.
+
+        With SSE2, 16 bytes are encoded at once.
+     */
+    inline void HexEncode(unsigned char const * from, size_t bytes, char * to) {
+        size_t i = 0;
+#if defined(__SSE2__)
+        __m128i mask = _mm_set1_epi8(0x0f);
+        for (; i + 16 <= bytes; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(from + i));
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), mask);
+            __m128i lo = _mm_and_si128(x, mask);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(to + 2 * i), NibblesToHexDigits(_mm_unpacklo_epi8(hi, lo)));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(to + 2 * i + 16), NibblesToHexDigits(_mm_unpackhi_epi8(hi, lo)));
+        }
+        for (; i + 4 <= bytes; i += 4) {
+            uint32_t y;
+            memcpy(& y, from + i, sizeof(y));
+            __m128i x = _mm_cvtsi32_si128(static_cast<int>(y));
+            __m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), mask);
+            __m128i lo = _mm_and_si128(x, mask);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(to + 2 * i), NibblesToHexDigits(_mm_unpacklo_epi8(hi, lo)));
+        }
+#endif
+        for (; i < bytes; ++i) {
+            to[2 * i] = NumberToHexChar(from[i] >> 4);
+            to[2 * i + 1] = NumberToHexChar(from[i] & 0x0f);
+        }
+    }
+
+} // namespace helpers
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "helpers.h"
+#include "strings.h"
+
+namespace helpers {
+
+    /** In-process HTTP client which runs many concurrent transfers on a few event loop threads using the libcurl multi interface.
+
+        Each event loop thread owns a curl multi handle, which keeps a cache of open connections so that requests to the same host reuse persistent keep-alive connections, and a pool of easy handles which are reused across requests. Requests are submitted from any thread with add(), which blocks when too many requests are waiting so that producers cannot run ahead of the transfers arbitrarily.
+
+        Response bodies are not buffered by the client, but passed to the request's data handler as they arrive. The completion handler is then called with the status and headers of the response. Both handlers are called from the event loop threads and must therefore be thread safe with respect to any data they share.
+
+        Only curl_multi_wait is used (and not the newer poll & wakeup API) so that the client works with the libcurl of older distributions.
+     */
+    class HttpClient {
+    public:
+
+        /** Response to a request.
+         */
+        class Response {
+        public:
+            /** HTTP status, 0 if the transfer failed before any status was received.
+             */
+            long status = 0;
+
+            /** Result of the transfer, CURLE_OK if the transfer itself succeeded (regardless of the HTTP status).
+             */
+            CURLcode result = CURLE_OK;
+
+            /** Response headers with lowercase names. If a header appears multiple times, the last value is kept.
+             */
+            std::unordered_map<std::string, std::string> headers;
+
+            bool ok() const {
+                return result == CURLE_OK;
+            }
+
+            /** Returns the value of given header (the name must be in lowercase), or empty string if not present.
+             */
+            std::string header(std::string const & name) const {
+                auto i = headers.find(name);
+                return i == headers.end() ? std::string() : i->second;
+            }
+
+            char const * error() const {
+                return curl_easy_strerror(result);
+            }
+        };
+
+        /** A request to be performed by the client.
+
+            Requests are owned by the caller, who must keep them alive until the completion handler is called. The completion handler is the last time the client touches the request and so it may delete the request.
+         */
+        class Request {
+        public:
+            std::string url;
+
+            /** Additional headers in the `Name: value` form.
+             */
+            std::vector<std::string> headers;
+
+            /** Called for every chunk of the body as it arrives. Returning false aborts the transfer.
+             */
+            std::function<bool(char const *, size_t)> onData;
+
+            /** Called once the request is finished.
+             */
+            std::function<void(Request *, Response const &)> onComplete;
+
+            virtual ~Request() {
+            }
+        };
+
+        /** Creates the client with given number of event loop threads and the total number of concurrent transfers, which are split evenly between the threads.
+         */
+        HttpClient(unsigned numThreads, unsigned maxTransfers, std::string const & userAgent = "DejaVuII"):
+            userAgent_(userAgent),
+            transfersPerThread_(std::max(1u, maxTransfers / std::max(1u, numThreads))),
+            maxWaiting_(std::max(1u, maxTransfers) * 2),
+            closing_(false),
+            active_(0) {
+            GlobalInit();
+            for (unsigned i = 0; i < std::max(1u, numThreads); ++i)
+                threads_.push_back(std::thread([this]() {
+                    eventLoop();
+                }));
+        }
+
+        HttpClient(HttpClient const &) = delete;
+
+        ~HttpClient() {
+            finish();
+        }
+
+        /** Submits the request, blocks while too many requests are waiting to be started.
+         */
+        void add(Request * r) {
+            std::unique_lock<std::mutex> g(m_);
+            cvSpace_.wait(g, [this]() {
+                    return waiting_.size() < maxWaiting_;
+                });
+            waiting_.push_back(r);
+        }
+
+        /** Submits the request without blocking.
+
+            Intended for the handlers of completed requests (which run on the event loop threads and must not block) to retry a request, or to issue a follow-up request. Unlike add() it can be used while finish() is waiting, provided it is called from a handler.
+         */
+        void resubmit(Request * r) {
+            std::lock_guard<std::mutex> g(m_);
+            waiting_.push_back(r);
+        }
+
+        /** Waits for all submitted requests to complete and stops the event loop threads.
+
+            No requests may be added afterwards.
+         */
+        void finish() {
+            {
+                std::lock_guard<std::mutex> g(m_);
+                if (closing_ && threads_.empty())
+                    return;
+                closing_ = true;
+            }
+            for (auto & t : threads_)
+                t.join();
+            threads_.clear();
+        }
+
+        /** Number of requests currently being transferred, or whose completion handler is running.
+         */
+        unsigned active() const {
+            return active_;
+        }
+
+    private:
+
+        /** State of a single running transfer.
+         */
+        struct Transfer {
+            Request * request;
+            Response response;
+            struct curl_slist * headers;
+
+            Transfer():
+                request(nullptr),
+                headers(nullptr) {
+            }
+        };
+
+        static void GlobalInit() {
+            static std::once_flag once;
+            std::call_once(once, []() {
+                    curl_global_init(CURL_GLOBAL_ALL);
+                });
+        }
+
+        static size_t WriteCallback(char * data, size_t, size_t size, void * t) {
+            Transfer * x = static_cast<Transfer *>(t);
+            if (x->request->onData && ! x->request->onData(data, size))
+                return 0; // aborts the transfer
+            return size;
+        }
+
+        static size_t HeaderCallback(char * data, size_t, size_t size, void * t) {
+            Transfer * x = static_cast<Transfer *>(t);
+            std::string line(data, size);
+            size_t colon = line.find(':');
+            if (colon == std::string::npos) {
+                // status line of a new response (i.e. after redirect, or 100 continue) resets the headers
+                if (line.compare(0, 5, "HTTP/") == 0)
+                    x->response.headers.clear();
+                return size;
+            }
+            std::string name = line.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(), [](char c) {
+                    return static_cast<char>(std::tolower(c));
+                });
+            x->response.headers[name] = strip(line.substr(colon + 1));
+            return size;
+        }
+
+        /** Takes up to given number of waiting requests, returns false if there are no more requests and the client is closing.
+
+            The taken requests are counted as active immediately, and are only removed from active after their completion handler returns, so that when the client is closing and there are no waiting and no active requests, no handler can resubmit any more requests.
+         */
+        bool takeWaiting(size_t max, std::vector<Request *> & into) {
+            std::lock_guard<std::mutex> g(m_);
+            while (max > 0 && ! waiting_.empty()) {
+                into.push_back(waiting_.front());
+                waiting_.pop_front();
+                ++active_;
+                --max;
+            }
+            if (! into.empty())
+                cvSpace_.notify_all();
+            return ! (closing_ && waiting_.empty() && active_ == 0);
+        }
+
+        void start(CURLM * multi, CURL * h, Request * r) {
+            Transfer * t = new Transfer();
+            t->request = r;
+            for (std::string const & header : r->headers)
+                t->headers = curl_slist_append(t->headers, header.c_str());
+            curl_easy_reset(h);
+            curl_easy_setopt(h, CURLOPT_URL, r->url.c_str());
+            curl_easy_setopt(h, CURLOPT_USERAGENT, userAgent_.c_str());
+            curl_easy_setopt(h, CURLOPT_HTTPHEADER, t->headers);
+            curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, WriteCallback);
+            curl_easy_setopt(h, CURLOPT_WRITEDATA, t);
+            curl_easy_setopt(h, CURLOPT_HEADERFUNCTION, HeaderCallback);
+            curl_easy_setopt(h, CURLOPT_HEADERDATA, t);
+            curl_easy_setopt(h, CURLOPT_PRIVATE, t);
+            curl_easy_setopt(h, CURLOPT_NOSIGNAL, 1L);
+            curl_easy_setopt(h, CURLOPT_TCP_KEEPALIVE, 1L);
+            curl_easy_setopt(h, CURLOPT_CONNECTTIMEOUT, 30L);
+            curl_easy_setopt(h, CURLOPT_ACCEPT_ENCODING, "");
+            curl_multi_add_handle(multi, h);
+        }
+
+        void complete(CURLM * multi, CURL * h, CURLcode result) {
+            Transfer * t;
+            curl_easy_getinfo(h, CURLINFO_PRIVATE, reinterpret_cast<char **>(& t));
+            curl_multi_remove_handle(multi, h);
+            t->response.result = result;
+            curl_easy_getinfo(h, CURLINFO_RESPONSE_CODE, & t->response.status);
+            curl_slist_free_all(t->headers);
+            Request * r = t->request;
+            Response response = std::move(t->response);
+            delete t;
+            if (r->onComplete)
+                r->onComplete(r, response);
+            --active_;
+        }
+
+        void eventLoop() {
+            CURLM * multi = curl_multi_init();
+            curl_multi_setopt(multi, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(transfersPerThread_));
+            std::vector<CURL *> idle;
+            for (unsigned i = 0; i < transfersPerThread_; ++i)
+                idle.push_back(curl_easy_init());
+            std::vector<Request *> requests;
+            int running = 0;
+            bool more = true;
+            while (more || running > 0) {
+                if (! idle.empty()) {
+                    requests.clear();
+                    more = takeWaiting(idle.size(), requests);
+                    for (Request * r : requests) {
+                        CURL * h = idle.back();
+                        idle.pop_back();
+                        start(multi, h, r);
+                    }
+                }
+                curl_multi_perform(multi, & running);
+                int msgs;
+                while (CURLMsg * msg = curl_multi_info_read(multi, & msgs)) {
+                    if (msg->msg != CURLMSG_DONE)
+                        continue;
+                    CURL * h = msg->easy_handle;
+                    complete(multi, h, msg->data.result);
+                    idle.push_back(h);
+                }
+                if (running > 0) {
+                    // short timeout so that newly added requests do not wait for long
+                    curl_multi_wait(multi, nullptr, 0, 10, nullptr);
+                } else if (more && requests.empty()) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                }
+            }
+            for (CURL * h : idle)
+                curl_easy_cleanup(h);
+            curl_multi_cleanup(multi);
+        }
+
+        std::string userAgent_;
+        unsigned transfersPerThread_;
+        size_t maxWaiting_;
+
+        std::deque<Request *> waiting_;
+        bool closing_;
+        std::mutex m_;
+        std::condition_variable cvSpace_;
+
+        std::atomic<unsigned> active_;
+        std::vector<std::thread> threads_;
+    }; // helpers::HttpClient
+
+} // namespace helpers
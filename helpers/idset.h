@@ -0,0 +1,391 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+namespace helpers {
+
+    /** Compressed set of unsigned ids.
+
+        A replacement for std::unordered_set<unsigned> when the ids are dense small integers, such as project, commit, or path ids. The id space is split into chunks of CHUNK_SIZE ids indexed by the upper 16 bits of the id. Each chunk stores the lower 16 bits of its ids either as a sorted array if it holds at most ARRAY_LIMIT ids, or as a bitmap of the whole chunk otherwise, so that the set never takes more than 2 bytes per id for sparse chunks and 1 bit per id for dense ones (as opposed to ~40 bytes per id of the unordered set).
+
+        Membership test is a directory lookup followed by either a bit test, or a binary search in at most ARRAY_LIMIT elements. Sets can be combined with union, intersection and difference, which work chunk by chunk, and can be built in parallel from a predicate (see Build).
+     */
+    class IdSet {
+    public:
+
+        static constexpr unsigned CHUNK_BITS = 16;
+        static constexpr unsigned CHUNK_SIZE = 1 << CHUNK_BITS;
+        static constexpr unsigned ARRAY_LIMIT = 4096;
+
+        IdSet():
+            size_(0) {
+        }
+
+        /** Builds the set of all ids from 0 to n for which the predicate returns true, using the given number of threads.
+
+            Each thread builds whole chunks, so the predicate is called concurrently and must be thread safe.
+         */
+        static IdSet Build(size_t n, unsigned numThreads, std::function<bool(unsigned)> const & predicate) {
+            IdSet result;
+            result.chunks_.resize((n + CHUNK_SIZE - 1) / CHUNK_SIZE);
+            std::atomic<size_t> next(0);
+            std::vector<std::thread> threads;
+            for (unsigned t = 0; t < std::max(numThreads, 1u); ++t)
+                threads.push_back(std::thread([&]() {
+                    while (true) {
+                        size_t i = next++;
+                        if (i >= result.chunks_.size())
+                            return;
+                        Chunk & c = result.chunks_[i];
+                        c.bitmap.resize(CHUNK_SIZE / 64);
+                        size_t first = i * CHUNK_SIZE;
+                        size_t last = std::min(first + CHUNK_SIZE, n);
+                        for (size_t id = first; id < last; ++id)
+                            if (predicate(static_cast<unsigned>(id)))
+                                c.bitmap[(id - first) / 64] |= uint64_t(1) << (id % 64);
+                        c.recount();
+                        c.compact();
+                    }
+                }));
+            for (auto & t : threads)
+                t.join();
+            for (Chunk const & c : result.chunks_)
+                result.size_ += c.size;
+            return result;
+        }
+
+        size_t size() const {
+            return size_;
+        }
+
+        bool empty() const {
+            return size_ == 0;
+        }
+
+        void clear() {
+            chunks_.clear();
+            size_ = 0;
+        }
+
+        bool contains(unsigned id) const {
+            size_t i = id >> CHUNK_BITS;
+            return i < chunks_.size() && chunks_[i].contains(static_cast<uint16_t>(id));
+        }
+
+        /** Adds the id to the set, returns true if it was not already present.
+         */
+        bool insert(unsigned id) {
+            size_t i = id >> CHUNK_BITS;
+            if (i >= chunks_.size())
+                chunks_.resize(i + 1);
+            if (! chunks_[i].insert(static_cast<uint16_t>(id)))
+                return false;
+            ++size_;
+            return true;
+        }
+
+        /** Removes the id from the set, returns true if it was present.
+         */
+        bool erase(unsigned id) {
+            size_t i = id >> CHUNK_BITS;
+            if (i >= chunks_.size() || ! chunks_[i].erase(static_cast<uint16_t>(id)))
+                return false;
+            --size_;
+            return true;
+        }
+
+        /** Calls the handler for all ids in the set in increasing order.
+         */
+        void forEach(std::function<void(unsigned)> const & handler) const {
+            for (size_t i = 0; i < chunks_.size(); ++i) {
+                unsigned base = static_cast<unsigned>(i << CHUNK_BITS);
+                Chunk const & c = chunks_[i];
+                if (c.bitmap.empty()) {
+                    for (uint16_t x : c.array)
+                        handler(base + x);
+                } else {
+                    for (size_t w = 0; w < c.bitmap.size(); ++w)
+                        for (uint64_t bits = c.bitmap[w]; bits != 0; bits &= bits - 1)
+                            handler(base + static_cast<unsigned>(w * 64 + __builtin_ctzll(bits)));
+                }
+            }
+        }
+
+        /** Returns the number of bytes used by the set.
+         */
+        size_t memory() const {
+            size_t result = chunks_.capacity() * sizeof(Chunk);
+            for (Chunk const & c : chunks_)
+                result += c.array.capacity() * sizeof(uint16_t) + c.bitmap.capacity() * sizeof(uint64_t);
+            return result;
+        }
+
+        /** Union.
+         */
+        IdSet & operator |= (IdSet const & other) {
+            if (other.chunks_.size() > chunks_.size())
+                chunks_.resize(other.chunks_.size());
+            for (size_t i = 0; i < other.chunks_.size(); ++i)
+                chunks_[i].unite(other.chunks_[i]);
+            recount();
+            return *this;
+        }
+
+        /** Intersection.
+         */
+        IdSet & operator &= (IdSet const & other) {
+            if (chunks_.size() > other.chunks_.size())
+                chunks_.resize(other.chunks_.size());
+            for (size_t i = 0; i < chunks_.size(); ++i)
+                chunks_[i].intersect(other.chunks_[i]);
+            recount();
+            return *this;
+        }
+
+        /** Difference.
+         */
+        IdSet & operator -= (IdSet const & other) {
+            for (size_t i = 0, e = std::min(chunks_.size(), other.chunks_.size()); i < e; ++i)
+                chunks_[i].subtract(other.chunks_[i]);
+            recount();
+            return *this;
+        }
+
+        friend IdSet operator | (IdSet a, IdSet const & b) {
+            return a |= b;
+        }
+
+        friend IdSet operator & (IdSet a, IdSet const & b) {
+            return a &= b;
+        }
+
+        friend IdSet operator - (IdSet a, IdSet const & b) {
+            return a -= b;
+        }
+
+        bool operator == (IdSet const & other) const {
+            if (size_ != other.size_)
+                return false;
+            std::vector<unsigned> a;
+            std::vector<unsigned> b;
+            forEach([&](unsigned id) { a.push_back(id); });
+            other.forEach([&](unsigned id) { b.push_back(id); });
+            return a == b;
+        }
+
+        bool operator != (IdSet const & other) const {
+            return ! (*this == other);
+        }
+
+        /** Writes the set to a binary stream.
+
+            The set is stored as the number of chunks followed by the chunks, each as its size, a flag whether it is a bitmap and either the sorted 16bit values, or the bitmap words.
+         */
+        void write(std::ostream & f) const {
+            uint64_t n = chunks_.size();
+            f.write(reinterpret_cast<char const *>(& n), sizeof(n));
+            for (Chunk const & c : chunks_) {
+                uint32_t header[] = { c.size, c.bitmap.empty() ? 0u : 1u };
+                f.write(reinterpret_cast<char const *>(header), sizeof(header));
+                if (c.bitmap.empty())
+                    f.write(reinterpret_cast<char const *>(c.array.data()), c.array.size() * sizeof(uint16_t));
+                else
+                    f.write(reinterpret_cast<char const *>(c.bitmap.data()), c.bitmap.size() * sizeof(uint64_t));
+            }
+        }
+
+        /** Reads the set from a binary stream, see write().
+         */
+        void read(std::istream & f) {
+            uint64_t n = 0;
+            f.read(reinterpret_cast<char *>(& n), sizeof(n));
+            chunks_.clear();
+            chunks_.resize(n);
+            for (Chunk & c : chunks_) {
+                uint32_t header[2];
+                f.read(reinterpret_cast<char *>(header), sizeof(header));
+                c.size = header[0];
+                if (header[1] == 0) {
+                    c.array.resize(c.size);
+                    f.read(reinterpret_cast<char *>(c.array.data()), c.array.size() * sizeof(uint16_t));
+                } else {
+                    c.bitmap.resize(CHUNK_SIZE / 64);
+                    f.read(reinterpret_cast<char *>(c.bitmap.data()), c.bitmap.size() * sizeof(uint64_t));
+                }
+            }
+            recount();
+        }
+
+    private:
+
+        /** Chunk of the set, which is an array container if the bitmap is empty and bitmap container otherwise.
+         */
+        class Chunk {
+        public:
+            uint32_t size = 0;
+            std::vector<uint16_t> array;
+            std::vector<uint64_t> bitmap;
+
+            bool contains(uint16_t x) const {
+                if (! bitmap.empty())
+                    return bitmap[x / 64] & (uint64_t(1) << (x % 64));
+                return std::binary_search(array.begin(), array.end(), x);
+            }
+
+            bool insert(uint16_t x) {
+                if (! bitmap.empty()) {
+                    uint64_t mask = uint64_t(1) << (x % 64);
+                    if (bitmap[x / 64] & mask)
+                        return false;
+                    bitmap[x / 64] |= mask;
+                } else if (array.empty() || array.back() < x) {
+                    // ids are mostly inserted in increasing order
+                    array.push_back(x);
+                } else {
+                    auto i = std::lower_bound(array.begin(), array.end(), x);
+                    if (*i == x)
+                        return false;
+                    array.insert(i, x);
+                }
+                ++size;
+                if (bitmap.empty() && size > ARRAY_LIMIT)
+                    toBitmap();
+                return true;
+            }
+
+            bool erase(uint16_t x) {
+                if (! bitmap.empty()) {
+                    uint64_t mask = uint64_t(1) << (x % 64);
+                    if ((bitmap[x / 64] & mask) == 0)
+                        return false;
+                    bitmap[x / 64] &= ~mask;
+                } else {
+                    auto i = std::lower_bound(array.begin(), array.end(), x);
+                    if (i == array.end() || *i != x)
+                        return false;
+                    array.erase(i);
+                }
+                --size;
+                return true;
+            }
+
+            void unite(Chunk const & other) {
+                if (other.size == 0)
+                    return;
+                if (bitmap.empty() && other.bitmap.empty() && size + other.size <= ARRAY_LIMIT) {
+                    std::vector<uint16_t> result;
+                    result.reserve(size + other.size);
+                    std::set_union(array.begin(), array.end(), other.array.begin(), other.array.end(), std::back_inserter(result));
+                    array.swap(result);
+                    size = array.size();
+                    return;
+                }
+                toBitmap();
+                if (other.bitmap.empty()) {
+                    for (uint16_t x : other.array)
+                        bitmap[x / 64] |= uint64_t(1) << (x % 64);
+                } else {
+                    for (size_t i = 0; i < bitmap.size(); ++i)
+                        bitmap[i] |= other.bitmap[i];
+                }
+                recount();
+                compact();
+            }
+
+            void intersect(Chunk const & other) {
+                if (! bitmap.empty() && ! other.bitmap.empty()) {
+                    for (size_t i = 0; i < bitmap.size(); ++i)
+                        bitmap[i] &= other.bitmap[i];
+                    recount();
+                    compact();
+                    return;
+                }
+                std::vector<uint16_t> result;
+                if (bitmap.empty()) {
+                    for (uint16_t x : array)
+                        if (other.contains(x))
+                            result.push_back(x);
+                } else {
+                    for (uint16_t x : other.array)
+                        if (contains(x))
+                            result.push_back(x);
+                    bitmap.clear();
+                    bitmap.shrink_to_fit();
+                }
+                array.swap(result);
+                size = array.size();
+            }
+
+            void subtract(Chunk const & other) {
+                if (other.size == 0)
+                    return;
+                if (bitmap.empty()) {
+                    array.erase(std::remove_if(array.begin(), array.end(), [&](uint16_t x) { return other.contains(x); }), array.end());
+                    size = array.size();
+                    return;
+                }
+                if (other.bitmap.empty()) {
+                    for (uint16_t x : other.array)
+                        bitmap[x / 64] &= ~(uint64_t(1) << (x % 64));
+                } else {
+                    for (size_t i = 0; i < bitmap.size(); ++i)
+                        bitmap[i] &= ~other.bitmap[i];
+                }
+                recount();
+                compact();
+            }
+
+            void recount() {
+                if (bitmap.empty()) {
+                    size = array.size();
+                } else {
+                    size = 0;
+                    for (uint64_t w : bitmap)
+                        size += __builtin_popcountll(w);
+                }
+            }
+
+            void toBitmap() {
+                if (! bitmap.empty())
+                    return;
+                bitmap.resize(CHUNK_SIZE / 64);
+                for (uint16_t x : array)
+                    bitmap[x / 64] |= uint64_t(1) << (x % 64);
+                array.clear();
+                array.shrink_to_fit();
+            }
+
+            /** Converts bitmap chunks which hold few enough ids back to arrays.
+             */
+            void compact() {
+                if (bitmap.empty() || size > ARRAY_LIMIT)
+                    return;
+                array.clear();
+                array.reserve(size);
+                for (size_t w = 0; w < bitmap.size(); ++w)
+                    for (uint64_t bits = bitmap[w]; bits != 0; bits &= bits - 1)
+                        array.push_back(static_cast<uint16_t>(w * 64 + __builtin_ctzll(bits)));
+                bitmap.clear();
+                bitmap.shrink_to_fit();
+            }
+        };
+
+        void recount() {
+            size_ = 0;
+            for (Chunk const & c : chunks_)
+                size_ += c.size;
+        }
+
+        std::vector<Chunk> chunks_;
+        size_t size_;
+    }; // helpers::IdSet
+
+} // namespace helpers
@@ -25,6 +25,10 @@ namespace dejavu {
     /** Filters given projects and their contents out of the dataset.
      */
     void FilterProjects(int argc, char * argv[]);
+
+    /** Writes the tables of a dataset view so that it no longer depends on its base dataset.
+     */
+    void MaterializeView(int argc, char * argv[]);
     
     /** The creation time join puts on projects is wrong (it is the oldest commit, which for forks is useless). This pass attempts to fix this by getting the proper (?) creation time from the ghtorrent database.
      */
@@ -91,6 +95,34 @@ namespace dejavu {
      */
     void DetectFileClones(int argc, char * argv[]);
 
+    /** Replays the history of each project once and stores the live files at each of the project's heads so that commands interested only in the final state of projects do not have to.
+     */
+    void BuildHeadStates(int argc, char * argv[]);
+
+    /** Extracts the fields we need from the GitHub metadata JSON files of all projects into a binary table indexed by project ids, which is then used by the commands working with the metadata.
+     */
+    void BuildMetadataTable(int argc, char * argv[]);
+
+    /** Builds the front coded dictionary of all paths which commands can map instead of loading paths.csv.
+     */
+    void BuildPathDictionary(int argc, char * argv[]);
+
+    /** Builds the image of the global directory tree of all paths which the folder clone commands map instead of building the tree themselves.
+     */
+    void BuildPathTree(int argc, char * argv[]);
+
+    /** Precomputes the NPM, package, extension, top folder and depth attributes of all paths.
+     */
+    void BuildPathAttributes(int argc, char * argv[]);
+
+    /** Builds the inverted indices from contents, path and project ids to their occurrences in file changes.
+     */
+    void BuildPostingsIndex(int argc, char * argv[]);
+
+    /** Prints all occurrences of a single contents, path, or project using the postings indices.
+     */
+    void Query(int argc, char * argv[]);
+
     /** The final breakdown of the remaining files after file clones have been removed.
      */
     void FinalBreakdown(int argc, char * argv[]);
@@ -184,6 +216,10 @@ namespace dejavu {
      */
     void DownloadContents(int argc, char * argv[]);
 
+    /** Moves contents downloaded in the old layout of one file per contents into the content store.
+     */
+    void PackContents(int argc, char * argv[]);
+
 
 
     /** Calculates active projects summaries.
@@ -0,0 +1,194 @@
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+
+#include "../objects.h"
+#include "../loaders.h"
+#include "../commands.h"
+#include "../commit_iterator.h"
+#include "../head_states.h"
+#include "../project_stream.h"
+
+/** Builds the head states of all projects.
+
+    For each project, its history is replayed once and for each head of the project (a commit without any children in the project) the live files, i.e. their path and contents ids, are stored in headStates.bin with an index from project ids to their heads in headStatesIndex.bin (see HeadStates for details of the format).
+
+    Commands which are only interested in the final state of the projects can then read the head states instead of loading the commit hierarchy and replaying the histories themselves.
+
+    If memory budget is specified, the projects are streamed one by one from the sorted file changes (see ProjectStream) instead of loading all of them at once.
+ */
+
+namespace dejavu {
+
+    namespace {
+
+        class Commit : public BaseCommit<Commit> {
+        public:
+            Commit(unsigned id, uint64_t time):
+                BaseCommit<Commit>(id, time) {
+            }
+        };
+
+        class Project : public BaseProject<Project, Commit> {
+        public:
+            Project(unsigned id, uint64_t createdAt):
+                BaseProject<Project, Commit>(id, createdAt) {
+            }
+        };
+
+        /** Live files of the project, pathId -> contentsId.
+         */
+        class State {
+        public:
+            State() {
+            }
+
+            State(State const & from) {
+                mergeWith(from, nullptr);
+            }
+
+            void mergeWith(State const & other, Commit * c) {
+                files.insert(other.files.begin(), other.files.end());
+            }
+
+            void updateWith(Commit * c) {
+                for (unsigned pathId : c->deletions)
+                    files.erase(pathId);
+                for (auto i : c->changes)
+                    files[i.first] = i.second;
+            }
+
+            std::unordered_map<unsigned, unsigned> files;
+        }; // State
+
+        class HeadStatesBuilder {
+        public:
+            void loadData() {
+                std::cerr << "Loading projects ... " << std::endl;
+                ProjectLoader{[this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
+                        if (id >= projects_.size())
+                            projects_.resize(id + 1);
+                        projects_[id] = new Project(id, createdAt);
+                    }};
+                if (MemoryBudget.value() != 0)
+                    return;
+                std::cerr << "Loading commits ... " << std::endl;
+                CommitLoader{[this](unsigned id, uint64_t authorTime, uint64_t committerTime){
+                        if (id >= commits_.size())
+                            commits_.resize(id + 1);
+                        commits_[id] = new Commit(id, authorTime);
+                    }};
+                std::cerr << "Loading commit parents ... " << std::endl;
+                CommitParentsLoader{[this](unsigned id, unsigned parentId){
+                        Commit * c = commits_[id];
+                        Commit * p = commits_[parentId];
+                        assert(c != nullptr);
+                        assert(p != nullptr);
+                        c->addParent(p);
+                    }};
+                std::cerr << "Loading file changes ... " << std::endl;
+                FileChangeLoader{[this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
+                        Project * p = projects_[projectId];
+                        Commit * c = commits_[commitId];
+                        assert(p != nullptr);
+                        assert(c != nullptr);
+                        p->addCommit(c);
+                        c->addChange(pathId, contentsId);
+                    }};
+            }
+
+            void buildHeadStates() {
+                std::cerr << "Building head states..." << std::endl;
+                HeadStates::Writer writer;
+                size_t heads = 0;
+                if (MemoryBudget.value() != 0) {
+                    ProjectStream<Project, Commit> stream;
+                    stream.process([this](unsigned id) {
+                            return id < projects_.size() ? projects_[id] : nullptr;
+                        }, [&, this](Project * p) {
+                            storeProject(p, writer, heads);
+                        }, NumThreads.value());
+                    writer.close();
+                    std::cerr << "    " << heads << " heads written" << std::endl;
+                    return;
+                }
+                std::vector<std::thread> threads;
+                size_t completed = 0;
+                for (unsigned stride = 0; stride < NumThreads.value(); ++stride)
+                    threads.push_back(std::thread([stride, & completed, & heads, & writer, this]() {
+                        while (true) {
+                            Project * p ;
+                            {
+                                std::lock_guard<std::mutex> g(mCerr_);
+                                if (completed == projects_.size())
+                                    return;
+                                p = projects_[completed];
+                                ++completed;
+                                if (completed % 1000 == 0)
+                                    std::cerr << " : " << completed << "    \r" << std::flush;
+                            }
+                            if (p == nullptr)
+                                continue;
+                            storeProject(p, writer, heads);
+                        }
+                    }));
+                for (auto & i : threads)
+                    i.join();
+                writer.close();
+                std::cerr << "    " << heads << " heads written" << std::endl;
+            }
+
+        private:
+
+            void storeProject(Project * p, HeadStates::Writer & writer, size_t & heads) {
+                std::vector<std::pair<unsigned, HeadFiles>> projectHeads = analyzeProject(p);
+                std::string block = HeadStates::Writer::Serialize(projectHeads);
+                {
+                    std::lock_guard<std::mutex> g(mWriter_);
+                    writer.add(p->id, block);
+                    heads += projectHeads.size();
+                }
+            }
+
+            /** Replays the history of the project and returns the live files at each of its heads.
+             */
+            std::vector<std::pair<unsigned, HeadFiles>> analyzeProject(Project * p) {
+                std::vector<std::pair<unsigned, HeadFiles>> result;
+                CommitForwardIterator<Project, Commit, State> it(p, [](Commit * c, State & state) {
+                        state.updateWith(c);
+                        return true;
+                    });
+                // heads of forked projects have children in the forks, so ask for all heads of the project
+                it.setLastCommitHandler([&](Commit * c, State & state) {
+                        result.push_back(std::make_pair(c->id, HeadFiles(state.files.begin(), state.files.end())));
+                        return true;
+                    }, true);
+                it.process();
+                return result;
+            }
+
+            std::vector<Project *> projects_;
+            std::vector<Commit *> commits_;
+
+            std::mutex mCerr_;
+            std::mutex mWriter_;
+        }; // HeadStatesBuilder
+
+    } // anonymous namespace
+
+    void BuildHeadStates(int argc, char * argv[]) {
+        Settings.addOption(DataDir);
+        Settings.addOption(NumThreads);
+        Settings.addOption(MemoryBudget);
+        Settings.addOption(TempDir);
+        Settings.parse(argc, argv);
+        Settings.check();
+
+        HeadStatesBuilder b;
+        b.loadData();
+        b.buildHeadStates();
+    }
+
+} // namespace dejavu
@@ -0,0 +1,121 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "../loaders.h"
+#include "../commands.h"
+#include "../metadata_table.h"
+
+/** Builds the binary project metadata table from the GitHub metadata JSON files.
+
+    The input directory is the directory with the metadata as downloaded by download-github-metadata (or copied by patch-projects-createdAt), i.e. with files named user_repo, or user_repo.json, in subfolders of the first two characters. The files are matched to the projects of the dataset by their names, first by the exact name and then by the lowercase name. The matching files are then parsed in parallel extracting only the fields we need (see ProjectMetadata) and the result is stored as metadata.bin in the input directory (see MetadataTable), indexed by project ids.
+
+    Since the project ids are preserved by all later stages of the pipeline, the table can be used with any dataset derived from the one it was built from, even if the projects were renamed.
+ */
+
+namespace dejavu {
+
+    namespace {
+
+        class TableBuilder {
+        public:
+
+            void loadData() {
+                std::cerr << "Loading projects ... " << std::endl;
+                ProjectLoader{[this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
+                        std::string name = user + "_" + repo;
+                        exact_[name] = id;
+                        lower_[helpers::ToLower(name)] = id;
+                        if (id >= numProjects_)
+                            numProjects_ = id + 1;
+                    }};
+                std::cerr << "    " << exact_.size() << " projects loaded" << std::endl;
+                std::cerr << "Listing metadata files..." << std::endl;
+                // project id -> (filename, exact match)
+                std::vector<std::pair<std::string, bool>> matches(numProjects_);
+                size_t numFiles = helpers::DirectoryReader(Input.value(), [&, this](std::string const & filename) {
+                        std::string name = filename.substr(filename.rfind('/') + 1);
+                        if (helpers::endsWith(name, ".json"))
+                            name = name.substr(0, name.size() - 5);
+                        auto i = exact_.find(name);
+                        if (i != exact_.end()) {
+                            matches[i->second] = std::make_pair(filename, true);
+                            return;
+                        }
+                        i = lower_.find(helpers::ToLower(name));
+                        if (i != lower_.end() && ! matches[i->second].second)
+                            matches[i->second] = std::make_pair(filename, false);
+                    }, true);
+                for (unsigned id = 0; id < numProjects_; ++id)
+                    if (! matches[id].first.empty())
+                        files_.push_back(std::make_pair(id, matches[id].first));
+                std::cerr << "    " << numFiles << " files found" << std::endl;
+                std::cerr << "    " << files_.size() << " files matched to projects" << std::endl;
+            }
+
+            void build() {
+                std::cerr << "Parsing metadata..." << std::endl;
+                std::vector<ProjectMetadata *> projects(numProjects_, nullptr);
+                std::vector<std::thread> threads;
+                std::atomic<size_t> next(0);
+                std::atomic<size_t> errors(0);
+                for (unsigned stride = 0; stride < NumThreads.value(); ++stride)
+                    threads.push_back(std::thread([&, this]() {
+                        while (true) {
+                            size_t i = next++;
+                            if (i >= files_.size())
+                                return;
+                            if (i % 10000 == 0) {
+                                std::lock_guard<std::mutex> g(mCerr_);
+                                std::cerr << " : " << i << "    \r" << std::flush;
+                            }
+                            std::ifstream f(files_[i].second);
+                            std::stringstream s;
+                            s << f.rdbuf();
+                            ProjectMetadata * m = new ProjectMetadata();
+                            if (m->parse(s.str())) {
+                                projects[files_[i].first] = m;
+                            } else {
+                                delete m;
+                                ++errors;
+                            }
+                        }
+                    }));
+                for (auto & i : threads)
+                    i.join();
+                std::cerr << "    " << (files_.size() - errors) << " projects parsed" << std::endl;
+                std::cerr << "    " << errors << " invalid files" << std::endl;
+                std::cerr << "Writing metadata table..." << std::endl;
+                MetadataTable::Write(Input.value(), projects);
+                for (ProjectMetadata * m : projects)
+                    delete m;
+            }
+
+        private:
+            std::unordered_map<std::string, unsigned> exact_;
+            std::unordered_map<std::string, unsigned> lower_;
+            unsigned numProjects_ = 0;
+            std::vector<std::pair<unsigned, std::string>> files_;
+            std::mutex mCerr_;
+        }; // TableBuilder
+
+    } // anonymous namespace
+
+    void BuildMetadataTable(int argc, char * argv[]) {
+        Settings.addOption(DataDir);
+        Settings.addOption(Input);
+        Settings.addOption(NumThreads);
+        Settings.parse(argc, argv);
+        Settings.check();
+
+        TableBuilder b;
+        b.loadData();
+        b.build();
+    }
+
+} // namespace dejavu
@@ -0,0 +1,33 @@
+#include <iostream>
+
+#include "../loaders.h"
+#include "../commands.h"
+#include "../path_attributes.h"
+
+/** Precomputes the attributes of all paths from paths.csv (see PathAttributes).
+
+    Commands which only need to know whether paths are in node_modules, which NPM package they belong to, or their extension, top folder and depth can then look these up by path id instead of loading and splitting all path strings.
+ */
+
+namespace dejavu {
+
+    void BuildPathAttributes(int argc, char * argv[]) {
+        Settings.addOption(DataDir);
+        Settings.parse(argc, argv);
+        Settings.check();
+
+        std::cerr << "Loading paths ... " << std::endl;
+        PathAttributes::Builder b;
+        size_t numPaths = 0;
+        PathLoader{[&](unsigned id, std::string const & path){
+                b.addPath(id, path);
+                ++numPaths;
+            }};
+        std::cerr << "    " << numPaths << " paths loaded" << std::endl;
+        std::cerr << "    " << b.numPackageRoots() << " package roots" << std::endl;
+        std::cerr << "    " << b.numExtensions() << " extensions" << std::endl;
+        std::cerr << "Writing path attributes..." << std::endl;
+        b.write(DataDir.value());
+    }
+
+} // namespace dejavu
@@ -0,0 +1,30 @@
+#include <iostream>
+#include <vector>
+
+#include "../loaders.h"
+#include "../commands.h"
+#include "../path_dictionary.h"
+
+/** Builds the front coded dictionary of all paths in the dataset from paths.csv (see PathDictionary).
+
+    Commands which only need to translate path ids to paths (or back) can then map the dictionary instead of loading all paths in string keyed maps, which for the whole dataset take tens of GB.
+ */
+
+namespace dejavu {
+
+    void BuildPathDictionary(int argc, char * argv[]) {
+        Settings.addOption(DataDir);
+        Settings.parse(argc, argv);
+        Settings.check();
+
+        std::cerr << "Loading paths ... " << std::endl;
+        std::vector<std::pair<std::string, unsigned>> paths;
+        PathLoader{[&](unsigned id, std::string const & path){
+                paths.push_back(std::make_pair(path, id));
+            }};
+        std::cerr << "    " << paths.size() << " paths loaded" << std::endl;
+        std::cerr << "Writing path dictionary..." << std::endl;
+        PathDictionary::Write(DataDir.value(), paths);
+    }
+
+} // namespace dejavu
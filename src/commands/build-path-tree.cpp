@@ -0,0 +1,32 @@
+#include <iostream>
+
+#include "../loaders.h"
+#include "../commands.h"
+#include "../path_tree.h"
+
+/** Builds the image of the global directory tree of all paths and the path segments table (see PathTree).
+
+    The paths are split and their segments interned in the order of paths.csv so that the segment ids are the same as when the folder clone commands built the tree themselves. The segments are also stored in pathSegments.csv for the later stages and the analysis.
+ */
+
+namespace dejavu {
+
+    void BuildPathTree(int argc, char * argv[]) {
+        Settings.addOption(DataDir);
+        Settings.parse(argc, argv);
+        Settings.check();
+
+        PathTree::Builder b;
+        std::cerr << "Loading paths ... " << std::endl;
+        PathToIdLoader{[&](unsigned id, std::string const & path){
+                b.addPath(id, path);
+            }};
+        std::cerr << "    " << b.numSegments() << " unique path segments" << std::endl;
+        std::cerr << "    " << b.numDirs() << " directories" << std::endl;
+        std::cerr << "Storing path segments ..." << std::endl;
+        b.writeSegments(DataDir.value() + "/pathSegments.csv");
+        std::cerr << "Writing path tree ..." << std::endl;
+        b.write(DataDir.value());
+    }
+
+} // namespace dejavu
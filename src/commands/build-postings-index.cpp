@@ -0,0 +1,64 @@
+#include <iostream>
+#include <vector>
+
+#include "../loaders.h"
+#include "../commands.h"
+#include "../postings_index.h"
+
+/** Builds the inverted indices from contents, path and project ids to their postings.
+
+    All file changes are loaded together with the times of their commits and for each of the keys an index is built (see PostingsIndex for the format). The posting lists are sorted and delta compressed in parallel.
+
+    The indices are then used by the query command to answer questions about single contents, paths and projects without scanning all file changes.
+ */
+
+namespace dejavu {
+
+    namespace {
+
+        class PostingsIndexBuilder {
+        public:
+
+            void loadData() {
+                std::cerr << "Loading commits ... " << std::endl;
+                std::vector<uint64_t> times;
+                CommitLoader{[&](unsigned id, uint64_t authorTime, uint64_t committerTime){
+                        if (id >= times.size())
+                            times.resize(id + 1);
+                        times[id] = authorTime;
+                    }};
+                std::cerr << "Loading file changes ... " << std::endl;
+                FileChangeLoader{[&, this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
+                        assert(commitId < times.size());
+                        postings_.push_back(Posting(projectId, commitId, pathId, contentsId, times[commitId]));
+                    }};
+                std::cerr << "    " << postings_.size() << " postings loaded" << std::endl;
+            }
+
+            void build() {
+                PostingsIndex::Builder builder(postings_);
+                for (PostingsIndex::Key key : { PostingsIndex::Key::Contents, PostingsIndex::Key::Path, PostingsIndex::Key::Project }) {
+                    std::cerr << "Building " << PostingsIndex::Name(key) << " index..." << std::endl;
+                    size_t n = builder.build(key, NumThreads.value());
+                    std::cerr << "    " << n << " ids indexed" << std::endl;
+                }
+            }
+
+        private:
+            std::vector<Posting> postings_;
+        }; // PostingsIndexBuilder
+
+    } // anonymous namespace
+
+    void BuildPostingsIndex(int argc, char * argv[]) {
+        Settings.addOption(DataDir);
+        Settings.addOption(NumThreads);
+        Settings.parse(argc, argv);
+        Settings.check();
+
+        PostingsIndexBuilder b;
+        b.loadData();
+        b.build();
+    }
+
+} // namespace dejavu
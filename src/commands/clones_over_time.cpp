@@ -9,6 +9,8 @@
 #include "../loaders.h"
 #include "../commands.h"
 #include "../commit_iterator.h"
+#include "../path_dictionary.h"
+#include "../path_attributes.h"
 
 
 namespace dejavu {
@@ -19,6 +21,47 @@ namespace dejavu {
         class Project;
         class TimeAggregator;
 
+        /** Paths of the dataset from the path dictionary, with their precomputed attributes for whether they are NPM paths.
+         */
+        class Paths {
+        public:
+
+            void load() {
+                dictionary_.reset(new PathDictionary());
+                attributes_.reset(new PathAttributes());
+            }
+
+            size_t size() const {
+                return dictionary_->size();
+            }
+
+            std::string path(unsigned id) const {
+                return (*dictionary_)[id];
+            }
+
+            /** Returns the rank of the path, which compares as the path itself, but does not have to be decoded.
+             */
+            uint32_t rank(unsigned id) const {
+                return dictionary_->rank(id);
+            }
+
+            PathDictionary::Range prefixRange(std::string const & prefix) const {
+                return dictionary_->prefixRange(prefix);
+            }
+
+            bool inRange(unsigned id, PathDictionary::Range const & range) const {
+                return dictionary_->inRange(id, range);
+            }
+
+            bool isNPM(unsigned id) const {
+                return attributes_->isNPM(id);
+            }
+
+        private:
+            std::unique_ptr<PathDictionary> dictionary_;
+            std::unique_ptr<PathAttributes> attributes_;
+        }; // Paths
+
         /** Information about aggregated numbers of different files at a time.
 
             The times for which TimeInfo is provided are discrete and reflect the situation *after* all commits happening at the particular time. 
@@ -187,8 +230,8 @@ namespace dejavu {
                 pathId(0) {
             }
 
-            void updateWith(Project * p, Commit * c, unsigned path, std::vector<std::pair<std::string, bool>> const & paths) {
-                if (project == nullptr || IsBetterOriginal(project, commit, paths[pathId].first, p, c, paths[path].first)) {
+            void updateWith(Project * p, Commit * c, unsigned path, Paths const & paths) {
+                if (project == nullptr || IsBetterOriginal(project, commit, paths.rank(pathId), p, c, paths.rank(path))) {
                     project = p;
                     commit = c;
                     pathId = path;
@@ -242,7 +285,7 @@ namespace dejavu {
                 }
             }
 
-            void updateWith(Project * p, Commit * c, std::unordered_map<unsigned,  FileOriginalInfo> & fileOriginals, std::vector<std::pair<std::string, bool>> const & paths) {
+            void updateWith(Project * p, Commit * c, std::unordered_map<unsigned,  FileOriginalInfo> & fileOriginals, Paths const & paths) {
                 // firt delete what must be deleted
                 for (unsigned pathId : c->deletions)
                     files_.erase(pathId);
@@ -253,7 +296,7 @@ namespace dejavu {
                     if (pi.contentsId == i.second)
                         continue;
                     // set the proper contents id, update the clone state
-                    bool npm = paths[i.first].second;
+                    bool npm = paths.isNPM(i.first);
                     pi.contentsId = i.second;
                     ++p->stats.files;
                     if (npm)
@@ -280,8 +323,9 @@ namespace dejavu {
                     // We don't have to maintain project with folder clones, because if there is a clone in commit, then the clone happens in *all* projects containing the clone. The only exception is if the original is itself a clone and happens to be in the oldest of projects containing the clone, which is what we check here (or if the original is same project, same commit, different path), both are degenerate cases
                     if (! IgnoreFolderOriginals.value() && clone.second->isOriginal(p, c, root))
                         continue;
+                    PathDictionary::Range range = paths.prefixRange(root);
                     for (auto i : c->changes) {
-                        if (paths[i.first].first.find(root) == 0) {
+                        if (paths.inRange(i.first, range)) {
                             /*
                             if (! IgnoreFolderOriginals.value()) {
                                 if (!files_[i.first].clone) {
@@ -293,11 +337,11 @@ namespace dejavu {
                             */
                             files_[i.first].setAsFolderClone();
                             ++p->stats.folderClones;
-                            if (paths[i.first].second)
+                            if (paths.isNPM(i.first))
                                 ++p->stats.npmFolderClones;
                         } else {
                             if (p->id == 43 && c->id == 7019)
-                                std::cout << paths[i.first].first << " -- NOT A CLONE" << std::endl;
+                                std::cout << paths.path(i.first) << " -- NOT A CLONE" << std::endl;
                         }
                     }
                 }
@@ -339,12 +383,12 @@ namespace dejavu {
                 }
             }
 
-            Stats getStats(std::vector<std::pair<std::string, bool>> const & paths) {
+            Stats getStats(Paths const & paths) {
                 Stats result;
                 for (auto i : files_) {
                     unsigned pathId = i.first & 0xffffffff; // mask only the path id
                     assert(pathId < paths.size());
-                    bool isNPM = paths[pathId].second;
+                    bool isNPM = paths.isNPM(pathId);
                     ++result.files;
                     if (i.second.clone)
                         ++result.clones;
@@ -403,12 +447,7 @@ namespace dejavu {
                         c->addParent(p);
                     }};
                 std::cerr << "Loading paths ... " << std::endl;
-                PathToIdLoader{[this](unsigned id, std::string const & path){
-                        if (paths_.size() <= id)
-                            paths_.resize(id + 1);
-                        //std::string p = std::string("/" + path);
-                        paths_[id] = std::make_pair(path, IsNPMPath(path));
-                    }};
+                paths_.load();
                 std::cerr << "    " << paths_.size() << " paths loaded" << std::endl;
                 std::string occurencesPath = DataDir.value() + "/folderCloneOccurences.csv";
                 if (! IgnoreFolderOriginals.value()) {
@@ -426,9 +465,8 @@ namespace dejavu {
                 std::cerr << "Loading clone occurences from " << occurencesPath << "..." << std::endl;
                 FolderCloneOccurencesLoader{occurencesPath, [this](unsigned cloneId, unsigned projectId, unsigned commitId, std::string const & rootDir, unsigned numFiles){
                         Commit * c = commits_[commitId];
-                        Project * p = projects_[projectId];
                         CloneOriginal * co = nullptr; 
-                        assert(p != nullptr);
+                        assert(projects_[projectId] != nullptr);
                         assert(c != nullptr);
                         if (! IgnoreFolderOriginals.value()) {
                             co = cloneOriginals_[cloneId];
@@ -581,9 +619,9 @@ namespace dejavu {
             std::vector<Project*> projects_;
             std::vector<Commit*> commits_;
             
-            /** If true then given path is NPM path.
+            /** Paths and whether they are NPM paths.
              */
-            std::vector<std::pair<std::string, bool>> paths_;
+            Paths paths_;
             
             std::unordered_map<unsigned, FileOriginalInfo> fileOriginals_;
             std::vector<CloneOriginal *> cloneOriginals_;
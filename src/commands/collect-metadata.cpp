@@ -1,12 +1,14 @@
 #include "../loaders.h"
 #include "../commands.h"
+#include "../metadata_table.h"
 
-#include "../loaders.h"
-
-#include "helpers/json.hpp"
 #include "helpers/strings.h"
 
 
+/** Collects the stars, watchers, forks, open issues and the has downloads and wiki flags of the projects from the metadata table in the input directory (see build-metadata-table) into projectsMetadata.csv.
+
+    Previously the command looked for the lowercased user_repo.json file of each project. The metadata table matches the files by the exact name first and by the lowercased name only if there is no exact match, with or without the .json suffix, so projects whose metadata file is not lowercase are found as well.
+ */
 namespace dejavu {
 
     namespace {
@@ -18,28 +20,16 @@ namespace dejavu {
                 size_t projects = 0;
                 size_t notFound = 0;
                 size_t patched = 0;
+                MetadataTable metadata(Input.value());
                 std::ofstream f{DataDir.value() + "/projectsMetadata.csv"};
                 f << "projectId,watchers,stars,forks,openIssues,hasDownloads,hasWiki" << std::endl;
                 std::cerr << "Collecting projects ... " << std::endl;
                 ProjectLoader{[&, this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
                         ++projects;
-                        std::string path = helpers::ToLower(STR(user << "_" << repo));
-                        path = Input.value() + "/" + path.substr(0, 2) + "/" + path + ".json";
-                        if (helpers::FileExists(path)) {
-                            try {
-                                nlohmann::json json;
-                                std::ifstream{path} >> json;
-                                size_t watchers = json["watchers_count"];
-                                size_t stars = json["stargazers_count"];
-                                size_t forks = json["forks_count"];
-                                size_t openIssues = json["open_issues"];
-                                bool hasDownloads = json["has_downloads"];
-                                bool hasWiki = json["has_wiki"];
-                                f << id << "," << watchers << "," << stars << "," << forks << "," << openIssues << "," << (hasDownloads ? 1 : 0) << "," << (hasWiki ? 1 : 0) << std::endl;
-                                ++patched;
-                            } catch (std::exception const & e) {
-                                std::cout << "error: " << e.what() << std::endl;
-                            }
+                        if (metadata.has(id)) {
+                            MetadataTable::Record const & m = metadata[id];
+                            f << id << "," << m.watchers << "," << m.stars << "," << m.forks << "," << m.openIssues << "," << (m.hasDownloads() ? 1 : 0) << "," << (m.hasWiki() ? 1 : 0) << std::endl;
+                            ++patched;
                         } else {
                             ++notFound;
                         }
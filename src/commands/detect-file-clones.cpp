@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <unordered_map>
@@ -6,6 +7,7 @@
 #include <atomic>
 #include <mutex>
 #include <thread>
+#include <tuple>
 #include <unistd.h>
 #include <openssl/sha.h>
 
@@ -13,6 +15,7 @@
 #include "../loaders.h"
 #include "../commands.h"
 #include "../commit_iterator.h"
+#include "../parallel_loader.h"
 
 
 namespace dejavu {
@@ -112,8 +115,11 @@ namespace dejavu {
                 if (commit->time > this->commit->time)
                     return;
                 if (commit->time == this->commit->time) {
-                    // if the commit is same age, but the project is newer or same, nothing to do
-                    if (project->createdAt >= this->project->createdAt)
+                    // if the commit is same age, but the project is newer, nothing to do
+                    if (project->createdAt > this->project->createdAt)
+                        return;
+                    // remaining ties are broken by ids, so that the original does not depend on the order in which the changes are seen
+                    if (project->createdAt == this->project->createdAt && std::tie(project->id, commit->id, fileId) >= std::tie(this->project->id, this->commit->id, this->fileId))
                         return;
                 }
                 this->project = project;
@@ -188,48 +194,58 @@ namespace dejavu {
         class FileClonesDetector {
         public:
 
+            /** Loads projects, commits, commit parents, paths and file changes concurrently and then links them together in parallel, while determining the possible originals of the file contents.
+             */
             void loadData() {
-                std::cerr << "Loading projects ... " << std::endl;
-                ProjectLoader{[this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
-                        projects_.insert(std::make_pair(id, new Project(id, user, repo, createdAt)));
-                    }};
-                std::cerr << "Loading commits ... " << std::endl;
-                CommitLoader{[this](unsigned id, uint64_t authorTime, uint64_t committerTime){
-                        commits_.insert(std::make_pair(id, new Commit(id, authorTime, committerTime)));
-                    }};
-                std::cerr << "Loading commit parents ... " << std::endl;
-                CommitParentsLoader{[this](unsigned id, unsigned parentId){
-                        Commit * c = commits_[id];
-                        Commit * p = commits_[parentId];
-                        assert(c != nullptr);
-                        assert(p != nullptr);
-                        c->addParent(p);
-                    }};
-                std::cerr << "Loading paths ... " << std::endl;
-                PathToIdLoader{[&,this](unsigned id, std::string const & path){
-                        paths_[id] = path;
-                    }};
-                std::cerr << "Loading file changes ... " << std::endl;
+                ParallelLoader::CommitParents parents;
+                ParallelLoader::FileChanges changes;
+                ParallelLoader loader;
+                loader.add("Loading projects", [this]() {
+                        ProjectLoader{[this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
+                                projects_.insert(std::make_pair(id, new Project(id, user, repo, createdAt)));
+                            }};
+                    }).add("Loading commits", [this]() {
+                        CommitLoader{[this](unsigned id, uint64_t authorTime, uint64_t committerTime){
+                                commits_.insert(std::make_pair(id, new Commit(id, authorTime, committerTime)));
+                            }};
+                    }).add("Loading commit parents", [& parents]() {
+                        ParallelLoader::Load(parents);
+                    }).add("Loading paths", [this]() {
+                        PathToIdLoader{[&,this](unsigned id, std::string const & path){
+                                paths_[id] = path;
+                            }};
+                    }).add("Loading file changes", [& changes]() {
+                        ParallelLoader::Load(changes);
+                    });
+                loader.run();
+                // the maps are only read while linking
+                auto project = [this](unsigned id) { return projects_.at(id); };
+                auto commit = [this](unsigned id) { return commits_.at(id); };
                 size_t numChanges = 0;
                 size_t numDeletions = 0;
-                FileChangeLoader{[& numChanges, & numDeletions, this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
-                        Project * p = projects_[projectId];
-                        Commit * c = commits_[commitId];
-                        assert(p != nullptr);
-                        assert(c != nullptr);
-                        p->addCommit(c);
-                        c->addChange(pathId, contentsId);
-                        if (contentsId == FILE_DELETED) {
-                            ++numDeletions;
-                        } else {
+                loader.addPass("Linking commit parents", [&](unsigned thread, unsigned numThreads) {
+                        ParallelLoader::LinkParents(parents, commit, thread, numThreads);
+                    }).addPass("Linking file changes", [&](unsigned thread, unsigned numThreads) {
+                        ParallelLoader::LinkChanges(changes, project, commit, thread, numThreads);
+                    }).add("Determining possible originals", [&, this]() {
+                        changes.forEach([&, this](ParallelLoader::FileChange const & r) {
+                            if (r.contentsId == FILE_DELETED) {
+                                ++numDeletions;
+                                return;
+                            }
                             ++numChanges;
-                            auto i = originals_.find(contentsId);
+                            Project * p = project(r.projectId);
+                            Commit * c = commit(r.commitId);
+                            auto i = originals_.find(r.contentsId);
                             if (i != originals_.end())
-                                i->second->update(p, c, pathId);
+                                i->second->update(p, c, r.pathId);
                             else
-                                originals_.insert(std::make_pair(contentsId, new FileOriginal(contentsId, p, c, pathId)));
-                        }
-                    }};
+                                originals_.insert(std::make_pair(r.contentsId, new FileOriginal(r.contentsId, p, c, r.pathId)));
+                        });
+                    });
+                loader.run();
+                ParallelLoader::Release(parents);
+                ParallelLoader::Release(changes);
                 std::cerr << "    " << numDeletions << " deletions" << std::endl;
                 std::cerr << "    " << numChanges << " changes" << std::endl;
                 std::cerr << "    " << originals_.size() << " unique contents (possible originals)" << std::endl;
@@ -332,8 +348,8 @@ namespace dejavu {
                     std::cerr << "Writing clone behavior..." << std::endl;
                     std::ofstream f(DataDir.value() + "/fileCloneOccurencesBehavior.csv");
                     f << "cloneId,projectId,commitId,pathId,path,changingCommits,divergentCommits,syncCommits,syncDelay,fullySyncedTime,fullySyncedCommits,youngestChange,youngestDivergentChange,youngestSyncChange" << std::endl;
-                    for (auto i : originals_)
-                        for (FileClone * c : i.second->clones)
+                    for (FileOriginal * o : sortedOriginals())
+                        for (FileClone * c : o->clones)
                             f << c->cloneId << ","
                               << c->projectId << ","
                               << c->commitId << ","
@@ -355,13 +371,13 @@ namespace dejavu {
                 std::cerr << "Writing originals information..." << std::endl;
                 std::ofstream f(DataDir.value() + "/fileCloneOriginals.csv");
                 f << "projectId,commitId,pathId,path,cloneId,numClones" << std::endl;
-                for (auto i : originals_)
-                    f << i.second->project->id << ","
-                      << i.second->commit->id << ","
-                      << i.second->fileId << ","
-                      << helpers::escapeQuotes(paths_[i.second->fileId]) << ","
-                      << i.second->id << ","
-                      << i.second->clones.size() << std::endl;
+                for (FileOriginal * o : sortedOriginals())
+                    f << o->project->id << ","
+                      << o->commit->id << ","
+                      << o->fileId << ","
+                      << helpers::escapeQuotes(paths_[o->fileId]) << ","
+                      << o->id << ","
+                      << o->clones.size() << std::endl;
             }
 
             void filterFileChanges() {
@@ -616,6 +632,19 @@ namespace dejavu {
             std::unordered_map<unsigned, std::string> paths_;
             std::unordered_map<unsigned, FileOriginal *> originals_;
 
+            /** Returns the originals ordered by their contents id, so that the outputs do not depend on the order in which the originals were created.
+             */
+            std::vector<FileOriginal *> sortedOriginals() {
+                std::vector<FileOriginal *> result;
+                result.reserve(originals_.size());
+                for (auto i : originals_)
+                    result.push_back(i.second);
+                std::sort(result.begin(), result.end(), [](FileOriginal * a, FileOriginal * b) {
+                    return a->id < b->id;
+                });
+                return result;
+            }
+
         };
 
 
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 #include <vector>
 #include <unordered_map>
@@ -9,10 +11,14 @@
 #include <unistd.h>
 #include <openssl/sha.h>
 
+#include "helpers/fixed_key_map.h"
+
 #include "../objects.h"
 #include "../loaders.h"
 #include "../commands.h"
 #include "../commit_iterator.h"
+#include "../project_stream.h"
+#include "../ordered_output.h"
 
 #include "folder_clones.h"
 
@@ -71,11 +77,15 @@ namespace dejavu {
             The `id` is a name id of the path segment and the ids are ordered (ascending), therefore the mapping from a directory to its structure is unambiguous.
 
             The structure strings are necessary for the second step where originals are searched and the clones themselves must be reconstitured. 
+
+            The output does not depend on the number of threads, or their scheduling. While detecting, subdirectories that are clones are referenced by the hex string of their hash instead of their id, and the hash of a clone is calculated from this canonical string. The strings and clone candidates are collected by each thread separately (see OrderedOutput) and once all clones are known, they are given ids in the order of their hashes and the outputs are merged in the order of the ids, replacing the hash references in the strings by clone ids.
          */
         class Detector {
         public:
 
-            Detector() {
+            Detector():
+                cloneCandidates_("cloneCandidates"),
+                cloneStrings_("cloneStrings") {
             }
 
             /** Loads the initial data required for the clone detection.
@@ -87,6 +97,10 @@ namespace dejavu {
                             projects_.resize(id + 1);
                         projects_[id] = new Project(id, createdAt);
                     }};
+                std::cerr << "    " << tree_.numFiles() << " paths, " << tree_.numDirs() << " dirs, " << tree_.numSegments() << " unique path segments in path tree" << std::endl;
+                // when streaming, the history is loaded one project at a time while detecting the clones
+                if (streaming())
+                    return;
                 std::cerr << "Loading commits ... " << std::endl;
                 CommitLoader{[this](unsigned id, uint64_t authorTime, uint64_t committerTime){
                         if (id >= commits_.size())
@@ -101,17 +115,6 @@ namespace dejavu {
                         assert(p != nullptr);
                         c->addParent(p);
                     }};
-                globalRoot_ = new Dir(EMPTY_PATH, nullptr);
-                std::cerr << "Loading paths ... " << std::endl;
-                PathToIdLoader{[&,this](unsigned id, std::string const & path){
-                        if (id >= paths_.size())
-                            paths_.resize(id + 1);
-                        paths_[id] = globalRoot_->addPath(id, path, pathSegments_);
-                    }};
-                std::cerr << "    " << pathSegments_.size() << " unique path segments" << std::endl;
-                std::cerr << "Storing path segments ..." << std::endl;
-                pathSegments_.save(DataDir.value() + "/pathSegments.csv");
-                pathSegments_.clearHelpers();
                 std::cerr << "Loading file changes ... " << std::endl;
                 FileChangeLoader{[this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
                         Project * p = projects_[projectId];
@@ -127,42 +130,51 @@ namespace dejavu {
              */
             void detectCloneCandidates() {
                 std::cerr << "Analyzing projects for clone candidates..." << std::endl;
-                clonesOut_ = std::ofstream(DataDir.value() + "/cloneCandidates.csv");
-                clonesOut_ << "cloneId,projectId,commitId,folder,files" << std::endl;
-
-                cloneStrings_ = std::ofstream(DataDir.value() + "/cloneStrings.csv");
-                cloneStrings_ << "cloneId,string" << std::endl;
-                    
+                if (streaming()) {
+                    std::cerr << "    streaming projects within " << MemoryBudget.value() << "MB..." << std::endl;
+                    ProjectStream<Project, Commit> stream;
+                    stream.process([this](unsigned id) {
+                            return id < projects_.size() ? projects_[id] : nullptr;
+                        }, [this](Project * p) {
+                            detectCloneCandidatesInFamily(std::vector<Project *>{p});
+                        }, NumThreads.value());
+                    writeClones();
+                    return;
+                }
+                // projects sharing commits (i.e. forks) are analyzed together so that their shared history is only walked once
+                std::vector<std::vector<Project *>> families = ProjectFamily<Project, Commit>::Find(projects_);
+                std::cerr << "    " << families.size() << " project families" << std::endl;
+                // large families are analyzed first, one by one, each using all threads so that they do not dominate the tail of the analysis
+                size_t largeFamilies = 0;
+                for (auto const & family : families)
+                    if (isLarge(family)) {
+                        ++largeFamilies;
+                        detectCloneCandidatesInFamily(family, NumThreads.value());
+                    }
+                std::cerr << "    " << largeFamilies << " large project families" << std::endl;
                 std::vector<std::thread> threads;
                 size_t completed = 0;
                 for (unsigned stride = 0; stride < NumThreads.value(); ++stride)
-                    threads.push_back(std::thread([stride, & completed, this]() {
+                    threads.push_back(std::thread([stride, & completed, & families, this]() {
                         while (true) {
-                            Project * p ;
+                            std::vector<Project *> * family ;
                             {
                                 std::lock_guard<std::mutex> g(mCerr_);
-                                if (completed == projects_.size())
+                                if (completed == families.size())
                                     return;
-                                p = projects_[completed];
+                                family = & families[completed];
                                 ++completed;
                                 if (completed % 1000 == 0)
                                     std::cerr << " : " << completed << "    \r" << std::flush;
                             }
-                            if (p == nullptr)
+                            if (isLarge(*family))
                                 continue;
-                            detectCloneCandidatesInProject(p);
+                            detectCloneCandidatesInFamily(*family);
                         }
                     }));
                 for (auto & i : threads)
                     i.join();
-                std::cerr << "Clone candidates: " << clones_.size() << std::endl;
-
-                std::cerr << "Writing results..." << std::endl;
-
-                std::ofstream clones(DataDir.value() + "/cloneOriginalsCandidates.csv");
-                clones << "cloneId,hash,occurences,files,projectId,commitId,path" << std::endl;
-                for (auto i : clones_)
-                    clones << *(i.second) << std::endl;
+                writeClones();
             }
 
         private:
@@ -170,21 +182,126 @@ namespace dejavu {
             friend class Dir;
             friend class ProjectState;
 
+            /** Returns true if the projects are streamed one by one instead of being loaded at once.
+             */
+            bool streaming() const {
+                return MemoryBudget.value() != 0;
+            }
+
+            /** Assigns the clone ids in the order of clone hashes and writes the clones, their strings and occurences.
+             */
+            void writeClones() {
+                std::cerr << "Clone candidates: " << clones_.size() << std::endl;
+                std::vector<Clone *> clones;
+                clones.reserve(clones_.size());
+                for (auto i : clones_)
+                    clones.push_back(i.second);
+                std::sort(clones.begin(), clones.end(), [](Clone * a, Clone * b) {
+                        return memcmp(a->hash.hash, b->hash.hash, sizeof(a->hash.hash)) < 0;
+                    });
+                for (size_t i = 0; i < clones.size(); ++i)
+                    clones[i]->id = i;
+
+                std::cerr << "Writing results..." << std::endl;
+                {
+                    std::ofstream f(DataDir.value() + "/cloneOriginalsCandidates.csv");
+                    f << "cloneId,hash,occurences,files,projectId,commitId,path" << std::endl;
+                    for (Clone * c : clones)
+                        f << *c << std::endl;
+                }
+                {
+                    std::ofstream f(DataDir.value() + "/cloneStrings.csv");
+                    f << "cloneId,string" << std::endl;
+                    cloneStrings_.merge([&, this](std::string const & key, std::string const & row) {
+                            f << cloneOf(key)->id << ",\"" << resolveCloneReferences(row) << "\"\n";
+                        });
+                }
+                {
+                    std::ofstream f(DataDir.value() + "/cloneCandidates.csv");
+                    f << "cloneId,projectId,commitId,folder,files" << std::endl;
+                    cloneCandidates_.merge([&, this](std::string const & key, std::string const & row) {
+                            f << cloneOf(key)->id << row << "\n";
+                        });
+                }
+            }
+
+            /** Returns the clone whose hash is at the beginning of given output key.
+             */
+            Clone * cloneOf(std::string const & key) {
+                SHA1Hash hash;
+                memcpy(hash.hash, key.c_str(), sizeof(hash.hash));
+                auto i = clones_.find(hash);
+                assert(i != clones_.end());
+                return i->second;
+            }
+
+            /** Replaces references to subdirectory clones by their hashes in the clone string with their ids.
+             */
+            std::string resolveCloneReferences(std::string const & str) {
+                std::string result;
+                size_t start = 0;
+                while (true) {
+                    size_t i = str.find('#', start);
+                    if (i == std::string::npos)
+                        break;
+                    result.append(str, start, i + 1 - start);
+                    SHA1Hash hash = SHA1Hash::FromHexString(str.substr(i + 1, 40));
+                    auto c = clones_.find(hash);
+                    assert(c != clones_.end());
+                    result += std::to_string(c->second->id);
+                    start = i + 41;
+                }
+                result.append(str, start, std::string::npos);
+                return result;
+            }
+
             
 
-            /** Looks for all clone candidates in the given project.
+            /** A family is large if any of its projects is large.
              */
-            void detectCloneCandidatesInProject(Project * p) {
-                std::unordered_set<Dir*> cloneCandidates;
-                CommitForwardIterator<Project,Commit,ProjectState> i(p, [&,this](Commit * c, ProjectState & state) {
-                        // update the project state and determine the clone candidate folders
-                        state.updateWith(c, paths_, & cloneCandidates);
-                        for (auto i : cloneCandidates)
-                            processCloneCandidate(p, c, i, state);
-                        cloneCandidates.clear();
+            bool isLarge(std::vector<Project *> const & family) {
+                for (Project * p : family)
+                    if (p->commits.size() >= LargeProjectThreshold.value())
                         return true;
-                });
-                i.process();
+                return false;
+            }
+
+            /** Looks for all clone candidates in the given family of projects.
+
+                Commits shared by multiple projects are analyzed only once and the clone candidates they contain are reported for all projects containing them. If more than one thread is specified, the history is walked in parallel.
+             */
+            void detectCloneCandidatesInFamily(std::vector<Project *> const & family, unsigned numThreads = 1) {
+                if (family.size() == 1) {
+                    walk(family.front(), [&,this](Commit * c, ProjectState & state) {
+                            return analyzeCommit(family, c, state);
+                        }, numThreads);
+                } else {
+                    ProjectFamily<Project, Commit> f(family);
+                    walk(& f, [&,this](Commit * c, ProjectState & state) {
+                            return analyzeCommit(f.projectsOf(c), c, state);
+                        }, numThreads);
+                }
+            }
+
+            template<typename PROJECT>
+            void walk(PROJECT * p, std::function<bool(Commit *, ProjectState &)> handler, unsigned numThreads) {
+                if (numThreads > 1) {
+                    ParallelCommitForwardIterator<PROJECT,Commit,ProjectState> i(p, handler, numThreads);
+                    i.process();
+                } else {
+                    CommitForwardIterator<PROJECT,Commit,ProjectState> i(p, handler);
+                    i.process();
+                }
+            }
+
+            /** Updates the state with the given commit and processes the clone candidates it introduces in all given projects.
+             */
+            bool analyzeCommit(std::vector<Project *> const & projects, Commit * c, ProjectState & state) {
+                std::unordered_set<Dir*> cloneCandidates;
+                state.updateWith(c, tree_, & cloneCandidates);
+                for (auto i : cloneCandidates)
+                    processCloneCandidate(projects, c, i, state);
+                return true;
             }
 
             /** Processes single clone candidate.
@@ -196,13 +313,13 @@ structures of the subdirs, remaining subdirs and files, the structure of the dir
 
                 Then we check, based on the hash, whether such a clone has already been found and if not, create the clone and output its structure.
 
-                Finally the number of occurences in the clone is bumped and the clone candidate is reported. 
+                Finally the number of occurences in the clone is bumped and the clone candidate is reported, once for each of the given projects. The clone is referenced by its hash, since clone ids are only assigned when all clones are known.
              */
-            std::string processCloneCandidate(Project * p, Commit * c, Dir * cloneRoot, ProjectState & state) {
+            std::string processCloneCandidate(std::vector<Project *> const & projects, Commit * c, Dir * cloneRoot, ProjectState & state) {
                 // first determine if any of the subdirs is a clone candidate itself and process it, returning its string
                 std::map<unsigned, std::string> subdirClones;
                 for (auto i : cloneRoot->dirs) {
-                    std::string x = processCloneCandidate(p, c, i.second, state);
+                    std::string x = processCloneCandidate(projects, c, i.second, state);
                     if (! x.empty())
                         subdirClones.insert(std::make_pair(i.first, std::move(x)));
                 }
@@ -220,34 +337,46 @@ structures of the subdirs, remaining subdirs and files, the structure of the dir
                 // now that we have the string, create the hash of the clone, which we use for comparisons
                 SHA1Hash hash;
                 SHA1((unsigned char *) cloneString.c_str(), cloneString.size(), (unsigned char *) & hash.hash);
-                std::string path = cloneRoot->path(pathSegments_);
+                std::string path = cloneRoot->path(tree_);
                 // see if the clone exists
                 bool outputString = false;
-                unsigned cloneId = 0;
                 {
                     std::lock_guard<std::mutex> g(mClones_);
                     auto i = clones_.find(hash);
+                    auto p = projects.begin();
+                    Commit * cc = retain(c);
                     if (i == clones_.end()) {
-                        i = clones_.insert(std::make_pair(hash, new Clone(clones_.size(), hash, p, c, path, numFiles))).first;
+                        // the id is assigned when all clones are known
+                        i = clones_.insert(std::make_pair(hash, new Clone(0, hash, *p, cc, path, numFiles))).first;
                         outputString = true;
-                    } else {
-                        i->second->updateWithOccurence(p, c, path, numFiles);
-                    }
-                    cloneId = i->second->id;
-                }
-                if (outputString) {
-                    std::string x = STR(cloneId << ",\"" << cloneString << "\"\n");
-                    {
-                        std::lock_guard<std::mutex> g(mCloneStrings_);
-                        cloneStrings_ << x;
+                        ++p;
                     }
+                    for (auto e = projects.end(); p != e; ++p)
+                        i->second->updateWithOccurence(*p, cc, path, numFiles);
                 }
-                std::string x = STR(cloneId << "," << p->id << "," << c->id << "," << helpers::escapeQuotes(path) << "," << numFiles << "\n");
-                {
-                    std::lock_guard<std::mutex> g(mClonesOut_);
-                    clonesOut_ << x;
+                std::string key(reinterpret_cast<char const *>(hash.hash), sizeof(hash.hash));
+                if (outputString)
+                    cloneStrings_.add(key, std::move(cloneString));
+                for (Project * p : projects) {
+                    std::string k = key;
+                    OrderedOutput::AppendKey(k, p->id);
+                    OrderedOutput::AppendKey(k, c->id);
+                    cloneCandidates_.add(std::move(k), STR("," << p->id << "," << c->id << "," << helpers::escapeQuotes(path) << "," << numFiles));
                 }
-                return STR("#" << cloneId);
+                return "#" + hash.toString();
+            }
+
+            /** Returns the commit to be referenced by clones.
+
+                When streaming, commits are deleted once their project has been analyzed, so a copy of the commit which outlives the project is returned instead. Must be called with the clones lock held. 
+             */
+            Commit * retain(Commit * c) {
+                if (! streaming())
+                    return c;
+                auto i = retained_.find(c->id);
+                if (i == retained_.end())
+                    i = retained_.insert(std::make_pair(c->id, new Commit(c->id, c->time))).first;
+                return i->second;
             }
 
             /** Calculates the string representation of a given directory.
@@ -278,22 +407,17 @@ structures of the subdirs, remaining subdirs and files, the structure of the dir
 
             std::vector<Project*> projects_;
             std::vector<Commit*> commits_;
-            std::vector<File*> paths_;
-            PathSegments pathSegments_;
-            
-            Dir * globalRoot_;
+            PathTree tree_;
 
-            std::unordered_map<SHA1Hash, Clone*> clones_;
+            helpers::FixedKeyMap<SHA1Hash, Clone*> clones_;
+            // copies of commits referenced by clones when streaming
+            std::unordered_map<unsigned, Commit*> retained_;
             std::mutex mClones_;
 
-
-
-            std::ofstream clonesOut_;
-            std::mutex mClonesOut_;
-
-            std::ofstream cloneStrings_;
-            std::mutex mCloneStrings_;
-
+            // keyed by clone hash, project and commit ids
+            OrderedOutput cloneCandidates_;
+            // keyed by clone hash
+            OrderedOutput cloneStrings_;
 
             std::mutex mCerr_;
             
@@ -308,6 +432,9 @@ structures of the subdirs, remaining subdirs and files, the structure of the dir
         Settings.addOption(DataDir);
         Settings.addOption(Threshold);
         Settings.addOption(NumThreads);
+        Settings.addOption(LargeProjectThreshold);
+        Settings.addOption(MemoryBudget);
+        Settings.addOption(TempDir);
         Settings.parse(argc, argv);
         Settings.check();
 
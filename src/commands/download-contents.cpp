@@ -1,20 +1,23 @@
 #include <iostream>
 #include <vector>
+#include <map>
 #include <unordered_set>
-#include <thread>
 #include <mutex>
+#include <cstring>
+
+#include "helpers/http.h"
 
 #include "../loaders.h"
 #include "../commands.h"
+#include "../content_store.h"
 
 /** Downloads specified files and stores them in the output directory.
 
-    The files are downloaded directly off github's website where the raw form of the files is available. This does scale, but not superbly well. As a result, this is probably not the fastest stage:)
+    The files are downloaded directly off github's website where the raw form of the files is available (the base URL can be changed with the baseUrl option). The downloads are performed in-process by the HttpClient, which keeps many concurrent transfers (maxTransfers) on persistent connections using the given number of threads and streams the contents directly to disk. At the end, the number of responses for each HTTP status is reported.
 
     Files to be downloaded are specified in the same way a file change record is, i.e. a tuple of project, commit, path and contents id. This allows the downloader to determine the URL as well as to determine whether the requested file has already been downloaded or not, based on the contents hash.
 
-    Downloaded files are stored in the output folder based on their contents id in folders that are the contents id modulo 1000 so that we do not have everything in a single folder which makes some fs tools rather slow. 
-
+    Downloaded files are stored in a content store (see ContentStore) in the output directory, i.e. appended to large pack files, instead of each file having its own file, which for millions of files makes the filesystem metadata more expensive than the data. Files already in the store are skipped, the check is done against the in-memory index of the store without touching the filesystem. If compressContents is set, the files are compressed in the store.
  */
 
 namespace dejavu {
@@ -73,90 +76,95 @@ namespace dejavu {
             }
 
             void download() {
+                std::cerr << "Opening content store..." << std::endl;
+                ContentStore store(OutputDir.value(), true, CompressContents.value());
+                std::cerr << "    " << store.size() << " contents already stored" << std::endl;
+                // if the file is already in the store, it has been downloaded by some other run before, no need to redownload
+                std::vector<unsigned> ids;
+                for (FileSpec const & f : filesToDownload_)
+                    ids.push_back(f.contentsId);
+                std::vector<bool> existing = store.contains(ids);
                 std::cerr << "Downloading contents..." << std::endl;
-                std::vector<std::thread> threads;
-                size_t completed = 0;
-                size_t errors = 0;
-                size_t existing = 0;
-                size_t notFound = 0;
-                for (unsigned stride = 0; stride < NumThreads.value(); ++stride)
-                    threads.push_back(std::thread([&, this]() {
-                        while (true) {
-                            size_t i = 0;
-                            {
-                                std::lock_guard<std::mutex> g(m_);
-                                if (completed == filesToDownload_.size())
-                                    return;
-                                i = completed;
-                                ++completed;
-                                if (completed % 100 == 0)
-                                    std::cerr << " : " << completed << ", existing: " << existing << ", not found: " << notFound << ", errors: " << errors << "    \r" << std::flush;
-                            }
-                            FileSpec const & f = filesToDownload_[i];
-                            unsigned result = downloadFile(f);
-                            {
-                                std::lock_guard<std::mutex> g(m_);
-                                switch (result) {
-                                case NOT_FOUND:
-                                    ++notFound;
-                                    break;
-                                case EXISTS:
-                                    ++existing;
-                                    break;
-                                case ERROR:
-                                    ++errors;
-                                }
-                            }
-                        }
-                    }));
-                for (auto & i : threads)
-                    i.join();
-                std::cerr << " : " << completed << ", existing: " << existing << ", not found: " << notFound << ", errors: " << errors << "    " << std::endl;
+                helpers::HttpClient client(NumThreads.value(), MaxTransfers.value());
+                for (size_t i = 0, e = filesToDownload_.size(); i != e; ++i) {
+                    FileSpec const & f = filesToDownload_[i];
+                    if (existing[i]) {
+                        std::lock_guard<std::mutex> g(m_);
+                        ++existing_;
+                        continue;
+                    }
+                    Download * d = new Download(store, f.contentsId);
+                    d->url = STR(BaseUrl.value() << "/" << projectStr(f.projectId) << "/" << commitHash(f.commitId) << "/" << pathStr(f.pathId));
+                    d->onData = [d](char const * data, size_t size) {
+                        return d->write(data, size);
+                    };
+                    d->onComplete = [this](helpers::HttpClient::Request * r, helpers::HttpClient::Response const & response) {
+                        downloadCompleted(static_cast<Download *>(r), response);
+                    };
+                    client.add(d);
+                }
+                client.finish();
+                store.close();
+                reportProgress("\n");
+                std::cerr << "HTTP statuses:" << std::endl;
+                for (auto i : statuses_)
+                    std::cerr << "    " << i.first << ": " << i.second << std::endl;
             }
             
 
 
         private:
 
-            static unsigned constexpr DOWNLOADED = 0;
-            static unsigned constexpr EXISTS = 1;
-            static unsigned constexpr NOT_FOUND = 2;
-            static unsigned constexpr ERROR = 3;
+            /** A file being downloaded.
 
-            /** Returns the file in which the contents should be stored
+                The contents are streamed to a writer of the content store (see ContentStore::Writer), which only keeps small files in memory, and added to the store only when the download completes successfully.
              */
-            std::string getContentsFile(unsigned contentsId) {
-                return STR(OutputDir.value() << "/" << (contentsId % 1000) << "/" << contentsId);
-            }
-            std::string getContentsFolder(unsigned contentsId) {
-                return STR(OutputDir.value() << "/" << (contentsId % 1000));
-            }
+            class Download : public helpers::HttpClient::Request {
+            public:
+                unsigned contentsId;
+                ContentStore::Writer contents;
+                bool valid;
+
+                Download(ContentStore & store, unsigned contentsId):
+                    contentsId(contentsId),
+                    contents(store, contentsId),
+                    valid(false) {
+                }
 
-            
-            /** Downloads the given file.
-             */
-            unsigned downloadFile(FileSpec const & f) {
-                std::string filename = getContentsFile(f.contentsId);
-                // if the file already exists, it has been downloaded by some other run before, no need to redownload
-                if (helpers::FileExists(filename))
-                    return EXISTS;
-                // otherwise download the file now
-                std::string url = std::string("https://raw.githubusercontent.com/" + projectStr(f.projectId) + "/" + commitHash(f.commitId) + "/" + pathStr(f.pathId));
-
-
-                std::string contents = helpers::Exec(STR("curl -s " << url), "");
-                if (contents == "404: Not Found\n")
-                    return NOT_FOUND;
-                // invalid structure
-                if (contents.find("{") == std::string::npos)
-                    return ERROR;
-                // save the contents of the file
-                helpers::EnsurePath(getContentsFolder(f.contentsId));
-                std::ofstream out(filename);
-                out << contents;
-                return DOWNLOADED;
+                bool write(char const * data, size_t size) {
+                    // invalid structure if there is no {
+                    if (! valid && memchr(data, '{', size) != nullptr)
+                        valid = true;
+                    contents.write(data, size);
+                    return true;
+                }
+            };
+
+            void downloadCompleted(Download * d, helpers::HttpClient::Response const & response) {
+                bool downloaded = response.ok() && response.status == 200 && d->valid;
+                if (downloaded)
+                    d->contents.commit();
+                {
+                    std::lock_guard<std::mutex> g(m_);
+                    if (! response.ok())
+                        ++statuses_[0];
+                    else
+                        ++statuses_[response.status];
+                    if (downloaded)
+                        ++downloaded_;
+                    else if (response.ok() && response.status == 404)
+                        ++notFound_;
+                    else
+                        ++errors_;
+                    if ((downloaded_ + notFound_ + errors_) % 100 == 0)
+                        reportProgress("\r");
+                }
+                delete d;
             }
 
+            void reportProgress(char const * end) {
+                std::cerr << " : " << (downloaded_ + notFound_ + errors_) << ", downloaded: " << downloaded_ << ", existing: " << existing_ << ", not found: " << notFound_ << ", errors: " << errors_ << "    " << end << std::flush;
+            }
 
             std::string const & projectStr(unsigned projectId) {
                 auto i = projects_.find(projectId);
@@ -183,6 +191,12 @@ namespace dejavu {
             std::unordered_map<unsigned, std::string> paths_;
             std::unordered_set<unsigned> contents_;
 
+            size_t downloaded_ = 0;
+            size_t existing_ = 0;
+            size_t notFound_ = 0;
+            size_t errors_ = 0;
+            // HTTP status -> number of responses, 0 for failed transfers
+            std::map<long, size_t> statuses_;
             std::mutex m_;
             
         }; // ContentsDownloader
@@ -194,10 +208,13 @@ namespace dejavu {
         Settings.addOption(OutputDir);
         Settings.addOption(Input);
         Settings.addOption(NumThreads);
+        Settings.addOption(MaxTransfers);
+        Settings.addOption(CompressContents);
+        BaseUrl.updateDefaultValue("https://raw.githubusercontent.com");
+        Settings.addOption(BaseUrl);
         Settings.parse(argc, argv);
         Settings.check();
 
-        helpers::EnsurePath(OutputDir.value());
         ContentsDownloader cd;
         cd.loadData();
         cd.download();
@@ -1,21 +1,31 @@
-#include <stdio.h>
-#include <curl/curl.h>
+#include <sys/stat.h>
 #include <stdlib.h>
 #include <iostream>
+#include <fstream>
 #include <vector>
+#include <deque>
 #include <unordered_map>
 #include <unordered_set>
-#include <set>
 #include <thread>
 #include <atomic>
 #include <mutex>
-#include <sstream>
+#include <condition_variable>
 #include <chrono>
+#include <ctime>
+
+#include "helpers/http.h"
 
 #include "../loaders.h"
 #include "helpers/json.hpp"
 
+/** Downloads the GitHub metadata (the repository information from the GitHub API) of given projects.
+
+    The requests are performed by the HttpClient on persistent connections and scheduled over all available authentication tokens by the TokenScheduler, which tracks the remaining quota of each token from the rate limit headers of the responses and sends each request with the token that has the most headroom. When a token runs out, only the requests that need it are parked until its quota resets (or another token becomes available), the transfers using the other tokens continue.
+
+    The ETags of the downloaded projects are kept in etags.csv in the output directory. Projects which have already been downloaded are skipped, unless refresh is set, in which case they are requested again with their ETag so that unchanged projects are answered with 304 Not Modified, which does not count against the quota.
 
+    The base URL of the API can be changed with the baseUrl option so that the command can be tested against a local mock server.
+ */
 
 namespace dejavu {
 
@@ -45,48 +55,184 @@ namespace dejavu {
             std::string renamedUrl;
         };
 
-        class CurlHeaders {
+        /** Authentication token and its estimated remaining quota.
+         */
+        class Token {
         public:
-            long status = 0;
-            std::string status_message;
-            long rate_limit = 0;
-            long rate_limit_remaining = 0;
-            long rate_limit_reset = 0;
-            int header_read_fields = 0;
-            std::string location;
-            
-            CurlHeaders(std::string const & from) {
-                for (std::string line : helpers::Split(from, '\n')) {
-                    std::vector<std::string> cols = helpers::Split(line, ':', 2);
-                    if (cols.size() < 2)
-                        continue;
-                    std::string value = helpers::strip(cols[1]);
-                    if (cols[0] == "Status") {
-                        std::vector<std::string> e = helpers::Split(value, ' ', 2);
-                        status = std::stoul(e[0]);
-                        status_message = helpers::strip(e[1]);
-                    } else if (cols[0] == "X-RateLimit-Limit") {
-                        rate_limit = std::stoul(value);
-                    } else if (cols[0] == "X-RateLimit-Remaining") {
-                        rate_limit_remaining = std::stoul(value);
-                    } else if (cols[0] == "X-RateLimit-Reset") {
-                        rate_limit_reset = std::stoul(value);
-                    } else if (cols[0] == "Location") {
-                        location = value;
-                        // Ignore.
+            /** Quota of a fresh token, until we learn the real limit from the headers.
+             */
+            static constexpr long DEFAULT_LIMIT = 5000;
+
+            std::string value;
+            long limit;
+            long remaining;
+            // time (in seconds since epoch) at which the quota resets, 0 if unknown
+            uint64_t reset;
+            unsigned inFlight;
+
+            Token(std::string const & value):
+                value(value),
+                limit(DEFAULT_LIMIT),
+                remaining(DEFAULT_LIMIT),
+                reset(0),
+                inFlight(0) {
+            }
+
+            /** Number of requests which can still be sent with the token.
+             */
+            long headroom(uint64_t now) {
+                // once the reset time has passed, the token has its full quota again
+                if (reset != 0 && now >= reset) {
+                    remaining = limit;
+                    reset = 0;
+                }
+                return remaining - static_cast<long>(inFlight);
+            }
+        };
+
+        /** Assigns requests to the authentication tokens based on their remaining quota.
+         */
+        class TokenScheduler {
+        public:
+
+            void addToken(std::string const & value) {
+                tokens_.push_back(Token(value));
+            }
+
+            size_t numTokens() const {
+                return tokens_.size();
+            }
+
+            /** Returns the token with the most headroom for a new request.
+
+                If all tokens are exhausted, blocks until the earliest of them resets.
+             */
+            Token * acquire() {
+                while (true) {
+                    uint64_t wakeup;
+                    {
+                        std::lock_guard<std::mutex> g(m_);
+                        uint64_t now = Now();
+                        Token * best = nullptr;
+                        long bestHeadroom = 0;
+                        for (Token & t : tokens_) {
+                            long h = t.headroom(now);
+                            if (h > bestHeadroom) {
+                                best = & t;
+                                bestHeadroom = h;
+                            }
+                        }
+                        if (best != nullptr) {
+                            ++best->inFlight;
+                            return best;
+                        }
+                        // no token available, wait for the earliest reset, or for in flight requests to return if we do not know when the tokens reset
+                        wakeup = 0;
+                        for (Token & t : tokens_)
+                            if (t.reset != 0 && (wakeup == 0 || t.reset < wakeup))
+                                wakeup = t.reset;
+                        if (wakeup == 0)
+                            wakeup = now + 1;
+                        else
+                            std::cerr << "All tokens exhausted, waiting " << (wakeup - now) << " seconds..." << std::endl;
                     }
+                    std::this_thread::sleep_until(std::chrono::system_clock::from_time_t(wakeup));
+                }
+            }
+
+            /** Updates the quota of the token used by a request from the response's headers.
+
+                Returns true if the request was rejected because the token was out of quota and so should be retried.
+             */
+            bool update(Token * t, helpers::HttpClient::Response const & response) {
+                std::lock_guard<std::mutex> g(m_);
+                --t->inFlight;
+                std::string limit = response.header("x-ratelimit-limit");
+                std::string remaining = response.header("x-ratelimit-remaining");
+                std::string reset = response.header("x-ratelimit-reset");
+                if (! limit.empty())
+                    t->limit = std::stol(limit);
+                if (! remaining.empty())
+                    t->remaining = std::stol(remaining);
+                else if (response.status != 304)
+                    --t->remaining;
+                if (! reset.empty())
+                    t->reset = std::stoull(reset);
+                if (response.status != 403 && response.status != 429)
+                    return false;
+                // secondary rate limits tell us how long to wait in retry-after
+                std::string retryAfter = response.header("retry-after");
+                if (! retryAfter.empty()) {
+                    t->remaining = 0;
+                    t->reset = Now() + std::stoull(retryAfter);
+                    return true;
+                }
+                if (! remaining.empty() && t->remaining == 0) {
+                    if (t->reset == 0)
+                        t->reset = Now() + 60;
+                    return true;
                 }
+                return false;
+            }
+
+        private:
+
+            static uint64_t Now() {
+                return static_cast<uint64_t>(std::time(nullptr));
+            }
+
+            std::vector<Token> tokens_;
+            std::mutex m_;
+        }; // TokenScheduler
+
+        /** Request for the metadata of a single project.
+
+            The same request is resubmitted if it has to be retried (redirects, rate limits).
+         */
+        class ProjectRequest : public helpers::HttpClient::Request {
+        public:
+            Project * project;
+            Token * token;
+            std::string etag;
+            std::string body;
+            unsigned attempts;
+
+            ProjectRequest(Project * p, std::string const & url):
+                project(p),
+                token(nullptr),
+                attempts(0) {
+                this->url = url;
+                onData = [this](char const * data, size_t size) {
+                    body.append(data, size);
+                    return true;
+                };
+            }
+
+            /** Prepares the request to be sent with the given token.
+             */
+            void prepare(Token * t) {
+                token = t;
+                body.clear();
+                ++attempts;
+                headers.clear();
+                headers.push_back("Authorization: token " + t->value);
+                if (! etag.empty())
+                    headers.push_back("If-None-Match: " + etag);
             }
         };
 
 
         class DownloadManager {
         public:
+            /** Number of attempts for requests which fail for other reasons than rate limits.
+             */
+            static constexpr unsigned MAX_ATTEMPTS = 3;
+
             DownloadManager():
                 existing_(0),
                 moved_(0) {
             }
-           
+
             void loadData() {
                 std::cerr << "Loading projects ... " << std::endl;
                 ProjectLoader{Input.value(), [this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
@@ -96,127 +242,195 @@ namespace dejavu {
                 std::cerr << "Loading authentication tokens..." << std::endl;
                 StringRowLoader(GitHubPersonalAccessToken.value(), [this](std::vector<std::string> const & row) {
                         assert(row.size() == 1);
-                        tokens_.push_back(row[0]);
+                        scheduler_.addToken(row[0]);
                     });
-                std::cerr << "    " << tokens_.size() << " tokens loaded" << std::endl;
+                std::cerr << "    " << scheduler_.numTokens() << " tokens loaded" << std::endl;
+                if (scheduler_.numTokens() == 0)
+                    ERROR("At least one authentication token is required");
+                if (helpers::FileExists(ETagsFile())) {
+                    std::cerr << "Loading ETags..." << std::endl;
+                    StringRowLoader(ETagsFile(), [this](std::vector<std::string> const & row) {
+                            assert(row.size() == 2);
+                            etags_[row[0]] = row[1];
+                        }, false);
+                    std::cerr << "    " << etags_.size() << " ETags loaded" << std::endl;
+                }
             }
 
+            /** Submits the requests for all projects, resubmitting the requests to be retried, until all of them are done.
+             */
             void download() {
-                std::vector<std::thread> threads;
-                size_t completed = 0;
-                size_t failed = 0;
-                std::atomic<unsigned> success(0);
-                for (unsigned i = 0; i < tokens_.size(); ++i)
-                    threads.push_back(std::thread([i, & completed, &failed, &success, this]() {
-                        while (true) {
-                            Project * p ;
-                            {
-                                std::lock_guard<std::mutex> g(m_);
-                                if (completed >= projects_.size())
-                                    return;
-                                p = projects_[completed];
-                                ++completed;
-                                if (completed % 1000 == 0)
-                                    std::cerr << "     " << completed << ", success: " << success <<  ", failed " << failed << ", moved " << moved_ << "     \r" << std::flush;
-                            }
-                            unsigned status = downloadProject(p, tokens_[i]);
-                            if (status != 200) {
-                                std::lock_guard<std::mutex> g(m_);
-                                std::cout << p->id << "," << status << std::endl;
-                                ++failed;
-                            } else {
-                                ++success;
-                            }
+                std::cerr << "Downloading..." << std::endl;
+                etagsOut_.open(ETagsFile(), std::ios::out | std::ios::app);
+                helpers::HttpClient client(NumThreads.value(), MaxTransfers.value());
+                size_t next = 0;
+                while (true) {
+                    ProjectRequest * r = nullptr;
+                    Project * p = nullptr;
+                    {
+                        std::unique_lock<std::mutex> g(m_);
+                        cv_.wait(g, [&, this]() {
+                                return ! retry_.empty() || next < projects_.size() || outstanding_ == 0;
+                            });
+                        if (! retry_.empty()) {
+                            r = retry_.front();
+                            retry_.pop_front();
+                        } else if (next < projects_.size()) {
+                            p = projects_[next++];
+                        } else {
+                            break;
                         }
-                    }));
-                for (auto & i : threads)
-                    i.join();
-                std::cerr << "     " << completed << " attempted downloads" << std::endl;
+                    }
+                    if (p != nullptr) {
+                        r = createRequest(p);
+                        if (r == nullptr)
+                            continue;
+                        std::lock_guard<std::mutex> g(m_);
+                        ++outstanding_;
+                    }
+                    r->prepare(scheduler_.acquire());
+                    client.add(r);
+                }
+                client.finish();
+                etagsOut_.close();
+                std::cerr << "     " << completed_ << " attempted downloads" << std::endl;
                 std::cerr << "     " << existing_ << " already existing files " << std::endl;
+                std::cerr << "     " << notModified_ << " not modified" << std::endl;
                 std::cerr << "     " << moved_ << " moved " << std::endl;
-                std::cerr << "     " << failed << " failed downloads" << std::endl;
-                std::cerr << "     " << success << " successful downloads" << std::endl;
+                std::cerr << "     " << rateLimited_ << " rate limited requests retried" << std::endl;
+                std::cerr << "     " << failed_ << " failed downloads" << std::endl;
+                std::cerr << "     " << success_ << " successful downloads" << std::endl;
             }
 
         private:
 
-            unsigned downloadProject(Project * p, std::string const & authToken) {
+            static std::string ETagsFile() {
+                return OutputDir.value() + "/etags.csv";
+            }
+
+            /** Creates the request for given project, or returns nullptr if the project does not have to be downloaded.
+             */
+            ProjectRequest * createRequest(Project * p) {
                 std::string path = STR(OutputDir.value() << "/" << p->mangledName());
-                // if the file has already been downloaded, skip it
+                std::string etag;
+                // if the file has already been downloaded, skip it, unless we are refreshing and have its ETag
                 if (helpers::FileExists(path)) {
-                    ++existing_;
-                    return 200;
+                    auto i = etags_.find(p->mangledName());
+                    if (! Refresh.value() || i == etags_.end()) {
+                        ++existing_;
+                        return nullptr;
+                    }
+                    etag = i->second;
                 }
-                std::string url = STR("https://api.github.com/repos/" << p->user << "/" << p->repo);
-                while (true) {
-                    // now download the project
-                    std::stringstream headersRaw;
-                    std::stringstream body;
-                    CURL * curl = curl_easy_init();
-                    struct curl_slist *list = nullptr;
-                    list = curl_slist_append(list, STR("Authorization: token " << authToken).c_str());                  
-                    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-                    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, CurlCallback);
-                    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, CurlCallback);
-                    curl_easy_setopt(curl, CURLOPT_USERAGENT, "DejaVuII");
-                    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
-                    curl_easy_setopt(curl, CURLOPT_HEADERDATA, &headersRaw);
-                    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
-                    /* CURLcode result = */ curl_easy_perform(curl);
-                    curl_easy_cleanup(curl);
-                    curl_slist_free_all(list);
-                    CurlHeaders headers(headersRaw.str());
-                    // if we have 200, all is fine, save the result
-                    if (headers.status == 200) {
-                        std::string targetDir = STR(OutputDir.value() << "/" << p->mangledDir());
-                        helpers::EnsurePath(targetDir);
-                        std::ofstream f(path);
-                        f << body.str();
-                        return 200;
-                    } else if (headers.status == 301) {
-                        // retry with new location
-                        ++moved_;
-                        url = headers.location;
-                    } else if (headers.status == 403 && headers.rate_limit_remaining == 0) {
-                        std::this_thread::sleep_until(std::chrono::system_clock::from_time_t(headers.rate_limit_reset));
+                ProjectRequest * r = new ProjectRequest(p, STR(BaseUrl.value() << "/repos/" << p->user << "/" << p->repo));
+                r->etag = etag;
+                r->onComplete = [this](helpers::HttpClient::Request * r, helpers::HttpClient::Response const & response) {
+                    downloadCompleted(static_cast<ProjectRequest *>(r), response);
+                };
+                return r;
+            }
+
+            /** Called by the client when the request is finished, determines whether the request should be retried, or is done.
+             */
+            void downloadCompleted(ProjectRequest * r, helpers::HttpClient::Response const & response) {
+                bool rateLimited = scheduler_.update(r->token, response);
+                bool retry = false;
+                long status = response.ok() ? response.status : 0;
+                if (rateLimited) {
+                    ++rateLimited_;
+                    retry = true;
+                } else if (status == 200) {
+                    store(r, response.header("etag"));
+                } else if (status == 304) {
+                    ++notModified_;
+                } else if (status == 301 || status == 302 || status == 307) {
+                    // retry with new location
+                    ++moved_;
+                    r->url = response.header("location");
+                    retry = ! r->url.empty();
+                } else if ((status == 0 || status >= 500) && r->attempts < MAX_ATTEMPTS) {
+                    retry = true;
+                }
+                std::lock_guard<std::mutex> g(m_);
+                if (retry) {
+                    retry_.push_back(r);
+                } else {
+                    if (status == 200 || status == 304) {
+                        ++success_;
                     } else {
-                        return headers.status;
+                        std::cout << r->project->id << "," << status << std::endl;
+                        ++failed_;
                     }
+                    ++completed_;
+                    if (completed_ % 1000 == 0)
+                        std::cerr << "     " << completed_ << ", success: " << success_ <<  ", failed " << failed_ << ", moved " << moved_ << "     \r" << std::flush;
+                    --outstanding_;
+                    delete r;
                 }
+                cv_.notify_one();
             }
 
-            
-
-
-            static size_t CurlCallback(char * data, size_t, size_t size, void * stream) {
-                static_cast<std::stringstream*>(stream)->write(data, size);
-                return size;
+            /** Saves the downloaded project metadata and remembers its ETag.
+             */
+            void store(ProjectRequest * r, std::string const & etag) {
+                Project * p = r->project;
+                std::string targetDir = STR(OutputDir.value() << "/" << p->mangledDir());
+                std::lock_guard<std::mutex> g(m_);
+                // create each target folder only once, the output directory itself is created upfront
+                if (createdDirs_.insert(p->mangledDir()).second)
+                    mkdir(targetDir.c_str(), 0755);
+                std::ofstream f(STR(OutputDir.value() << "/" << p->mangledName()));
+                f << r->body;
+                if (! etag.empty())
+                    etagsOut_ << helpers::escapeQuotes(p->mangledName()) << "," << helpers::escapeQuotes(etag) << std::endl;
             }
 
-            
             std::vector<Project *> projects_;
-            std::vector<std::string> tokens_;
+            TokenScheduler scheduler_;
+
+            // mangled project name -> ETag of the last download
+            std::unordered_map<std::string, std::string> etags_;
+            std::ofstream etagsOut_;
+            std::unordered_set<std::string> createdDirs_;
 
+            // requests to be resubmitted
+            std::deque<ProjectRequest *> retry_;
+            // requests created but not yet done
+            size_t outstanding_ = 0;
             std::mutex m_;
+            std::condition_variable cv_;
+
+            size_t completed_ = 0;
+            size_t success_ = 0;
+            size_t failed_ = 0;
+            size_t notModified_ = 0;
+            size_t rateLimited_ = 0;
             std::atomic<unsigned> existing_;
             std::atomic<unsigned> moved_;
 
         };
-        
+
     } // anonymous namespace
 
-    
+
 
     void DownloadGithubMetadata(int argc, char * argv[]) {
         Settings.addOption(Input);
         Settings.addOption(OutputDir);
         Settings.addOption(GitHubPersonalAccessToken);
+        Settings.addOption(NumThreads);
+        MaxTransfers.updateDefaultValue(32);
+        Settings.addOption(MaxTransfers);
+        BaseUrl.updateDefaultValue("https://api.github.com");
+        Settings.addOption(BaseUrl);
+        Settings.addOption(Refresh);
         Settings.parse(argc, argv);
         Settings.check();
 
+        helpers::EnsurePath(OutputDir.value());
         DownloadManager dm;
         dm.loadData();
         dm.download();
     }
-    
+
 } // namespace dejavu
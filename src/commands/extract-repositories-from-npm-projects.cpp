@@ -5,12 +5,18 @@
 #include <set>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <src/commit_iterator.h>
 #include <sstream>
 
 #include "../loaders.h"
 #include "helpers/json.hpp"
 
+/** Prepares a list of GitHub URLs for NPM packages from their package.json files.
+
+    The NPM registry documents of the packages are processed in parallel, each thread collecting its own set of packages, which are merged at the end. The documents can be very large, so they are not parsed into a DOM, but only the repository fields are extracted from them by a SAX handler (see RepositoryExtractor).
+ */
+
 namespace dejavu {
 
     namespace {
@@ -18,24 +24,24 @@ namespace dejavu {
 
         class Stats {
         public:
-            static size_t parsed;
-            static size_t parsed_correctly;
-            static size_t parsed_incorrectly;
+            static std::atomic<size_t> parsed;
+            static std::atomic<size_t> parsed_correctly;
+            static std::atomic<size_t> parsed_incorrectly;
 
-            static size_t urls_recognized_as_github_repo;
-            static size_t urls_unrecognized_as_github_repo;
+            static std::atomic<size_t> urls_recognized_as_github_repo;
+            static std::atomic<size_t> urls_unrecognized_as_github_repo;
 
     //        static size_t packages_already_in_dataset;
     //        static size_t packages_not_in_dataset_yet;
     //        static size_t packages_loaded;
 
-            static size_t urls_examined;
-            static size_t urls_empty;
-            static size_t urls_no_user_or_project;
-            static size_t urls_correctly_splitting;
+            static std::atomic<size_t> urls_examined;
+            static std::atomic<size_t> urls_empty;
+            static std::atomic<size_t> urls_no_user_or_project;
+            static std::atomic<size_t> urls_correctly_splitting;
 
-            static size_t unique_urls_recognized_as_github_repo;
-            static size_t unique_urls_recognized_as_github_repo_missing_from_data;
+            static std::atomic<size_t> unique_urls_recognized_as_github_repo;
+            static std::atomic<size_t> unique_urls_recognized_as_github_repo_missing_from_data;
 
             static void PrintOut() {
                 std::cerr << "Parsed correctly: " << parsed_correctly
@@ -86,20 +92,20 @@ namespace dejavu {
             }
         };
 
-        size_t Stats::parsed = 0;
-        size_t Stats::parsed_correctly = 0;
-        size_t Stats::parsed_incorrectly = 0;
-        size_t Stats::urls_recognized_as_github_repo = 0;
-        size_t Stats::urls_unrecognized_as_github_repo = 0;
+        std::atomic<size_t> Stats::parsed(0);
+        std::atomic<size_t> Stats::parsed_correctly(0);
+        std::atomic<size_t> Stats::parsed_incorrectly(0);
+        std::atomic<size_t> Stats::urls_recognized_as_github_repo(0);
+        std::atomic<size_t> Stats::urls_unrecognized_as_github_repo(0);
     //    size_t Stats::packages_already_in_dataset = 0;
     //    size_t Stats::packages_not_in_dataset_yet = 0;
     //    size_t Stats::packages_loaded = 0;
-        size_t Stats::urls_examined = 0;
-        size_t Stats::urls_empty = 0;
-        size_t Stats::urls_no_user_or_project = 0;
-        size_t Stats::urls_correctly_splitting = 0;
-        size_t Stats::unique_urls_recognized_as_github_repo = 0;
-        size_t Stats::unique_urls_recognized_as_github_repo_missing_from_data = 0;
+        std::atomic<size_t> Stats::urls_examined(0);
+        std::atomic<size_t> Stats::urls_empty(0);
+        std::atomic<size_t> Stats::urls_no_user_or_project(0);
+        std::atomic<size_t> Stats::urls_correctly_splitting(0);
+        std::atomic<size_t> Stats::unique_urls_recognized_as_github_repo(0);
+        std::atomic<size_t> Stats::unique_urls_recognized_as_github_repo_missing_from_data(0);
 
         struct Project {
             unsigned id;
@@ -235,72 +241,290 @@ namespace dejavu {
             return user + "/" + project;
         }
 
-        void ExtractDataFromRepository(nlohmann::json json,
+        /** The repository field of a package.json, either a string with the URL, or an object with the type and url of the repository.
+         */
+        struct Repository {
+            enum class Kind {
+                None,
+                String,
+                Object,
+            };
+            Kind kind = Kind::None;
+            // the URL if the repository is a string
+            std::string value;
+            bool hasType = false;
+            std::string type;
+            bool hasUrl = false;
+            std::string url;
+        };
+
+        void AddPackage(std::string const & url, std::vector<NPMPackage> &repos) {
+            std::string repo_info = URLToRepository(url);
+            if (repo_info != "" || url != "") {
+                NPMPackage package;
+                package.repo = repo_info;
+                package.url = url;
+                package.github = IsURLAGitHubRepo(url);
+                repos.push_back(package);
+            }
+        }
+
+        void ExtractDataFromRepository(Repository const & repository,
                                        std::vector<NPMPackage> &repos) {
-            if (json.is_string()) {
-                std::string url = json.get<std::string>();
-                std::string repo_info = URLToRepository(url);
-                if (repo_info != "" || url != "") {
-                    NPMPackage package;
-                    package.repo = repo_info;
-                    package.url = url;
-                    package.github = IsURLAGitHubRepo(url);
-                    repos.push_back(package);
-                }
+            if (repository.kind == Repository::Kind::String)
+                AddPackage(repository.value, repos);
+            if (repository.kind == Repository::Kind::Object && repository.hasType && repository.type == "git" && repository.hasUrl)
+                AddPackage(repository.url, repos);
+        }
+
+        /** SAX handler which extracts the repository fields from an NPM registry document.
+
+            Does the same as walking the DOM of the document would, i.e. for each version of the package (the elements of the versions field), its package_json.repository is used if the version is an object, otherwise the repository of the whole document is used.
+         */
+        class RepositoryExtractor : public nlohmann::json_sax<nlohmann::json> {
+        public:
+
+            /** Kinds of the containers we are interested in, anything else is Other.
+             */
+            enum class Kind {
+                Other,
+                Root,
+                Versions,
+                Version,
+                PackageJson,
+                RootRepository,
+                VersionRepository,
+            };
+
+            /** Repositories of the versions which are objects.
+             */
+            std::vector<Repository> versionRepositories;
+
+            /** Number of versions which are not objects and therefore use the root repository.
+             */
+            size_t nonObjectVersions = 0;
+
+            Repository rootRepository;
+
+            bool null() override {
+                return value(false);
             }
-            if (json.is_object()) {
-                auto type = json["type"];
-                if (type.is_string()) {
-                    if (type.get<std::string>() == "git") {
-                        if (json["url"].is_string()) {
-                            auto url = json["url"].get<std::string>();
-                            std::string repo_info = URLToRepository(url);
-                            if (repo_info != "" || url != "") {
-                                NPMPackage package;
-                                package.repo = repo_info;
-                                package.url = url;
-                                package.github = IsURLAGitHubRepo(url);
-                                repos.push_back(package);
-                            }
-                        }
+
+            bool boolean(bool val) override {
+                return value(true);
+            }
+
+            bool number_integer(number_integer_t val) override {
+                return value(true);
+            }
+
+            bool number_unsigned(number_unsigned_t val) override {
+                return value(true);
+            }
+
+            bool number_float(number_float_t val, string_t const & s) override {
+                return value(true);
+            }
+
+            bool string(string_t & val) override {
+                if (stack_.empty())
+                    return value(true);
+                switch (stack_.back()) {
+                case Kind::Root:
+                    if (key_ == "repository") {
+                        rootRepository = Repository();
+                        rootRepository.kind = Repository::Kind::String;
+                        rootRepository.value = val;
+                        return true;
+                    }
+                    break;
+                case Kind::PackageJson:
+                    if (key_ == "repository") {
+                        Repository & r = versionRepositories.back();
+                        r = Repository();
+                        r.kind = Repository::Kind::String;
+                        r.value = val;
+                        return true;
+                    }
+                    break;
+                case Kind::RootRepository:
+                case Kind::VersionRepository: {
+                    Repository & r = stack_.back() == Kind::RootRepository ? rootRepository : versionRepositories.back();
+                    if (key_ == "type") {
+                        r.hasType = true;
+                        r.type = val;
+                        return true;
+                    } else if (key_ == "url") {
+                        r.hasUrl = true;
+                        r.url = val;
+                        return true;
                     }
+                    break;
                 }
+                default:
+                    break;
+                }
+                return value(true);
             }
-        }
 
-        std::vector<NPMPackage> ExtractFromJSONFile(std::string file) {
-            //std::cerr << "opening " << file << std::endl;
-            std::vector<NPMPackage> repos;
+            bool start_object(std::size_t elements) override {
+                return start(true);
+            }
 
-            try {
-                nlohmann::json data;
+            bool key(string_t & val) override {
+                key_ = val;
+                return true;
+            }
 
-                std::ifstream input(file);
-                assert(input.is_open());
-                input >> data;
+            bool end_object() override {
+                stack_.pop_back();
+                return true;
+            }
 
-                for (auto version : data["versions"]) {
+            bool start_array(std::size_t elements) override {
+                return start(false);
+            }
 
-                    if (!version.is_object()) {
-                        auto repository = data["repository"];
-                        ExtractDataFromRepository(repository, repos);
-                        continue;
-                    }
+            bool end_array() override {
+                stack_.pop_back();
+                return true;
+            }
 
-                    auto package_json = version["package_json"];
-                    auto repository = package_json["repository"];
+            bool parse_error(std::size_t position, std::string const & lastToken, nlohmann::detail::exception const & e) override {
+                error = e.what();
+                return false;
+            }
 
-                    ExtractDataFromRepository(repository, repos);
+            std::string error;
+
+        private:
+
+            /** A primitive value, if it is a repository field, or a version, it must be accounted for.
+             */
+            bool value(bool nonNull) {
+                if (stack_.empty())
+                    return true;
+                switch (stack_.back()) {
+                case Kind::Root:
+                    // versions which are a primitive value are iterated over as a single non-object element (unless null)
+                    if (key_ == "versions" && nonNull)
+                        ++nonObjectVersions;
+                    else if (key_ == "repository")
+                        rootRepository = Repository();
+                    break;
+                case Kind::Versions:
+                    ++nonObjectVersions;
+                    break;
+                case Kind::Version:
+                    if (key_ == "package_json")
+                        versionRepositories.back() = Repository();
+                    break;
+                case Kind::PackageJson:
+                    if (key_ == "repository")
+                        versionRepositories.back() = Repository();
+                    break;
+                case Kind::RootRepository:
+                case Kind::VersionRepository: {
+                    Repository & r = stack_.back() == Kind::RootRepository ? rootRepository : versionRepositories.back();
+                    if (key_ == "type")
+                        r.hasType = false;
+                    else if (key_ == "url")
+                        r.hasUrl = false;
+                    break;
                 }
-                ++Stats::parsed_correctly;
-                return repos;
+                default:
+                    break;
+                }
+                return true;
+            }
 
-            } catch (nlohmann::json::parse_error& e) {
+            /** Start of an object or array, determines its kind from its parent and key.
+             */
+            bool start(bool isObject) {
+                Kind kind = Kind::Other;
+                if (stack_.empty()) {
+                    kind = isObject ? Kind::Root : Kind::Other;
+                } else {
+                    switch (stack_.back()) {
+                    case Kind::Root:
+                        if (key_ == "versions") {
+                            kind = Kind::Versions;
+                        } else if (key_ == "repository") {
+                            rootRepository = Repository();
+                            if (isObject) {
+                                rootRepository.kind = Repository::Kind::Object;
+                                kind = Kind::RootRepository;
+                            }
+                        }
+                        break;
+                    case Kind::Versions:
+                        if (isObject) {
+                            versionRepositories.push_back(Repository());
+                            kind = Kind::Version;
+                        } else {
+                            ++nonObjectVersions;
+                        }
+                        break;
+                    case Kind::Version:
+                        if (key_ == "package_json") {
+                            versionRepositories.back() = Repository();
+                            if (isObject)
+                                kind = Kind::PackageJson;
+                        }
+                        break;
+                    case Kind::PackageJson:
+                        if (key_ == "repository") {
+                            Repository & r = versionRepositories.back();
+                            r = Repository();
+                            if (isObject) {
+                                r.kind = Repository::Kind::Object;
+                                kind = Kind::VersionRepository;
+                            }
+                        }
+                        break;
+                    case Kind::RootRepository:
+                    case Kind::VersionRepository: {
+                        Repository & r = stack_.back() == Kind::RootRepository ? rootRepository : versionRepositories.back();
+                        if (key_ == "type")
+                            r.hasType = false;
+                        else if (key_ == "url")
+                            r.hasUrl = false;
+                        break;
+                    }
+                    default:
+                        break;
+                    }
+                }
+                stack_.push_back(kind);
+                return true;
+            }
+
+            std::vector<Kind> stack_;
+            std::string key_;
+        }; // RepositoryExtractor
+
+        std::vector<NPMPackage> ExtractFromJSONFile(std::string file) {
+            //std::cerr << "opening " << file << std::endl;
+            std::vector<NPMPackage> repos;
+            ++Stats::parsed;
+
+            std::ifstream input(file);
+            assert(input.is_open());
+
+            // parse directly from the stream, no need to read the whole file in memory first
+            RepositoryExtractor extractor;
+            if (! nlohmann::json::sax_parse(input, & extractor)) {
                 ++Stats::parsed_incorrectly;
                 std::cerr << "could not parse: " << file
-                          << " ("<< e.what() << ")" << std::endl;
+                          << " ("<< extractor.error << ")" << std::endl;
                 return repos;
             }
+            for (Repository const & repository : extractor.versionRepositories)
+                ExtractDataFromRepository(repository, repos);
+            for (size_t i = 0; i < extractor.nonObjectVersions; ++i)
+                ExtractDataFromRepository(extractor.rootRepository, repos);
+            ++Stats::parsed_correctly;
+            return repos;
         }
 
         void CompilePackageList(std::vector<std::string> const &json_files,
@@ -313,24 +537,39 @@ namespace dejavu {
             size_t inspected = 0;
             helpers::StartCounting(inspected);
 
-            for(std::string file : json_files) {
-                std::vector<NPMPackage> repos = ExtractFromJSONFile(file);
-                //npm_packages.insert(npm_packages.end(), repos.begin(), repos.end());
-                for (NPMPackage r : repos) {
-
-                    if (project_ids.find(r.repo) == project_ids.end()) {
-                        r.identified = false;
-                        r.project_id = 0;
-                    } else {
-                        r.identified  = true;
-                        r.project_id = project_ids.at(r.repo);
-                    }
+            // each thread collects its own packages, which are merged at the end
+            std::vector<std::unordered_set<NPMPackage, NPMPackageHash, NPMPackageComp>> thread_packages(NumThreads.value());
+            std::atomic<size_t> next(0);
+            std::mutex m;
+            std::vector<std::thread> threads;
+            for (unsigned stride = 0; stride < NumThreads.value(); ++stride)
+                threads.push_back(std::thread([&, stride]() {
+                    while (true) {
+                        size_t i = next++;
+                        if (i >= json_files.size())
+                            return;
+                        std::vector<NPMPackage> repos = ExtractFromJSONFile(json_files[i]);
+                        for (NPMPackage r : repos) {
+
+                            if (project_ids.find(r.repo) == project_ids.end()) {
+                                r.identified = false;
+                                r.project_id = 0;
+                            } else {
+                                r.identified  = true;
+                                r.project_id = project_ids.at(r.repo);
+                            }
 
-                    npm_packages.insert(r);
-                }
+                            thread_packages[stride].insert(r);
+                        }
 
-                helpers::Count(inspected);
-            }
+                        std::lock_guard<std::mutex> g(m);
+                        helpers::Count(inspected);
+                    }
+                }));
+            for (auto & t : threads)
+                t.join();
+            for (auto & packages : thread_packages)
+                npm_packages.insert(packages.begin(), packages.end());
 
             helpers::FinishCounting(inspected, "JSON files");
             helpers::FinishTask(task, timer);
@@ -16,8 +16,7 @@
 #include "../loaders.h"
 #include "../commands.h"
 #include "../commit_iterator.h"
-
-#include "helpers/json.hpp"
+#include "../metadata_table.h"
 
 namespace dejavu {
 
@@ -68,19 +67,11 @@ namespace dejavu {
 
             /** Load the stargazers from the metadata.
              */
-            void updateFromMetadata(std::string const & user, std::string const & repo) {
-                std::string pName = user + "_" + repo + ".json";
-                std::string mFile = STR("/data/dejavu/projects-metadata/" << pName.substr(0,2) << "/" << pName);
-                if (helpers::FileExists(mFile)) {
-                    nlohmann::json json;
-                    std::ifstream(mFile) >> json;
-                    stargazers = json["stargazers_count"];
-                    try {
-                        language = json["language"];
-                        
-                    } catch (...) {
-                        // don't worry
-                    }
+            void updateFromMetadata(MetadataTable const & metadata) {
+                if (metadata.has(id)) {
+                    MetadataTable::Record const & m = metadata[id];
+                    stargazers = m.stars;
+                    language = metadata.str(m.language);
                 }
             }
 
@@ -162,10 +153,12 @@ namespace dejavu {
         public:
 
             void loadData() {
+                std::cerr << "Loading project metadata ... " << std::endl;
+                MetadataTable metadata(Input.value());
                 std::cerr << "Loading projects ... " << std::endl;
-                ProjectLoader{[this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
+                ProjectLoader{[&, this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
                         Project * p = new Project{id, user, repo, createdAt};
-                        p->updateFromMetadata(user, repo);
+                        p->updateFromMetadata(metadata);
                         projects_.insert(std::make_pair(id, p));
                     }};
                 std::cerr << "Loading commits ... " << std::endl;
@@ -243,6 +236,7 @@ namespace dejavu {
 
     void FileDuplicationPerProject(int argc, char * argv[]) {
         Settings.addOption(DataDir);
+        Settings.addOption(Input);
         Settings.parse(argc, argv);
         Settings.check();
 
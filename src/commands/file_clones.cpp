@@ -4,6 +4,7 @@
 #include <thread>
 #include <mutex>
 #include <src/commit_iterator.h>
+#include <src/ordered_output.h>
 
 #include "../loaders.h"
 #include "../commands.h"
@@ -464,7 +465,8 @@ namespace dejavu {
     class ChangesDetector {
     public:
         ChangesDetector(std::unordered_set<unsigned> const &clusterIds):
-                contentsToBeTracked_(clusterIds) {
+                contentsToBeTracked_(clusterIds),
+                out_("fileCloneChanges") {
         }
 
         static void ExtractClusterIds(std::unordered_set<unsigned> &clusterIds) {
@@ -528,9 +530,6 @@ namespace dejavu {
 
             std::cerr << "TODO: " << projects.size() << " projects" << std::endl;
 
-            fOut_.open(path);
-            fOut_ << "#projectId,clusterId,notFromEmpty,changes,deletions" << std::endl;
-            
             std::vector<std::thread> threads;
             size_t completed = 0;
 
@@ -556,6 +555,11 @@ namespace dejavu {
             for (auto & i : threads)
                 i.join();
 
+            // the rows are ordered by project and cluster ids so that the output does not depend on the threads
+            std::ofstream f(path);
+            f << "#projectId,clusterId,notFromEmpty,changes,deletions" << std::endl;
+            out_.write(f);
+
             helpers::FinishCounting(completed, "projects");
             helpers::FinishTask(task, timer);
         }
@@ -572,10 +576,11 @@ namespace dejavu {
             cfi.process();
 
             // clusterInfos contain information about all clusters found in the project
-            {
-                std::lock_guard<std::mutex> g(mOut_);
-                for (ClusterInfo * ci : clusterInfos)
-                    fOut_ << p->id << "," << *ci << std::endl;
+            for (ClusterInfo * ci : clusterInfos) {
+                std::string key;
+                OrderedOutput::AppendKey(key, p->id);
+                OrderedOutput::AppendKey(key, ci->contentsId);
+                out_.add(std::move(key), STR(p->id << "," << *ci));
             }
 
             for (ClusterInfo * ci : clusterInfos)
@@ -588,14 +593,14 @@ namespace dejavu {
         
         std::unordered_set<unsigned> contentsToBeTracked_;
 
-        std::ofstream fOut_;
-        std::mutex mOut_;
+        OrderedOutput out_;
         std::mutex mCerr_;
     };
 
     void DetectFileClones2(int argc, char * argv[]) {
         Settings.addOption(DataDir);
         Settings.addOption(NumThreads);
+        Settings.addOption(TempDir);
         Settings.parse(argc, argv);
         Settings.check();
 
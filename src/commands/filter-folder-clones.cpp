@@ -17,7 +17,7 @@
 
 /** Filters given folder clones from the dataset.
 
-    This is done by essentially loading the entire dataset and then going project by project, tagging those files which belong to a clone and then ignoring their changes until they are deleted.
+    This is done by essentially loading the entire dataset and then going project by project, tagging those files which belong to a clone and then ignoring their changes until they are deleted. The output is a view of the dataset (see DatasetView) which selects the remaining file changes by their rows.
  */
 
 namespace dejavu {
@@ -31,7 +31,8 @@ namespace dejavu {
             unsigned commitId;
             std::string path;
             unsigned files;
-            unsigned fileChanges;
+            // atomic because large projects are analyzed by multiple threads
+            std::atomic<unsigned> fileChanges;
 
             Clone(unsigned id, unsigned projectId, unsigned commitId, std::string const & path, unsigned files):
                 id(id),
@@ -66,6 +67,7 @@ namespace dejavu {
             }
 
             void addIgnoredChange(Commit * c, unsigned pathId) {
+                std::lock_guard<std::mutex> g(mIgnoredChanges);
                 ignoredChanges.insert(Join2Unsigned(c->id, pathId));
             }
 
@@ -76,6 +78,7 @@ namespace dejavu {
 
             //commit + pathId
             std::unordered_set<uint64_t> ignoredChanges;
+            std::mutex mIgnoredChanges;
             // commit id -> set of pathIds that are to be ignored because they change a clone
             //            std::unordered_map<unsigned, std::unordered_set<unsigned>> ignoredChanges;
 
@@ -213,8 +216,14 @@ namespace dejavu {
 
             void filterFileChanges() {
                 std::cerr << "Filtering file changes..." << std::endl;
-                changesOut_.open(OutputDir.value() + "/fileChanges.csv");
-                changesOut_ << "projectId,commitId,pathId,contentsId" << std::endl;
+                // large projects are analyzed first, one by one, each using all threads so that they do not dominate the tail of the analysis
+                std::vector<Project *> largeProjects;
+                for (auto i : projects_)
+                    if (i.second != nullptr && i.second->commits.size() >= LargeProjectThreshold.value())
+                        largeProjects.push_back(i.second);
+                std::cerr << "    " << largeProjects.size() << " large projects" << std::endl;
+                for (Project * p : largeProjects)
+                    analyzeProject(p, NumThreads.value());
                 std::vector<std::thread> threads;
                 auto i = projects_.begin();
                 size_t completed = 0;
@@ -232,7 +241,7 @@ namespace dejavu {
                                 if (completed % 1000 == 0)
                                     std::cout << " : " << completed << "    \r" << std::flush;
                             }
-                            if (p == nullptr)
+                            if (p == nullptr || p->commits.size() >= LargeProjectThreshold.value())
                                 continue;
                             analyzeProject(p);
                         }
@@ -261,85 +270,84 @@ namespace dejavu {
                 }
             }
 
-            /** Filtering projects is easy, we output all projects that are tagged.
-             */
-            void filterProjects() {
-                std::cerr << "Writing filtered projects..." << std::endl;
-                std::ofstream f(OutputDir.value() + "/projects.csv");
-                f << "projectId,user,repo,createdAt" << std::endl;
-                unsigned tagged = 0;
-                for (auto i : projects_) {
-                    Project * p = i.second;
-                    if (!p->tag)
-                        continue;
-                    ++tagged;
-                    f << p->id << ","
-                      << helpers::escapeQuotes(p->user) << ","
-                      << helpers::escapeQuotes(p->repo) << ","
-                      << p->createdAt << std::endl;
-                }
-                std::cerr << "    " << tagged << " projects written" << std::endl;
-                std::cerr << "    " << projects_.size() << "projects total" << std::endl;
-            }
+            /** Outputs the view of the dataset without the clones.
 
-            /** First remove any untagged commits from the hierarchy. Then output the surviving ones.
+                The view selects the tagged projects and commits and the rows of file changes which were not ignored. Untagged commits are removed from the commit hierarchy first, which changes the commit parents, so these are written in full to the view. If materialize is set, the view is then materialized.
              */
-            void filterCommits() {
-                std::cerr << "Removing empty commits..." << std::endl;
-                unsigned removed = 0;
-                for (auto i : commits_) {
-                    Commit * c = i.second;
-                    if (c->tag)
-                        continue;
-                    ++removed;
-                    c->detach();
+            void output() {
+                helpers::EnsurePath(OutputDir.value());
+                DatasetView view(DataDir.value());
+                {
+                    std::cerr << "Selecting projects..." << std::endl;
+                    view.projects = Selection();
+                    for (auto i : projects_)
+                        if (i.second->tag)
+                            view.projects.insert(i.first);
+                    std::cerr << "    " << view.projects.size() << " projects selected" << std::endl;
+                    std::cerr << "    " << projects_.size() << " projects total" << std::endl;
                 }
-                std::cerr << "    " << removed << " commits detached" << std::endl;
-                std::cerr << "    " << commits_.size() << " out of total" << std::endl;
                 {
-                    std::cerr << "Writing filtered commits..." << std::endl;
-                    std::ofstream f(OutputDir.value() + "/commits.csv");
-                    f << "commitId,authorTime,committerTime" << std::endl;
+                    std::cerr << "Removing empty commits..." << std::endl;
+                    unsigned removed = 0;
                     for (auto i : commits_) {
                         Commit * c = i.second;
-                        if (!c->tag)
+                        if (c->tag)
                             continue;
-                        f << c->id << "," << c->time << "," << c->time2 << std::endl;
+                        ++removed;
+                        c->detach();
                     }
+                    std::cerr << "    " << removed << " commits detached" << std::endl;
+                    std::cerr << "    " << commits_.size() << " out of total" << std::endl;
                 }
                 {
-                    std::cerr << "Writing commit parents..." << std::endl;
+                    std::cerr << "Selecting commits and writing commit parents..." << std::endl;
                     std::ofstream f(OutputDir.value() + "/commitParents.csv");
                     f << "commitId,parentId" << std::endl;
+                    view.commits = Selection();
                     for (auto i : commits_) {
                         Commit * c = i.second;
                         if (!c->tag)
                             continue;
+                        view.commits.insert(c->id);
                         for (Commit * p : c->parents)
                             f << c->id << "," << p->id << std::endl;
                     }
+                    std::cerr << "    " << view.commits.size() << " commits selected" << std::endl;
                 }
+                {
+                    std::cerr << "Selecting file changes..." << std::endl;
+                    view.changes = Selection();
+                    uint64_t row = 0;
+                    // if a commit changes the same path more than once, only the change kept by the commit is selected
+                    FileChangeLoader{[&, this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
+                            Project * p = projects_[projectId];
+                            Commit * c = commits_[commitId];
+                            if (p->ignoredChanges.find(Join2Unsigned(commitId, pathId)) == p->ignoredChanges.end()
+                                && (contentsId == FILE_DELETED || c->changes[pathId] == contentsId))
+                                view.changes.insert(row);
+                            ++row;
+                        }};
+                    std::cerr << "    " << view.changes.size() << " file changes selected" << std::endl;
+                    std::cerr << "    " << row << " file changes total" << std::endl;
+                }
+                std::cerr << "Writing dataset view..." << std::endl;
+                view.write(OutputDir.value());
+                if (Materialize.value())
+                    DatasetView::Materialize(OutputDir.value());
             }
 
-            void createSymlinks() {
-                std::cerr << "Creating symlinks..." << std::endl;
-                helpers::System(STR("ln -s " << DataDir.value() + "/hashes.csv " << OutputDir.value() << "/hashes.csv"));
-                helpers::System(STR("ln -s " << DataDir.value() + "/paths.csv " << OutputDir.value() << "/paths.csv"));
-            }
-
-            
-
         private:
 
-            /** Takes the project and creates a list of changes to be removed because they either create, or modify a clone.
+            /** Takes the project and creates a list of changes to be removed because they either create, or modify a clone. Commits and projects with at least one change that is not ignored are tagged.
 
+                The ignored changes are kept until the view is written. If more than one thread is specified, the project's history is walked in parallel.
              */
-            void analyzeProject(Project * p) {
+            void analyzeProject(Project * p, unsigned numThreads = 1) {
                 //if (p->id != 3544422)
                 //    return;
                 // if there are no clones in the project, no need to go though it
                 if (! p->clones.empty()) {
-                    CommitForwardIterator<Project,Commit,State> i(p, [&, this](Commit * c, State & state) {
+                    auto handler = [&, this](Commit * c, State & state) {
                             //std::cout << "Commit " << c->id << std::endl;
                             try {
                                 // first deal with deletions in the commit, if they belong to any active commit
@@ -370,16 +378,21 @@ namespace dejavu {
                                 //}
                             // that's it
                             return true;
-                        });
-                    i.process();
+                        };
+                    if (numThreads > 1) {
+                        ParallelCommitForwardIterator<Project,Commit,State> i(p, handler, numThreads);
+                        i.process();
+                    } else {
+                        CommitForwardIterator<Project,Commit,State> i(p, handler);
+                        i.process();
+                    }
                 }
                 {
-                    std::lock_guard<std::mutex> g(mChangesOut_);
+                    std::lock_guard<std::mutex> g(mTags_);
                     for (Commit * c : p->commits) {
                         for (auto i : c->deletions) {
                             uint64_t x = Join2Unsigned(c->id, i);
                             if (p->ignoredChanges.find(x) == p->ignoredChanges.end()) {
-                                changesOut_ << p->id << "," << c->id << "," << i << "," << FILE_DELETED << std::endl;
                                 c->tag = true;
                                 p->tag = true;
                             }
@@ -387,14 +400,12 @@ namespace dejavu {
                         for (auto i : c->changes) {
                             uint64_t x = Join2Unsigned(c->id, i.first);
                             if (p->ignoredChanges.find(x) == p->ignoredChanges.end()) {
-                                changesOut_ << p->id << "," << c->id << "," << i.first << "," << i.second << std::endl;
                                 c->tag = true;
                                 p->tag = true;
                             }
                         }
                     }
                 }
-                p->ignoredChanges.clear();
                 /*
                 std::cerr << "Project " << p->id << " (ignored changed: " << p->ignoredChanges.size() << ")" << std::endl;
                 for (auto i : p->clones)
@@ -411,8 +422,7 @@ namespace dejavu {
             std::unordered_map<unsigned, std::string> paths_;
 
             std::mutex mCerr_;
-            std::mutex mChangesOut_;
-            std::ofstream changesOut_;
+            std::mutex mTags_;
 
             
         }; // FolderCloneFilter
@@ -427,6 +437,8 @@ namespace dejavu {
         Settings.addOption(Filter);
         Settings.addOption(OutputDir);
         Settings.addOption(NumThreads);
+        Settings.addOption(LargeProjectThreshold);
+        Settings.addOption(Materialize);
         Settings.parse(argc, argv);
         Settings.check();
 
@@ -435,9 +447,7 @@ namespace dejavu {
         fcf.loadData();
         fcf.filterFileChanges();
         fcf.reportCloneChanges();
-        fcf.filterProjects();
-        fcf.filterCommits();
-        fcf.createSymlinks();
+        fcf.output();
         
     }
     
@@ -7,29 +7,13 @@ namespace dejavu {
 
     namespace {
 
-        class Project {
-        public:
-            unsigned id;
-            std::string user;
-            std::string repo;
-            uint64_t createdAt;
-
-            Project(unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt):
-                id{id},
-                user{user},
-                repo{repo},
-                createdAt{createdAt} {
-            }
-        };
-
-
         class AgeFilter {
         public:
             
             void loadData() {
                 std::cerr << "Loading projects..." << std::endl;
                 ProjectLoader{[this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
-                        projects_.insert(std::make_pair(id, new Project(id, user, repo, createdAt)));
+                        projects_.insert(id);
                     }};
                 std::cerr << "    " << projects_.size() << " projects loaded" << std::endl;
                 std::cerr << "Loading commits ... " << std::endl;
@@ -46,93 +30,48 @@ namespace dejavu {
             void filterProjects() {
                 std::cerr << "filtering projects..." << std::endl;
                 FileChangeLoader{[this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
-                        if (tooOldCommits_.find(commitId) != tooOldCommits_.end()) {
-                            auto i = projects_.find(projectId);
-                            if (i != projects_.end()) {
-                                delete i->second;
-                                projects_.erase(i);
-                            }
-                        }
+                        if (tooOldCommits_.contains(commitId))
+                            projects_.erase(projectId);
                     }};
                 std::cerr << "    " << projects_.size() << " valid projects left" << std::endl;
-                std::ofstream f{OutputDir.value() + "/projects.csv"};
-                f << "projectid,user,repo,createdAt" << std::endl;
-                for (auto i : projects_) {
-                    Project * p = i.second;
-                    f << p->id << ","
-                      << helpers::escapeQuotes(p->user) << ","
-                      << helpers::escapeQuotes(p->repo) << ","
-                      << p->createdAt << std::endl;
-                }
             }
 
             void filter() {
-                std::unordered_set<unsigned> validCommits;
-                {
-                    std::cerr << "Filtering file changes..." << std::endl;
-                    std::ofstream f(OutputDir.value() + "/fileChanges.csv");
-                    f << "projectId,commitId,pathId,contentsId" << std::endl;
-                    size_t total = 0;
-                    size_t valid = 0;
-                    FileChangeLoader{[&,this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
-                            ++total;
-                            if (projects_.find(projectId) != projects_.end() && tooNewCommits_.find(commitId) == tooNewCommits_.end()) {
-                                ++valid;
-                                validCommits.insert(commitId);
-                                f << projectId << "," << commitId << "," << pathId << "," << contentsId << std::endl;
-                            }
-                        }};
-                    std::cerr << "    " << total << " file changes observed" << std::endl;
-                    std::cerr << "    " << valid << " file changes kept" << std::endl;
-                    std::cerr << "    " << validCommits.size() << " valid commits detected" << std::endl;
-                }
-                {
-                    std::cerr << "Filtering commits..." << std::endl;
-                    std::ofstream f(OutputDir.value() + "/commits.csv");
-                    f << "commitId,authorTime,committerTime" << std::endl;
-                    size_t total = 0;
-                    size_t valid = 0;
-                    CommitLoader{[&,this](unsigned id, uint64_t authorTime, uint64_t committerTime){
-                            ++total;
-                            if (validCommits.find(id) == validCommits.end())
-                                return;
-                            ++valid;
-                            f << id << "," << authorTime << "," << committerTime << std::endl;
-                        }};
-                    std::cerr << "    " << total << " commits observed" << std::endl;
-                    std::cerr << "    " << valid << " commits kept" << std::endl;
-                }
-                {
-                    std::cerr << "Filtering commit parents..." << std::endl;
-                    std::ofstream f(OutputDir.value() + "/commitParents.csv");
-                    f << "commitId,parentId" << std::endl;
-                    size_t total = 0;
-                    size_t valid = 0;
-                    CommitParentsLoader{[&, this](unsigned id, unsigned parentId){
-                            ++total;
-                            if (validCommits.find(id) == validCommits.end())
-                                return;
-                            if (validCommits.find(parentId) == validCommits.end())
-                                return;
+                std::cerr << "Filtering file changes..." << std::endl;
+                size_t total = 0;
+                size_t valid = 0;
+                FileChangeLoader{[&,this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
+                        ++total;
+                        if (projects_.contains(projectId) && ! tooNewCommits_.contains(commitId)) {
                             ++valid;
-                            f << id << "," << parentId << std::endl;
-                        }};
-                    std::cerr << "    " << total << " links observed" << std::endl;
-                    std::cerr << "    " << valid << " links kept" << std::endl;
-                }
+                            validCommits_.insert(commitId);
+                        }
+                    }};
+                std::cerr << "    " << total << " file changes observed" << std::endl;
+                std::cerr << "    " << valid << " file changes kept" << std::endl;
+                std::cerr << "    " << validCommits_.size() << " valid commits detected" << std::endl;
             }
 
-            void createSymlinks() {
-                std::cerr << "Creating symlinks..." << std::endl;
-                helpers::System(STR("ln -s " << DataDir.value() + "/hashes.csv " << OutputDir.value() << "/hashes.csv"));
-                helpers::System(STR("ln -s " << DataDir.value() + "/paths.csv " << OutputDir.value() << "/paths.csv"));
+            /** Writes the view of the valid projects and commits, materializing it if requested.
+
+                The file changes of the view are those of valid projects and commits, in commit parents only records where both commit and parent are valid are kept.
+             */
+            void writeView() {
+                std::cerr << "Writing dataset view..." << std::endl;
+                DatasetView view(DataDir.value());
+                view.projects = Selection(std::move(projects_));
+                view.commits = Selection(std::move(validCommits_));
+                view.write(OutputDir.value());
+                if (Materialize.value())
+                    DatasetView::Materialize(OutputDir.value());
             }
 
         private:
 
-            std::unordered_map<unsigned, Project *> projects_;
-            std::unordered_set<unsigned> tooOldCommits_;
-            std::unordered_set<unsigned> tooNewCommits_;
+            helpers::IdSet projects_;
+            helpers::IdSet tooOldCommits_;
+            helpers::IdSet tooNewCommits_;
+            helpers::IdSet validCommits_;
 
             
         }; // Filter
@@ -147,6 +86,7 @@ namespace dejavu {
     void Filter2008to2018(int argc, char * argv []) {
         Settings.addOption(DataDir);
         Settings.addOption(OutputDir);
+        Settings.addOption(Materialize);
         Settings.parse(argc, argv);
         Settings.check();
 
@@ -156,7 +96,7 @@ namespace dejavu {
         f.loadData();
         f.filterProjects();
         f.filter();
-        f.createSymlinks();
+        f.writeView();
                                        
         
     }
@@ -12,7 +12,7 @@
 #include "../objects.h"
 #include "../loaders.h"
 #include "../commands.h"
-#include "../commit_iterator.h"
+#include "../head_states.h"
 
 namespace dejavu {
 
@@ -32,6 +32,12 @@ namespace dejavu {
             Project(unsigned id, uint64_t createdAt):
                 BaseProject<Project, Commit>(id, createdAt) {
             }
+
+            unsigned heads = 0;
+            unsigned files = 0;
+            unsigned uniqueFiles = 0;
+            unsigned originalFiles = 0;
+            unsigned cloneFiles = 0;
         };
 
         class FileOriginal {
@@ -64,58 +70,6 @@ namespace dejavu {
                 this->commit = commit;
                 this->fileId = fileId;
             }
-        };
-
-        enum class FileState {
-            /** The file has unique contents and no other file in the dataset at any point of time has the same contents.
-             */
-            Unique,
-            /** The file is an original, i.e. at least one file has or will have the same contents, but this is the oldest file.
-             */
-            Original,
-            /** The file is a clone, i.e. an earlier file of the same contents existed. 
-             */
-            Clone
-        };
-
-        class FileRecord {
-        public:
-            unsigned pathId;
-            unsigned contentsId;
-            FileState initialState;
-            FileState state;
-            unsigned transitionsToUnique;
-            unsigned transitionsToOriginal;
-            unsigned transitionsToClone;
-
-            FileRecord(unsigned pathId, unsigned contentsId, FileState state):
-                pathId(pathId),
-                contentsId(contentsId),
-                initialState(state),
-                state(state),
-                transitionsToUnique(0),
-                transitionsToOriginal(0),
-                transitionsToClone(0) {
-            }
-        };
-
-        class State {
-        public:
-            State() {
-            }
-
-            State(State const & from) {
-                mergeWith(from, nullptr);
-            }
-
-            void mergeWith(State const & from, Commit * c) {
-                
-            }
-
-            
-
-
-            
         };
 
         class FinalBreaker {
@@ -129,14 +83,7 @@ namespace dejavu {
                 CommitLoader{[this](unsigned id, uint64_t authorTime, uint64_t committerTime){
                         commits_.insert(std::make_pair(id, new Commit(id, authorTime, committerTime)));
                     }};
-                std::cerr << "Loading commit parents ... " << std::endl;
-                CommitParentsLoader{[this](unsigned id, unsigned parentId){
-                        Commit * c = commits_[id];
-                        Commit * p = commits_[parentId];
-                        assert(c != nullptr);
-                        assert(p != nullptr);
-                        c->addParent(p);
-                    }};
+                // the final states come from the head states, so we do not need the commit hierarchy, or the changes to be kept in memory
                 std::cerr << "Loading file changes ... " << std::endl;
                 size_t numChanges = 0;
                 size_t numDeletions = 0;
@@ -145,8 +92,6 @@ namespace dejavu {
                         Commit * c = commits_[commitId];
                         assert(p != nullptr);
                         assert(c != nullptr);
-                        p->addCommit(c);
-                        c->addChange(pathId, contentsId);
                         if (contentsId == FILE_DELETED) {
                             ++numDeletions;
                         } else {
@@ -177,15 +122,74 @@ namespace dejavu {
             }
 
             /** Analyze the rest in categories of files.
+
+                Reads the live files at the heads of each project and determines whether they are unique, originals, or clones. A file (path and contents) present in multiple heads of the project is counted only once. 
              */
+            void analyzeProjects() {
+                std::cerr << "Analyzing project heads..." << std::endl;
+                HeadStates heads;
+                std::vector<std::thread> threads;
+                auto i = projects_.begin();
+                size_t completed = 0;
+                for (unsigned stride = 0; stride < NumThreads.value(); ++stride)
+                    threads.push_back(std::thread([stride, &i, & completed, & heads, this]() {
+                        while (true) {
+                            Project * p;
+                            {
+                                std::lock_guard<std::mutex> g(mCerr_);
+                                if (i == projects_.end())
+                                    return;
+                                p = i->second;
+                                ++i;
+                                ++completed;
+                                if (completed % 1000 == 0)
+                                    std::cerr << " : " << completed << "    \r" << std::flush;
+                            }
+                            if (p == nullptr)
+                                continue;
+                            analyzeProject(p, heads);
+                        }
+                    }));
+                for (auto & i : threads)
+                    i.join();
+            }
+
+            void output() {
+                std::cerr << "Writing final breakdown..." << std::endl;
+                std::ofstream f(DataDir.value() + "/finalBreakdown.csv");
+                f << "projectId,heads,files,uniqueFiles,originalFiles,cloneFiles" << std::endl;
+                size_t uniqueFiles = 0;
+                size_t originalFiles = 0;
+                size_t cloneFiles = 0;
+                for (auto i : projects_) {
+                    Project * p = i.second;
+                    f << p->id << "," << p->heads << "," << p->files << "," << p->uniqueFiles << "," << p->originalFiles << "," << p->cloneFiles << std::endl;
+                    uniqueFiles += p->uniqueFiles;
+                    originalFiles += p->originalFiles;
+                    cloneFiles += p->cloneFiles;
+                }
+                std::cerr << "    " << uniqueFiles << " unique files" << std::endl;
+                std::cerr << "    " << originalFiles << " original files" << std::endl;
+                std::cerr << "    " << cloneFiles << " clone files" << std::endl;
+            }
             
         private:
 
-            void analyzeProject(Project * p) {
-
-
-
-                
+            void analyzeProject(Project * p, HeadStates const & heads) {
+                std::set<std::pair<unsigned, unsigned>> files;
+                p->heads = heads.readProject(p->id, [&](unsigned commitId, HeadFiles const & headFiles) {
+                        files.insert(headFiles.begin(), headFiles.end());
+                    });
+                p->files = files.size();
+                for (auto const & f : files) {
+                    auto i = originals_.find(f.second);
+                    if (i == originals_.end())
+                        ++p->uniqueFiles;
+                    else if (i->second->project == p && i->second->fileId == f.first)
+                        ++p->originalFiles;
+                    else
+                        ++p->cloneFiles;
+                }
             }
 
             
@@ -194,7 +198,7 @@ namespace dejavu {
             std::unordered_map<unsigned, Commit *> commits_;
             std::unordered_map<unsigned, FileOriginal *> originals_;
 
-
+            std::mutex mCerr_;
             
         }; // FinalBreaker
         
@@ -214,6 +218,8 @@ namespace dejavu {
         FinalBreaker fb;
         fb.loadData();
         fb.removeUniqueFiles();
+        fb.analyzeProjects();
+        fb.output();
     }
     
 } // namespace dejavu
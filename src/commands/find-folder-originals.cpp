@@ -158,15 +158,6 @@ namespace dejavu {
                         assert(p != nullptr);
                         c->addParent(p);
                     }};
-                std::cerr << "Loading path segments ... " << std::endl;
-                pathSegments_.load();
-                globalRoot_ = new Dir(EMPTY_PATH, nullptr);
-                std::cerr << "Loading paths ... " << std::endl;
-                PathToIdLoader{[&,this](unsigned id, std::string const & path){
-                        if (id >= paths_.size())
-                            paths_.resize(id + 1);
-                        paths_[id] = globalRoot_->addPath(id, path, pathSegments_);
-                    }};
                 std::cerr << "Loading changes ... " << std::endl;
                 FileChangeLoader{[this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
                         Project * p = projects_[projectId];
@@ -178,7 +169,7 @@ namespace dejavu {
                         getLocationHint(pathId, contentsId).addOccurence(p, c);
                     }};
                 std::cerr << "    " << locationHints_.size() << " location hints" << std::endl;
-                std::cerr << "    " << paths_.size() << " paths " << std::endl;
+                std::cerr << "    " << tree_.numFiles() << " paths " << std::endl;
                 std::cerr << "Loading clone candidates ..." << std::endl;
                 FolderCloneOriginalsCandidateLoader{DataDir.value() + "/cloneOriginalsCandidates.csv", [this](unsigned id, SHA1Hash const & hash, unsigned occurences, unsigned files, unsigned projectId, unsigned commitId, std::string const & path){
                         if (id >= clones_.size())
@@ -295,7 +286,7 @@ namespace dejavu {
             LocationHint & getLocationHint(unsigned path, unsigned contents) {
                 static_assert(sizeof(unsigned) * 2 == sizeof(uint64_t), "Loss of data");
 
-                unsigned filename = paths_[path]->name;
+                unsigned filename = tree_.file(tree_.fileOf(path)).name;
                 uint64_t id = (static_cast<uint64_t>(filename) << (sizeof(unsigned) * 8)) + contents;
                 return locationHints_[id];
             }
@@ -400,7 +391,7 @@ namespace dejavu {
                         if (c == clone->commit)
                             return false;
                         ++counts.visitedCommits;
-                        state.updateWith(c, paths_, clone->validContents, changedFiles);
+                        state.updateWith(c, tree_, clone->validContents, changedFiles);
                         counts.totalChanges += c->changes.size();
                         counts.checkedChanges += changedFiles.size();
                         // for each file that has changed
@@ -421,7 +412,7 @@ namespace dejavu {
                                 ++counts.checkedDirs;
                                 if (isSubsetOf(clone->root, d, state)) {
                                     // to be deterministic, we do not optimize and we check all folders candidates taking the one with lexicographically smallest path
-                                    std::string path = d->path(pathSegments_);
+                                    std::string path = d->path(tree_);
                                     if (clone->updateWithOccurence(p, c, path, clone->files)) {
                                         ++counts.originalUpdates;
                                         updated = true;
@@ -484,13 +475,13 @@ namespace dejavu {
                 unsigned changes = 0;
                 CommitForwardIterator<Project,Commit,ProjectState> i(p, [&,this](Commit * c, ProjectState & state) {
                         // update the project state and determine the clone candidate folders
-                        state.updateWith(c, paths_, nullptr);
+                        state.updateWith(c, tree_, nullptr);
                         auto i = originals_.find(c);
                         if (i != originals_.end()) {
                             for (Clone * clone : i->second) {
                                 if (clone->project == p) {
                                     assert(clone->commit == c);
-                                    unsigned numFiles = state.getDir(clone->path, pathSegments_)->numFiles();
+                                    unsigned numFiles = state.getDir(clone->path, tree_)->numFiles();
                                     assert(clone->files <= numFiles);
                                     if (numFiles > clone->files) {
                                         ++changes;
@@ -507,9 +498,7 @@ namespace dejavu {
             
             std::vector<Project *> projects_;
             std::vector<Commit *> commits_;
-            std::vector<File *> paths_;
-            PathSegments pathSegments_;
-            Dir * globalRoot_;
+            PathTree tree_;
             std::unordered_map<uint64_t, LocationHint> locationHints_;
             std::vector<Clone *> clones_;
             std::unordered_map<Commit *, std::unordered_set<Clone *>> originals_;
@@ -10,28 +10,62 @@
 #include <openssl/sha.h>
 #include <fstream>
 
+#include "helpers/fixed_key_map.h"
+
 #include "../objects.h"
 #include "../loaders.h"
 #include "../commands.h"
 #include "../commit_iterator.h"
+#include "../path_dictionary.h"
 
 
 namespace dejavu {
 
     namespace {
 
+
+        class Clone;
+
+        class Original {
+        public:
+            unsigned cloneId;
+            unsigned projectId;
+            unsigned commitId;
+            std::string path;
+            std::vector<Clone *> clones;
+
+            // state of the original folder -> time it was first observed
+            helpers::FixedKeyMap<SHA1Hash, uint64_t> contents;
+            // states of the original folder sorted by the time they were observed
+            std::vector<std::pair<uint64_t, SHA1Hash>> sortedContents;
+
+            Original(unsigned cloneId, unsigned projectId, unsigned commitId, std::string const & path):
+                cloneId(cloneId),
+                projectId(projectId),
+                commitId(commitId),
+                path(path) {
+            }
+
+            void addClone(Clone * clone) {
+                clones.push_back(clone);
+            }
+            
+        }; // Original
+
         class Clone {
         public:
             unsigned id;
             unsigned projectId;
             unsigned commitId;
             std::string path;
+            Original * original;
 
-            Clone(unsigned id, unsigned projectId, unsigned commitId, std::string const & path):
+            Clone(unsigned id, unsigned projectId, unsigned commitId, std::string const & path, Original * original):
                 id(id),
                 projectId(projectId),
                 commitId(commitId),
                 path(path),
+                original(original),
                 changingCommits{0},
                 divergentCommits{0},
                 syncCommits{0},
@@ -55,27 +89,6 @@ namespace dejavu {
             
         }; // Clone
 
-        class Original {
-        public:
-            unsigned cloneId;
-            unsigned projectId;
-            unsigned commitId;
-            std::string path;
-            std::vector<Clone *> clones;
-
-            Original(unsigned cloneId, unsigned projectId, unsigned commitId, std::string const & path):
-                cloneId(cloneId),
-                projectId(projectId),
-                commitId(commitId),
-                path(path) {
-            }
-
-            void addClone(Clone * clone) {
-                clones.push_back(clone);
-            }
-            
-        }; // Original
-
         class Commit : public BaseCommit<Commit> {
         public:
             Commit(unsigned id, uint64_t time):
@@ -92,8 +105,14 @@ namespace dejavu {
                 BaseProject<Project, Commit>(id, createdAt) {
             }
 
+            // originals and clones located in the project
+            std::vector<Original *> originals;
+            std::vector<Clone *> clones;
+
         };
 
+        /** State of a single tracked folder.
+         */
         class State {
         public:
             State():
@@ -119,24 +138,22 @@ namespace dejavu {
                 active_ = true;
             }
 
-            /** First takes the */ 
-            bool processCommit(Commit * c, std::string const & path, std::unordered_map<unsigned, std::string> const & paths) {
-                bool result = false;
-                for (unsigned pathId : c->deletions) {
-                    std::string fp = getRelativePath(pathId, path, paths);
-                    if (fp.empty())
-                        continue;
-                    status.erase(fp);
-                    result = true;
-                }
-                for (auto ch : c->changes) {
-                    std::string fp = getRelativePath(ch.first, path, paths);
-                    if (fp.empty())
-                        continue;
-                    status[fp] = ch.second;
-                    result = true;
-                }
-                return result;
+            /** Deletes the given file if it belongs to the folder, returns true if so.
+             */
+            bool processDeletion(std::string const & fp, std::string const & path) {
+                if (fp.size() == path.size() || ! helpers::startsWith(fp, path))
+                    return false;
+                status.erase(fp.substr(path.size()));
+                return true;
+            }
+
+            /** Updates the given file if it belongs to the folder, returns true if so.
+             */
+            bool processChange(std::string const & fp, unsigned contentsId, std::string const & path) {
+                if (fp.size() == path.size() || ! helpers::startsWith(fp, path))
+                    return false;
+                status[fp.substr(path.size())] = contentsId;
+                return true;
             }
 
             /** Calculates the hash of the current state of the folder.
@@ -153,19 +170,92 @@ namespace dejavu {
 
         private:
 
-            std::string getRelativePath(unsigned pathId, std::string const & path, std::unordered_map<unsigned, std::string> const & paths) {
-                std::string const & fp = paths.find(pathId)->second;
-                if (helpers::startsWith(fp, path))
-                    return fp.substr(path.size());
-                else
-                    return std::string{};
-            }
-
             // path inside the folder -> contents id
             std::map<std::string, unsigned> status;
 
             bool active_;
-        }; // STate
+        }; // State
+
+        /** State of all folders tracked in a project, so that all clones (or originals) in the project can be analyzed in a single pass over its history.
+
+            The folders are identified by their index, only folders which have been activated are stored and so copying the state is proportional to the folders actually seen so far.
+         */
+        class BatchState {
+        public:
+            BatchState() = default;
+
+            BatchState(BatchState const & from) {
+                mergeWith(from);
+            }
+
+            void mergeWith(BatchState const & other, Commit * c = nullptr) {
+                for (auto const & i : other.folders_) {
+                    auto j = folders_.find(i.first);
+                    if (j == folders_.end())
+                        folders_.insert(i);
+                    else
+                        j->second.mergeWith(i.second);
+                }
+            }
+
+            void activate(size_t index) {
+                folders_[index].setActive();
+            }
+
+            State & operator [] (size_t index) {
+                return folders_[index];
+            }
+
+            /** Updates the tracked folders with the changes of the given commit and fills in indices of the folders changed.
+
+                If onlyActive is true, only folders that have already been activated are updated, otherwise a folder is tracked as soon as the commit touches it. The ranges are the ranks of the paths in each folder (see PathDictionary::prefixRange), so that the path of a change is only decoded if it belongs to any of the folders.
+             */
+            void processCommit(Commit * c, std::vector<std::string const *> const & folders, std::vector<PathDictionary::Range> const & ranges, bool onlyActive, PathDictionary const & paths, std::set<size_t> & changed) {
+                if (onlyActive && folders_.empty())
+                    return;
+                std::string fp;
+                for (unsigned pathId : c->deletions) {
+                    fp.clear();
+                    if (onlyActive) {
+                        for (auto & i : folders_)
+                            if (paths.inRange(pathId, ranges[i.first]) && i.second.processDeletion(path(fp, pathId, paths), *folders[i.first]))
+                                changed.insert(i.first);
+                    } else {
+                        for (size_t i = 0, e = folders.size(); i != e; ++i)
+                            if (paths.inRange(pathId, ranges[i]) && path(fp, pathId, paths).size() != folders[i]->size()) {
+                                folders_[i].processDeletion(fp, *folders[i]);
+                                changed.insert(i);
+                            }
+                    }
+                }
+                for (auto ch : c->changes) {
+                    fp.clear();
+                    if (onlyActive) {
+                        for (auto & i : folders_)
+                            if (paths.inRange(ch.first, ranges[i.first]) && i.second.processChange(path(fp, ch.first, paths), ch.second, *folders[i.first]))
+                                changed.insert(i.first);
+                    } else {
+                        for (size_t i = 0, e = folders.size(); i != e; ++i)
+                            if (paths.inRange(ch.first, ranges[i]) && path(fp, ch.first, paths).size() != folders[i]->size()) {
+                                folders_[i].processChange(fp, ch.second, *folders[i]);
+                                changed.insert(i);
+                            }
+                    }
+                }
+            }
+
+        private:
+
+            /** Returns the path of given id, decoding it only the first time it is needed.
+             */
+            static std::string const & path(std::string & fp, unsigned pathId, PathDictionary const & paths) {
+                if (fp.empty())
+                    fp = paths[pathId];
+                return fp;
+            }
+
+            std::unordered_map<size_t, State> folders_;
+        }; // BatchState
 
         
         
@@ -188,10 +278,7 @@ namespace dejavu {
                         assert(p != nullptr);
                         c->addParent(p);
                     }};
-                std::cerr << "Loading paths ... " << std::endl;
-                PathToIdLoader{[&,this](unsigned id, std::string const & path){
-                        paths_.insert(std::make_pair(id, path));
-                    }};
+                std::cerr << "    " << paths_.numPaths() << " paths in dictionary" << std::endl;
                 std::cerr << "Loading file changes ... " << std::endl;
                 FileChangeLoader{[this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
                         Project * p = projects_[projectId];
@@ -203,40 +290,28 @@ namespace dejavu {
                     }};
                 std::cerr << "Loading folder clone originals ..." << std::endl;
                 FolderCloneOriginalsLoader([this](unsigned cloneId, SHA1Hash const &, unsigned occurences, unsigned files, unsigned projectId, unsigned commitId, std::string const & path, bool isOriginalClone){
-                        originals_.insert(std::make_pair(cloneId, new Original(cloneId, projectId, commitId, path)));
+                        Original * o = new Original(cloneId, projectId, commitId, path);
+                        originals_.insert(std::make_pair(cloneId, o));
+                        projects_[projectId]->originals.push_back(o);
                     });
                 std::cerr << "Loading folder clone occurences ..." << std::endl;
                 FolderCloneOccurencesLoader([this](unsigned cloneId, unsigned projectId, unsigned commitId, std::string const & path, unsigned numFiles) {
-                        originals_[cloneId]->addClone(new Clone(cloneId, projectId, commitId, path));
+                        Original * o = originals_[cloneId];
+                        Clone * c = new Clone(cloneId, projectId, commitId, path, o);
+                        o->addClone(c);
+                        projects_[projectId]->clones.push_back(c);
                     });
             }
 
             void analyzeClones() {
+                std::cerr << "Analyzing originals..." << std::endl;
+                analyzeProjects([this](Project * p) {
+                        analyzeOriginalsIn(p);
+                    });
                 std::cerr << "Analyzing clone behavior..." << std::endl;
-                std::vector<std::thread> threads;
-                auto i = originals_.begin();
-                size_t completed = 0;
-                for (unsigned stride = 0; stride < NumThreads.value(); ++stride)
-                    threads.push_back(std::thread([stride, &i, & completed, this]() {
-                        while (true) {
-                            Original * o ;
-                            {
-                                std::lock_guard<std::mutex> g(mCerr_);
-                                if (i == originals_.end())
-                                    return;
-                                o = i->second;
-                                ++i;
-                                ++completed;
-                                //if (completed % 1000 == 0)
-                                    std::cerr << " : " << completed << "    \r" << std::flush;
-                            }
-                            if (o == nullptr)
-                                continue;
-                            analyzeOriginal(o);
-                        }
-                    }));
-                for (auto & i : threads)
-                    i.join();
+                analyzeProjects([this](Project * p) {
+                        analyzeClonesIn(p);
+                    });
                 std::cerr << "Writing results..." << std::endl;
                 std::ofstream f(DataDir.value() + "/folderCloneOccurencesBehavior.csv");
                 f << "cloneId,projectId,commitId,path,changingCommits,divergentCommits,syncCommits,syncDelay,fullySyncedTime,fullySyncedCommits,youngestChange,youngestDivergentChange,youngestSyncChange" << std::endl;
@@ -259,37 +334,64 @@ namespace dejavu {
 
         private:
 
-            /** Analyzes single original and its clones.
-
-                First we must calculate the state of the folder in the original at various times so that we can later compare this. 
+            /** Runs the given analysis on all projects in parallel.
              */
-            void analyzeOriginal(Original * o) {
-                // calculate a map of different states of the original and the times
-                std::unordered_map<SHA1Hash, uint64_t> originalContents;
-                fillOriginalContents(o, originalContents);
-                std::vector<std::pair<uint64_t, SHA1Hash>> sortedContents;
-                {
-                    std::map<uint64_t, SHA1Hash> sorted;
-                    for (auto i : originalContents)
-                        sorted.insert(std::make_pair(i.second, i.first));
-                    for (auto i : sorted)
-                        sortedContents.push_back(i);
-                }
-                for (Clone * c : o->clones)
-                    analyzeClone(c, originalContents, sortedContents);
+            void analyzeProjects(std::function<void(Project *)> analysis) {
+                std::vector<std::thread> threads;
+                auto i = projects_.begin();
+                size_t completed = 0;
+                for (unsigned stride = 0; stride < NumThreads.value(); ++stride)
+                    threads.push_back(std::thread([stride, &i, & completed, & analysis, this]() {
+                        while (true) {
+                            Project * p ;
+                            {
+                                std::lock_guard<std::mutex> g(mCerr_);
+                                if (i == projects_.end())
+                                    return;
+                                p = i->second;
+                                ++i;
+                                ++completed;
+                                if (completed % 1000 == 0)
+                                    std::cerr << " : " << completed << "    \r" << std::flush;
+                            }
+                            if (p == nullptr)
+                                continue;
+                            analysis(p);
+                        }
+                    }));
+                for (auto & i : threads)
+                    i.join();
             }
 
-            void fillOriginalContents(Original * o,  std::unordered_map<SHA1Hash, uint64_t> & contents) {
-                Project * p = projects_[o->projectId];
-                CommitForwardIterator<Project, Commit, State> i(p, [&, this](Commit * c, State & state){
-                        if (state.processCommit(c, o->path, paths_))
-                            contents.insert(std::make_pair(state.hash(), c->time));
+            /** Calculates the states of all originals in the project and the times at which they were first observed, in a single pass over the project's history.
+             */
+            void analyzeOriginalsIn(Project * p) {
+                if (p->originals.empty())
+                    return;
+                std::vector<std::string const *> folders;
+                std::vector<PathDictionary::Range> ranges;
+                for (Original * o : p->originals) {
+                    folders.push_back(& o->path);
+                    ranges.push_back(paths_.prefixRange(o->path));
+                }
+                CommitForwardIterator<Project, Commit, BatchState> i(p, [&, this](Commit * c, BatchState & state){
+                        std::set<size_t> changed;
+                        state.processCommit(c, folders, ranges, false, paths_, changed);
+                        for (size_t index : changed)
+                            p->originals[index]->contents.insert(std::make_pair(state[index].hash(), c->time));
                         return true;
                     });
                 i.process();
+                for (Original * o : p->originals) {
+                    std::map<uint64_t, SHA1Hash> sorted;
+                    for (auto i : o->contents)
+                        sorted.insert(std::make_pair(i.second, i.first));
+                    for (auto i : sorted)
+                        o->sortedContents.push_back(i);
+                }
             }
 
-            /** Analyzes the clone and calculates the following metrics:
+            /** Analyzes all clones in the project in a single pass over its history and calculates the following metrics for each:
 
                 Time spent 100% synchronized - for each change in clone we check if parent has the same state at the time and if it does we add the time during which they are identical to the overall time.
 
@@ -297,42 +399,76 @@ namespace dejavu {
 
                 Synchronization time - for each non-divergent commit calculate the time it took to propagate the commit from original to clone. 
 
+                Since nothing happens to a clone before its commit, the iteration starts at the commits introducing the clones with empty snapshots instead of replaying the project's entire history.
              */
-            void analyzeClone(Clone * clone, std::unordered_map<SHA1Hash, uint64_t> const & originalContents, std::vector<std::pair<uint64_t, SHA1Hash>> const & sortedContents) {
-                Project * p = projects_[clone->projectId];
-                std::map<uint64_t, SHA1Hash> cloneSorted;
-                CommitForwardIterator<Project, Commit, State> i(p, [&, this](Commit * c, State & state){
-                        if (! state.active() && clone->commitId == c->id)
-                            state.setActive();
-                        if (state.active()) {
-                            if (state.processCommit(c, clone->path, paths_)) {
-                                SHA1Hash hash = state.hash();
-                                cloneSorted.insert(std::make_pair(c->time, hash));
-                                if (clone->commitId != c->id) {
-                                    ++clone->changingCommits;
-                                    if (clone->youngestChange < c->time)
-                                        clone->youngestChange = c->time;
-                                    auto i = originalContents.find(hash);
-                                    if (i == originalContents.end()) {
-                                        ++clone->divergentCommits;
-                                        if (clone->youngestDivergentChange < c->time)
-                                            clone->youngestDivergentChange = c->time;
-                                    } else {
-                                        uint64_t originalTime = i->second;
-                                        if (originalTime <= c->time) {
-                                            ++clone->syncCommits;
-                                            clone->syncDelay += (c->time - originalTime);
-                                            if (clone->youngestSyncChange < c->time)
-                                                clone->youngestSyncChange = c->time;
-                                        }
-                                    }
-                                }
-                            }
+            void analyzeClonesIn(Project * p) {
+                if (p->clones.empty())
+                    return;
+                std::vector<std::string const *> folders;
+                std::vector<PathDictionary::Range> ranges;
+                std::unordered_map<unsigned, std::vector<size_t>> clonesByCommit;
+                for (size_t i = 0, e = p->clones.size(); i != e; ++i) {
+                    folders.push_back(& p->clones[i]->path);
+                    ranges.push_back(paths_.prefixRange(p->clones[i]->path));
+                    clonesByCommit[p->clones[i]->commitId].push_back(i);
+                }
+                std::vector<std::pair<Commit *, BatchState>> initial;
+                for (auto i : clonesByCommit) {
+                    auto c = commits_.find(i.first);
+                    if (c != commits_.end())
+                        initial.push_back(std::make_pair(c->second, BatchState()));
+                }
+                std::vector<std::map<uint64_t, SHA1Hash>> cloneSorted(p->clones.size());
+                CommitForwardIterator<Project, Commit, BatchState> i(p, [&, this](Commit * c, BatchState & state){
+                        auto j = clonesByCommit.find(c->id);
+                        if (j != clonesByCommit.end())
+                            for (size_t index : j->second)
+                                if (! state[index].active())
+                                    state.activate(index);
+                        std::set<size_t> changed;
+                        state.processCommit(c, folders, ranges, true, paths_, changed);
+                        for (size_t index : changed) {
+                            Clone * clone = p->clones[index];
+                            SHA1Hash hash = state[index].hash();
+                            cloneSorted[index].insert(std::make_pair(c->time, hash));
+                            if (clone->commitId != c->id)
+                                updateCloneWith(clone, c, hash);
                         }
                         return true;
-                    });
+                    }, initial);
                 i.process();
-                // now we must calculate the fully synced time
+                for (size_t i = 0, e = p->clones.size(); i != e; ++i)
+                    calculateFullySynced(p->clones[i], cloneSorted[i]);
+            }
+
+            /** Updates the clone metrics with a commit changing the clone to a state with given hash.
+             */
+            void updateCloneWith(Clone * clone, Commit * c, SHA1Hash const & hash) {
+                ++clone->changingCommits;
+                if (clone->youngestChange < c->time)
+                    clone->youngestChange = c->time;
+                auto i = clone->original->contents.find(hash);
+                if (i == clone->original->contents.end()) {
+                    ++clone->divergentCommits;
+                    if (clone->youngestDivergentChange < c->time)
+                        clone->youngestDivergentChange = c->time;
+                } else {
+                    uint64_t originalTime = i->second;
+                    if (originalTime <= c->time) {
+                        ++clone->syncCommits;
+                        clone->syncDelay += (c->time - originalTime);
+                        if (clone->youngestSyncChange < c->time)
+                            clone->youngestSyncChange = c->time;
+                    }
+                }
+            }
+
+            /** Calculates the time the clone spent fully synchronized with its original.
+             */
+            void calculateFullySynced(Clone * clone, std::map<uint64_t, SHA1Hash> const & cloneSorted) {
+                std::vector<std::pair<uint64_t, SHA1Hash>> const & sortedContents = clone->original->sortedContents;
+                if (cloneSorted.empty() || sortedContents.empty())
+                    return;
                 size_t o = 0;
                 uint64_t tmax = std::max(cloneSorted.rbegin()->first, sortedContents.back().first);
                 for (auto c = cloneSorted.begin(), ce = cloneSorted.end(); c != ce;) {
@@ -375,7 +511,7 @@ namespace dejavu {
             
             std::unordered_map<unsigned, Project *> projects_;
             std::unordered_map<unsigned, Commit *> commits_;
-            std::unordered_map<unsigned, std::string> paths_;
+            PathDictionary paths_;
             std::unordered_map<unsigned, Original *> originals_;
 
             std::mutex mCerr_;
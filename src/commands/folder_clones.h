@@ -3,6 +3,7 @@
 #include "../objects.h"
 #include "../loaders.h"
 #include "../commit_iterator.h"
+#include "../path_tree.h"
 
 namespace dejavu {
 
@@ -22,56 +23,6 @@ namespace dejavu {
 
     class Dir;
 
-    class PathSegments {
-    public:
-        unsigned getIndex(std::string name) {
-            auto i = helper_.find(name);
-            if (i == helper_.end()) {
-                unsigned id = pathSegments_.size();
-                pathSegments_.push_back(name);
-                i = helper_.insert(std::make_pair(name, id)).first;
-            }
-            return i->second;
-        }
-
-        void save(std::string const & filename) {
-            std::ofstream psegs(filename);
-            psegs << "segmentId,str" << std::endl;
-            for (size_t i = 0, e = pathSegments_.size(); i < e; ++i)
-                psegs << i << "," << helpers::escapeQuotes(pathSegments_[i]) << std::endl;
-        }
-
-        void load() {
-            PathSegmentsLoader{[this](unsigned id, std::string const & str) {
-                    if (id >= pathSegments_.size())
-                        pathSegments_.resize(id + 1);
-                    pathSegments_[id] = str;
-                    helper_.insert(std::make_pair(str, id));
-                }};
-        }
-
-        void clearHelpers() {
-            helper_.clear();
-        }
-
-        size_t size() const {
-            return pathSegments_.size();
-        }
-
-        std::string const & operator [] (size_t index) const {
-            assert(index < pathSegments_.size());
-            return pathSegments_[index];
-        }
-
-        PathSegments() {
-            pathSegments_.push_back("");
-            helper_.insert(std::make_pair("",EMPTY_PATH));
-        }
-    private:
-        std::vector<std::string> pathSegments_;
-        std::unordered_map<std::string, unsigned> helper_;
-    };
-
     /** Describes a file in either the global tree, or project level tree.
 
         Contains pathId of the path the file represents and its name.
@@ -106,14 +57,14 @@ namespace dejavu {
             return result;
         }
 
-        std::string path(PathSegments const & pathSegments) const {
+        std::string path(PathTree const & tree) const {
             if (parent == nullptr)
                 return "";
-            std::string ppath = parent->path(pathSegments);
+            std::string ppath = parent->path(tree);
             if (ppath.empty())
-                return pathSegments[name];
+                return tree.segment(name);
             else
-                return ppath + "/" + pathSegments[name];
+                return ppath + "/" + tree.segment(name);
         }
 
         bool empty() const {
@@ -121,16 +72,6 @@ namespace dejavu {
         }
 
 
-        File * addPath(unsigned id, std::string const & path, PathSegments & pathSegments) {
-            assert(parent == nullptr && "files can only be added to root dirs");
-            // split the path into the folders
-            std::vector<std::string> p = helpers::Split(path, '/');
-            Dir * d = this;
-            for (size_t i = 0; i + 1 < p.size(); ++i) // for all directories
-                d = d->getOrCreateDirectory(pathSegments.getIndex(p[i]));
-            return new File(id, pathSegments.getIndex(p.back()), d);
-        }
-
         Dir(unsigned name, Dir * parent):
             name(name),
             parent(parent) {
@@ -157,13 +98,6 @@ namespace dejavu {
             files.insert(std::make_pair(name, f));
             return f;
         }
-            
-        Dir * getOrCreateDirectory(unsigned name) {
-            auto i = dirs.find(name);
-            if (i != dirs.end())
-                return i->second;
-            return new Dir(name, this);
-        }
     };
 
     inline File::File(unsigned pathId, unsigned name, Dir * parent):
@@ -369,13 +303,13 @@ namespace dejavu {
             void mergeWith(ProjectState const & other, Commit * c) {
                 for (auto i : other.files_) {
                     if (files_.find(i.first) == files_.end()) {
-                        File * f = addGlobalFile(i.second.file, nullptr);
+                        File * f = copyFile(i.second.file);
                         files_.insert(std::make_pair(i.first, FileInfo(i.second.contents, f)));
                     }
                 }
             }
 
-            void updateWith(Commit * c, std::vector<File*> const & paths, std::unordered_set<Dir*> * cloneCandidates) {
+            void updateWith(Commit * c, PathTree const & tree, std::unordered_set<Dir*> * cloneCandidates) {
                 // first delete all files the commit deletes
                 for (auto i : c->deletions) 
                     deleteFile(i);
@@ -385,11 +319,11 @@ namespace dejavu {
                     if (j != files_.end()) 
                         j->second.contents = i.second;
                     else 
-                        addFile(i.first, i.second, paths, cloneCandidates);
+                        addFile(i.first, i.second, tree, cloneCandidates);
                 }
             }
 
-            void updateWith(Commit * c, std::vector<File*> const & paths, std::unordered_map<unsigned, std::unordered_set<File *>> const & validContents, std::unordered_set<File *> & changes) {
+            void updateWith(Commit * c, PathTree const & tree, std::unordered_map<unsigned, std::unordered_set<File *>> const & validContents, std::unordered_set<File *> & changes) {
                 // first delete all files the commit deletes
                 for (auto i : c->deletions) {
                     if (files_.find(i) == files_.end())
@@ -410,7 +344,7 @@ namespace dejavu {
                         f = j->second.file;
                         j->second.contents = i.second;
                     } else {
-                        f = addFile(i.first, i.second, paths, nullptr);
+                        f = addFile(i.first, i.second, tree, nullptr);
                     }
                     assert(f != nullptr);
                     changes.insert(f);
@@ -425,14 +359,15 @@ namespace dejavu {
 
             /** Returns directory corresponding to the given path.
              */
-            Dir * getDir(std::string const & path, PathSegments & segments) {
+            Dir * getDir(std::string const & path, PathTree const & tree) {
                 if (path.empty())
                     return root_;
-                std::vector<std::string> psegs = helpers::Split(path, '/');
+                unsigned globalDir = tree.findDir(path);
+                assert(globalDir != PathTree::NONE);
+                std::vector<unsigned> names = tree.namesOf(globalDir);
                 Dir * d = root_;
-                for (std::string const & name : psegs) {
-                    unsigned nameId = segments.getIndex(name);
-                    auto i = d->dirs.find(nameId);
+                for (size_t j = 1; j < names.size(); ++j) {
+                    auto i = d->dirs.find(names[j]);
                     assert(i != d->dirs.end());
                     d = i->second;
                 }
@@ -456,7 +391,7 @@ namespace dejavu {
 
             /** Adds given file to the project state.
              */
-            File * addFile(unsigned pathId, unsigned contentsId, std::vector<File *> const & paths, std::unordered_set<Dir*> * createdDirs = nullptr) {
+            File * addFile(unsigned pathId, unsigned contentsId, PathTree const & tree, std::unordered_set<Dir*> * createdDirs = nullptr) {
                 assert(contentsId != FILE_DELETED);
                 auto i = files_.find(pathId);
                 // if the file already exists, just update its contents
@@ -464,8 +399,7 @@ namespace dejavu {
                     i->second.contents = contentsId;
                     return i->second.file;
                 } else {
-                    File * globalFile = paths[pathId];
-                    File *f  = addGlobalFile(globalFile, createdDirs);
+                    File *f  = addGlobalFile(tree, tree.fileOf(pathId), createdDirs);
                     files_.insert(std::make_pair(pathId, FileInfo(contentsId, f)));
                     return f;
                 }
@@ -474,34 +408,47 @@ namespace dejavu {
 
             /** Given a file from the global tree, creates its copy in the project state.
 
-                First makes recursively sure that all parent directories exist (adding newly created ones to the createdDirs vector if not null) and then adds the file to its parent directory and to the map of all files by path. 
+                First makes sure that all parent directories exist (adding newly created ones to the createdDirs vector if not null) and then adds the file to its parent directory and to the map of all files by path. 
              */
-            File * addGlobalFile(File * globalFile, std::unordered_set<Dir*> * createdDirs) {
-                Dir * parent = addGlobalDir(globalFile->parent, createdDirs);
-                return new File(globalFile->pathId, globalFile->name, parent);
+            File * addGlobalFile(PathTree const & tree, unsigned globalFile, std::unordered_set<Dir*> * createdDirs) {
+                assert(globalFile != PathTree::NONE);
+                PathTree::FileRecord const & f = tree.file(globalFile);
+                Dir * parent = addDirs(tree.namesOf(f.parent), createdDirs);
+                return new File(f.pathId, f.name, parent);
             }
 
-            /** Makes sure that given global dir exists in the project state, creating it, or any of its parent dirs along the way.
+            /** Given a file from other project state, creates its copy in the project state.
+             */
+            File * copyFile(File * other) {
+                std::vector<unsigned> names;
+                for (Dir * d = other->parent; d != nullptr; d = d->parent)
+                    names.push_back(d->name);
+                std::reverse(names.begin(), names.end());
+                return new File(other->pathId, other->name, addDirs(names, nullptr));
+            }
+
+            /** Makes sure that the directory with given names of directories from the root exists in the project state, creating it, or any of its parent dirs along the way.
 
                 If the createdDirs argument is specified, any newly created directories will be added to it.
             */
-            Dir * addGlobalDir(Dir * globalDir, std::unordered_set<Dir*> * & createdDirs) {
-                // if the global directory is root, return our root, or create it if it does not exist
-                if (globalDir->parent == nullptr) {
-                    if (root_ == nullptr)
-                        root_ = createDirectory(globalDir->name, nullptr, createdDirs);
-                    else
-                        preventSubfolderCreation(root_, createdDirs);
-                    return root_;
-                    
-                }
-                Dir * parent = addGlobalDir(globalDir->parent, createdDirs);
-                auto i = parent->dirs.find(globalDir->name);
-                if (i != parent->dirs.end()) {
-                    preventSubfolderCreation(i->second, createdDirs);
-                    return i->second;
+            Dir * addDirs(std::vector<unsigned> const & names, std::unordered_set<Dir*> * createdDirs) {
+                assert(! names.empty());
+                // return our root, or create it if it does not exist
+                if (root_ == nullptr)
+                    root_ = createDirectory(names[0], nullptr, createdDirs);
+                else
+                    preventSubfolderCreation(root_, createdDirs);
+                Dir * d = root_;
+                for (size_t j = 1; j < names.size(); ++j) {
+                    auto i = d->dirs.find(names[j]);
+                    if (i != d->dirs.end()) {
+                        preventSubfolderCreation(i->second, createdDirs);
+                        d = i->second;
+                    } else {
+                        d = createDirectory(names[j], d, createdDirs);
+                    }
                 }
-                return createDirectory(globalDir->name, parent, createdDirs);
+                return d;
             }
 
             void preventSubfolderCreation(Dir * d, std::unordered_set<Dir *> * & createdDirs) {
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <unordered_map>
@@ -6,6 +7,7 @@
 #include <atomic>
 #include <mutex>
 #include <thread>
+#include <memory>
 #include <unistd.h>
 #include <openssl/sha.h>
 
@@ -13,6 +15,7 @@
 #include "../loaders.h"
 #include "../commands.h"
 #include "../commit_iterator.h"
+#include "../project_stream.h"
 /*
 
   Writing project aggregates...
@@ -43,6 +46,8 @@ namespace dejavu {
         class Project : public BaseProject<Project, Commit> {
         public:
 
+            unsigned numCommits = 0;
+
             unsigned uniqueFiles = 0;
             unsigned originalFiles = 0;
             unsigned cloneFiles = 0;
@@ -56,39 +61,66 @@ namespace dejavu {
             }
         };
 
+        /** The original occurence of a contents.
+
+            Keeps the id and time of the commit rather than the commit itself so that the commits do not have to outlive their projects when streaming.
+         */
         class FileOriginal {
         public:
             unsigned id;
             Project * project;
-            Commit * commit;
+            unsigned commitId;
+            uint64_t commitTime;
             unsigned fileId;
             unsigned numOccurences;
 
-            FileOriginal(unsigned id, Project * project, Commit * commit, unsigned fileId):
+            /** Placeholder for contents which has not been seen yet.
+             */
+            FileOriginal():
+                id(0),
+                project(nullptr),
+                commitId(0),
+                commitTime(0),
+                fileId(0),
+                numOccurences(0) {
+            }
+
+            FileOriginal(unsigned id, Project * project, unsigned commitId, uint64_t commitTime, unsigned fileId):
                 id(id),
                 project(project),
-                commit(commit),
+                commitId(commitId),
+                commitTime(commitTime),
                 fileId(fileId),
                 numOccurences(1) {
             }
 
-            void update(Project * project, Commit * commit, unsigned fileId) {
+            void update(Project * project, unsigned commitId, uint64_t commitTime, unsigned fileId) {
                 ++this->numOccurences;
                 // if the new commit is newer, nothing to do
-                if (commit->time > this->commit->time)
+                if (commitTime > this->commitTime)
                     return;
-                if (commit->time == this->commit->time) {
+                if (commitTime == this->commitTime) {
                     // if the commit is same age, but the project is newer or same, nothing to do
                     if (project->createdAt >= this->project->createdAt)
                         return;
                 }
                 this->project = project;
-                this->commit = commit;
+                this->commitId = commitId;
+                this->commitTime = commitTime;
                 this->fileId = fileId;
             }
         };
 
 
+        /** Compact original of a non-unique contents, used when streaming.
+         */
+        struct CompactOriginal {
+            unsigned contentsId;
+            unsigned projectId;
+            unsigned commitId;
+            unsigned fileId;
+        };
+
         enum class FileState {
             Unique,
             Original,
@@ -232,12 +264,23 @@ namespace dejavu {
 
         class PathsCounter {
         public:
+
+            /** Smallest range of contents ids whose originals are determined in a single pass when streaming.
+             */
+            static size_t MinOriginalsRange() {
+                return 1024 * 1024;
+            }
+
             void loadData() {
                 std::cerr << "Loading projects ... " << std::endl;
                 ProjectLoader{[this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
                         createdAt -= createdAt % Threshold.value();
                         projects_.insert(std::make_pair(id, new Project(id, createdAt)));
                     }};
+                if (MemoryBudget.value() != 0) {
+                    loadStream();
+                    return;
+                }
                 std::cerr << "Loading commits ... " << std::endl;
                 CommitLoader{[this](unsigned id, uint64_t authorTime, uint64_t committerTime){
                         authorTime -= authorTime % Threshold.value();
@@ -265,11 +308,7 @@ namespace dejavu {
                             ++numDeletions;
                         } else {
                             ++numChanges;
-                            auto i = originals_.find(contentsId);
-                            if (i != originals_.end())
-                                i->second->update(p, c, pathId);
-                            else
-                                originals_.insert(std::make_pair(contentsId, new FileOriginal(contentsId, p, c, pathId)));
+                            updateOriginal(contentsId, p, c->id, c->time, pathId);
                         }
                     }};
                 std::cerr << "    " << numDeletions << " deletions" << std::endl;
@@ -278,10 +317,77 @@ namespace dejavu {
                 
             }
 
+            /** Prepares the project stream, which will load the projects one by one later, and determines the originals from the sorted file changes.
+
+                Only the originals of non-unique contents are needed by the analysis. They are kept sorted by contents id in a compact form for the whole run and their size is reserved from the memory budget of the stream. Finding them requires the occurences of all contents, unique ones included, so the contents ids are partitioned into ranges which fit in what is left of the budget and the sorted file changes are read once for each range. The budget is thus only exceeded if the compact originals alone do not fit in it.
+             */
+            void loadStream() {
+                size_t budget = static_cast<size_t>(MemoryBudget.value()) * 1024 * 1024;
+                stream_.reset(new ProjectStream<Project, Commit>(budget));
+                stream_->setCommitFactory([](unsigned id, uint64_t time) {
+                        return new Commit(id, time - time % Threshold.value());
+                    });
+                std::cerr << "Determining originals from sorted file changes ... " << std::endl;
+                size_t numChanges = 0;
+                size_t numDeletions = 0;
+                size_t numContents = 0;
+                unsigned maxContentsId = 0;
+                unsigned passes = 0;
+                std::vector<FileOriginal> range;
+                uint64_t first = 0;
+                do {
+                    size_t used = compactOriginals_.size() * sizeof(CompactOriginal);
+                    size_t rangeSize = std::max<size_t>(budget > used ? (budget - used) / sizeof(FileOriginal) : 0, MinOriginalsRange());
+                    uint64_t last = first + rangeSize;
+                    range.assign(rangeSize, FileOriginal());
+                    stream_->forEachChange([&, this](SortedFileChanges::Record const & r) {
+                            if (passes == 0) {
+                                if (r.contentsId == FILE_DELETED)
+                                    ++numDeletions;
+                                else
+                                    ++numChanges;
+                                maxContentsId = std::max(maxContentsId, r.contentsId);
+                            }
+                            if (r.contentsId == FILE_DELETED || r.contentsId < first || r.contentsId >= last)
+                                return;
+                            Project * p = projects_[r.projectId];
+                            assert(p != nullptr);
+                            uint64_t time = stream_->commitTime(r.commitId);
+                            time -= time % Threshold.value();
+                            FileOriginal & o = range[r.contentsId - first];
+                            if (o.numOccurences == 0)
+                                o = FileOriginal(r.contentsId, p, r.commitId, time, r.pathId);
+                            else
+                                o.update(p, r.commitId, time, r.pathId);
+                        });
+                    for (FileOriginal const & o : range) {
+                        if (o.numOccurences == 0)
+                            continue;
+                        ++numContents;
+                        if (o.numOccurences > 1)
+                            compactOriginals_.push_back(CompactOriginal{o.id, o.project->id, o.commitId, o.fileId});
+                    }
+                    ++passes;
+                    first = last;
+                } while (first <= maxContentsId);
+                std::vector<FileOriginal>().swap(range);
+                std::cerr << "    " << numDeletions << " deletions" << std::endl;
+                std::cerr << "    " << numChanges << " changes" << std::endl;
+                std::cerr << "    " << numContents << " contents hashes (" << passes << " passes)" << std::endl;
+                size_t reserved = compactOriginals_.size() * sizeof(CompactOriginal);
+                if (! stream_->reserveMemory(reserved))
+                    std::cerr << "    WARNING: originals alone take " << reserved << " bytes, which exceeds the memory budget, projects will be analyzed one at a time" << std::endl;
+            }
+
             /** This removes the unique files from the list so that we don't bother with these.
              */
             void removeUniqueFiles() {
                 std::cerr << "Removing unique files..." << std::endl;
+                // when streaming, only the non-unique originals have been kept
+                if (stream_) {
+                    std::cerr << "    " << compactOriginals_.size() << " non-unique content hashes (originals)" << std::endl;
+                    return;
+                }
                 for (auto i = originals_.begin(); i != originals_.end();) {
                     if (i->second->numOccurences == 1)
                         i = originals_.erase(i);
@@ -293,6 +399,15 @@ namespace dejavu {
 
             void calculatePathsHistory() {
                 std::cerr << "Analyzing clone behavior..." << std::endl;
+                if (stream_) {
+                    stream_->process([this](unsigned id) {
+                            auto i = projects_.find(id);
+                            return i == projects_.end() ? nullptr : i->second;
+                        }, [this](Project * p) {
+                            analyzeProject(p);
+                        }, NumThreads.value());
+                    return;
+                }
                 std::vector<std::thread> threads;
                 auto i = projects_.begin();
                 size_t completed = 0;
@@ -331,7 +446,7 @@ namespace dejavu {
                 size_t finalCloneFiles = 0;
                 for (auto i : projects_) {
                     Project * p = i.second;
-                    f << p->id << "," << p->commits.size() << "," << p->uniqueFiles << "," << p->originalFiles << "," << p->cloneFiles << ","
+                    f << p->id << "," << p->numCommits << "," << p->uniqueFiles << "," << p->originalFiles << "," << p->cloneFiles << ","
                         << p->finalUniqueFiles << "," << p->finalOriginalFiles << "," << p->finalCloneFiles << std::endl;
                     uniqueFiles += p->uniqueFiles;
                     originalFiles += p->originalFiles;
@@ -364,6 +479,7 @@ namespace dejavu {
         private:
 
             void analyzeProject(Project * p) {
+                p->numCommits = p->commits.size();
                 // time -> (fileId -> status)
                 std::map<uint64_t, std::unordered_map<unsigned, FileState>> files;
                 // fileId -> stats about commits & deletions over time
@@ -406,11 +522,14 @@ namespace dejavu {
                 it.process();
                 // update the global diff state
                 Stats last;
-                for (auto i : files) {
-                    uint64_t time = i.first;
-                    Stats current(i.second);
-                    diffStats_[time] += current.diff(last);
-                    last = current;
+                {
+                    std::lock_guard<std::mutex> g(mDiffStats_);
+                    for (auto i : files) {
+                        uint64_t time = i.first;
+                        Stats current(i.second);
+                        diffStats_[time] += current.diff(last);
+                        last = current;
+                    }
                 }
                 // and update the project state & final state
                 for (auto i : allFiles) {
@@ -445,20 +564,43 @@ namespace dejavu {
 
 
             FileState getFileState(Project * p, Commit * c, unsigned pathId, unsigned contentsId) {
+                if (stream_) {
+                    auto i = std::lower_bound(compactOriginals_.begin(), compactOriginals_.end(), contentsId, [](CompactOriginal const & o, unsigned id) {
+                            return o.contentsId < id;
+                        });
+                    if (i == compactOriginals_.end() || i->contentsId != contentsId)
+                        return FileState::Unique;
+                    if (i->projectId == p->id && i->commitId == c->id && i->fileId == pathId)
+                        return FileState::Original;
+                    return FileState::Clone;
+                }
                 auto i = originals_.find(contentsId);
                 if (i == originals_.end())
                     return FileState::Unique;
-                if (i->second->project == p && i->second->commit == c && i->second->fileId == pathId)
+                if (i->second->project == p && i->second->commitId == c->id && i->second->fileId == pathId)
                     return FileState::Original;
                 return FileState::Clone;
             }
 
+            void updateOriginal(unsigned contentsId, Project * p, unsigned commitId, uint64_t commitTime, unsigned pathId) {
+                auto i = originals_.find(contentsId);
+                if (i != originals_.end())
+                    i->second->update(p, commitId, commitTime, pathId);
+                else
+                    originals_.insert(std::make_pair(contentsId, new FileOriginal(contentsId, p, commitId, commitTime, pathId)));
+            }
+
 
             std::mutex mCerr_;
             std::unordered_map<unsigned, Project *> projects_;
             std::unordered_map<unsigned, Commit *> commits_;
             std::unordered_map<unsigned, FileOriginal *> originals_;
+            // non-unique originals sorted by contents id, when streaming
+            std::vector<CompactOriginal> compactOriginals_;
             std::map<uint64_t, Stats> diffStats_;
+            std::mutex mDiffStats_;
+
+            std::unique_ptr<ProjectStream<Project, Commit>> stream_;
             
         }; // PathsCounter
     }
@@ -468,6 +610,8 @@ namespace dejavu {
         Settings.addOption(DataDir);
         Settings.addOption(NumThreads);
         Settings.addOption(Threshold);
+        Settings.addOption(MemoryBudget);
+        Settings.addOption(TempDir);
         Settings.parse(argc, argv);
         Settings.check();
 
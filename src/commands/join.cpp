@@ -1,9 +1,11 @@
 #include <unordered_map>
 #include <unordered_set>
 #include <algorithm>
+#include <limits>
 #include <string>
 #include <set>
 
+#include "helpers/fixed_key_map.h"
 #include "helpers/strings.h"
 
 #include "../commands.h"
@@ -29,6 +31,7 @@
     - submodules are removed from the dataset
     - only changes to Javascript and package.json files are kept
     - empty commits (after the above data is discarded) are removed
+    - commit parents which are also ancestors of other parents of the same commit are removed
 
     The following files are created in the data dir:
 
@@ -64,18 +67,28 @@ namespace dejavu {
                 }
             };
             
+            /** Contents hash github uses for deleted files (all zeros).
+             */
+            static SHA1Hash const DELETED;
+
             unsigned id;
             
             /** Hash of the commit. */
-            std::string hash;
+            SHA1Hash hash;
 
             /** Ids of the parent commits. */
             std::unordered_set<Commit *> parents;
             std::unordered_set<Commit *> children;
 
-            /** Changes made to files by the commit (path -> hash)
+            /** Index of the commit in topological order, valid during compaction of the commit hierarchy (see Project::compactCommitHierarchy).
+             */
+            unsigned order;
+
+            /** Changes made to files by the commit (project path id -> contents hash)
+
+                Paths are interned by the project (see Project::internPath) as soon as they are read.
              */
-            std::unordered_map<std::string, std::string> changes;
+            std::unordered_map<unsigned, SHA1Hash> changes;
 
             /** Cummulative changes in the commit per filename extension.
 
@@ -93,7 +106,7 @@ namespace dejavu {
             uint64_t committerTime;
             std::unordered_set<std::string> tags;
 
-            Commit(std::string const & hash, std::string const & authorEmail, uint64_t authorTime, std::string const & committerEmail, uint64_t committerTime, std::string const & tag);
+            Commit(SHA1Hash const & hash, std::string const & authorEmail, uint64_t authorTime, std::string const & committerEmail, uint64_t committerTime, std::string const & tag);
 
 
             // Commit iterator interface
@@ -112,20 +125,22 @@ namespace dejavu {
                 - the first change is a delete, the current change is update. This can happen if a commit renames two files A -> B and C -> A. We might first see the delete of A and create of B an then delete of C and create of A
                 - the first change is valid, the second change is delete (the reverse of the above - there is no order for changes in single commit)
                 - multiple updates to the same file as long as all updates change the path to the same contents id (merge commits report diffs to all their parents)
+
+                Returns false if the path has already been changed to different contents.
              */
-            void addChange(std::string const & pathId, std::string const & contentsId) {
+            bool addChange(unsigned pathId, SHA1Hash const & contents) {
                 auto i = changes.find(pathId);
                 if (i == changes.end()) {
-                    changes.insert(std::make_pair(pathId, contentsId));
+                    changes.insert(std::make_pair(pathId, contents));
                 } else {
-                    if (i->second == "0000000000000000000000000000000000000000") {
-                        i->second = contentsId;
+                    if (i->second == DELETED) {
+                        i->second = contents;
                     } else {
-                        if (contentsId != "0000000000000000000000000000000000000000")
-                            if (contentsId != i->second) 
-                                std::cerr << "ERROR: Commit " << hash << ", path: " << pathId << " set to " << contentsId << ", after " << i->second << std::endl;
+                        if (contents != DELETED && contents != i->second)
+                            return false;
                     }
                 }
+                return true;
             }
 
             /** Detaches the commit from the hierarchy of commits.
@@ -147,28 +162,6 @@ namespace dejavu {
                 }
             }
 
-            /** Removes unnecessary edges to children.
-
-                Child edge is unnecessary if all other children of the commit eventually have the child as their children as well. 
-             */
-            unsigned compactChildEdges() {
-                if (children.size() < 2)
-                    return 0;
-                std::vector<Commit *> toBeRemoved;
-                for (Commit * c : children) {
-                    if (c->parents.size() < 2)
-                        continue;
-                    std::unordered_set<Commit *> visited;
-                    if (isDominatedBy(c, visited))
-                        toBeRemoved.push_back(c);
-                }
-                for (Commit * r : toBeRemoved) {
-                    children.erase(r);
-                    r->parents.erase(this);
-                }
-                return toBeRemoved.size();
-            }
-
             bool isMasterHead(std::string const & expectedTag) {
                 if (tags.empty()) return 0;
                 for (std::string const & tag : tags) {
@@ -177,20 +170,6 @@ namespace dejavu {
                 }
                 return false;
             }
-
-        private:
-
-            bool isDominatedBy(Commit * child, std::unordered_set<Commit *> & visited) {
-                if (this == child)
-                    return true;
-                if (visited.find(this) != visited.end())
-                    return true;
-                for (Commit * c : children)
-                    if (! c->isDominatedBy(child, visited))
-                        return false;
-                visited.insert(this);
-                return true;
-            }
         };
 
 
@@ -222,26 +201,44 @@ namespace dejavu {
              */
             void updateWith(Commit * c, std::string const & path, Project * p);
 
-            /** Path ids of submodule files.
+            /** Project path ids of submodule files.
              */
-            std::unordered_set<std::string> submodules;
-            std::unordered_map<std::string, std::string> submoduleUrls;
+            std::unordered_set<unsigned> submodules;
+            std::unordered_map<unsigned, std::string> submoduleUrls;
             /** It may happen that a submodule is deleted from gitmodules, but the actual file stays in the repo. In this case the path is moved to this set and any delete of a path from this set is ignored.
 
                 Both change and delete of a path in this list removes the path from the list.
              */
-            std::unordered_set<std::string> submodulesPendingDelete;
+            std::unordered_set<unsigned> submodulesPendingDelete;
         };
 
         class SubmoduleChange {
         public:
-            std::string commitHash;
-            std::string path;
+            SHA1Hash commitHash;
+            unsigned path;
             std::string url;
-            std::string contentsHash;
+            SHA1Hash contentsHash;
             
         };
 
+        /** Path changed by commits of a project.
+         */
+        class PathInfo {
+        public:
+            static constexpr unsigned NONE = 0xffffffff;
+
+            std::string path;
+            /** Extension of the file used by the cummulative commit changes, i.e. the filename from its last dot, or the whole filename.
+             */
+            std::string extension;
+            /** Whether changes to the path are kept (see ProjectAnalyzer::IsValidPath).
+             */
+            bool valid;
+            /** Global id of the path, NONE until the path is written.
+             */
+            unsigned id;
+        };
+
 
         class Project {
         public:
@@ -258,7 +255,16 @@ namespace dejavu {
 
             std::vector<SubmoduleChange> submoduleChanges;
 
-            std::unordered_map<std::string, Commit *> commits;
+            std::unordered_map<SHA1Hash, Commit *> commits;
+
+            /** Paths changed by the commits, indexed by project path ids.
+             */
+            std::vector<PathInfo> paths;
+            std::unordered_map<std::string, unsigned> pathIds;
+
+            /** Project path id of the .gitmodules file.
+             */
+            unsigned gitmodules;
 
             // TODO this should be converted to project objects
             
@@ -283,6 +289,7 @@ namespace dejavu {
                 repo(repo),
                 createdAt(-1),
                 containsSubmodules_(false) {
+                gitmodules = internPath(".gitmodules");
             }
 
             ~Project() {
@@ -299,10 +306,24 @@ namespace dejavu {
                     return STR(where << "/" << user << "/" << mn);
             }
 
+            /** Returns the project path id of given path, creating it if the path has not been seen by the project yet.
+             */
+            unsigned internPath(std::string const & path);
+
+            /** Returns the global id of given project path, creating it if necessary.
+             */
+            unsigned globalPathId(unsigned pathId);
+
             /** Loads commits metadata for the given project.
              */
             void loadCommits(std::string const & path);
 
+            /** Raises an error if the commit parents contain a cycle.
+
+                Must be called before anything about the project is written. Removing commits later on (see filterMasterBranch and removeEmptyCommits) does not create cycles.
+             */
+            void checkAcyclic();
+
             Commit * getMasterHead(std::string const & expectedTag);
 
             /** Keeps only commits on the master branch.
@@ -321,9 +342,19 @@ namespace dejavu {
              */
             void removeEmptyCommits();
 
+            /** Removes commit parent edges implied by other edges, i.e. computes the transitive reduction of the commit hierarchy.
+
+                Removing empty commits connects their children to all their parents, which creates many such edges. Since a child is visited after all its ancestors, forward iteration over the commits is not affected.
+             */
             void compactCommitHierarchy();
 
             void write();
+
+        private:
+
+            /** Returns the commits in topological order (parents first). Commits on a cycle and their descendants are missing from the result.
+             */
+            std::vector<Commit *> topologicalOrder();
         };
 
         /** Analyzes and compacts a single project.
@@ -345,14 +376,16 @@ namespace dejavu {
                 std::cerr << "Loading translated hashes..." << std::endl;
                 std::string hashes = DataDir.value() + "/hashes.csv";
                 if (helpers::FileExists(hashes)) {
-                    HashToIdLoader{hashes, hashToId_};
+                    HashToIdLoader{hashes, [](unsigned id, std::string const & hash) {
+                            hashToId_.insert(std::make_pair(SHA1Hash::FromHexString(hash), id));
+                        }};
                     hashes_.open(hashes, std::ios_base::app);
                 } else {
                     hashes_.open(hashes);
                     hashes_ << "hashId,hash" << std::endl;
-                    GetOrCreateHashId("0000000000000000000000000000000000000000");
+                    GetOrCreateHashId(Commit::DELETED);
                 }
-                assert(GetOrCreateHashId("0000000000000000000000000000000000000000") == FILE_DELETED);
+                assert(GetOrCreateHashId(Commit::DELETED) == FILE_DELETED);
                 // load the previously seen paths
                 std::cerr << "Loading translated paths..." << std::endl;
                 std::string paths = DataDir.value() + "/paths.csv";
@@ -488,12 +521,13 @@ namespace dejavu {
                         try {
                             p->loadCommits(path);
                             if (!p->commits.empty()) {
+                                p->checkAcyclic();
                                 p->filterMasterBranch();
                                 p->ignoreSubmodulesAndNonJSFiles(path);
                                 p->assignCommitIds();
                                 p->writeCummulativeInfo();
                                 p->removeEmptyCommits();
-                                //p->compactCommitHierarchy();
+                                p->compactCommitHierarchy();
                                 p->write();
                                 ++validProjects;
                             } else {
@@ -536,7 +570,7 @@ namespace dejavu {
             friend class Project;
             friend class SubmoduleInfo;
 
-            static unsigned GetHashId(std::string const & hash) {
+            static unsigned GetHashId(SHA1Hash const & hash) {
                 auto i = hashToId_.find(hash);
                 if (i == hashToId_.end())
                     return UNKNOWN_HASH;
@@ -544,14 +578,12 @@ namespace dejavu {
                     return i->second;
             }
 
-            static unsigned GetOrCreateHashId(std::string const & hash) {
-                auto i = hashToId_.find(hash);
-                if (i == hashToId_.end()) {
-                    i = hashToId_.insert(std::make_pair(hash, hashToId_.size())).first;
-                    // write the hash
-                    hashes_ << i->second << "," << hash << std::endl;
-                }
-                return i->second;
+            static unsigned GetOrCreateHashId(SHA1Hash const & hash) {
+                auto i = hashToId_.insert(std::make_pair(hash, hashToId_.size()));
+                // write the hash
+                if (i.second)
+                    hashes_ << i.first->second << "," << hash << std::endl;
+                return i.first->second;
             }
 
             static unsigned GetOrCreatePathId(std::string const & path) {
@@ -577,8 +609,10 @@ namespace dejavu {
 
 
             /** Global map from SHA1 hashes used by github to ids used internally. When object's hash is in this map, the object does not have to be processed. 
+
+                Holds every commit and contents hash of the dataset, so the hashes are stored in binary in a flat table.
              */
-            static std::unordered_map<std::string, unsigned> hashToId_;
+            static helpers::FixedKeyMap<SHA1Hash, unsigned> hashToId_;
             static std::ofstream hashes_;
             
             /** Global map of paths so that we can convert them to ids in the output data.
@@ -605,7 +639,7 @@ namespace dejavu {
 
 
         
-        std::unordered_map<std::string, unsigned> ProjectAnalyzer::hashToId_;
+        helpers::FixedKeyMap<SHA1Hash, unsigned> ProjectAnalyzer::hashToId_;
         std::ofstream ProjectAnalyzer::hashes_;
         std::unordered_map<std::string, unsigned> ProjectAnalyzer::pathToId_;
         std::ofstream ProjectAnalyzer::paths_;
@@ -614,10 +648,13 @@ namespace dejavu {
         std::unordered_set<std::string> ProjectAnalyzer::completedProjects_;
         std::unordered_set<unsigned> ProjectAnalyzer::seenCommits_;
         std::ofstream ProjectAnalyzer::reports_;
+
+        SHA1Hash const Commit::DELETED = SHA1Hash();
         
-        Commit::Commit(std::string const & hash, std::string const & authorEmail, uint64_t authorTime, std::string const & committerEmail, uint64_t committerTime, std::string const & tag):
+        Commit::Commit(SHA1Hash const & hash, std::string const & authorEmail, uint64_t authorTime, std::string const & committerEmail, uint64_t committerTime, std::string const & tag):
             id(0),
             hash(hash),
+            order(0),
             authorEmail(authorEmail),
             authorTime(authorTime),
             committerEmail(committerEmail),
@@ -626,10 +663,31 @@ namespace dejavu {
                 tags.insert(tag);
         }
 
+        unsigned Project::internPath(std::string const & path) {
+            auto i = pathIds.find(path);
+            if (i != pathIds.end())
+                return i->second;
+            pathIds.insert(std::make_pair(path, paths.size()));
+            std::string ext = path.substr(path.find_last_of("/") + 1);
+            size_t e = ext.find_last_of(".");
+            if (e != std::string::npos)
+                ext = ext.substr(e);
+            paths.push_back(PathInfo{path, ext, ProjectAnalyzer::IsValidPath(path), PathInfo::NONE});
+            return paths.size() - 1;
+        }
+
+        unsigned Project::globalPathId(unsigned pathId) {
+            PathInfo & p = paths[pathId];
+            if (p.id == PathInfo::NONE)
+                p.id = ProjectAnalyzer::GetOrCreatePathId(p.path);
+            return p.id;
+        }
+
         inline void Project::loadCommits(std::string const & path) {
             //std::cerr << "    commits ... " << std::endl;
             std::string filename = getPath(path + "/commit_metadata") + ".csv";
-            DownloaderCommitMetadataLoader{filename, [this](std::string const & hash, std::string const & authorEmail, uint64_t authorTime, std::string const & committerEmail, uint64_t committerTime, std::string const & tag) {
+            DownloaderCommitMetadataLoader{filename, [this](std::string const & commitHash, std::string const & authorEmail, uint64_t authorTime, std::string const & committerEmail, uint64_t committerTime, std::string const & tag) {
+                    SHA1Hash hash = SHA1Hash::FromHexString(commitHash);
                     Commit * c = new Commit(hash, authorEmail, authorTime, committerEmail, committerTime, tag);
                     commits.insert(std::make_pair(hash, c));
                     commits_.insert(c);
@@ -642,10 +700,12 @@ namespace dejavu {
             //std::cerr << "    commit parents ... ";
             filename = getPath(path + "/commit_parents") + ".csv";
             DownloaderCommitParentsLoader{filename, [this](std::string const & commitHash, std::string const & parentHash){
-                    assert(commits.find(commitHash) != commits.end());
-                    Commit * c = commits[commitHash];
-                    assert(commits.find(parentHash) != commits.end());
-                    Commit * p = commits[parentHash];
+                    SHA1Hash hash = SHA1Hash::FromHexString(commitHash);
+                    assert(commits.find(hash) != commits.end());
+                    Commit * c = commits[hash];
+                    hash = SHA1Hash::FromHexString(parentHash);
+                    assert(commits.find(hash) != commits.end());
+                    Commit * p = commits[hash];
                     c->parents.insert(p);
                     p->children.insert(c);
                 }};
@@ -663,21 +723,22 @@ namespace dejavu {
             unsigned validChanges = 0;
             filename = getPath(path + "/commit_file_hashes") + ".csv";
             DownloaderCommitChangesLoader{filename, [& validChanges, this](std::string const & commitHash, std::string const & fileHash, char changeType, std::string const & path, std::string const & path2) {
-                    assert(commits.find(commitHash) != commits.end());
-                    Commit * c = commits[commitHash];
+                    SHA1Hash hash = SHA1Hash::FromHexString(commitHash);
+                    assert(commits.find(hash) != commits.end());
+                    Commit * c = commits[hash];
                     if (changeType == 'R' || changeType == 'C') {
                         assert(&path2 != & DownloaderCommitChangesLoader::NOT_A_RENAME);
                         //if (ProjectAnalyzer::IsValidPath(path2)) { // if source is valid path, emit delete of the source
-                        //unsigned pathId = ProjectAnalyzer::GetOrCreatePathId(path2);
-                        c->addChange(path2, "0000000000000000000000000000000000000000");
+                        c->addChange(internPath(path2), Commit::DELETED);
                             //}
                     } else {
                         assert(&path2 == & DownloaderCommitChangesLoader::NOT_A_RENAME);
                     }
                     //if (ProjectAnalyzer::IsValidPath(path)) {
-                    //unsigned pathId = ProjectAnalyzer::GetOrCreatePathId(path);
-                    //unsigned contentsId = ProjectAnalyzer::GetOrCreateHashId(fileHash);
-                    c->addChange(path, fileHash);
+                    unsigned pathId = internPath(path);
+                    SHA1Hash contents = SHA1Hash::FromHexString(fileHash);
+                    if (! c->addChange(pathId, contents))
+                        std::cerr << "ERROR: Commit " << c->hash << ", path: " << path << " set to " << contents << ", after " << c->changes[pathId] << std::endl;
                     ++validChanges;
                         //}
                 }};
@@ -740,7 +801,7 @@ namespace dejavu {
                 // check if the commit changes any submodule information, if it does the commits contains submodules and we must deal with them
                 if (containsSubmodules_ == false)
                     for (auto i : c->changes) {
-                        if (i.first == ".gitmodules") {
+                        if (i.first == gitmodules) {
                             containsSubmodules_ = true;
                             break;
                         }
@@ -764,7 +825,7 @@ namespace dejavu {
 
         void Project::removeEmptyCommits() {
             //std::cerr << "    removing empty commits ... ";
-            std::vector<std::string> toBeDeleted;
+            std::vector<SHA1Hash> toBeDeleted;
             for (auto i : commits) {
                 Commit * c = i.second;
                 if (c->changes.empty()) {
@@ -774,12 +835,97 @@ namespace dejavu {
                 }
             }
             //std::cerr << toBeDeleted.size() << " empty commits found, ";
-            for (std::string const & c : toBeDeleted) {
+            for (SHA1Hash const & c : toBeDeleted) {
                 commits.erase(c);
             }
             //std::cerr << commits.size() << " commits left" << std::endl;
         }
 
+        std::vector<Commit *> Project::topologicalOrder() {
+            std::unordered_map<Commit *, unsigned> pending;
+            std::vector<Commit *> q;
+            for (auto i : commits) {
+                Commit * c = i.second;
+                if (c->parents.empty())
+                    q.push_back(c);
+                else
+                    pending[c] = c->parents.size();
+            }
+            std::vector<Commit *> result;
+            while (! q.empty()) {
+                Commit * c = q.back();
+                q.pop_back();
+                result.push_back(c);
+                for (Commit * child : c->children)
+                    if (--pending[child] == 0)
+                        q.push_back(child);
+            }
+            return result;
+        }
+
+        void Project::checkAcyclic() {
+            size_t ordered = topologicalOrder().size();
+            if (ordered != commits.size())
+                ERROR("Cycle in commit parents, " << (commits.size() - ordered) << " commits not reachable in topological order");
+        }
+
+        /** Only parents of merge commits can be redundant, so reachability is only tracked for them (the candidates). The candidates are split into chunks of fixed size. For each chunk, a bitset of the candidates each commit can reach (including itself) is computed in a single pass in topological order, as the union of the bitsets of its parents. A parent of a merge commit is then redundant if it can be reached from another parent of the commit. This takes O(edges * candidates / 64) word operations and memory for one bitset chunk per commit. The redundant edges are only removed once all chunks are done, which is fine since removing them does not change reachability.
+         */
+        void Project::compactCommitHierarchy() {
+            std::vector<Commit *> order = topologicalOrder();
+            // cycles are rejected by checkAcyclic
+            assert(order.size() == commits.size());
+            for (size_t i = 0, e = order.size(); i != e; ++i)
+                order[i]->order = i;
+            unsigned const NOT_CANDIDATE = std::numeric_limits<unsigned>::max();
+            // topological index -> candidate index
+            std::vector<unsigned> candidate(order.size(), NOT_CANDIDATE);
+            size_t numCandidates = 0;
+            for (Commit * c : order)
+                if (c->parents.size() > 1)
+                    for (Commit * p : c->parents)
+                        if (candidate[p->order] == NOT_CANDIDATE)
+                            candidate[p->order] = numCandidates++;
+            size_t const chunkSize = 1024;
+            std::vector<uint64_t> reach;
+            std::vector<std::pair<Commit *, Commit *>> redundant;
+            for (size_t first = 0; first < numCandidates; first += chunkSize) {
+                size_t last = std::min(first + chunkSize, numCandidates);
+                size_t words = (last - first + 63) / 64;
+                reach.assign(order.size() * words, 0);
+                for (Commit * c : order) {
+                    uint64_t * r = reach.data() + c->order * words;
+                    for (Commit * p : c->parents) {
+                        uint64_t const * pr = reach.data() + p->order * words;
+                        for (size_t w = 0; w < words; ++w)
+                            r[w] |= pr[w];
+                    }
+                    unsigned x = candidate[c->order];
+                    if (x != NOT_CANDIDATE && x >= first && x < last)
+                        r[(x - first) / 64] |= uint64_t(1) << ((x - first) % 64);
+                }
+                for (Commit * c : order) {
+                    if (c->parents.size() < 2)
+                        continue;
+                    for (Commit * p : c->parents) {
+                        unsigned x = candidate[p->order];
+                        if (x < first || x >= last)
+                            continue;
+                        for (Commit * other : c->parents) {
+                            if (other != p && (reach[other->order * words + (x - first) / 64] >> ((x - first) % 64)) & 1) {
+                                redundant.push_back(std::make_pair(c, p));
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
+            for (auto const & e : redundant) {
+                e.first->parents.erase(e.second);
+                e.second->children.erase(e.first);
+            }
+        }
+
         /** Assigns commit ids to all surviving commits.
 
             And outputs the all commits info about them 
@@ -788,14 +934,13 @@ namespace dejavu {
             std::ofstream allCommits(DataDir.value() + "/allCommits.csv", std::ios_base::app);
             for (auto i : commits) {
                 Commit * c = i.second;
-                auto j = ProjectAnalyzer::hashToId_.find(c->hash);
-                if (j == ProjectAnalyzer::hashToId_.end()) {
-                    j = ProjectAnalyzer::hashToId_.insert(std::make_pair(c->hash, ProjectAnalyzer::hashToId_.size())).first;
-                    allCommits << j->second << "," << c->authorTime << "," << c->committerTime << std::endl;
+                auto j = ProjectAnalyzer::hashToId_.insert(std::make_pair(c->hash, ProjectAnalyzer::hashToId_.size()));
+                if (j.second) {
+                    allCommits << j.first->second << "," << c->authorTime << "," << c->committerTime << std::endl;
                     // write the hash
-                    ProjectAnalyzer::hashes_ << j->second << "," << c->hash << std::endl;
+                    ProjectAnalyzer::hashes_ << j.first->second << "," << c->hash << std::endl;
                 }
-                c->id = j->second;
+                c->id = j.first->second;
             }
         }
 
@@ -847,7 +992,7 @@ namespace dejavu {
                 assert(changes.good());
                 for (auto i : commits) {
                     for (auto ch : i.second->changes) {
-                        unsigned pathId = ProjectAnalyzer::GetOrCreatePathId(ch.first);
+                        unsigned pathId = globalPathId(ch.first);
                         unsigned contentsId = ProjectAnalyzer::GetOrCreateHashId(ch.second);
                         // project, commit, path, hash
                         changes << id << "," << i.second->id << "," << pathId << "," << contentsId << std::endl;
@@ -869,7 +1014,7 @@ namespace dejavu {
             if (! submoduleChanges.empty()) {
                 std::ofstream f(DataDir.value() + "/submoduleChanges.csv", std::ios_base::app);
                 for (SubmoduleChange const & ch : submoduleChanges)
-                    f << id << "," << ch.commitHash << "," << helpers::escapeQuotes(ch.path) << "," << helpers::escapeQuotes(ch.url) << "," << ch.contentsHash << std::endl;
+                    f << id << "," << ch.commitHash << "," << helpers::escapeQuotes(paths[ch.path].path) << "," << helpers::escapeQuotes(ch.url) << "," << ch.contentsHash << std::endl;
             }
         }
 
@@ -879,13 +1024,13 @@ namespace dejavu {
             // first see if there is a change to gitmodules
             //            unsigned pathId = ProjectAnalyzer::GetOrCreatePathId(".gitmodules");
             for (auto i = c->changes.begin(), e = c->changes.end(); i != e; ++i) {
-                if (i->first == ".gitmodules") {
+                if (i->first == p->gitmodules) {
                     // if there is submodules, move all existing submodules into pending delete submodules
                     for (auto i : submodules)
                         submodulesPendingDelete.insert(i);
                     // analyze the new version of submodules
-                    if (i->second != "0000000000000000000000000000000000000000") {
-                        std::ifstream f(path + c->hash);
+                    if (i->second != Commit::DELETED) {
+                        std::ifstream f(path + c->hash.toString());
                         std::string line;
                         std::string path = "";
                         while (std::getline(f, line)) {
@@ -894,17 +1039,17 @@ namespace dejavu {
                                 line = line.substr(x + 5);
                                 if (path == "")
                                     std::cout << "ERROR -- empty submodule path, commit " << c->hash << std::endl;
-                                submoduleUrls[path] = line;
+                                submoduleUrls[p->internPath(path)] = line;
                                 continue;
                             }
                             x = line.find("path = ");
                             if (x != std::string::npos) {
                                 path = line.substr(x + 7);
                                 // std::cout << line << " -- " << c->hash << std::endl;
-                                //pathId = ProjectAnalyzer::GetOrCreatePathId(line);
-                                submodules.insert(path);
+                                unsigned pathId = p->internPath(path);
+                                submodules.insert(pathId);
                                 // check that the submodule is not in the pending deletes and remove it if so
-                                auto j = submodulesPendingDelete.find(path);
+                                auto j = submodulesPendingDelete.find(pathId);
                                 if (j != submodulesPendingDelete.end())
                                     submodulesPendingDelete.erase(j);
                             }
@@ -926,21 +1071,16 @@ namespace dejavu {
                 } else if (submodulesPendingDelete.find(i->first) != submodulesPendingDelete.end()) {
                     submodulesPendingDelete.erase(i->first);
                     // output the submodule change info
-                    p->submoduleChanges.push_back(SubmoduleChange{c->hash, i->first, submoduleUrls[i->first], "0000000000000000000000000000000000000000" });
+                    p->submoduleChanges.push_back(SubmoduleChange{c->hash, i->first, submoduleUrls[i->first], Commit::DELETED });
                     i = c->changes.erase(i);
                 } else {
-                    // determine the extension of the file and update the cummulative counts
-                    std::string ext = i->first;
-                    auto e = ext.find_last_of("/");
-                    ext = ext.substr(e + 1);
-                    e = ext.find_last_of(".");
-                    if (e != std::string::npos) 
-                        ext = ext.substr(e);
-                    if (i->second == "0000000000000000000000000000000000000000")
-                        ++(c->cummulativeChanges[ext]).deletions;
+                    // update the cummulative counts for the extension of the file
+                    PathInfo const & info = p->paths[i->first];
+                    if (i->second == Commit::DELETED)
+                        ++(c->cummulativeChanges[info.extension]).deletions;
                     else
-                        ++(c->cummulativeChanges[ext]).changes;;
-                    if (ProjectAnalyzer::IsValidPath(i->first)) {
+                        ++(c->cummulativeChanges[info.extension]).changes;
+                    if (info.valid) {
                         ++i;
                     } else {
                         i = c->changes.erase(i);
@@ -0,0 +1,24 @@
+#include <iostream>
+
+#include "../loaders.h"
+#include "../commands.h"
+#include "../dataset_view.h"
+
+/** Materializes the dataset view in the data directory (see DatasetView).
+
+    Writes the filtered tables of the view to the view's directory, links the tables the view does not filter and removes the view, so that the dataset no longer depends on its base.
+ */
+
+namespace dejavu {
+
+    void MaterializeView(int argc, char * argv[]) {
+        Settings.addOption(DataDir);
+        Settings.parse(argc, argv);
+        Settings.check();
+
+        if (! DatasetView::IsView(DataDir.value()))
+            ERROR(DataDir.value() << " is not a dataset view");
+        DatasetView::Materialize(DataDir.value());
+    }
+
+} // namespace dejavu
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <unordered_map>
@@ -10,9 +11,18 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 
+#include "helpers/http.h"
+
 #include "../loaders.h"
 #include "../commands.h"
 
+/** Downloads the package.json files of NPM projects for all commits which changed them.
+
+    The files are downloaded in-process by the HttpClient with many concurrent transfers (maxTransfers) on the given number of threads. Since many projects share their package.json files (forks and clones), each unique contents is downloaded only once and then written to every place it belongs to. If the download from one URL fails, the other URLs of the same contents are tried in turn.
+
+    Completed downloads are appended to package.json/__downloaded.csv, which also serves as a resume log, so that an interrupted run can be restarted without downloading the already completed files again. Failed downloads are written to package.json/__failed.csv.
+ */
+
 namespace dejavu {
 
     namespace {
@@ -39,12 +49,49 @@ namespace dejavu {
         };
 
         struct Download {
-            Download(std::string url, std::string dir, std::string file):
-                    url(url), dir(dir), file(file), path(dir + "/" + file) {}
+            Download(std::string url, std::string dir, std::string file, unsigned contentsId):
+                    url(url), dir(dir), file(file), path(dir + "/" + file), contentsId(contentsId) {}
             std::string url;
             std::string dir;
             std::string file;
             std::string path;
+            unsigned contentsId;
+        };
+
+        /** Request for a single unique contents, which is stored at all its targets.
+
+            If the download from one URL fails, the request is resubmitted with the next URL of the contents.
+         */
+        class ContentsDownload : public helpers::HttpClient::Request {
+        public:
+            std::vector<Download const *> targets;
+            // unique urls from which the contents can be downloaded
+            std::vector<std::string> urls;
+            size_t next = 0;
+            std::string body;
+
+            ContentsDownload() {
+                onData = [this](char const * data, size_t size) {
+                    body.append(data, size);
+                    return true;
+                };
+            }
+
+            void addTarget(Download const * d) {
+                targets.push_back(d);
+                if (std::find(urls.begin(), urls.end(), d->url) == urls.end())
+                    urls.push_back(d->url);
+            }
+
+            /** Moves to the next url, returns false if there are no more urls to try.
+             */
+            bool advance() {
+                if (next == urls.size())
+                    return false;
+                url = urls[next++];
+                body.clear();
+                return true;
+            }
         };
 
         void LoadInfoForInterestingProjects(std::unordered_set<unsigned> const &interesting_projects,
@@ -253,7 +300,7 @@ namespace dejavu {
                 std::string hash = hashes.at(commit.commitId);
 
                 std::stringstream url;
-                url << "https://raw.githubusercontent.com/"
+                url << BaseUrl.value() << "/"
                     << project->user << "/" << project->repo << "/"
                     << hash << "/" << commit.path;
 
@@ -264,7 +311,7 @@ namespace dejavu {
                 std::stringstream file;
                 file << commit.contentsId;
 
-                Download download(url.str(), dir.str(), file.str());
+                Download download(url.str(), dir.str(), file.str(), commit.contentsId);
                 downloads.push_back(download);
 
                 helpers::Count(inspected_commits);
@@ -302,55 +349,112 @@ namespace dejavu {
 //        }
 
         void DownloadAll(std::vector<Download> const &downloads) {
-            std::string filename_failed = DataDir.value() + "/package.json/__failed.csv";
-            std::string filename_downloaded = DataDir.value() + "/package.json/__downloaded.csv";
+            std::string root = DataDir.value() + "/package.json";
+            std::string filename_failed = root + "/__failed.csv";
+            std::string filename_downloaded = root + "/__downloaded.csv";
 
             clock_t timer = clock();
             std::string task = "downloading stuff";
             size_t downloaded = 0;
             size_t failed = 0;
             size_t attempted = 0;
+            size_t resumed = 0;
             helpers::StartTask(task, timer);
 
-            std::ofstream sf(filename_failed);
+            // files downloaded by previous runs are skipped
+            std::unordered_set<std::string> done;
+            bool resuming = helpers::FileExists(filename_downloaded);
+            if (resuming) {
+                StringRowLoader(filename_downloaded, [&](std::vector<std::string> const & row) {
+                        if (row.size() == 3)
+                            done.insert(row[1] + "/" + row[2]);
+                    });
+                std::cerr << "Resuming, " << done.size() << " files already downloaded" << std::endl;
+            }
+
+            // group the remaining downloads by their contents so that each unique file is downloaded only once
+            std::vector<ContentsDownload *> requests;
+            std::unordered_map<unsigned, ContentsDownload *> byContents;
+            for (Download const &download : downloads) {
+                if (done.find(download.path) != done.end()) {
+                    ++resumed;
+                    continue;
+                }
+                ContentsDownload * & r = byContents[download.contentsId];
+                if (r == nullptr) {
+                    r = new ContentsDownload();
+                    requests.push_back(r);
+                }
+                r->addTarget(& download);
+            }
+            std::cerr << "Skipped: " << resumed << std::endl;
+            std::cerr << "Unique files to download: " << requests.size() << std::endl;
+
+            // failures of previous runs are kept, like the downloaded files
+            bool failedExists = helpers::FileExists(filename_failed);
+            std::ofstream sf(filename_failed, std::ios::out | std::ios::app);
             if (! sf.good()) {
                 ERROR("Unable to open file " << filename_failed
                                              << " for writing");
             }
-            sf << "url,dir,file" <<std::endl;
+            if (! failedExists)
+                sf << "url,dir,file" <<std::endl;
 
-            std::ofstream sd(filename_downloaded);
+            std::ofstream sd(filename_downloaded, std::ios::out | std::ios::app);
             if (! sd.good()) {
                 ERROR("Unable to open file " << filename_downloaded
                                              << " for writing");
             }
-            sd << "url,dir,file" <<std::endl;
-
-            for (Download const &download : downloads) {
-                std::stringstream mkdirCmd;
-                mkdirCmd << "mkdir -p " << DataDir.value() + "/" + download.dir;
-
-                std::stringstream wgetCmd;
-                wgetCmd << "wget -nv -q "
-                        << "-O " << DataDir.value() << "/" << download.path
-                        << " " << download.url;
-
-                int status =  system(mkdirCmd.str().c_str());
-                assert(status == 0);
-
-                status = system(wgetCmd.str().c_str());
-                if (status != 0) {
-                    sf << download.url << "," << download.dir << ","
-                       << download.file << std::endl;
-                    ++failed;
-                } else {
-                    sd << download.url << "," << download.dir << ","
-                       << download.file << std::endl;
-                    ++downloaded;
-                }
-
-                helpers::Count(attempted);
+            if (! resuming)
+                sd << "url,dir,file" <<std::endl;
+
+            std::unordered_set<std::string> createdDirs;
+            std::mutex m;
+            helpers::HttpClient client(NumThreads.value(), MaxTransfers.value());
+            for (ContentsDownload * r : requests) {
+                r->advance();
+                r->onComplete = [&](helpers::HttpClient::Request * request, helpers::HttpClient::Response const & response) {
+                    ContentsDownload * r = static_cast<ContentsDownload *>(request);
+                    bool ok = response.ok() && response.status == 200;
+                    // try the next url if there is one
+                    if (! ok && r->advance()) {
+                        client.resubmit(r);
+                        return;
+                    }
+                    std::lock_guard<std::mutex> g(m);
+                    for (Download const * download : r->targets) {
+                        // a failed write only fails its own target
+                        bool written = ok;
+                        if (written) {
+                            // the target directory is package.json/projectId/pathId/ where package.json already exists
+                            std::string dir = DataDir.value() + "/" + download->dir;
+                            if (createdDirs.insert(dir).second) {
+                                mkdir(dir.substr(0, dir.rfind('/', dir.size() - 2)).c_str(), 0755);
+                                mkdir(dir.c_str(), 0755);
+                            }
+                            std::ofstream f(DataDir.value() + "/" + download->path, std::ios::out | std::ios::binary);
+                            f << r->body;
+                            f.close();
+                            if (f.good()) {
+                                sd << helpers::escapeQuotes(download->url) << "," << download->dir << ","
+                                   << download->file << std::endl;
+                                ++downloaded;
+                            } else {
+                                written = false;
+                            }
+                        }
+                        if (! written) {
+                            sf << helpers::escapeQuotes(download->url) << "," << download->dir << ","
+                               << download->file << std::endl;
+                            ++failed;
+                        }
+                        helpers::Count(attempted);
+                    }
+                    delete r;
+                };
+                client.add(r);
             }
+            client.finish();
 
             sd.close();
             sf.close();
@@ -367,12 +471,13 @@ namespace dejavu {
     void NPMDownload(int argc, char * argv[]) {
         Settings.addOption(DataDir);
         Settings.addOption(NumThreads);
+        Settings.addOption(MaxTransfers);
+        BaseUrl.updateDefaultValue("https://raw.githubusercontent.com");
+        Settings.addOption(BaseUrl);
         Settings.parse(argc, argv);
         Settings.check();
 
-        std::string mkdir = "mkdir -p " + DataDir.value() + "/project.json/";
-        int status =  system(mkdir.c_str());
-        assert(status == 0);
+        helpers::EnsurePath(DataDir.value() + "/package.json");
 
         std::unordered_set<unsigned> interesting_projects;
         std::unordered_set<std::string> paths_to_interesting_package_json;
@@ -4,6 +4,7 @@
 
 #include "../loaders.h"
 #include "../commands.h"
+#include "../path_attributes.h"
 
 
 namespace dejavu {
@@ -34,18 +35,18 @@ namespace dejavu {
         public:
             void filter() {
                 {
-                    std::cerr << "Filtering paths..." << std::endl;
-                    std::ofstream f(OutputDir.value() + "/paths.csv");
+                    std::cerr << "Loading path attributes..." << std::endl;
+                    attributes_.reset(new PathAttributes());
                     size_t totalPaths = 0;
-                    PathToIdLoader{[&,this](unsigned id, std::string const & path){
+                    size_t retainedPaths = 0;
+                    for (unsigned id = 0; id < attributes_->size(); ++id) {
+                        if (attributes_->has(id))
                             ++totalPaths;
-                            if (!IsNPMPath(path)) {
-                                f << id << "," << helpers::escapeQuotes(path) << std::endl;
-                                paths_.insert(id);
-                            }
-                        }};
-                    std::cerr << "    " << totalPaths << " total paths read" << std::endl;
-                    std::cerr << "    " << paths_.size() << " retained paths" << std::endl;
+                        if (isRetained(id))
+                            ++retainedPaths;
+                    }
+                    std::cerr << "    " << totalPaths << " total paths" << std::endl;
+                    std::cerr << "    " << retainedPaths << " retained paths" << std::endl;
                 }
                 // now that we have paths, we can load all projects and commits
                 {
@@ -86,19 +87,16 @@ namespace dejavu {
                 {
                     std::cerr << "Loading file changes to determine unique contents..." << std::endl;
                     size_t totalChanges = 0;
-                    std::unordered_map<unsigned, unsigned> contents;
+                    // contents seen at least once and more than once, the unique contents are their difference
+                    helpers::IdSet seen;
+                    helpers::IdSet seenTwice;
                     FileChangeLoader{[&,this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
                             ++totalChanges;
-                            auto i = contents.find(contentsId);
-                            if (i == contents.end()) 
-                                contents.insert(std::make_pair(contentsId, 1));
-                            else
-                                ++(i->second);
+                            if (! seen.insert(contentsId))
+                                seenTwice.insert(contentsId);
                         }};
                     std::cerr << "    " << totalChanges << " total changes read" << std::endl;
-                    for (auto i : contents)
-                        if (i.second == 1)
-                            uniqueContents_.insert(i.first);
+                    uniqueContents_ = seen - seenTwice;
                     std::cerr << "    " << uniqueContents_.size() << " unique file contents" << std::endl;
                 }
                 {
@@ -110,7 +108,7 @@ namespace dejavu {
                     f << "projectId,commitId,pathId,contentsId" << std::endl;
                     FileChangeLoader{[&,this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
                             ++totalChanges;
-                            if (paths_.find(pathId) != paths_.end()) {
+                            if (isRetained(pathId)) {
                                 ++validChanges;
                                 Project * p = projects_[projectId];
                                 Commit * c = commits_[commitId];
@@ -118,7 +116,7 @@ namespace dejavu {
                                 assert(c != nullptr);
                                 p->addCommit(c);
                                 c->addChange(pathId, contentsId);
-                            } else if (uniqueContents_.find(contentsId) != uniqueContents_.end()) {
+                            } else if (uniqueContents_.contains(contentsId)) {
                                 f << projectId << "," << commitId << "," << pathId << "," << contentsId << std::endl;
                                 ++uniqueContentsRemoved;
                             }
@@ -143,99 +141,57 @@ namespace dejavu {
             }
 
             /** Now that commits have been removed, we can output the data we have.
+
+                The output is a view of the original dataset (see DatasetView) which selects the projects with at least one remaining commit, the remaining commits and the retained paths. Since removing the empty commits changes the commit hierarchy, the commit parents are written in full to the view. If materialize is set, the view is then materialized.
              */
             void output() {
                 helpers::EnsurePath(OutputDir.value());
+                DatasetView view(DataDir.value());
                 {
-                    std::cerr << "Writing projects..." << std::endl;
-                    std::ofstream f(OutputDir.value() + "/projects.csv");
-                    f << "projectId,user,repo,createdAt" << std::endl;
-                    size_t kept = 0;
+                    std::cerr << "Selecting projects..." << std::endl;
+                    view.projects = Selection();
                     for (Project * p : projects_) {
                         if (p == nullptr)
                             continue;
-                        bool keep = false;
                         for (Commit * c : p->commits)
                             if (! c->tainted) {
-                                keep = true;
+                                view.projects.insert(p->id);
                                 break;
                             }
-                        if (keep) {
-                            f << p->id << "," << helpers::escapeQuotes(p->user) << "," << helpers::escapeQuotes(p->repo) << "," <<  p->createdAt << std::endl;
-                            ++kept;
-                        }
                     }
-                    std::cerr << "    " << kept << " projects written." << std::endl;
+                    std::cerr << "    " << view.projects.size() << " projects selected." << std::endl;
                 }
                 {
-                    std::cerr << "Writing commits and commit parents..." << std::endl;
-                    std::ofstream fc(OutputDir.value() + "/commits.csv");
+                    std::cerr << "Selecting commits and writing commit parents..." << std::endl;
                     std::ofstream fp(OutputDir.value() + "/commitParents.csv");
-                    fc << "commitId,authorTime,committerTime" << std::endl;
                     fp << "commitId,parentId" << std::endl;
-                    size_t commits = 0;
+                    view.commits = Selection();
                     size_t parentRecords = 0;
                     for (Commit * c : commits_) {
                         if (c == nullptr || c->tainted)
                             continue;
-                        fc << c->id << "," << c->time << "," << c->time2 << std::endl;
-                        ++commits;
+                        view.commits.insert(c->id);
                         for (Commit * p : c->parents) {
                             fp << c->id << "," << p->id << std::endl;
                             ++parentRecords;
                         }
                     }
-                    std::cout << "    " << commits << " commits written" << std::endl;
-                    std::cout << "    " << parentRecords << " parent records writtem " << std::endl;
+                    std::cerr << "    " << view.commits.size() << " commits selected" << std::endl;
+                    std::cerr << "    " << parentRecords << " parent records written" << std::endl;
                 }
                 {
-                    std::cerr << "Writing file changes" << std::endl;
-                    std::ofstream f(OutputDir.value() + "/fileChanges.csv");
-                    f << "projectId,commitId,pathId,contentsId" << std::endl;
-                    size_t count = 0;
-                    for (Project * p : projects_) {
-                        if (p == nullptr)
-                            continue;
-                        for (Commit * c : p->commits) {
-                            if ( c == nullptr || c->tainted)
-                                continue;
-                            for (unsigned x : c->deletions)
-                                f << p->id << "," << c->id << "," << x << "," << FILE_DELETED << std::endl;
-                            for (auto i : c->changes)
-                                f << p->id << "," << c->id << "," << i.first << "," << i.second << std::endl;
-                            count += c->deletions.size() + c->changes.size();
-                        }
-                    }
-                    std::cerr << "    " << count << " records written" << std::endl;
+                    std::cerr << "Selecting paths..." << std::endl;
+                    view.paths = Selection(helpers::IdSet::Build(attributes_->size(), NumThreads.value(), [this](unsigned id) {
+                        return isRetained(id);
+                    }));
+                    std::cerr << "    " << view.paths.size() << " paths selected" << std::endl;
                 }
-                {
-                    std::cerr << "Filtering paths..." << std::endl;
-                    std::ofstream f(OutputDir.value() + "/paths.csv");
-                    f << "id,path" << std::endl;
-                    size_t count = 0;
-                    size_t retained = 0;
-                    PathToIdLoader{[&,this](unsigned id, std::string const & path){
-                            ++count;
-                            if (paths_.find(id) == paths_.end())
-                                return;
-                            f << id << "," << helpers::escapeQuotes(path) << std::endl;
-                            ++retained;
-                        }};
-                    std::cerr << "    " << count << " paths read" << std::endl;
-                    std::cerr << "    " << retained << " paths retained" << std::endl;
-                }
-            }
-
-            /** Creates symlinks for non-filtered files from the original dataset to the verified one to save disk space.
-             */
-            void createSymlinks() {
-                std::cerr << "Creating symlinks..." << std::endl;
-                helpers::System(STR("ln -s " << DataDir.value() + "/hashes.csv " << OutputDir.value() << "/hashes.csv"));
-                // TODO do we want more symlinks?
+                std::cerr << "Writing dataset view..." << std::endl;
+                view.write(OutputDir.value());
+                if (Materialize.value())
+                    DatasetView::Materialize(OutputDir.value());
             }
-            
 
-            
         private:
 
 
@@ -260,10 +216,16 @@ namespace dejavu {
                 return 1;
             }
 
-            std::unordered_set<unsigned> paths_;
+            /** Only paths which are not in node_modules are retained.
+             */
+            bool isRetained(unsigned pathId) const {
+                return attributes_->has(pathId) && ! attributes_->isNPM(pathId);
+            }
+
+            std::unique_ptr<PathAttributes> attributes_;
             std::vector<Project*> projects_;
             std::vector<Commit*> commits_;
-            std::unordered_set<unsigned> uniqueContents_;
+            helpers::IdSet uniqueContents_;
             
         };
         
@@ -274,6 +236,8 @@ namespace dejavu {
     void NPMFilter(int argc, char * argv[]) {
         Settings.addOption(DataDir);
         Settings.addOption(OutputDir);
+        Settings.addOption(Materialize);
+        Settings.addOption(NumThreads);
         Settings.parse(argc, argv);
         Settings.check();
 
@@ -281,7 +245,6 @@ namespace dejavu {
         f.filter();
         f.removeEmptyCommits();
         f.output();
-        f.createSymlinks();
     }
     
 } // namespace dejavu
@@ -6,6 +6,8 @@
 #include "../loaders.h"
 #include "../commands.h"
 #include "../commit_iterator.h"
+#include "../parallel_loader.h"
+#include "../path_attributes.h"
 
 // - project, # commits, # paths, # npmPaths, # of updates to npm files, date of first and last commit dates
 
@@ -198,15 +200,17 @@ namespace dejavu {
                     return false;
             }
 
-            void mergeEmptyPackages(Commit * c, std::unordered_map<std::string, NPMPackage> & into) {
+            void mergeEmptyPackages(Commit * c, std::vector<std::unordered_map<std::string, NPMPackage> *> const & into) {
                 for(auto i = packages_.begin(), e = packages_.end(); i != e; ) {
                     if (i->second.activeFiles.empty()) {
                         i->second.completeDeletions.insert(c->id);
-                        auto j = into.find(i->first);
-                        if (j == into.end())
-                            into.insert(*i);
-                        else
-                            j->second.mergeWith(i->second);
+                        for (auto packages : into) {
+                            auto j = packages->find(i->first);
+                            if (j == packages->end())
+                                packages->insert(*i);
+                            else
+                                j->second.mergeWith(i->second);
+                        }
                         i = packages_.erase(i);
                     } else {
                         ++i;
@@ -232,90 +236,77 @@ namespace dejavu {
 
         class Summary {
         public:
+            /** Loads the path attributes, projects, commits, commit parents and file changes concurrently and then links them together in parallel, while counting the occurences of file contents.
+             */
             void loadData() {
-                {
-                    std::cerr << "Loading paths..." << std::endl;
-                    size_t totalPaths = 0;
-                    size_t npmPaths = 0;
-                    PathToIdLoader{[&,this](unsigned id, std::string const & path){
-                            // break the path into segments
-                            // we are interested in node_modules/folder/...
-                            std::vector<std::string> ps = helpers::Split(path, '/');
-                            ++totalPaths;
-                            size_t i = ps.size() - 2;
-                            while (i < ps.size()) {
-                                if (ps[i] == "node_modules") {
-                                    std::string name = ps[i + 1];
-                                    std::string root = ps[0];
-                                    for (size_t j = 1; j <= i + 1; ++j)
-                                        root = root + "/" + ps[j];
-                                    packageRoots_.insert(std::make_pair(id, PathInfo(name, root, i + 3 == ps.size() && ps.back() == "package.json")));
-                                    ++npmPaths;
-                                    break;
-                                }
-                                --i;
-                            }
-                        }};
-                    std::cerr << "    " << totalPaths << " total paths read" << std::endl;
-                    std::cerr << "    " << npmPaths << " retained paths" << std::endl;
-                }
-                {
-                    size_t totalProjects = 0;
-                    std::cerr << "Loading projects ... " << std::endl;
-                    ProjectLoader{DataDir.value() + "/projects.csv", [&,this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
-                            ++totalProjects;
-                            if (id >= projects_.size())
-                                projects_.resize(id + 1);
-                            projects_[id] = new Project(id,createdAt);
-                        }};
-                    std::cerr << "    " << totalProjects << " total projects read" << std::endl;
-                }
-                {
-                    std::cerr << "Loading commits ... " << std::endl;
-                    size_t totalCommits = 0;
-                    CommitLoader{[&,this](unsigned id, uint64_t authorTime, uint64_t committerTime){
-                            ++totalCommits;
-                            if (id >= commits_.size())
-                                commits_.resize(id + 1);
-                            commits_[id] = new Commit(id, authorTime);
-                        }};
-                    std::cerr << "    " << totalCommits << " total commits read" << std::endl;
-                }
-                {
-                    std::cerr << "Loading commit parents ... " << std::endl;
-                    CommitParentsLoader{[this](unsigned id, unsigned parentId){
-                            Commit * c = commits_[id];
-                            Commit * p = commits_[parentId];
-                            assert(c != nullptr);
-                            assert(p != nullptr);
-                            c->addParent(p);
-                        }};
-                    
-                }
-                {
-                    std::cerr << "Loading file changes ... " << std::endl;
-                    size_t totalChanges = 0;
-                    std::unordered_map<unsigned, unsigned> contents;
-                    FileChangeLoader{[&,this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
-                            ++totalChanges;
-                            Project * p = projects_[projectId];
-                            Commit * c = commits_[commitId];
-                            assert(p != nullptr);
-                            assert(c != nullptr);
-                            p->addCommit(c);
-                            c->addChange(pathId, contentsId);
-                            auto i = contents.find(contentsId);
+                size_t totalPaths = 0;
+                size_t npmPaths = 0;
+                size_t totalProjects = 0;
+                size_t totalCommits = 0;
+                ParallelLoader::CommitParents parents;
+                ParallelLoader::FileChanges changes;
+                ParallelLoader loader;
+                loader.add("Loading path attributes", [&, this]() {
+                        attributes_.reset(new PathAttributes());
+                        for (unsigned id = 0; id < attributes_->size(); ++id) {
+                            if (attributes_->has(id))
+                                ++totalPaths;
+                            if (isNPMPath(id))
+                                ++npmPaths;
+                        }
+                        packageRoots_.reserve(attributes_->numPackageRoots());
+                        for (unsigned i = 0; i < attributes_->numPackageRoots(); ++i)
+                            packageRoots_.push_back(PathInfo(attributes_->packageName(i), attributes_->packageRootName(i)));
+                    }).add("Loading projects", [&, this]() {
+                        ProjectLoader{DataDir.value() + "/projects.csv", [&,this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
+                                ++totalProjects;
+                                if (id >= projects_.size())
+                                    projects_.resize(id + 1);
+                                projects_[id] = new Project(id,createdAt);
+                            }};
+                    }).add("Loading commits", [&, this]() {
+                        CommitLoader{[&,this](unsigned id, uint64_t authorTime, uint64_t committerTime){
+                                ++totalCommits;
+                                if (id >= commits_.size())
+                                    commits_.resize(id + 1);
+                                commits_[id] = new Commit(id, authorTime);
+                            }};
+                    }).add("Loading commit parents", [& parents]() {
+                        ParallelLoader::Load(parents);
+                    }).add("Loading file changes", [& changes]() {
+                        ParallelLoader::Load(changes);
+                    });
+                loader.run();
+                std::cerr << "    " << totalPaths << " total paths" << std::endl;
+                std::cerr << "    " << npmPaths << " retained paths" << std::endl;
+                std::cerr << "    " << packageRoots_.size() << " package roots" << std::endl;
+                std::cerr << "    " << totalProjects << " total projects read" << std::endl;
+                std::cerr << "    " << totalCommits << " total commits read" << std::endl;
+                std::cerr << "    " << changes.size() << " total changes read" << std::endl;
+                auto project = [this](unsigned id) { return projects_[id]; };
+                auto commit = [this](unsigned id) { return commits_[id]; };
+                loader.addPass("Linking commit parents", [&](unsigned thread, unsigned numThreads) {
+                        ParallelLoader::LinkParents(parents, commit, thread, numThreads);
+                    }).addPass("Linking file changes", [&](unsigned thread, unsigned numThreads) {
+                        ParallelLoader::LinkChanges(changes, project, commit, thread, numThreads);
+                    }).add("Counting file contents", [&, this]() {
+                        // contents id -> number of its occurences after the first one
+                        std::unordered_map<unsigned, unsigned> contents;
+                        changes.forEach([&](ParallelLoader::FileChange const & r) {
+                            auto i = contents.find(r.contentsId);
                             if (i == contents.end())
-                                contents.insert(std::make_pair(contentsId, 0));
+                                contents.insert(std::make_pair(r.contentsId, 0));
                             else
                                 ++i->second;
-                        }};
-                    std::cerr << "    " << totalChanges << " total changes read" << std::endl;
-                    for (auto i : contents)
-                        if (i.second == 0)
-                            originalContents_.insert(i.first);
-                    std::cerr << "    " << originalContents_.size() << " unique files" << std::endl;
-                }
+                        });
+                        for (auto i : contents)
+                            if (i.second == 0)
+                                originalContents_.insert(i.first);
+                    });
+                loader.run();
+                ParallelLoader::Release(parents);
+                ParallelLoader::Release(changes);
+                std::cerr << "    " << originalContents_.size() << " unique files" << std::endl;
             }
 
             void analyzeProjects() {
@@ -343,15 +334,20 @@ namespace dejavu {
                 packageDetails_ << "projectId,path,name,numVersions,numFiles,numManualChanges,numManualChangesOriginal,numDeletions,numCompleteDeletions,numChangedFiles,numChangedFilesOriginal,numDeletedFiles,numChangingCommits,numChangingCommitsOriginal,numDeletingCommits,numActiveFiles" << std::endl;
                 manualChanges_.open(DataDir.value() + "/npm-summary-manualChanges.csv");
                 manualChanges_ << "projectId,commitId,pathId,contentsId" << std::endl;
+                // forks are analyzed together with the projects they share history with so that the shared history is only walked once
+                std::vector<Project *> npmProjects;
+                for (Project * p : projects_)
+                    if (p != nullptr && p->hasNPM)
+                        npmProjects.push_back(p);
                 unsigned i = 0;
-                for (Project * p : projects_) {
-                    if (++i % 1000 == 0)
-                        std::cerr << " : " << i << '\r' << std::flush;
-                    if (p == nullptr || p->hasNPM == false)
-                        continue;
-                    analyzeProjectProper(p);
-                    p->paths.clear();
-                    p->npmPaths.clear();
+                for (auto const & family : ProjectFamily<Project, Commit>::Find(npmProjects)) {
+                    i += family.size();
+                    std::cerr << " : " << i << '\r' << std::flush;
+                    analyzeFamily(family);
+                    for (Project * p : family) {
+                        p->paths.clear();
+                        p->npmPaths.clear();
+                    }
                 }
                 
             }
@@ -361,12 +357,10 @@ namespace dejavu {
             public:
                 std::string name;
                 std::string root;
-                bool isJson;
 
-                PathInfo(std::string const & name, std::string const & root, bool isJson):
+                PathInfo(std::string const & name, std::string const & root):
                     name(name),
-                    root(root),
-                    isJson(isJson) {
+                    root(root) {
                 }
 
                 bool valid() const {
@@ -403,60 +397,82 @@ namespace dejavu {
                 p->npmFileChanges -= p->npmPaths.size();
             }
 
-            /** Proper analysis of the project, which calculates all paths, all node modules and so on.
-
+            /** Proper analysis of the family of projects, which calculates all paths, all node modules and so on.
 
                 don't use dummy state, but keep active NPMPackages
 
+                Projects sharing history are walked together, results of shared commits are recorded for each project containing them. 
              */
-            void analyzeProjectProper(Project * p) {
-                std::unordered_map<std::string, NPMPackage> packages;
-                CommitForwardIterator<Project, Commit, State> cfi(p, [&,this](Commit * c, State & state) {
-                        // check if any package has been completely deleted and if so, mark it as such and update the main package
-                        state.mergeEmptyPackages(c, packages);
-                        // now deal with package.jsons since any changes to them mean that the package has version update and therefore we ignore changes to it
-                        std::unordered_set<std::string> changedPackages;
-                        for (auto i : c->changes) {
-                            PathInfo const & pi = getNPMPathInfo(i.first);
-                            if (pi.isJson) { // it has to be valid if it is package.json
-                                state.addPackageVersion(pi.name, pi.root, i.first, i.second);
-                                changedPackages.insert(pi.root);
-                            }
-                        }
-                        // deal with deletions now, file deletion is manual if package.json is not changed. Issue is if package.json is deleted, and so are other files. If all other files are deleted then the package will not exist and will be uninteresting even if we mark the deletions as manual. If some files survive and package.json is deleted, then it is indeed manual deletion, so it is correct. 
-                        for (auto i : c->deletions) {
-                            PathInfo const & pi = getNPMPathInfo(i);
-                            if (pi.valid()) {
-                                if (changedPackages.find(pi.root) != changedPackages.end())
-                                    state.handleFileDeletion(c, pi.root, i);
-                                else
-                                    state.handleManualFileDeletion(c, pi.root, i);
-                            }
-                        }
-                        // now deal with other changes, for each change determine if it belongs to a package and if it does, update the package
-                        for (auto i : c->changes) {
-                            PathInfo const & pi = getNPMPathInfo(i.first);
-                            if (pi.valid()) {
-                                if (changedPackages.find(pi.root) != changedPackages.end()) {
-                                    state.registerFile(pi.root, i.first);
-                                } else {
-                                    bool orig = isOriginal(i.second);
-                                    if (state.registerFileChange(c, pi.name, pi.root, i.first, orig))
-                                        manualChanges_ << p->id << "," << c->id << "," << i.first << "," << i.second << std::endl;
-                                }
-                            }
-                        }
-
-                        if (c->children.empty())
-                            state.mergeAllPackages(c, packages);
-                    return true;
-                });
-                cfi.process();
+            void analyzeFamily(std::vector<Project *> const & family) {
+                std::unordered_map<Project *, std::unordered_map<std::string, NPMPackage>> packages;
+                if (family.size() == 1) {
+                    std::vector<std::unordered_map<std::string, NPMPackage> *> into{ & packages[family.front()] };
+                    CommitForwardIterator<Project, Commit, State> cfi(family.front(), [&,this](Commit * c, State & state) {
+                            return analyzeCommit(c, state, family, into);
+                        });
+                    cfi.process();
+                } else {
+                    ProjectFamily<Project, Commit> f(family);
+                    CommitForwardIterator<ProjectFamily<Project, Commit>, Commit, State> cfi(& f, [&,this](Commit * c, State & state) {
+                            std::vector<Project *> const & projects = f.projectsOf(c);
+                            std::vector<std::unordered_map<std::string, NPMPackage> *> into;
+                            for (Project * p : projects)
+                                into.push_back(& packages[p]);
+                            return analyzeCommit(c, state, projects, into);
+                        });
+                    cfi.process();
+                }
                 /** Output the packages info
                  */
-                for (auto i : packages) {
-                    packageDetails_ << p->id << "," << i.second << std::endl;
+                for (Project * p : family)
+                    for (auto i : packages[p]) {
+                        packageDetails_ << p->id << "," << i.second << std::endl;
+                    }
+            }
+
+            /** Analyzes single commit of given projects, into are the packages of the projects, in the same order.
+             */
+            bool analyzeCommit(Commit * c, State & state, std::vector<Project *> const & projects, std::vector<std::unordered_map<std::string, NPMPackage> *> const & into) {
+                // check if any package has been completely deleted and if so, mark it as such and update the main package
+                state.mergeEmptyPackages(c, into);
+                // now deal with package.jsons since any changes to them mean that the package has version update and therefore we ignore changes to it
+                std::unordered_set<std::string> changedPackages;
+                for (auto i : c->changes) {
+                    if (attributes_->isPackageJson(i.first)) { // it has to be valid if it is package.json
+                        PathInfo const & pi = getNPMPathInfo(i.first);
+                        state.addPackageVersion(pi.name, pi.root, i.first, i.second);
+                        changedPackages.insert(pi.root);
+                    }
+                }
+                // deal with deletions now, file deletion is manual if package.json is not changed. Issue is if package.json is deleted, and so are other files. If all other files are deleted then the package will not exist and will be uninteresting even if we mark the deletions as manual. If some files survive and package.json is deleted, then it is indeed manual deletion, so it is correct. 
+                for (auto i : c->deletions) {
+                    PathInfo const & pi = getNPMPathInfo(i);
+                    if (pi.valid()) {
+                        if (changedPackages.find(pi.root) != changedPackages.end())
+                            state.handleFileDeletion(c, pi.root, i);
+                        else
+                            state.handleManualFileDeletion(c, pi.root, i);
+                    }
                 }
+                // now deal with other changes, for each change determine if it belongs to a package and if it does, update the package
+                for (auto i : c->changes) {
+                    PathInfo const & pi = getNPMPathInfo(i.first);
+                    if (pi.valid()) {
+                        if (changedPackages.find(pi.root) != changedPackages.end()) {
+                            state.registerFile(pi.root, i.first);
+                        } else {
+                            bool orig = isOriginal(i.second);
+                            if (state.registerFileChange(c, pi.name, pi.root, i.first, orig))
+                                for (Project * p : projects)
+                                    manualChanges_ << p->id << "," << c->id << "," << i.first << "," << i.second << std::endl;
+                        }
+                    }
+                }
+
+                if (c->children.empty())
+                    for (auto packages : into)
+                        state.mergeAllPackages(c, *packages);
+                return true;
             }
 
             /** Returns true if the given contents id was seen only once in the entire corpus.
@@ -470,24 +486,25 @@ namespace dejavu {
             /** Returns true if given path is NPM file.
              */
             bool isNPMPath(unsigned pathId) {
-                return packageRoots_.find(pathId) != packageRoots_.end();
+                return attributes_->packageRoot(pathId) != PathAttributes::NONE;
             }
 
             PathInfo const & getNPMPathInfo(unsigned path) {
-                auto i = packageRoots_.find(path);
-                if (i == packageRoots_.end())
+                unsigned root = attributes_->packageRoot(path);
+                if (root == PathAttributes::NONE)
                     return notNPM_;
                 else
-                    return i->second;
+                    return packageRoots_[root];
             }
 
 
 
-            PathInfo notNPM_ = PathInfo("","",false);
+            PathInfo notNPM_ = PathInfo("","");
             
-            /** path -> isNPM?
+            /** package root id -> package name and root
              */
-            std::unordered_map<unsigned, PathInfo> packageRoots_;
+            std::vector<PathInfo> packageRoots_;
+            std::unique_ptr<PathAttributes> attributes_;
             std::vector<Project *> projects_;
             std::vector<Commit *> commits_;
             std::ofstream packageDetails_;
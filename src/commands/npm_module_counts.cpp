@@ -1,6 +1,7 @@
 
 #include "../loaders.h"
 #include "../commands.h"
+#include "../path_attributes.h"
 
 namespace dejavu {
 
@@ -22,8 +23,8 @@ namespace dejavu {
                 npmDeletes(0) {
             }
 
-            void addChange(unsigned pathId, unsigned contentsId, std::unordered_set<unsigned> const & npmPaths) {
-                if (npmPaths.find(pathId) == npmPaths.end()) {
+            void addChange(unsigned pathId, unsigned contentsId, PathAttributes const & attributes) {
+                if (! attributes.isNPM(pathId)) {
                     // not an NPM path
                     if (contentsId == FILE_DELETED)
                         ++deletes;
@@ -45,18 +46,15 @@ namespace dejavu {
         class NPMCounter {
         public:
             void loadValidPaths() {
-                std::cerr << "Loading paths ... " << std::endl;
-                PathToIdLoader{[this](unsigned id, std::string const & path){
-                        if (IsNPMPath(path))
-                            paths_.insert(id);
-                    }};
-                std::cerr << "    " << paths_.size() << " paths loaded" << std::endl;
+                std::cerr << "Loading path attributes ... " << std::endl;
+                attributes_.reset(new PathAttributes());
+                std::cerr << "    " << attributes_->size() << " paths mapped" << std::endl;
             }
 
             void countChanges() {
                 std::cerr << "Loading file changes ... " << std::endl;
                 FileChangeLoader{[this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
-                        projects_[projectId].addChange(pathId, contentsId, paths_);
+                        projects_[projectId].addChange(pathId, contentsId, *attributes_);
                     }};
                 // and now output the results
                 std::cerr << "Writing project summaries..." << std::endl;
@@ -69,7 +67,7 @@ namespace dejavu {
         }
 
         private:
-            std::unordered_set<unsigned> paths_;
+            std::unique_ptr<PathAttributes> attributes_;
 
             std::unordered_map<unsigned, ProjectInfo> projects_;
 
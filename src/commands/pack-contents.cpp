@@ -0,0 +1,75 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+
+#include "helpers/helpers.h"
+
+#include "../commands.h"
+#include "../content_store.h"
+
+/** Moves contents downloaded in the old layout into the content store.
+
+    Older versions of download-contents stored each file in its own file named by its contents id in folders of contents id modulo 1000. This command reads all such files from the input directory and appends them to the content store in the output directory (see ContentStore), skipping any contents the store already has. The input files are left untouched so that they can be deleted once the store is verified.
+ */
+
+namespace dejavu {
+
+    namespace {
+
+        class ContentsPacker {
+        public:
+            void pack() {
+                std::cerr << "Opening content store..." << std::endl;
+                ContentStore store(OutputDir.value(), true, CompressContents.value());
+                std::cerr << "    " << store.size() << " contents already stored" << std::endl;
+                std::cerr << "Packing contents..." << std::endl;
+                helpers::DirectoryReader(Input.value(), [&, this](std::string const & filename) {
+                        std::string name = filename.substr(filename.rfind('/') + 1);
+                        char * end;
+                        unsigned long contentsId = strtoul(name.c_str(), & end, 10);
+                        // skip files which are not contents, such as partial downloads
+                        if (name.empty() || * end != 0) {
+                            ++skipped_;
+                            return;
+                        }
+                        if (store.contains(contentsId)) {
+                            ++existing_;
+                        } else {
+                            std::ifstream f(filename, std::ios::in | std::ios::binary);
+                            if (! f.good())
+                                ERROR("Unable to open " << filename);
+                            std::stringstream contents;
+                            contents << f.rdbuf();
+                            store.add(contentsId, contents.str());
+                            ++packed_;
+                        }
+                        if ((packed_ + existing_) % 1000 == 0)
+                            std::cerr << " : " << (packed_ + existing_) << "    \r" << std::flush;
+                    }, true);
+                store.close();
+                std::cerr << "    " << packed_ << " contents packed" << std::endl;
+                std::cerr << "    " << existing_ << " contents already in store" << std::endl;
+                std::cerr << "    " << skipped_ << " other files skipped" << std::endl;
+            }
+
+        private:
+            size_t packed_ = 0;
+            size_t existing_ = 0;
+            size_t skipped_ = 0;
+        }; // ContentsPacker
+
+    } // anonymous namespace
+
+    void PackContents(int argc, char * argv[]) {
+        Settings.addOption(Input);
+        Settings.addOption(OutputDir);
+        Settings.addOption(CompressContents);
+        Settings.parse(argc, argv);
+        Settings.check();
+
+        ContentsPacker p;
+        p.pack();
+    }
+
+} // namespace dejavu
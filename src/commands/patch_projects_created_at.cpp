@@ -3,10 +3,7 @@
 
 #include "../loaders.h"
 #include "../commands.h"
-
-#include "../loaders.h"
-
-#include "helpers/json.hpp"
+#include "../metadata_table.h"
 
 /*
 
@@ -232,7 +229,11 @@ namespace dejavu {
 
         class Patcher {
         public:
-            
+
+            Patcher():
+                metadata_(Input.value()) {
+            }
+
             void loadData() {
                 std::cerr << "Loading projects ... " << std::endl;
                 ProjectLoader{[this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
@@ -255,28 +256,19 @@ namespace dejavu {
                 std::cerr << "    " << notFound_ << " not found (no metadata)" << std::endl;
             }
 
-            uint64_t iso8601ToTime(std::string const & str) {
-                struct tm t;
-                strptime(str.c_str(),"%Y-%m-%dT%H:%M:%SZ",&t);
-                return mktime(&t);
-            }
-
             void patchProject(Project * p) {
-                std::string path = STR(p->user << "_" << p->repo);
-                path = Input.value() + "/" + path.substr(0, 2) + "/" + path;
-                if (helpers::FileExists(path)) {
-                    nlohmann::json json;
-                    std::ifstream{path} >> json;
+                if (metadata_.has(p->id)) {
+                    MetadataTable::Record const & m = metadata_[p->id];
                     // mark the project as fork, but continue so that we can run two filters allowing us do determine the two datasets size
-                    if (json["fork"] == true) {
+                    if (m.fork()) {
                         p->fork = true;
-                    } else if (json["fork"] != false) {
-                        std::cout << path << std::endl;
+                    } else if (! m.forkKnown()) {
+                        std::cout << p->id << ": " << p->user << "/" << p->repo << std::endl;
                         assert(false);
                     }
-                    std::string jsonRepo = json["name"];
-                    std::string jsonUser = json["owner"]["login"];
-                    uint64_t jsonCreatedAt = iso8601ToTime(json["created_at"]);
+                    std::string jsonRepo = metadata_.str(m.name);
+                    std::string jsonUser = metadata_.str(m.owner);
+                    uint64_t jsonCreatedAt = m.createdAt;
                     // now store the project
                     std::string fullName = jsonUser + "/" + jsonRepo;
                     auto i = patchedProjects_.find(fullName);
@@ -347,6 +339,7 @@ namespace dejavu {
             }
 
         private:
+            MetadataTable metadata_;
             std::unordered_map<unsigned, Project *> projects_;
             std::unordered_map<std::string, Project *> patchedProjects_;
             size_t notPatched_ = 0;
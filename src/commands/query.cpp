@@ -0,0 +1,68 @@
+#include <algorithm>
+#include <iostream>
+#include <unordered_set>
+#include <vector>
+
+#include "../commands.h"
+#include "../postings_index.h"
+
+/** Answers ad-hoc questions about a single contents, path, or project from the postings indices (see build-postings-index).
+
+    Exactly one of the contents, path, or project ids must be given. All postings of the id, i.e. the file changes with that contents, path, or in that project, are printed to stdout as csv sorted by time so that the first occurrence comes first. A short summary (number of occurrences, projects and the first occurrence) is printed to stderr.
+
+    Only the two offsets of the requested id and its posting list are read from the index so that the query takes milliseconds even for the largest datasets.
+ */
+
+namespace dejavu {
+
+    namespace {
+
+        helpers::Option<unsigned> ContentsId("contents", 0, false);
+        helpers::Option<unsigned> PathId("path", 0, false);
+        helpers::Option<unsigned> ProjectId("project", 0, false);
+
+    } // anonymous namespace
+
+    void Query(int argc, char * argv[]) {
+        Settings.addOption(DataDir);
+        Settings.addOption(ContentsId);
+        Settings.addOption(PathId);
+        Settings.addOption(ProjectId);
+        Settings.parse(argc, argv);
+        Settings.check();
+
+        PostingsIndex::Key key;
+        unsigned id;
+        if (ContentsId.isSpecified() + PathId.isSpecified() + ProjectId.isSpecified() != 1)
+            ERROR("Exactly one of contents, path, or project must be specified");
+        if (ContentsId.isSpecified()) {
+            key = PostingsIndex::Key::Contents;
+            id = ContentsId.value();
+        } else if (PathId.isSpecified()) {
+            key = PostingsIndex::Key::Path;
+            id = PathId.value();
+        } else {
+            key = PostingsIndex::Key::Project;
+            id = ProjectId.value();
+        }
+
+        PostingsIndex index(key);
+        std::vector<Posting> postings = index.get(id);
+        std::stable_sort(postings.begin(), postings.end(), [](Posting const & a, Posting const & b) {
+                return a.time < b.time;
+            });
+        std::unordered_set<unsigned> projects;
+        std::cout << "projectId,commitId,pathId,contentsId,time" << std::endl;
+        for (Posting const & p : postings) {
+            std::cout << p.projectId << "," << p.commitId << "," << p.pathId << "," << p.contentsId << "," << p.time << std::endl;
+            projects.insert(p.projectId);
+        }
+        std::cerr << "    " << postings.size() << " occurrences" << std::endl;
+        std::cerr << "    " << projects.size() << " projects" << std::endl;
+        if (! postings.empty()) {
+            Posting const & first = postings.front();
+            std::cerr << "    first in project " << first.projectId << ", commit " << first.commitId << ", path " << first.pathId << " at " << first.time << std::endl;
+        }
+    }
+
+} // namespace dejavu
@@ -53,8 +53,7 @@ namespace dejavu {
                             helpers::EnsurePath(targetDir);
                             createdPaths.insert(p->id % 1000);
                         }
-                        auto ec = system(STR("cp " << source << " " << target).c_str());
-                        assert(ec = EXIT_SUCCESS);
+                        helpers::System(STR("cp " << source << " " << target));
                         ++translated;
                     }, false); // no headers
                 std::cout << "    " << errors <<  " errors" << std::endl;
@@ -13,6 +13,7 @@
 #include "../loaders.h"
 #include "../commands.h"
 #include "../commit_iterator.h"
+#include "../parallel_loader.h"
 
 namespace dejavu {
 
@@ -42,10 +43,9 @@ namespace dejavu {
                 return true;
             }
 
-            /** Checks all children of the commit, if we find a children that is older (i.e. lower time), then we change commit time accordingly.
-              */
-            unsigned fixTimes() {
-                unsigned result = 0;
+            /** Lowers the commit times to the minimum of its own times and those of its children, which must already be fixed. Returns true if the times changed.
+             */
+            bool fixTimes() {
                 uint64_t minTime1 = time;
                 uint64_t minTime2 = time2;
                 for (Commit * c : children) {
@@ -54,16 +54,11 @@ namespace dejavu {
                     if (c->time2 < minTime2)
                         minTime2 = c->time2;
                 }
-                if (minTime1 != time || minTime2 != time2) {
-                    result = 1;
-                    time = minTime1;
-                    time2 = minTime2;
-                    // and update all parents
-                    for (Commit * p : parents)
-                        result += p->fixTimes();
-                    result = 1;
-                }
-                return result;
+                if (minTime1 == time && minTime2 == time2)
+                    return false;
+                time = minTime1;
+                time2 = minTime2;
+                return true;
             }
             
         };
@@ -81,6 +76,8 @@ namespace dejavu {
         };
 
         /** Tracks known files in a project.
+
+            The state is copied at every branch and merged at every merge of the project's history and only holds the files of a single project, so a hash set is used rather than a (dataset wide) id set.
          */
         class ProjectState {
         public:
@@ -92,17 +89,13 @@ namespace dejavu {
             }
 
             void mergeWith(ProjectState const & other, Commit * c) {
-                for (auto i : other.files_)
-                    files_.insert(i);
+                files_.insert(other.files_.begin(), other.files_.end());
             }
 
             bool verifyCommit(Commit * c) {
-                for (auto i : c->deletions) {
-                    auto j = files_.find(i);
-                    if (j == files_.end())
+                for (auto i : c->deletions)
+                    if (! files_.erase(i))
                         return false;
-                    files_.erase(j);
-                }
                 for (auto i : c->changes)
                     files_.insert(i.first);
                 return true;
@@ -115,36 +108,40 @@ namespace dejavu {
          */
         class Verifier {
         public:
+            /** Loads projects, commits, commit parents and file changes concurrently and then links them together in parallel.
+             */
             void loadData() {
-                std::cerr << "Loading projects ... " << std::endl;
-                ProjectLoader{[this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
-                        if (id >= projects_.size())
-                            projects_.resize(id + 1);
-                        projects_[id] = new Project(id, user, repo, createdAt);
-                    }};
-                std::cerr << "Loading commits ... " << std::endl;
-                CommitLoader{[this](unsigned id, uint64_t authorTime, uint64_t committerTime){
-                        if (id >= commits_.size())
-                            commits_.resize(id + 1);
-                        commits_[id] = new Commit(id, authorTime, committerTime);
-                    }};
-                std::cerr << "Loading commit parents ... " << std::endl;
-                CommitParentsLoader{[this](unsigned id, unsigned parentId){
-                        Commit * c = commits_[id];
-                        Commit * p = commits_[parentId];
-                        assert(c != nullptr);
-                        assert(p != nullptr);
-                        c->addParent(p);
-                    }};
-                std::cerr << "Loading file changes ... " << std::endl;
-                FileChangeLoader{[this](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId){
-                        Project * p = projects_[projectId];
-                        Commit * c = commits_[commitId];
-                        assert(p != nullptr);
-                        assert(c != nullptr);
-                        p->addCommit(c);
-                        c->addChange(pathId, contentsId);
-                    }};
+                ParallelLoader::CommitParents parents;
+                ParallelLoader::FileChanges changes;
+                ParallelLoader loader;
+                loader.add("Loading projects", [this]() {
+                        ProjectLoader{[this](unsigned id, std::string const & user, std::string const & repo, uint64_t createdAt){
+                                if (id >= projects_.size())
+                                    projects_.resize(id + 1);
+                                projects_[id] = new Project(id, user, repo, createdAt);
+                            }};
+                    }).add("Loading commits", [this]() {
+                        CommitLoader{[this](unsigned id, uint64_t authorTime, uint64_t committerTime){
+                                if (id >= commits_.size())
+                                    commits_.resize(id + 1);
+                                commits_[id] = new Commit(id, authorTime, committerTime);
+                            }};
+                    }).add("Loading commit parents", [& parents]() {
+                        ParallelLoader::Load(parents);
+                    }).add("Loading file changes", [& changes]() {
+                        ParallelLoader::Load(changes);
+                    });
+                loader.run();
+                auto project = [this](unsigned id) { return projects_[id]; };
+                auto commit = [this](unsigned id) { return commits_[id]; };
+                loader.addPass("Linking commit parents", [&](unsigned thread, unsigned numThreads) {
+                        ParallelLoader::LinkParents(parents, commit, thread, numThreads);
+                    }).addPass("Linking file changes", [&](unsigned thread, unsigned numThreads) {
+                        ParallelLoader::LinkChanges(changes, project, commit, thread, numThreads);
+                    });
+                loader.run();
+                ParallelLoader::Release(parents);
+                ParallelLoader::Release(changes);
             }
 
             void verifyProjectStructure() {
@@ -180,41 +177,86 @@ namespace dejavu {
             }
 
             /** Instead of verifying that commit times make sense, we now attempt to fix them.
+
+                Each commit gets the minimum of its own times and the times of all its descendants, so that no commit is younger than any of its descendants. The times are fixed in a single sweep from the leaves of the commit graph to the roots, in which every commit is fixed only after all of its children have been. Connected components of the commit graph (i.e. projects and their forks) are independent and are processed in parallel.
+
+                Commits on a cycle in the commit parents (and their ancestors) never get all their children fixed. Such commits are left as they are and marked invalid, so that their projects are excluded when the timings are verified.
              */
             void fixCommitTimings() {
                 std::cerr << "Fixing commit times..." << std::endl;
-                size_t updates = 0;
-                for (Commit * c : commits_) {
-                    if (c == nullptr)
-                        continue;
-                    updates += c->fixTimes();
-                }
+                std::vector<std::vector<Commit *>> components = commitComponents();
+                std::cerr << "    " << components.size() << " connected components" << std::endl;
+                // number of children of each commit that have not been fixed yet
+                std::vector<unsigned> pending(commits_.size(), 0);
+                std::atomic<size_t> next(0);
+                std::atomic<size_t> updates(0);
+                std::atomic<size_t> cyclic(0);
+                std::vector<std::thread> threads;
+                for (unsigned stride = 0; stride < NumThreads.value(); ++stride)
+                    threads.push_back(std::thread([&, this]() {
+                        std::vector<Commit *> ready;
+                        while (true) {
+                            size_t i = next++;
+                            if (i >= components.size())
+                                return;
+                            for (Commit * c : components[i]) {
+                                pending[c->id] = c->children.size();
+                                if (c->children.empty())
+                                    ready.push_back(c);
+                            }
+                            size_t fixed = 0;
+                            size_t processed = 0;
+                            while (! ready.empty()) {
+                                Commit * c = ready.back();
+                                ready.pop_back();
+                                ++processed;
+                                if (c->fixTimes())
+                                    ++fixed;
+                                for (Commit * p : c->parents)
+                                    if (--pending[p->id] == 0)
+                                        ready.push_back(p);
+                            }
+                            updates += fixed;
+                            if (processed != components[i].size()) {
+                                for (Commit * c : components[i])
+                                    if (pending[c->id] != 0)
+                                        c->valid = false;
+                                cyclic += components[i].size() - processed;
+                            }
+                        }
+                    }));
+                for (auto & i : threads)
+                    i.join();
                 std::cerr << "    "  << updates << " updates to commit times made" << std::endl;
+                std::cerr << "    "  << cyclic << " commits on cycles in commit parents or their ancestors left unfixed" << std::endl;
             }
 
+            /** Commits are verified in parallel, then projects containing invalid commits are removed.
+             */
             void verifyCommitTimings() {
-                size_t failed = 0;
                 std::cerr << "Verifying commit timings ..." << std::endl;
-                for (Commit * c : commits_) {
-                    if (c == nullptr)
-                        continue;
-                    if (! c->verifyTimings())
+                std::atomic<size_t> failed(0);
+                std::vector<char> failedProjects(projects_.size(), false);
+                parallelFor(commits_.size(), [&, this](size_t i) {
+                    Commit * c = commits_[i];
+                    if (c != nullptr && ! c->verifyTimings())
                         ++failed;
-                }
+                });
                 std::cerr << "    " << failed << " failed commits" << std::endl;
-                for (size_t i = 0, e = projects_.size(); i != e; ++i) {
+                parallelFor(projects_.size(), [&, this](size_t i) {
                     Project * p = projects_[i];
                     if (p == nullptr)
-                        continue;
-                    bool valid = true;
+                        return;
                     for (Commit * c : p->commits)
                         if (! c->valid) {
-                            valid = false;
+                            failedProjects[i] = true;
                             break;
                         }
-                    if (!valid) {
+                });
+                for (size_t i = 0, e = projects_.size(); i != e; ++i) {
+                    if (failedProjects[i]) {
+                        failedTimings_.push_back(projects_[i]);
                         projects_[i] = nullptr;
-                        failedTimings_.push_back(p);
                     }
                 }
                 std::cerr << "    " << failedTimings_.size() << " affected projects" << std::endl;
@@ -229,58 +271,40 @@ namespace dejavu {
                 }
             }
 
+            /** Outputs the verified dataset as a view of the original one (see DatasetView).
+
+                The view selects the valid projects and their commits, whose file changes and commit parents are thus selected too. Since the commit times have been fixed, the commits are written in full to the view. If materialize is set, the view is then materialized.
+             */
             void outputResults() {
                 helpers::EnsurePath(OutputDir.value());
+                DatasetView view(DataDir.value());
                 {
-                    std::cerr << "Writing projects..." << std::endl;
-                    std::ofstream f(OutputDir.value() + "/projects.csv");
-                    f << "projectId,user,repo,createdAt" << std::endl;
-                    for (auto i : projects_) {
-                        if (i == nullptr)
-                            continue;
-                        f << i->id << "," << helpers::escapeQuotes(i->user) << "," << helpers::escapeQuotes(i->repo) << "," << i->createdAt << std::endl;
-                    }
+                    std::cerr << "Selecting projects..." << std::endl;
+                    view.projects = Selection();
+                    for (auto i : projects_)
+                        if (i != nullptr)
+                            view.projects.insert(i->id);
+                    std::cerr << "    " << view.projects.size() << " projects selected" << std::endl;
                 }
                 {
-                    std::cerr << "Writing commits..." << std::endl;
+                    std::cerr << "Selecting and writing commits..." << std::endl;
                     std::ofstream f(OutputDir.value() + "/commits.csv");
                     f << "commitId,authorTime,committerTime" << std::endl;
+                    view.commits = Selection();
                     for (auto i : commits_) {
                         if (i == nullptr)
                             continue;
                         if (! i->tainted)
                             continue;
+                        view.commits.insert(i->id);
                         f << i->id << "," << i->time << "," << i->time2 << std::endl;
                     }
+                    std::cerr << "    " << view.commits.size() << " commits selected" << std::endl;
                 }
-                {
-                    std::cerr << "Writing commit parents..." << std::endl;
-                    std::ofstream f(OutputDir.value() + "/commitParents.csv");
-                    f << "commitId,parentId" << std::endl;
-                    for (Commit * c : commits_) {
-                        if (c == nullptr)
-                            continue;
-                        if (! c->tainted)
-                            continue;
-                        for (Commit * p : c->parents)
-                            f << c->id << "," << p->id << std::endl;
-                    }
-                }
-                {
-                    std::cerr << "Writing file changes..." << std::endl;
-                    std::ofstream f(OutputDir.value() + "/fileChanges.csv");
-                    f << "projectId,commitId,pathId,contentsId" << std::endl;
-                    for (Project * p : projects_) {
-                        if (p == nullptr)
-                            continue;
-                        for (Commit * c : p->commits) {
-                            for (unsigned i : c->deletions)
-                                f << p->id << "," << c->id << "," << i << "," << FILE_DELETED << std::endl;
-                            for (auto i : c->changes)
-                                f << p->id << "," << c->id << "," << i.first << "," << i.second << std::endl;
-                        }
-                    }
-                }
+                std::cerr << "Writing dataset view..." << std::endl;
+                view.write(OutputDir.value());
+                if (Materialize.value())
+                    DatasetView::Materialize(OutputDir.value());
             }
 
             void outputErrors() {
@@ -309,18 +333,71 @@ namespace dejavu {
                 }
             }
 
-            /** Creates symlinks for non-filtered files from the original dataset to the verified one to save disk space.
+        private:
+
+            /** Splits the commits into the connected components of the commit graph, largest components first.
              */
-            void createSymlinks() {
-                std::cerr << "Creating symlinks..." << std::endl;
-                helpers::System(STR("ln -s " << DataDir.value() + "/paths.csv " << OutputDir.value() << "/paths.csv"));
-                helpers::System(STR("ln -s " << DataDir.value() + "/hashes.csv " << OutputDir.value() << "/hashes.csv"));
-                // TODO do we want more symlinks?
+            std::vector<std::vector<Commit *>> commitComponents() {
+                // union-find over commit ids
+                std::vector<unsigned> parent(commits_.size());
+                for (size_t i = 0; i < parent.size(); ++i)
+                    parent[i] = i;
+                auto find = [&parent](unsigned x) {
+                    while (parent[x] != x) {
+                        parent[x] = parent[parent[x]];
+                        x = parent[x];
+                    }
+                    return x;
+                };
+                for (Commit * c : commits_) {
+                    if (c == nullptr)
+                        continue;
+                    for (Commit * p : c->parents) {
+                        unsigned a = find(c->id);
+                        unsigned b = find(p->id);
+                        if (a != b)
+                            parent[std::max(a, b)] = std::min(a, b);
+                    }
+                }
+                std::vector<unsigned> index(commits_.size(), 0);
+                std::vector<std::vector<Commit *>> result;
+                for (Commit * c : commits_) {
+                    if (c == nullptr)
+                        continue;
+                    unsigned root = find(c->id);
+                    if (root == c->id) {
+                        index[root] = result.size();
+                        result.push_back(std::vector<Commit *>());
+                    }
+                }
+                for (Commit * c : commits_)
+                    if (c != nullptr)
+                        result[index[find(c->id)]].push_back(c);
+                std::stable_sort(result.begin(), result.end(), [](std::vector<Commit *> const & a, std::vector<Commit *> const & b) {
+                    return a.size() > b.size();
+                });
+                return result;
             }
 
-
-        private:
-
+            /** Calls the handler for all indices from 0 to n in parallel.
+             */
+            void parallelFor(size_t n, std::function<void(size_t)> const & handler) {
+                size_t const batch = 10000;
+                std::atomic<size_t> next(0);
+                std::vector<std::thread> threads;
+                for (unsigned stride = 0; stride < NumThreads.value(); ++stride)
+                    threads.push_back(std::thread([&]() {
+                        while (true) {
+                            size_t first = next.fetch_add(batch);
+                            if (first >= n)
+                                return;
+                            for (size_t i = first, e = std::min(first + batch, n); i < e; ++i)
+                                handler(i);
+                        }
+                    }));
+                for (auto & i : threads)
+                    i.join();
+            }
 
             bool verifyProjectStructure(Project * p) {
                 bool valid = true;
@@ -361,6 +438,7 @@ namespace dejavu {
         Settings.addOption(DataDir);
         Settings.addOption(OutputDir);
         Settings.addOption(NumThreads);
+        Settings.addOption(Materialize);
         Settings.parse(argc, argv);
         Settings.check();
 
@@ -371,7 +449,6 @@ namespace dejavu {
         v.verifyCommitTimings();
         v.outputResults();
         v.outputErrors();
-        v.createSymlinks();
     }
     
 } // namespace dejavu
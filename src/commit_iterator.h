@@ -1,13 +1,43 @@
 #pragma once
 #include <type_traits>
 #include <functional>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <assert.h>
 
 namespace dejavu {
 
 
 
+    /** Merges the states which arrived at a merge commit from its parents (or the initial snapshots) into a single item for the merge commit.
+
+        The states arrive in whatever order the branches happen to be walked, which depends on the commits the walk contains and, for the parallel iterator, on the scheduling of its threads. Since mergeWith() is not necessarily commutative (e.g. it keeps the file of the state merged first), the items are ordered first, initial snapshots in the order given and then parents by their ids. The first item is reused for the merge commit and the states of the others are merged into it in order and deleted.
+     */
+    template<typename COMMIT, typename ITEM>
+    ITEM * MergeInParentOrder(COMMIT * c, std::vector<std::pair<COMMIT *, ITEM *>> & incomming) {
+        assert(! incomming.empty());
+        std::stable_sort(incomming.begin(), incomming.end(), [](std::pair<COMMIT *, ITEM *> const & a, std::pair<COMMIT *, ITEM *> const & b) {
+                if (a.first == nullptr || b.first == nullptr)
+                    return a.first == nullptr && b.first != nullptr;
+                return a.first->id < b.first->id;
+            });
+        ITEM * result = incomming.front().second;
+        result->c = c;
+        for (size_t i = 1; i < incomming.size(); ++i) {
+            result->s.mergeWith(incomming[i].second->s, c);
+            delete incomming[i].second;
+        }
+        incomming.clear();
+        return result;
+    }
+
     /** Commit:
+            - id field
             - numParentCommits function
             - childrenCommits() function returning container of the commits children
 
@@ -15,10 +45,14 @@ namespace dejavu {
            - hasCommit()
            - commitsBegin(), commitsEnd()
 
+        The last commit handler, if set, is called with the state after the commit has been handled for every commit without any children. When set with projectHeads, it is called for every head of the project instead, i.e. every commit without children in the project, which includes the commits whose children only belong to forks of the project.
+
         State :
             - default constructor
             - deep copy constructor
             - mergeWiTH(const &) method
+
+        The states of the parents of a merge commit are merged in the order of the parent ids (see MergeInParentOrder), so the state at a commit does not depend on the order in which the branches are walked.
      */
 
     template<typename PROJECT, typename COMMIT, typename STATE>
@@ -38,29 +72,37 @@ namespace dejavu {
             }
         }
 
+        /** Creates the iterator which starts at the given commits instead of the initial commits of the project.
+
+            Each initial commit comes with a snapshot of the state *before* the commit, i.e. the state the handler would normally see for it. Only commits reachable from the initial commits are visited and merge commits wait only for those of their parents which are visited as well. If an initial commit is itself reachable from other initial commits, its snapshot is merged with the states of its visited parents.
+         */
+        CommitForwardIterator(PROJECT * p, Handler h, std::vector<std::pair<COMMIT *, STATE>> const & initial):
+            p_(p),
+            handler_(h) {
+            calculateIncommingEdges(initial);
+            // the same commit may be given multiple times, its snapshots are then merged
+            for (auto const & i : initial)
+                if (p->hasCommit(i.first))
+                    arrive(i.first, nullptr, new QueueItem(i.first, i.second));
+        }
+
         ~CommitForwardIterator() {
             for (auto i : q_)
                 delete i;
-            for (auto i : pending_)
-                delete i.second;
+            for (auto & i : pending_)
+                for (auto & j : i.second)
+                    delete j.second;
         }
 
-        /*
-        void addInitialCommit(COMMIT * c) {
-            QueueItem * qi = new QueueItem(c, STATE());
-            assert(qi->merges == 0);
-            q_.push_back(qi);
-            } */
-
-        void setLastCommitHandler(Handler h) {
+        void setLastCommitHandler(Handler h, bool projectHeads = false) {
             lastCommitHandler_ = h;
+            projectHeads_ = projectHeads;
         }
 
         void process() {
             while (!q_.empty()) {
                 QueueItem * current = q_.back();
                 q_.pop_back();
-                assert(current->merges == 0); // if merges is greater than 0 the commit is not ready to be processed
                 // call the handler
                 bool cont = handler_(current->c, current->s);
                 // if we are not to continue, delete the queue item and do not schedule its offsprings, otherwise add all children of the current commit to the queue, or pending lists
@@ -79,84 +121,410 @@ namespace dejavu {
         struct QueueItem {
             COMMIT * c;
             STATE s;
-            unsigned merges;
 
             QueueItem(COMMIT * c, STATE const & s):
                 c(c),
-                s(s),
-                merges(c->numParentCommits() == 0 ? 0 : c->numParentCommits() - 1) {
+                s(s) {
             }
+        };
 
-            void replaceCommit(COMMIT * newC) {
-                c = newC;
-                merges = c->numParentCommits() - 1;
+        /** Returns the number of states the given commit must wait for before it can be processed.
+
+            Unless the iteration started from given commits, this is simply the number of its parents.
+         */
+        unsigned numIncomming(COMMIT * c) const {
+            if (incomming_.empty())
+                return c->numParentCommits();
+            auto i = incomming_.find(c);
+            assert(i != incomming_.end());
+            return i->second;
+        }
+
+        /** Determines all commits reachable from the initial ones and for each of them the number of visited parents, counting the snapshots of initial commits as extra parents.
+         */
+        void calculateIncommingEdges(std::vector<std::pair<COMMIT *, STATE>> const & initial) {
+            std::vector<COMMIT *> q;
+            for (auto const & i : initial) {
+                if (! p_->hasCommit(i.first))
+                    continue;
+                if (++incomming_[i.first] == 1)
+                    q.push_back(i.first);
             }
+            std::unordered_set<COMMIT *> visited(q.begin(), q.end());
+            while (! q.empty()) {
+                COMMIT * c = q.back();
+                q.pop_back();
+                for (COMMIT * child : c->childrenCommits()) {
+                    if (!p_->hasCommit(child))
+                        continue;
+                    ++incomming_[child];
+                    if (visited.insert(child).second)
+                        q.push_back(child);
+                }
+            }
+        }
+
+        /** Schedules the children of the given item which belong to the project.
+
+            If the commit has no children (or no children in the project when asked for project heads), the last commit handler is called. 
+         */
+        void addChildren(QueueItem * i) {
+            bool isLast = projectHeads_ || i->c->childrenCommits().empty();
+            COMMIT * reuse = nullptr;
+            for (COMMIT * child : i->c->childrenCommits()) {
+                if (!p_->hasCommit(child))
+                    continue;
+                isLast = false;
+                // the first child reuses the current item & state, all others get a copy
+                if (reuse == nullptr)
+                    reuse = child;
+                else
+                    arrive(child, i->c, new QueueItem(child, i->s));
+            }
+            if (isLast && lastCommitHandler_)
+                lastCommitHandler_(i->c, i->s);
+            // the reuse must happen only after all copies have been made as the state may be merged into once the item arrives
+            if (reuse == nullptr)
+                delete i;
+            else
+                arrive(reuse, i->c, i);
+        }
 
-            void  mergeState(STATE const & incomming) {
-                s.mergeWith(incomming, c);
-                --merges;
+        /** Called when the state from given parent (or initial snapshot if the parent is nullptr) arrives at the commit.
+
+            The commit is scheduled once the states from all its parents arrived, merged in the order of parent ids.
+         */
+        void arrive(COMMIT * c, COMMIT * from, QueueItem * i) {
+            unsigned incomming = numIncomming(c);
+            if (incomming <= 1) {
+                i->c = c;
+                q_.push_back(i);
+                return;
+            }
+            auto & states = pending_[c];
+            states.push_back(std::make_pair(from, i));
+            if (states.size() == incomming) {
+                q_.push_back(MergeInParentOrder(c, states));
+                pending_.erase(c);
             }
+        }
+
+
+        PROJECT * p_;
+        Handler handler_;
+        Handler lastCommitHandler_;
+        bool projectHeads_ = false;
+        
+        std::vector<QueueItem *> q_;
+
+        // items of merge commits which are still waiting for the states of some of their parents, with the parents they came from
+        std::unordered_map<COMMIT *, std::vector<std::pair<COMMIT *, QueueItem *>>> pending_;
+
+        // number of incomming states per commit when the iteration does not start at the initial commits of the project
+        std::unordered_map<COMMIT *, unsigned> incomming_;
+        
+    };
+
+    
+    /** Parallel version of the CommitForwardIterator intended for very large projects.
+
+        Has the same requirements on the project, commits and state as the CommitForwardIterator and calls the handlers with identical semantics, only once the history forks, independent branches are analyzed concurrently by the given number of threads. The threads only synchronize when the work queue is accessed and at merge commits, where the states of all parents must be merged before the merge commit itself can be processed. 
+
+        Since the handler and the last commit handler may be called concurrently for different commits of the same project, they must be thread safe with respect to any data they share outside the state they are given. The mergeWith() method of the state is always called under a lock. 
+     */
+    template<typename PROJECT, typename COMMIT, typename STATE>
+    class ParallelCommitForwardIterator {
+    public:
+
+        typedef std::function<bool(COMMIT * c, STATE & s)> Handler;
+
+        ParallelCommitForwardIterator(PROJECT * p, Handler h, unsigned numThreads):
+            p_(p),
+            handler_(h),
+            numThreads_(numThreads == 0 ? 1 : numThreads),
+            active_(0) {
+            for (auto i = p->commitsBegin(), e = p->commitsEnd(); i != e; ++i) {
+                if ((*i)->numParentCommits() == 0) {
+                    QueueItem * qi = new QueueItem(*i, STATE());
+                    q_.push_back(qi);
+                }
+            }
+        }
+
+        ~ParallelCommitForwardIterator() {
+            for (auto i : q_)
+                delete i;
+            for (auto & i : pending_)
+                for (auto & j : i.second)
+                    delete j.second;
+        }
+
+        void setLastCommitHandler(Handler h, bool projectHeads = false) {
+            lastCommitHandler_ = h;
+            projectHeads_ = projectHeads;
+        }
+
+        void process() {
+            std::vector<std::thread> threads;
+            for (unsigned i = 0; i < numThreads_; ++i)
+                threads.push_back(std::thread([this]() {
+                    worker();
+                }));
+            for (auto & i : threads)
+                i.join();
+        }
+
+    private:
 
-            
+        struct QueueItem {
+            COMMIT * c;
+            STATE s;
 
+            QueueItem(COMMIT * c, STATE const & s):
+                c(c),
+                s(s) {
+            }
         };
 
-        void addChildren(QueueItem * i) {
-            // get the children of current commit, if there are no current children, detete the queue item
-            auto children = i->c->childrenCommits();
-            bool shouldDelete = true;
-            if (! children.empty()) {
-                //otherwise for each child
-                bool canReuse = true;
-                for (COMMIT * child : i->c->childrenCommits()) {
-                    if (!p_->hasCommit(child))
-                        continue;
-                    // first see if the child is staged in pending
-                    auto j = pending_.find(child);
-                    if (j != pending_.end()) {
-                        QueueItem * qi = j->second;
-                        qi->mergeState(i->s);
-                        if (qi->merges == 0) {
-                            pending_.erase(j);
-                            schedule(qi);
-                        }
-                    // otherwise either reuse current item & state for the queued commit, or create a new one and schedule it
-                    } else {
-                        if (canReuse) {
-                            canReuse = false;
-                            i->replaceCommit(child);
-                            schedule(i);
-                            shouldDelete = false;
-                        } else {
-                            schedule(new QueueItem(child, i->s));
+        /** Takes items from the queue and processes them until the entire history has been analyzed.
+
+            Once a thread obtains an item, it keeps following the first child of the commit on its own so that linear histories do not touch the shared queue at all. The analysis is done when the queue is empty and no thread is processing any commit, as only the processing threads may schedule new commits.
+         */
+        void worker() {
+            QueueItem * current = nullptr;
+            while (true) {
+                if (current == nullptr) {
+                    std::unique_lock<std::mutex> g(mQueue_);
+                    cv_.wait(g, [this]() {
+                        return ! q_.empty() || active_ == 0;
+                    });
+                    if (q_.empty())
+                        return;
+                    current = q_.back();
+                    q_.pop_back();
+                    ++active_;
+                }
+                bool cont = handler_(current->c, current->s);
+                if (cont) {
+                    current = addChildren(current);
+                } else {
+                    delete current;
+                    current = nullptr;
+                }
+                if (current == nullptr) {
+                    std::lock_guard<std::mutex> g(mQueue_);
+                    --active_;
+                    if (active_ == 0 && q_.empty())
+                        cv_.notify_all();
+                }
+            }
+        }
+
+        /** Schedules the children of given item and returns the item the current thread should continue with, or nullptr if there is none.
+
+            Merge commits get a copy of the state, which is always staged in the pending map under a lock until the states of all their parents arrive and are merged in the order of parent ids into a single item. Of the remaining children, the first one reuses the current item (and is returned), all others get a copy of the state and are added to the queue. The reuse must happen only after all copies have been made as the state is not ours anymore once scheduled.
+         */
+        QueueItem * addChildren(QueueItem * i) {
+            bool isLast = projectHeads_ || i->c->childrenCommits().empty();
+            COMMIT * reuse = nullptr;
+            for (COMMIT * child : i->c->childrenCommits()) {
+                if (!p_->hasCommit(child))
+                    continue;
+                isLast = false;
+                if (child->numParentCommits() > 1) {
+                    QueueItem * copy = new QueueItem(child, i->s);
+                    QueueItem * ready = nullptr;
+                    {
+                        std::lock_guard<std::mutex> g(mPending_);
+                        auto & states = pending_[child];
+                        states.push_back(std::make_pair(i->c, copy));
+                        if (states.size() == child->numParentCommits()) {
+                            ready = MergeInParentOrder(child, states);
+                            pending_.erase(child);
                         }
                     }
+                    if (ready != nullptr)
+                        schedule(ready);
+                } else if (reuse == nullptr) {
+                    reuse = child;
+                } else {
+                    schedule(new QueueItem(child, i->s));
                 }
-            } else {
-                if (lastCommitHandler_)
-                    lastCommitHandler_(i->c, i->s);
             }
-            if (shouldDelete)
+            if (isLast && lastCommitHandler_)
+                lastCommitHandler_(i->c, i->s);
+            if (reuse == nullptr) {
                 delete i;
+                return nullptr;
+            }
+            i->c = reuse;
+            return i;
         }
 
         void schedule(QueueItem * i) {
-            if (i->merges == 0)
-                q_.push_back(i);
-            else
-                pending_.insert(std::make_pair(i->c, i));
+            std::lock_guard<std::mutex> g(mQueue_);
+            q_.push_back(i);
+            cv_.notify_one();
         }
 
-
         PROJECT * p_;
         Handler handler_;
         Handler lastCommitHandler_;
-        
+        bool projectHeads_ = false;
+        unsigned numThreads_;
+
         std::vector<QueueItem *> q_;
+        unsigned active_;
+        std::mutex mQueue_;
+        std::condition_variable cv_;
 
-        std::unordered_map<COMMIT *, QueueItem *> pending_;
-        
+        // items of merge commits which are still waiting for the states of some of their parents, with the parents they came from
+        std::unordered_map<COMMIT *, std::vector<std::pair<COMMIT *, QueueItem *>>> pending_;
+        std::mutex mPending_;
     };
 
+
+
+    /** A group of projects which share commits, such as a project and its forks, presented to the commit iterators as a single project.
+
+        The state at any commit depends only on the commit and its ancestors, which are the same in every project containing the commit. Walking the union of the histories of all projects in the family therefore calculates the state of the shared history only once and each fork simply continues from the commit where it diverged from the rest of the family, with the state calculated for the shared prefix. The handler uses projectsOf() to attribute any per-project results of a commit to all projects whose own walk would visit it.
+
+        A commit is visited by the walk of a project if the project contains the commit and all its parents are visited by the walk of the project as well, which is exactly the set of commits the iterators visit when given the project alone. The last commit handler is called for the heads of the family, not of the individual projects.
+
+        Commits must have an `id` field for the grouping of projects into families.
+
+        The projects visiting a commit are not stored per commit. All commits of the shared history are visited by the same projects, and so are all commits of a fork after it diverged, so each commit only stores the index of its set of projects and every distinct set is stored once. The memory is one index per commit of the family plus the distinct sets, whose number grows with the number of points where the histories of the members diverge, not with the number of commits.
+     */
+    template<typename PROJECT, typename COMMIT>
+    class ProjectFamily {
+    public:
+
+        typedef typename std::vector<COMMIT *>::iterator iterator;
+
+        ProjectFamily(std::vector<PROJECT *> const & members):
+            members_(members),
+            sets_(1) {
+            for (size_t i = 0; i < members.size(); ++i)
+                addVisitedCommits(i);
+            commits_.reserve(setOf_.size());
+            for (auto const & i : setOf_)
+                commits_.push_back(i.first);
+        }
+
+        /** Groups the given projects into families of projects sharing at least one commit.
+
+            Projects which do not share any commits with others form families of their own, null projects are ignored. The members of each family, as well as the families themselves, are ordered as the projects given. 
+         */
+        static std::vector<std::vector<PROJECT *>> Find(std::vector<PROJECT *> const & projects) {
+            std::vector<size_t> parent(projects.size());
+            for (size_t i = 0; i < parent.size(); ++i)
+                parent[i] = i;
+            // each commit remembers the first project containing it, any other project containing it is joined with that project
+            size_t const none = projects.size();
+            std::vector<size_t> owner;
+            for (size_t i = 0; i < projects.size(); ++i) {
+                PROJECT * p = projects[i];
+                if (p == nullptr)
+                    continue;
+                for (auto ci = p->commitsBegin(), ce = p->commitsEnd(); ci != ce; ++ci) {
+                    unsigned id = (*ci)->id;
+                    if (id >= owner.size())
+                        owner.resize(id + 1, none);
+                    if (owner[id] == none)
+                        owner[id] = i;
+                    else
+                        parent[Root(parent, i)] = Root(parent, owner[id]);
+                }
+            }
+            std::vector<std::vector<PROJECT *>> result;
+            std::unordered_map<size_t, size_t> families;
+            for (size_t i = 0; i < projects.size(); ++i) {
+                if (projects[i] == nullptr)
+                    continue;
+                auto f = families.insert(std::make_pair(Root(parent, i), result.size()));
+                if (f.second)
+                    result.push_back(std::vector<PROJECT *>());
+                result[f.first->second].push_back(projects[i]);
+            }
+            return result;
+        }
+
+        std::vector<PROJECT *> const & members() const {
+            return members_;
+        }
+
+        size_t numCommits() const {
+            return commits_.size();
+        }
+
+        /** Returns the projects whose walk visits the given commit.
+         */
+        std::vector<PROJECT *> const & projectsOf(COMMIT * c) const {
+            auto i = setOf_.find(c);
+            assert(i != setOf_.end());
+            return sets_[i->second];
+        }
+
+        bool hasCommit(COMMIT * c) const {
+            return setOf_.find(c) != setOf_.end();
+        }
+
+        iterator commitsBegin() {
+            return commits_.begin();
+        }
+
+        iterator commitsEnd() {
+            return commits_.end();
+        }
+
+    private:
+
+        static size_t Root(std::vector<size_t> & parent, size_t i) {
+            while (parent[i] != i) {
+                parent[i] = parent[parent[i]];
+                i = parent[i];
+            }
+            return i;
+        }
+
+        /** Adds the given member to all commits its walk visits.
+
+            Members are added in order, so the sets are extended by one project at a time and the set a commit moves to only depends on its current set and the member, which is remembered so that all commits of the same set move to the same new set.
+         */
+        void addVisitedCommits(size_t member) {
+            PROJECT * p = members_[member];
+            std::unordered_map<unsigned, unsigned> extended;
+            std::unordered_map<COMMIT *, unsigned> arrived;
+            std::vector<COMMIT *> q;
+            for (auto i = p->commitsBegin(), e = p->commitsEnd(); i != e; ++i)
+                if ((*i)->numParentCommits() == 0)
+                    q.push_back(*i);
+            while (! q.empty()) {
+                COMMIT * c = q.back();
+                q.pop_back();
+                unsigned & set = setOf_[c];
+                auto i = extended.find(set);
+                if (i == extended.end()) {
+                    i = extended.insert(std::make_pair(set, sets_.size())).first;
+                    sets_.push_back(sets_[set]);
+                    sets_.back().push_back(p);
+                }
+                set = i->second;
+                for (COMMIT * child : c->childrenCommits()) {
+                    if (! p->hasCommit(child))
+                        continue;
+                    if (++arrived[child] == child->numParentCommits())
+                        q.push_back(child);
+                }
+            }
+        }
+
+        std::vector<PROJECT *> members_;
+        std::vector<COMMIT *> commits_;
+        // distinct sets of projects visiting a commit, the first one is empty
+        std::vector<std::vector<PROJECT *>> sets_;
+        // commit -> index of its set of projects
+        std::unordered_map<COMMIT *, unsigned> setOf_;
+    };
     
 } // namespace dejavu
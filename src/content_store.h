@@ -0,0 +1,718 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "helpers/helpers.h"
+
+namespace dejavu {
+
+    /** Storage of file contents in append-only pack files.
+
+        Storing each downloaded file in its own file leaves us with millions of tiny files whose filesystem metadata is more expensive than the data itself. The content store instead appends the contents to large pack files and keeps an index from contents ids to their location in the packs. The store directory contains:
+
+        pack-NNNNN.bin files, each starting with a magic string followed by records:
+
+            RECORD := RECORD_MAGIC contentsId flags storedSize size check { byte }
+
+        where the header values are 32bit unsigned integers, size is the original size of the contents and storedSize the number of bytes that follow the header (smaller than size if the contents is compressed, as indicated by flags). The check is a hash of the preceding header values, so that together with the magic a header can be told apart from unwritten space, or a partially written header, and from data of other records.
+
+        packs.idx, which starts with a magic string followed by an IndexRecord for each stored contents, in the order in which they were added.
+
+        The index is loaded in memory when the store is opened so that checking which contents we already have does not touch the filesystem at all. Records are always written to the pack before their index entries and the index is only flushed periodically, so when the store is opened for writing, any records at the end of the last pack which are missing from the index are indexed again and incomplete records are truncated. A store interrupted at any point is thus consistent when reopened.
+
+        Adding contents only reserves the space for its record at the end of the pack under the lock, the record itself is written outside of it so that concurrent writers do not wait for each other's I/O. The data of a record is written before its header, so a record whose writing has been interrupted has no valid header. As the records reserved after it by other writers may have been completed, the recovery then scans forward for the next valid header and only truncates the pack after the last valid record. The space of the interrupted record is left unused.
+
+        Contents can optionally be compressed with zlib (if the tool is built with it). Compressed contents are only stored if they are actually smaller than the original.
+
+        Contents which arrive in pieces, such as downloaded files, can be added with a Writer, which keeps only small contents in memory.
+
+        Adding contents is thread safe. Reading can be done concurrently with other reads and writes.
+     */
+    class ContentStore {
+    public:
+
+        /** Compression flag of a record.
+         */
+        static constexpr uint32_t COMPRESSED = 1;
+
+        /** First value of each record header, never zero so that unwritten space is not mistaken for a record.
+         */
+        static constexpr uint32_t RECORD_MAGIC = 0x4b43524a;
+
+        static constexpr size_t MAGIC_SIZE = 8;
+
+        /** Packs are rotated after they grow beyond this size.
+         */
+        static constexpr uint64_t PACK_SIZE = 4ull * 1024 * 1024 * 1024;
+
+        /** Number of index records buffered in memory before they are written to the index file.
+         */
+        static constexpr size_t INDEX_BUFFER = 1024;
+
+        /** Contents written by a Writer larger than this are moved from memory to a temporary file.
+         */
+        static constexpr size_t STREAM_BUFFER = 256 * 1024;
+
+        /** Size of the buffer used when copying contents from files.
+         */
+        static constexpr size_t COPY_BUFFER = 1024 * 1024;
+
+        static char const * PackMagic() {
+            return "DJVPACK2";
+        }
+
+        static char const * IndexMagic() {
+            return "DJVPIDX1";
+        }
+
+        static std::string IndexFile(std::string const & dir) {
+            return dir + "/packs.idx";
+        }
+
+        static std::string PackFile(std::string const & dir, unsigned pack) {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "/pack-%05u.bin", pack);
+            return dir + buffer;
+        }
+
+        /** Returns true if the tool can compress contents.
+         */
+        static bool CompressionSupported() {
+#ifdef HAVE_ZLIB
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        /** Location of stored contents.
+         */
+        class Entry {
+        public:
+            uint32_t pack;
+            uint32_t flags;
+            uint64_t offset;
+            uint32_t storedSize;
+            uint32_t size;
+        };
+
+        /** Opens the content store in given directory.
+
+            If the store is opened for writing, the directory and the store are created if they do not exist and the end of the last pack is recovered if necessary. If compress is true, added contents are compressed.
+         */
+        ContentStore(std::string const & dir, bool writable = false, bool compress = false):
+            dir_(dir),
+            writable_(writable),
+            compress_(compress),
+            indexFd_(-1) {
+            if (compress_ && ! CompressionSupported())
+                ERROR("Compression of contents requested, but the tool was built without zlib");
+            if (writable_)
+                helpers::EnsurePath(dir_);
+            loadIndex();
+            openPacks();
+            if (writable_) {
+                recoverLastPack();
+                openIndexForWriting();
+            }
+        }
+
+        ContentStore(ContentStore const &) = delete;
+
+        ~ContentStore() {
+            close();
+        }
+
+        /** Writes any buffered index records and closes the store.
+         */
+        void close() {
+            std::lock_guard<std::mutex> g(m_);
+            if (indexFd_ != -1) {
+                flushIndex();
+                ::close(indexFd_);
+                indexFd_ = -1;
+            }
+            for (int fd : packs_)
+                ::close(fd);
+            packs_.clear();
+        }
+
+        /** Number of stored contents.
+         */
+        size_t size() const {
+            std::lock_guard<std::mutex> g(m_);
+            return index_.size();
+        }
+
+        /** Returns true if the store has the given contents.
+         */
+        bool contains(unsigned contentsId) const {
+            std::lock_guard<std::mutex> g(m_);
+            return index_.find(contentsId) != index_.end();
+        }
+
+        /** Checks which of the given contents are in the store at once, returning a flag for each of them.
+         */
+        std::vector<bool> contains(std::vector<unsigned> const & contentsIds) const {
+            std::vector<bool> result(contentsIds.size());
+            std::lock_guard<std::mutex> g(m_);
+            for (size_t i = 0, e = contentsIds.size(); i != e; ++i)
+                result[i] = index_.find(contentsIds[i]) != index_.end();
+            return result;
+        }
+
+        /** Adds the contents to the store, returns false if the contents is already stored.
+         */
+        bool add(unsigned contentsId, char const * data, size_t size) {
+            std::string compressed;
+            if (compress_ && Compress(data, size, compressed))
+                return append(contentsId, COMPRESSED, compressed.data(), compressed.size(), size);
+            return append(contentsId, 0, data, size, size);
+        }
+
+        bool add(unsigned contentsId, std::string const & contents) {
+            return add(contentsId, contents.data(), contents.size());
+        }
+
+        /** Contents added to the store piece by piece.
+
+            The data are collected in memory until they grow over STREAM_BUFFER bytes, after which they are moved to an unnamed temporary file in the store directory and any further data is appended to the file. Nothing is added to the store until commit() is called, so a writer which is destroyed without being committed leaves the store intact.
+         */
+        class Writer {
+        public:
+            Writer(ContentStore & store, unsigned contentsId):
+                store_(store),
+                contentsId_(contentsId),
+                fd_(-1),
+                size_(0) {
+            }
+
+            Writer(Writer const &) = delete;
+
+            ~Writer() {
+                if (fd_ != -1)
+                    ::close(fd_);
+            }
+
+            size_t size() const {
+                return size_;
+            }
+
+            void write(char const * data, size_t size) {
+                if (fd_ == -1) {
+                    if (buffer_.size() + size <= STREAM_BUFFER) {
+                        buffer_.append(data, size);
+                        size_ += size;
+                        return;
+                    }
+                    fd_ = store_.createTempFile();
+                    WriteFully(fd_, buffer_.data(), buffer_.size(), 0);
+                    std::string().swap(buffer_);
+                }
+                WriteFully(fd_, data, size, size_);
+                size_ += size;
+            }
+
+            /** Adds the written contents to the store, returns false if the contents is already stored.
+             */
+            bool commit() {
+                if (fd_ == -1)
+                    return store_.add(contentsId_, buffer_);
+                return store_.addFile(contentsId_, fd_, size_);
+            }
+
+        private:
+            ContentStore & store_;
+            unsigned contentsId_;
+            std::string buffer_;
+            int fd_;
+            size_t size_;
+        };
+
+        /** Reads the given contents, returns false if the contents is not in the store.
+         */
+        bool get(unsigned contentsId, std::string & into) const {
+            Entry e;
+            int fd;
+            {
+                std::lock_guard<std::mutex> g(m_);
+                auto i = index_.find(contentsId);
+                if (i == index_.end())
+                    return false;
+                e = i->second;
+                fd = packs_[e.pack];
+            }
+            read(fd, e, into);
+            return true;
+        }
+
+        /** Calls the handler for all stored contents.
+
+            The contents are read in the order in which they are stored in the packs, which for large stores is much faster than reading them in random order.
+         */
+        void forEach(std::function<void(unsigned, std::string const &)> handler) const {
+            std::vector<std::pair<unsigned, Entry>> entries;
+            std::vector<int> fds;
+            {
+                std::lock_guard<std::mutex> g(m_);
+                entries.assign(index_.begin(), index_.end());
+                fds = packs_;
+            }
+            std::sort(entries.begin(), entries.end(), [](std::pair<unsigned, Entry> const & a, std::pair<unsigned, Entry> const & b) {
+                    return a.second.pack < b.second.pack || (a.second.pack == b.second.pack && a.second.offset < b.second.offset);
+                });
+            std::string contents;
+            for (auto const & i : entries) {
+                read(fds[i.second.pack], i.second, contents);
+                handler(i.first, contents);
+            }
+        }
+
+    private:
+
+        /** Record of the index file.
+         */
+        struct IndexRecord {
+            uint32_t contentsId;
+            uint32_t pack;
+            uint32_t flags;
+            uint32_t storedSize;
+            uint32_t size;
+            uint32_t reserved;
+            uint64_t offset;
+        };
+
+        /** Header of a record in the pack.
+         */
+        struct RecordHeader {
+            uint32_t magic;
+            uint32_t contentsId;
+            uint32_t flags;
+            uint32_t storedSize;
+            uint32_t size;
+            uint32_t check;
+        };
+
+        static constexpr size_t RECORD_HEADER_SIZE = sizeof(RecordHeader);
+
+        /** FNV-1a hash of the header values preceding the check.
+         */
+        static uint32_t HeaderCheck(RecordHeader const & h) {
+            uint32_t values[5] = { h.magic, h.contentsId, h.flags, h.storedSize, h.size };
+            uint32_t result = 2166136261u;
+            for (uint32_t v : values) {
+                for (unsigned i = 0; i < 4; ++i) {
+                    result ^= (v >> (i * 8)) & 0xff;
+                    result *= 16777619u;
+                }
+            }
+            return result;
+        }
+
+        /** Returns true if the header is a complete header of a record which fits in the pack of given size.
+         */
+        static bool ValidHeader(RecordHeader const & h, uint64_t offset, uint64_t fileSize) {
+            return h.magic == RECORD_MAGIC && h.check == HeaderCheck(h) && offset + RECORD_HEADER_SIZE + h.storedSize <= fileSize;
+        }
+
+        /** Returns the offset of the first valid record header at or after from, or fileSize if there is none.
+         */
+        static uint64_t FindRecord(int fd, uint64_t from, uint64_t fileSize) {
+            std::vector<char> buffer(COPY_BUFFER);
+            uint32_t magic = RECORD_MAGIC;
+            while (from + RECORD_HEADER_SIZE <= fileSize) {
+                size_t n = std::min<uint64_t>(buffer.size(), fileSize - from);
+                ReadFully(fd, buffer.data(), n, from);
+                for (size_t i = 0; i + RECORD_HEADER_SIZE <= n; ++i) {
+                    if (memcmp(buffer.data() + i, & magic, sizeof(magic)) != 0)
+                        continue;
+                    RecordHeader h;
+                    memcpy(& h, buffer.data() + i, RECORD_HEADER_SIZE);
+                    if (ValidHeader(h, from + i, fileSize))
+                        return from + i;
+                }
+                // the next chunk overlaps this one so that headers across the boundary are not missed
+                from += n - RECORD_HEADER_SIZE + 1;
+            }
+            return fileSize;
+        }
+
+        static bool Compress(char const * data, size_t size, std::string & into) {
+#ifdef HAVE_ZLIB
+            uLongf csize = compressBound(size);
+            into.resize(csize);
+            if (compress2(reinterpret_cast<Bytef *>(& into[0]), & csize, reinterpret_cast<Bytef const *>(data), size, Z_DEFAULT_COMPRESSION) != Z_OK)
+                return false;
+            into.resize(csize);
+            return csize < size;
+#else
+            return false;
+#endif
+        }
+
+        /** Compresses size bytes of the from file into the to file, returns false if the compressed contents would not be smaller.
+         */
+        static bool CompressFile(int from, size_t size, int to, size_t & compressedSize) {
+#ifdef HAVE_ZLIB
+            z_stream z;
+            memset(& z, 0, sizeof(z));
+            if (deflateInit(& z, Z_DEFAULT_COMPRESSION) != Z_OK)
+                return false;
+            std::vector<char> in(COPY_BUFFER);
+            std::vector<char> out(COPY_BUFFER);
+            uint64_t offset = 0;
+            compressedSize = 0;
+            int flush = Z_NO_FLUSH;
+            while (flush != Z_FINISH && compressedSize < size) {
+                size_t n = std::min<uint64_t>(in.size(), size - offset);
+                ReadFully(from, in.data(), n, offset);
+                offset += n;
+                flush = offset == size ? Z_FINISH : Z_NO_FLUSH;
+                z.next_in = reinterpret_cast<Bytef *>(in.data());
+                z.avail_in = n;
+                do {
+                    z.next_out = reinterpret_cast<Bytef *>(out.data());
+                    z.avail_out = out.size();
+                    if (deflate(& z, flush) == Z_STREAM_ERROR) {
+                        deflateEnd(& z);
+                        return false;
+                    }
+                    size_t produced = out.size() - z.avail_out;
+                    WriteFully(to, out.data(), produced, compressedSize);
+                    compressedSize += produced;
+                } while (z.avail_out == 0);
+            }
+            deflateEnd(& z);
+            return flush == Z_FINISH && compressedSize < size;
+#else
+            return false;
+#endif
+        }
+
+        static void Decompress(std::string const & data, size_t size, std::string & into) {
+#ifdef HAVE_ZLIB
+            into.resize(size);
+            uLongf dsize = size;
+            if (uncompress(reinterpret_cast<Bytef *>(& into[0]), & dsize, reinterpret_cast<Bytef const *>(data.data()), data.size()) != Z_OK || dsize != size)
+                ERROR("Corrupted compressed contents");
+#else
+            ERROR("Compressed contents found, but the tool was built without zlib");
+#endif
+        }
+
+        static void ReadFully(int fd, void * into, size_t bytes, uint64_t offset) {
+            char * x = reinterpret_cast<char *>(into);
+            while (bytes > 0) {
+                ssize_t n = pread(fd, x, bytes, offset);
+                if (n <= 0)
+                    ERROR("Unable to read pack at offset " << offset);
+                x += n;
+                bytes -= n;
+                offset += n;
+            }
+        }
+
+        static void WriteFully(int fd, void const * from, size_t bytes, uint64_t offset) {
+            char const * x = reinterpret_cast<char const *>(from);
+            while (bytes > 0) {
+                ssize_t n = pwrite(fd, x, bytes, offset);
+                if (n <= 0)
+                    ERROR("Unable to write pack at offset " << offset);
+                x += n;
+                bytes -= n;
+                offset += n;
+            }
+        }
+
+        static void CopyFully(int from, size_t bytes, int to, uint64_t offset) {
+            std::vector<char> buffer(bytes < COPY_BUFFER ? bytes : COPY_BUFFER);
+            uint64_t fromOffset = 0;
+            while (bytes > 0) {
+                size_t n = std::min(bytes, buffer.size());
+                ReadFully(from, buffer.data(), n, fromOffset);
+                WriteFully(to, buffer.data(), n, offset);
+                fromOffset += n;
+                offset += n;
+                bytes -= n;
+            }
+        }
+
+        static uint64_t FileSize(int fd) {
+            struct stat s;
+            if (fstat(fd, & s) != 0)
+                ERROR("Unable to stat file");
+            return s.st_size;
+        }
+
+        void read(int fd, Entry const & e, std::string & into) const {
+            if (e.flags & COMPRESSED) {
+                std::string compressed;
+                compressed.resize(e.storedSize);
+                ReadFully(fd, & compressed[0], e.storedSize, e.offset);
+                Decompress(compressed, e.size, into);
+            } else {
+                into.resize(e.size);
+                ReadFully(fd, & into[0], e.size, e.offset);
+            }
+        }
+
+        /** Loads the index, ignoring any incomplete record at its end.
+         */
+        void loadIndex() {
+            int fd = open(IndexFile(dir_).c_str(), O_RDONLY);
+            if (fd == -1) {
+                if (! writable_)
+                    ERROR("Unable to open content store index " << IndexFile(dir_));
+                return;
+            }
+            uint64_t fileSize = FileSize(fd);
+            if (fileSize < MAGIC_SIZE)
+                ERROR("Invalid content store index " << IndexFile(dir_));
+            char magic[MAGIC_SIZE];
+            ReadFully(fd, magic, MAGIC_SIZE, 0);
+            if (strncmp(magic, IndexMagic(), MAGIC_SIZE) != 0)
+                ERROR("Invalid content store index " << IndexFile(dir_));
+            size_t n = (fileSize - MAGIC_SIZE) / sizeof(IndexRecord);
+            std::vector<IndexRecord> records(n);
+            if (n > 0)
+                ReadFully(fd, records.data(), n * sizeof(IndexRecord), MAGIC_SIZE);
+            ::close(fd);
+            indexSize_ = MAGIC_SIZE + n * sizeof(IndexRecord);
+            index_.reserve(n);
+            for (IndexRecord const & r : records)
+                index_[r.contentsId] = Entry{r.pack, r.flags, r.offset, r.storedSize, r.size};
+        }
+
+        /** Opens all existing packs and drops any index entries which point past their ends.
+         */
+        void openPacks() {
+            while (true) {
+                std::string filename = PackFile(dir_, packs_.size());
+                int fd = open(filename.c_str(), O_RDONLY);
+                if (fd == -1)
+                    break;
+                char magic[MAGIC_SIZE];
+                if (FileSize(fd) < MAGIC_SIZE)
+                    ERROR("Invalid pack " << filename);
+                ReadFully(fd, magic, MAGIC_SIZE, 0);
+                if (strncmp(magic, PackMagic(), MAGIC_SIZE) != 0)
+                    ERROR("Invalid pack " << filename);
+                packs_.push_back(fd);
+            }
+            std::vector<uint64_t> sizes;
+            for (int fd : packs_)
+                sizes.push_back(FileSize(fd));
+            for (auto i = index_.begin(); i != index_.end(); ) {
+                Entry const & e = i->second;
+                if (e.pack >= sizes.size() || e.offset + e.storedSize > sizes[e.pack]) {
+                    i = index_.erase(i);
+                    rewriteIndex_ = true;
+                } else {
+                    ++i;
+                }
+            }
+        }
+
+        /** Indexes complete records at the end of the last pack which are missing from the index, skipping over interrupted records, and truncates the pack after the last complete record.
+
+            Also reopens the last pack for writing, or creates the first pack if there is none.
+         */
+        void recoverLastPack() {
+            if (packs_.empty()) {
+                createPack();
+                return;
+            }
+            unsigned last = packs_.size() - 1;
+            uint64_t end = MAGIC_SIZE;
+            for (auto const & i : index_)
+                if (i.second.pack == last)
+                    end = std::max(end, i.second.offset + i.second.storedSize);
+            ::close(packs_[last]);
+            packs_[last] = open(PackFile(dir_, last).c_str(), O_RDWR);
+            if (packs_[last] == -1)
+                ERROR("Unable to open pack " << PackFile(dir_, last) << " for writing");
+            int fd = packs_[last];
+            uint64_t fileSize = FileSize(fd);
+            size_t recovered = 0;
+            size_t interrupted = 0;
+            // end of the last complete record
+            uint64_t valid = end;
+            while (end + RECORD_HEADER_SIZE <= fileSize) {
+                RecordHeader h;
+                ReadFully(fd, & h, RECORD_HEADER_SIZE, end);
+                // the header is written last, without a valid one the writing of the record has been interrupted, but records reserved after it may be complete
+                if (! ValidHeader(h, end, fileSize)) {
+                    end = FindRecord(fd, end + 1, fileSize);
+                    ++interrupted;
+                    continue;
+                }
+                uint64_t offset = end + RECORD_HEADER_SIZE;
+                if (index_.find(h.contentsId) == index_.end()) {
+                    index_[h.contentsId] = Entry{last, h.flags, offset, h.storedSize, h.size};
+                    bufferIndexRecord(h.contentsId, index_[h.contentsId]);
+                    ++recovered;
+                }
+                end = offset + h.storedSize;
+                valid = end;
+            }
+            if (valid != fileSize && ftruncate(fd, valid) != 0)
+                ERROR("Unable to truncate pack " << PackFile(dir_, last));
+            packEnd_ = valid;
+            if (recovered > 0)
+                std::cerr << "    " << recovered << " unindexed contents recovered from " << PackFile(dir_, last) << std::endl;
+            if (interrupted > 0)
+                std::cerr << "    " << interrupted << " interrupted records skipped in " << PackFile(dir_, last) << std::endl;
+        }
+
+        void openIndexForWriting() {
+            indexFd_ = open(IndexFile(dir_).c_str(), O_WRONLY | O_CREAT, 0644);
+            if (indexFd_ == -1)
+                ERROR("Unable to open content store index " << IndexFile(dir_) << " for writing");
+            // if the index has entries of contents which are no longer in the packs, it must be rewritten as the space they pointed to will be reused
+            if (rewriteIndex_) {
+                indexBuffer_.clear();
+                for (auto const & i : index_)
+                    bufferIndexRecord(i.first, i.second);
+                indexSize_ = 0;
+            }
+            if (indexSize_ == 0) {
+                WriteFully(indexFd_, IndexMagic(), MAGIC_SIZE, 0);
+                indexSize_ = MAGIC_SIZE;
+            }
+            // drop incomplete record at the end, if any
+            if (ftruncate(indexFd_, indexSize_) != 0)
+                ERROR("Unable to truncate content store index " << IndexFile(dir_));
+            flushIndex();
+        }
+
+        void createPack() {
+            std::string filename = PackFile(dir_, packs_.size());
+            int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd == -1)
+                ERROR("Unable to create pack " << filename);
+            WriteFully(fd, PackMagic(), MAGIC_SIZE, 0);
+            packs_.push_back(fd);
+            packEnd_ = MAGIC_SIZE;
+        }
+
+        /** Returns an unnamed temporary file in the store directory.
+         */
+        int createTempFile() const {
+            std::string filename = dir_ + "/tmp-XXXXXX";
+            int fd = mkstemp(& filename[0]);
+            if (fd == -1)
+                ERROR("Unable to create temporary file in " << dir_);
+            unlink(filename.c_str());
+            return fd;
+        }
+
+        /** Adds the contents of given file to the store, returns false if the contents is already stored.
+         */
+        bool addFile(unsigned contentsId, int fd, size_t size) {
+            if (contains(contentsId))
+                return false;
+            if (compress_) {
+                int cfd = createTempFile();
+                size_t csize;
+                bool result;
+                if (CompressFile(fd, size, cfd, csize)) {
+                    result = append(contentsId, COMPRESSED, size, csize, [cfd, csize](int pack, uint64_t offset) {
+                            CopyFully(cfd, csize, pack, offset);
+                        });
+                    ::close(cfd);
+                    return result;
+                }
+                ::close(cfd);
+            }
+            return append(contentsId, 0, size, size, [fd, size](int pack, uint64_t offset) {
+                    CopyFully(fd, size, pack, offset);
+                });
+        }
+
+        bool append(unsigned contentsId, uint32_t flags, char const * data, size_t storedSize, size_t size) {
+            return append(contentsId, flags, size, storedSize, [data, storedSize](int pack, uint64_t offset) {
+                    WriteFully(pack, data, storedSize, offset);
+                });
+        }
+
+        /** Appends record of given contents, whose data are written to the pack by the writer function.
+
+            The space for the record is reserved at the end of the pack under the lock, the record is then written without holding it and only once it has been written, the contents is added to the index. While being written, the contents is remembered as in flight so that concurrent attempts to add it fail.
+         */
+        bool append(unsigned contentsId, uint32_t flags, size_t size, size_t storedSize, std::function<void(int, uint64_t)> writer) {
+            if (! writable_)
+                ERROR("Content store " << dir_ << " is not opened for writing");
+            int fd;
+            Entry e;
+            {
+                std::lock_guard<std::mutex> g(m_);
+                if (index_.find(contentsId) != index_.end() || ! inFlight_.insert(contentsId).second)
+                    return false;
+                if (packEnd_ + RECORD_HEADER_SIZE + storedSize > PACK_SIZE && packEnd_ > MAGIC_SIZE)
+                    createPack();
+                fd = packs_.back();
+                e = Entry{static_cast<uint32_t>(packs_.size() - 1), flags, packEnd_ + RECORD_HEADER_SIZE, static_cast<uint32_t>(storedSize), static_cast<uint32_t>(size)};
+                packEnd_ = e.offset + storedSize;
+            }
+            RecordHeader h{RECORD_MAGIC, contentsId, flags, static_cast<uint32_t>(storedSize), static_cast<uint32_t>(size), 0};
+            h.check = HeaderCheck(h);
+            writer(fd, e.offset);
+            WriteFully(fd, & h, RECORD_HEADER_SIZE, e.offset - RECORD_HEADER_SIZE);
+            std::lock_guard<std::mutex> g(m_);
+            inFlight_.erase(contentsId);
+            index_[contentsId] = e;
+            bufferIndexRecord(contentsId, e);
+            if (indexBuffer_.size() >= INDEX_BUFFER)
+                flushIndex();
+            return true;
+        }
+
+        void bufferIndexRecord(unsigned contentsId, Entry const & e) {
+            indexBuffer_.push_back(IndexRecord{contentsId, e.pack, e.flags, e.storedSize, e.size, 0, e.offset});
+        }
+
+        void flushIndex() {
+            if (indexBuffer_.empty())
+                return;
+            size_t bytes = indexBuffer_.size() * sizeof(IndexRecord);
+            WriteFully(indexFd_, indexBuffer_.data(), bytes, indexSize_);
+            indexSize_ += bytes;
+            indexBuffer_.clear();
+        }
+
+        std::string dir_;
+        bool writable_;
+        bool compress_;
+
+        std::unordered_map<unsigned, Entry> index_;
+        // contents whose records are being written
+        std::unordered_set<unsigned> inFlight_;
+        std::vector<int> packs_;
+        uint64_t packEnd_ = 0;
+
+        int indexFd_;
+        uint64_t indexSize_ = 0;
+        bool rewriteIndex_ = false;
+        std::vector<IndexRecord> indexBuffer_;
+
+        mutable std::mutex m_;
+    }; // ContentStore
+
+} // namespace dejavu
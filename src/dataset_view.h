@@ -0,0 +1,409 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "helpers/csv-reader.h"
+#include "helpers/helpers.h"
+#include "helpers/idset.h"
+#include "helpers/strings.h"
+
+namespace dejavu {
+
+    /** Set of ids selected by a dataset view.
+
+        The ids are kept in compressed id sets, one for each 2^32 ids, so that file changes can be selected by their 64bit row indices. A selection may also select all ids, which is what views use for the tables they do not restrict.
+     */
+    class Selection {
+    public:
+
+        /** Creates an empty selection.
+         */
+        Selection():
+            all_(false) {
+        }
+
+        /** Creates selection of given ids.
+         */
+        explicit Selection(helpers::IdSet ids):
+            all_(false) {
+            ids_.push_back(std::move(ids));
+        }
+
+        /** Returns selection of all ids.
+         */
+        static Selection All() {
+            Selection result;
+            result.all_ = true;
+            return result;
+        }
+
+        bool all() const {
+            return all_;
+        }
+
+        /** Returns the number of selected ids, which is undefined for selections of all ids.
+         */
+        size_t size() const {
+            size_t result = 0;
+            for (helpers::IdSet const & ids : ids_)
+                result += ids.size();
+            return result;
+        }
+
+        void insert(uint64_t id) {
+            assert(! all_);
+            size_t high = id >> 32;
+            if (high >= ids_.size())
+                ids_.resize(high + 1);
+            ids_[high].insert(static_cast<unsigned>(id));
+        }
+
+        bool contains(uint64_t id) const {
+            if (all_)
+                return true;
+            size_t high = id >> 32;
+            return high < ids_.size() && ids_[high].contains(static_cast<unsigned>(id));
+        }
+
+        void write(std::ostream & f) const {
+            uint64_t header[] = { all_, ids_.size() };
+            f.write(reinterpret_cast<char const *>(header), sizeof(header));
+            for (helpers::IdSet const & ids : ids_)
+                ids.write(f);
+        }
+
+        void read(std::istream & f) {
+            uint64_t header[2];
+            f.read(reinterpret_cast<char *>(header), sizeof(header));
+            if (! f.good())
+                return;
+            all_ = header[0];
+            ids_.resize(header[1]);
+            for (helpers::IdSet & ids : ids_)
+                ids.read(f);
+        }
+
+    private:
+        bool all_;
+        // id sets for ids with the same upper 32 bits
+        std::vector<helpers::IdSet> ids_;
+    }; // Selection
+
+    /** Dataset view, i.e. a dataset defined as a selection of projects, commits, paths and file changes of another dataset.
+
+        Instead of rewriting the tables of the dataset they filter, filter commands store a view in their output directory. The view consists of the directory of the base dataset and the selections in view.bin:
+
+            magic baseLength base (padding to 8 bytes) projects commits paths changes
+
+        where each selection is stored as a flag whether it selects all ids and the number of its id sets, followed by the id sets (see helpers::IdSet::write). Unlike the other selections, changes are not identified by ids, but by the index of their row in the file changes of the base dataset, i.e. in the rows the base dataset (or its views) passes to the loaders.
+
+        When a loader reads a table which does not exist in the view's directory, the table is read from the base dataset (which may be a view itself) and only rows selected by the view are passed to the loader (see Table). Projects, commits, commit parents and authors, paths and file changes are filtered, file changes are selected when their row, project, commit and path are selected, commit parents when both commits are. All other tables are passed through. Tables present in the view's directory take precedence, which allows views to replace tables they cannot express as a selection (such as commit parents after removal of commits), or to be later partially materialized.
+
+        The whole view can be materialized with the materialize-view command.
+     */
+    class DatasetView {
+
+        /** Kinds of tables which determine how their rows are selected.
+         */
+        enum class Kind {
+            Projects,
+            Commits,
+            CommitParents,
+            Paths,
+            FileChanges,
+            Other,
+        };
+
+    public:
+
+        static constexpr size_t MAGIC_SIZE = 8;
+
+        static char const * Magic() {
+            return "DJVVIEW4";
+        }
+
+        static std::string File(std::string const & dir) {
+            return dir + "/view.bin";
+        }
+
+        static bool IsView(std::string const & dir) {
+            return helpers::FileExists(File(dir));
+        }
+
+        /** A table of a dataset, which may be filtered by one or more views.
+         */
+        class Table {
+        public:
+
+            /** Resolves the given filename, if it does not exist and its directory is a view, the file is looked up in the base datasets and all the views on the way are remembered.
+             */
+            Table(std::string const & filename) {
+                size_t slash = filename.rfind('/');
+                std::string dir = slash == std::string::npos ? std::string(".") : filename.substr(0, slash);
+                std::string name = filename.substr(slash + 1);
+                file_ = filename;
+                while (! helpers::FileExists(file_) && IsView(dir)) {
+                    std::shared_ptr<DatasetView> view = Load(dir);
+                    views_.push_back(view);
+                    dir = view->base();
+                    file_ = dir + "/" + name;
+                }
+                rows_.resize(views_.size(), 0);
+                if (name == "projects.csv")
+                    kind_ = Kind::Projects;
+                else if (name == "commits.csv" || name == "commitAuthors.csv")
+                    kind_ = Kind::Commits;
+                else if (name == "commitParents.csv")
+                    kind_ = Kind::CommitParents;
+                else if (name == "paths.csv")
+                    kind_ = Kind::Paths;
+                else if (name == "fileChanges.csv")
+                    kind_ = Kind::FileChanges;
+                else
+                    kind_ = Kind::Other;
+            }
+
+            /** The actual file the table is stored in.
+             */
+            std::string const & file() const {
+                return file_;
+            }
+
+            /** Returns true if the table rows must be filtered.
+             */
+            bool filtered() const {
+                for (auto const & view : views_)
+                    if (! view->selectsAll(kind_))
+                        return true;
+                return false;
+            }
+
+            /** Returns true if the given row is selected by all views on the way to the actual file.
+
+                Must be called for all rows of the file in order. The views closest to the file are asked first, so that each view only counts the rows its base dataset selects.
+             */
+            bool selects(std::vector<std::string> const & row) {
+                for (size_t i = views_.size(); i-- > 0; )
+                    if (! views_[i]->selects(kind_, row, rows_[i]++))
+                        return false;
+                return true;
+            }
+
+        private:
+            std::string file_;
+            Kind kind_;
+            std::vector<std::shared_ptr<DatasetView>> views_;
+            // number of rows each view has seen so far
+            std::vector<uint64_t> rows_;
+        }; // DatasetView::Table
+
+        /** Returns the actual file in which the given table is stored.
+         */
+        static std::string Resolve(std::string const & filename) {
+            return Table(filename).file();
+        }
+
+        /** Creates a view of the given dataset which selects everything.
+         */
+        DatasetView(std::string const & base):
+            base_(base),
+            projects(Selection::All()),
+            commits(Selection::All()),
+            paths(Selection::All()),
+            changes(Selection::All()) {
+            char * real = realpath(base.c_str(), nullptr);
+            if (real != nullptr) {
+                base_ = real;
+                free(real);
+            }
+        }
+
+        std::string const & base() const {
+            return base_;
+        }
+
+        /** Writes the view to the given directory, which must not be the base dataset.
+         */
+        void write(std::string const & dir) const {
+            std::ofstream f(File(dir), std::ios::out | std::ios::binary);
+            if (! f.good())
+                ERROR("Unable to open " << File(dir) << " for writing");
+            f.write(Magic(), MAGIC_SIZE);
+            uint64_t n = base_.size();
+            f.write(reinterpret_cast<char const *>(& n), sizeof(n));
+            f.write(base_.c_str(), n);
+            uint64_t padding = 0;
+            f.write(reinterpret_cast<char const *>(& padding), (8 - n % 8) % 8);
+            projects.write(f);
+            commits.write(f);
+            paths.write(f);
+            changes.write(f);
+            if (! f.good())
+                ERROR("Unable to write " << File(dir));
+        }
+
+        /** Loads the view in given directory. The views are cached so that each is only read once.
+         */
+        static std::shared_ptr<DatasetView> Load(std::string const & dir) {
+            static std::mutex m;
+            static std::map<std::string, std::shared_ptr<DatasetView>> views;
+            std::lock_guard<std::mutex> g(m);
+            auto i = views.find(dir);
+            if (i != views.end())
+                return i->second;
+            std::ifstream f(File(dir), std::ios::in | std::ios::binary);
+            char magic[MAGIC_SIZE];
+            f.read(magic, MAGIC_SIZE);
+            if (! f.good() || strncmp(magic, Magic(), MAGIC_SIZE) != 0)
+                ERROR("Invalid dataset view " << File(dir));
+            uint64_t n;
+            f.read(reinterpret_cast<char *>(& n), sizeof(n));
+            std::string base(n, '\0');
+            f.read(& base[0], n);
+            f.ignore((8 - n % 8) % 8);
+            std::shared_ptr<DatasetView> result(new DatasetView());
+            result->base_ = base;
+            result->projects.read(f);
+            result->commits.read(f);
+            result->paths.read(f);
+            result->changes.read(f);
+            if (! f.good())
+                ERROR("Truncated dataset view " << File(dir));
+            if (base == dir || ! helpers::FileExists(base))
+                ERROR("Invalid base dataset " << base << " of view " << File(dir));
+            views.insert(std::make_pair(dir, result));
+            return result;
+        }
+
+        /** Materializes the view in given directory, i.e. writes all tables it filters to the directory and removes the view.
+
+            Tables already present in the directory are kept, tables which are not filtered (such as hashes.csv) are linked from the base dataset.
+         */
+        static void Materialize(std::string const & dir) {
+            for (char const * name : { "projects.csv", "commits.csv", "commitParents.csv", "commitAuthors.csv", "paths.csv", "fileChanges.csv", "hashes.csv" }) {
+                std::string filename = dir + "/" + name;
+                if (helpers::FileExists(filename))
+                    continue;
+                Table table(filename);
+                if (! helpers::FileExists(table.file()))
+                    continue;
+                if (! table.filtered()) {
+                    helpers::System(STR("ln -s " << table.file() << " " << filename));
+                    continue;
+                }
+                std::cerr << "Materializing " << name << "..." << std::endl;
+                TableWriter w(table, filename);
+                std::cerr << "    " << w.written() << " rows written" << std::endl;
+            }
+            std::remove(File(dir).c_str());
+        }
+
+    private:
+
+        /** Writes the rows of a table selected by its views to a new file.
+
+            String columns are quoted, numeric columns are written as they are.
+         */
+        class TableWriter : public helpers::CSVReader {
+        public:
+            TableWriter(Table & table, std::string const & filename):
+                table_(table),
+                f_(filename),
+                written_(0) {
+                if (! f_.good())
+                    ERROR("Unable to open " << filename << " for writing");
+                std::string header;
+                {
+                    std::ifstream in(table.file());
+                    std::getline(in, header);
+                }
+                f_ << header << std::endl;
+                parse(table.file(), true);
+            }
+
+            size_t written() const {
+                return written_;
+            }
+
+        protected:
+            void row(std::vector<std::string> & row) override {
+                if (! table_.selects(row))
+                    return;
+                for (size_t i = 0; i < row.size(); ++i) {
+                    if (i != 0)
+                        f_ << ",";
+                    std::string const & col = row[i];
+                    if (! col.empty() && std::all_of(col.begin(), col.end(), [](char c) { return c >= '0' && c <= '9'; }))
+                        f_ << col;
+                    else
+                        f_ << helpers::escapeQuotes(col);
+                }
+                f_ << '\n';
+                ++written_;
+            }
+
+        private:
+            Table & table_;
+            std::ofstream f_;
+            size_t written_;
+        };
+
+        DatasetView() = default;
+
+        bool selectsAll(Kind kind) const {
+            switch (kind) {
+                case Kind::Projects:
+                    return projects.all();
+                case Kind::Commits:
+                case Kind::CommitParents:
+                    return commits.all();
+                case Kind::Paths:
+                    return paths.all();
+                case Kind::FileChanges:
+                    return projects.all() && commits.all() && paths.all() && changes.all();
+                default:
+                    return true;
+            }
+        }
+
+        /** Returns true if the given row of a table is selected, rowIndex is the index of the row among the rows selected by the base dataset.
+         */
+        bool selects(Kind kind, std::vector<std::string> const & row, uint64_t rowIndex) const {
+            switch (kind) {
+                case Kind::Projects:
+                    return projects.contains(std::stoul(row[0]));
+                case Kind::Commits:
+                    return commits.contains(std::stoul(row[0]));
+                case Kind::CommitParents:
+                    return commits.contains(std::stoul(row[0])) && commits.contains(std::stoul(row[1]));
+                case Kind::Paths:
+                    return paths.contains(std::stoul(row[0]));
+                case Kind::FileChanges:
+                    return changes.contains(rowIndex) && projects.contains(std::stoul(row[0])) && commits.contains(std::stoul(row[1])) && paths.contains(std::stoul(row[2]));
+                default:
+                    return true;
+            }
+        }
+
+        std::string base_;
+
+    public:
+
+        Selection projects;
+        Selection commits;
+        Selection paths;
+        Selection changes;
+
+    }; // DatasetView
+
+} // namespace dejavu
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "helpers/helpers.h"
+
+#include "settings.h"
+
+namespace dejavu {
+
+    /** Live files of a project at one of its heads as (pathId, contentsId) pairs, sorted by pathId.
+     */
+    typedef std::vector<std::pair<unsigned, unsigned>> HeadFiles;
+
+    /** Persisted states of projects at their heads (commits without any children in the project).
+
+        Produced by the build-head-states command so that commands which only need the final state of projects can get it without loading the commit hierarchy and replaying project histories. The states are stored in two binary files in the data directory:
+
+        headStates.bin contains for each project a block of its heads:
+
+            BLOCK := numHeads { commitId numFiles { pathId contentsId } }
+
+        where all values are 32bit unsigned integers and the files are sorted by their path ids.
+
+        headStatesIndex.bin contains the number of entries followed by 64bit offset of the block for each project id, or 0 if the project has no block.
+
+        Both files start with a magic string which also identifies the version of the format.
+     */
+    class HeadStates {
+    public:
+
+        static constexpr size_t MAGIC_SIZE = 8;
+
+        static char const * Magic() {
+            return "DJVHEAD1";
+        }
+
+        static std::string DataFile(std::string const & dir) {
+            return dir + "/headStates.bin";
+        }
+
+        static std::string IndexFile(std::string const & dir) {
+            return dir + "/headStatesIndex.bin";
+        }
+
+        /** Writes the head states, projects may be added in any order and from multiple threads provided the calls to add() are synchronized.
+         */
+        class Writer {
+        public:
+            Writer(std::string const & dir = DataDir.value()):
+                dir_(dir),
+                f_(DataFile(dir), std::ios::out | std::ios::binary),
+                offset_(MAGIC_SIZE) {
+                if (! f_.good())
+                    ERROR("Unable to open " << DataFile(dir) << " for writing");
+                f_.write(Magic(), MAGIC_SIZE);
+            }
+
+            /** Serializes the given heads of a project into a buffer which can be later added to the file.
+
+                The files of each head are sorted in the process.
+             */
+            static std::string Serialize(std::vector<std::pair<unsigned, HeadFiles>> & heads) {
+                std::string result;
+                Append(result, heads.size());
+                for (auto & head : heads) {
+                    std::sort(head.second.begin(), head.second.end());
+                    Append(result, head.first);
+                    Append(result, head.second.size());
+                    for (auto const & f : head.second) {
+                        Append(result, f.first);
+                        Append(result, f.second);
+                    }
+                }
+                return result;
+            }
+
+            /** Adds previously serialized project block to the file.
+             */
+            void add(unsigned projectId, std::string const & block) {
+                if (projectId >= index_.size())
+                    index_.resize(projectId + 1, 0);
+                index_[projectId] = offset_;
+                f_.write(block.c_str(), block.size());
+                offset_ += block.size();
+            }
+
+            /** Closes the data file and writes the index.
+             */
+            void close() {
+                f_.close();
+                std::ofstream idx(IndexFile(dir_), std::ios::out | std::ios::binary);
+                if (! idx.good())
+                    ERROR("Unable to open " << IndexFile(dir_) << " for writing");
+                idx.write(Magic(), MAGIC_SIZE);
+                uint64_t n = index_.size();
+                idx.write(reinterpret_cast<char const *>(& n), sizeof(n));
+                idx.write(reinterpret_cast<char const *>(index_.data()), n * sizeof(uint64_t));
+            }
+
+        private:
+
+            static void Append(std::string & buffer, size_t value) {
+                uint32_t x = static_cast<uint32_t>(value);
+                buffer.append(reinterpret_cast<char const *>(& x), sizeof(x));
+            }
+
+            std::string dir_;
+            std::ofstream f_;
+            uint64_t offset_;
+            std::vector<uint64_t> index_;
+        }; // HeadStates::Writer
+
+        /** Opens the head states in given directory and loads the project index.
+         */
+        HeadStates(std::string const & dir = DataDir.value()) {
+            std::ifstream idx(IndexFile(dir), std::ios::in | std::ios::binary);
+            if (! idx.good())
+                ERROR("Unable to open " << IndexFile(dir) << ", run build-head-states first");
+            checkMagic(idx, IndexFile(dir));
+            uint64_t n = 0;
+            idx.read(reinterpret_cast<char *>(& n), sizeof(n));
+            index_.resize(n);
+            idx.read(reinterpret_cast<char *>(index_.data()), n * sizeof(uint64_t));
+            if (! idx.good())
+                ERROR("Truncated head states index " << IndexFile(dir));
+            fd_ = open(DataFile(dir).c_str(), O_RDONLY);
+            if (fd_ == -1)
+                ERROR("Unable to open " << DataFile(dir));
+        }
+
+        HeadStates(HeadStates const &) = delete;
+
+        ~HeadStates() {
+            ::close(fd_);
+        }
+
+        /** Returns true if the given project has stored heads.
+         */
+        bool hasProject(unsigned projectId) const {
+            return projectId < index_.size() && index_[projectId] != 0;
+        }
+
+        /** Returns the largest project id + 1 for which the index has an entry.
+         */
+        size_t size() const {
+            return index_.size();
+        }
+
+        /** Reads the heads of given project and calls the handler for each of them with the commit id and the live files.
+
+            Does not change the reader and so can be called concurrently from multiple threads. Returns the number of heads of the project.
+         */
+        size_t readProject(unsigned projectId, std::function<void(unsigned, HeadFiles const &)> handler) const {
+            if (! hasProject(projectId))
+                return 0;
+            uint64_t offset = index_[projectId];
+            uint32_t numHeads = read(offset);
+            HeadFiles files;
+            for (uint32_t i = 0; i < numHeads; ++i) {
+                uint32_t commitId = read(offset);
+                uint32_t numFiles = read(offset);
+                files.resize(numFiles);
+                std::vector<uint32_t> raw(numFiles * 2);
+                readInto(raw.data(), raw.size() * sizeof(uint32_t), offset);
+                for (uint32_t j = 0; j < numFiles; ++j)
+                    files[j] = std::make_pair(raw[j * 2], raw[j * 2 + 1]);
+                handler(commitId, files);
+            }
+            return numHeads;
+        }
+
+    private:
+
+        static void checkMagic(std::ifstream & f, std::string const & filename) {
+            char magic[MAGIC_SIZE];
+            f.read(magic, MAGIC_SIZE);
+            if (! f.good() || strncmp(magic, Magic(), MAGIC_SIZE) != 0)
+                ERROR("Invalid head states file " << filename);
+        }
+
+        uint32_t read(uint64_t & offset) const {
+            uint32_t result;
+            readInto(& result, sizeof(result), offset);
+            return result;
+        }
+
+        void readInto(void * into, size_t bytes, uint64_t & offset) const {
+            char * x = reinterpret_cast<char *>(into);
+            while (bytes > 0) {
+                ssize_t n = pread(fd_, x, bytes, offset);
+                if (n <= 0)
+                    ERROR("Unable to read head states at offset " << offset);
+                x += n;
+                bytes -= n;
+                offset += n;
+            }
+        }
+
+        std::vector<uint64_t> index_;
+        int fd_;
+    }; // HeadStates
+
+} // namespace dejavu
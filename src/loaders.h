@@ -6,8 +6,10 @@
 #include "helpers/csv-reader.h"
 #include "helpers/hash.h"
 
+#include "dataset_view.h"
 #include "objects.h"
 #include "settings.h"
+#include "typed_loader.h"
 
 #include <iostream>
 #include <fstream>
@@ -23,9 +25,18 @@ namespace dejavu {
 
     class BaseLoader : public helpers::CSVReader {
     public:
+        /** Reads the given file. If the file is a table of a dataset view, reads it from the view's base dataset and passes to the loader only the rows selected by the view (see DatasetView).
+         */
         void readFile(std::string const & filename, bool headers = true) {
-            parse(filename, headers);
-            onDone(numRows());
+            DatasetView::Table table(filename);
+            if (table.filtered()) {
+                ViewReader r(*this, table);
+                r.read(headers);
+                onDone(r.selected());
+            } else {
+                parse(table.file(), headers);
+                onDone(numRows());
+            }
         }
 
     protected:
@@ -35,6 +46,40 @@ namespace dejavu {
         virtual void onDone(size_t n) {
             //std::cerr << n << " records loaded" << std::endl;
         }
+
+    private:
+
+        /** Reads the base table of a view and forwards the selected rows to the loader.
+         */
+        class ViewReader : public helpers::CSVReader {
+        public:
+            ViewReader(BaseLoader & loader, DatasetView::Table & table):
+                loader_(loader),
+                table_(table),
+                selected_(0) {
+            }
+
+            void read(bool headers) {
+                parse(table_.file(), headers);
+            }
+
+            size_t selected() const {
+                return selected_;
+            }
+
+        protected:
+            void row(std::vector<std::string> & row) override {
+                if (! table_.selects(row))
+                    return;
+                ++selected_;
+                loader_.row(row);
+            }
+
+        private:
+            BaseLoader & loader_;
+            DatasetView::Table & table_;
+            size_t selected_;
+        };
         
     }; // dejavuii::BaseLoader
 
@@ -192,33 +237,32 @@ namespace dejavu {
     };
 
     /** Loads the commits basic information.
+
+        The rows are parsed by the typed loader, the handler can be inlined when passed to Read.
      */
-    class CommitLoader : public BaseLoader {
+    class CommitLoader {
     public:
         // id, authorTime, committerTime
+        typedef Schema<unsigned, uint64_t, uint64_t> Columns;
         typedef std::function<void(unsigned, uint64_t, uint64_t)> RowHandler;
 
-        CommitLoader(std::string const & filename, RowHandler f):
-            f_(f) {
-            readFile(filename);
+        CommitLoader(std::string const & filename, RowHandler f) {
+            Read(filename, f);
         }
 
-        CommitLoader(RowHandler f):
-            f_(f) {
-            readFile(DataDir.value() + "/commits.csv");
+        CommitLoader(RowHandler f) {
+            Read(f);
         }
-    protected:
-        void row(std::vector<std::string> & row) override {
-            assert(row.size() == 3);
-            unsigned id = std::stoul(row[0]);
-            uint64_t authorTime = std::stoull(row[1]);
-            uint64_t committerTime = std::stoull(row[1]);
-            f_(id, authorTime, committerTime);
+
+        template<typename HANDLER>
+        static size_t Read(std::string const & filename, HANDLER && handler) {
+            return TypedLoader<Columns>::Read(filename, handler);
         }
 
-    private:
-        RowHandler f_;
-        
+        template<typename HANDLER>
+        static size_t Read(HANDLER && handler) {
+            return Read(DataDir.value() + "/commits.csv", handler);
+        }
     };
 
     /** Loads the commits basic information.
@@ -254,33 +298,34 @@ namespace dejavu {
 
     
     /** Loads the commits information about parents.
+
+        The rows are parsed by the typed loader, the handler can be inlined when passed to Read.
      */
-    class CommitParentsLoader : public BaseLoader {
+    class CommitParentsLoader {
     public:
         // id, parentId
+        typedef Schema<unsigned, unsigned> Columns;
         typedef std::function<void(unsigned, unsigned)> RowHandler;
 
-        CommitParentsLoader(std::string const & filename, RowHandler f):
-            f_(f) {
-            readFile(filename);
+        CommitParentsLoader(std::string const & filename, RowHandler f) {
+            Read(filename, f);
         }
 
-        CommitParentsLoader(RowHandler f):
-            f_(f) {
-            readFile(DataDir.value() + "/commitParents.csv");
+        CommitParentsLoader(RowHandler f) {
+            Read(f);
         }
-    protected:
-        void row(std::vector<std::string> & row) override {
-            assert(row.size() == 2);
-            unsigned id = std::stoul(row[0]);
-            unsigned parentId = std::stoul(row[1]);
-            f_(id, parentId);
+
+        template<typename HANDLER>
+        static size_t Read(std::string const & filename, HANDLER && handler) {
+            return TypedLoader<Columns>::Read(filename, handler);
         }
 
-    private:
-        RowHandler f_;
-        
+        template<typename HANDLER>
+        static size_t Read(HANDLER && handler) {
+            return Read(DataDir.value() + "/commitParents.csv", handler);
+        }
     };
+
     /** Loads the commit authors (authors and committers).
      */
     class CommitAuthorsLoader : public BaseLoader {
@@ -347,34 +392,32 @@ namespace dejavu {
     };
 
     /** Loads the file change records.
+
+        The rows are parsed by the typed loader, the handler can be inlined when passed to Read.
      */
-    class FileChangeLoader : public BaseLoader {
+    class FileChangeLoader {
     public:
         // project id, commit id, path id, contents id
+        typedef Schema<unsigned, unsigned, unsigned, unsigned> Columns;
         typedef std::function<void(unsigned, unsigned, unsigned, unsigned)> RowHandler;
 
-        FileChangeLoader(std::string const & filename, RowHandler f):
-            f_(f) {
-            readFile(filename);
+        FileChangeLoader(std::string const & filename, RowHandler f) {
+            Read(filename, f);
         }
 
-        FileChangeLoader(RowHandler f):
-            f_(f) {
-            readFile(DataDir.value() + "/fileChanges.csv");
+        FileChangeLoader(RowHandler f) {
+            Read(f);
         }
-    protected:
-        void row(std::vector<std::string> & row) override {
-            assert(row.size() == 4);
-            unsigned projectId = std::stoul(row[0]);
-            unsigned commitId = std::stoul(row[1]);
-            unsigned pathId = std::stoul(row[2]);
-            unsigned contentId = std::stoul(row[3]);
-            f_(projectId, commitId, pathId, contentId);
+
+        template<typename HANDLER>
+        static size_t Read(std::string const & filename, HANDLER && handler) {
+            return TypedLoader<Columns>::Read(filename, handler);
         }
 
-    private:
-        RowHandler f_;
-        
+        template<typename HANDLER>
+        static size_t Read(HANDLER && handler) {
+            return Read(DataDir.value() + "/fileChanges.csv", handler);
+        }
     };
 
     class PathLoader : public BaseLoader {
@@ -783,7 +826,6 @@ namespace dejavu {
         void row(std::vector<std::string> & row) override {
             if (row.size() != 5) {
                 std::cout << " row size " << row.size() << std::endl;
-                for (auto i L: row) 
             }
             assert(row.size() == 5);
             unsigned cloneId = std::stoul(row[0]);
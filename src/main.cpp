@@ -20,12 +20,19 @@ namespace dejavu {
     helpers::Option<std::string> DownloaderDir("downloader", "/array/dejavu/ghgrabber_distributed_take_4", false);
     helpers::Option<std::string> TempDir("tmp", "/tmp", false);
     helpers::Option<unsigned> NumThreads("numThreads", 8, {"-n"}, false);
+    helpers::Option<unsigned> LargeProjectThreshold("largeProjectThreshold", 100000, false);
+    helpers::Option<unsigned> MemoryBudget("memoryBudget", 0, false);
+    helpers::Option<bool> Materialize("materialize", false, false);
     helpers::Option<unsigned> Seed("seed", 0, false);
     helpers::Option<unsigned> Threshold("threshold", 2, {"-t"}, false);
     helpers::Option<unsigned> Pct("pct", 5, {"-pct"}, false);
     helpers::Option<std::string> GhtDir("ghtorrent", "", {"-ght"}, true);
     helpers::Option<unsigned> IgnoreFolderOriginals("ignoreFolderOriginals", 0, false);
     helpers::Option<std::string> GitHubPersonalAccessToken("GitHubPersonalAccessToken", "", {"-auth"}, false);
+    helpers::Option<std::string> BaseUrl("baseUrl", "", false);
+    helpers::Option<unsigned> MaxTransfers("maxTransfers", 256, false);
+    helpers::Option<bool> Refresh("refresh", false, false);
+    helpers::Option<bool> CompressContents("compressContents", false, false);
     helpers::Option<std::string> RepositoryList("RepositoryList",
                                                 "/data/dejavuii/verified/npm-packages-missing.list",
                                                 {"-repos"}, false);
@@ -50,10 +57,12 @@ void InitializeCommands() {
     new helpers::Command("download-github-metadata", DownloadGithubMetadata, "Downloads a JSON file containint basic info about the repository (createdAt, etc.) for each specified project");
     new helpers::Command("patch-projects-createdAt", PatchProjectsCreatedAt, "Patches project createAt times from ghtorrent data.");
 
+    new helpers::Command("build-metadata-table", BuildMetadataTable, "Builds the binary table of project metadata from the downloaded GitHub metadata.");
     new helpers::Command("collect-project-metadata", CollectMetadata, "Creates projectsMetadata.csv.");
     
     
     new helpers::Command("filter-projects", FilterProjects, "Filters given projects and their contents from the dataset.");
+    new helpers::Command("materialize-view", MaterializeView, "Writes the tables of a dataset view.");
 
     new helpers::Command("filter-2008-to-2018", Filter2008to2018, "Filters too old projects and too new commits");
     new helpers::Command("detect-old-projects", DetectOldProjects, "Detects projects with commits older than given threshold");
@@ -82,6 +91,7 @@ void InitializeCommands() {
     new helpers::Command("npm-summary", NPMSummary, "Produces a summary of NPM packages");
     new helpers::Command("npm-using-projects", NPMUsingProjects, "Determine which projects use node.js");
     new helpers::Command("download-contents", DownloadContents, "Downloads contents of selected files.");
+    new helpers::Command("pack-contents", PackContents, "Moves contents downloaded as individual files into the content store.");
 
     // folder clones pipeline
     new helpers::Command("detect-folder-clones", DetectFolderClones, "Detects folder clones across all projects and find their originals");
@@ -95,7 +105,13 @@ void InitializeCommands() {
     // file clones
     new helpers::Command("detect-file-clones", DetectFileClones, "Detects the file clones");
 
-    new helpers::Command("final-breakdown", FinalBreakdown, "Detects the file clones");
+    new helpers::Command("build-head-states", BuildHeadStates, "Stores the live files at the heads of all projects");
+    new helpers::Command("build-path-dictionary", BuildPathDictionary, "Builds the front coded dictionary of all paths");
+    new helpers::Command("build-path-tree", BuildPathTree, "Builds the image of the global directory tree of all paths and the path segments table");
+    new helpers::Command("build-path-attributes", BuildPathAttributes, "Precomputes the attributes of all paths");
+    new helpers::Command("build-postings-index", BuildPostingsIndex, "Builds the inverted indices from contents, path and project ids to their occurrences");
+    new helpers::Command("query", Query, "Prints all occurrences of given contents, path, or project");
+    new helpers::Command("final-breakdown", FinalBreakdown, "Breaks down the files at project heads into unique, original and clone files");
 
     // project developers
     new helpers::Command("project-authors", ProjectAuthors, "Calculates the number of authors in a project");
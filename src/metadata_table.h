@@ -0,0 +1,320 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "helpers/helpers.h"
+#include "helpers/json.hpp"
+
+namespace dejavu {
+
+    /** Selected fields of the GitHub metadata of a project, extracted from the JSON returned by the GitHub API.
+     */
+    class ProjectMetadata {
+    public:
+        bool fork = false;
+        // true if the fork field is present and is a boolean
+        bool forkKnown = false;
+        bool hasDownloads = false;
+        bool hasWiki = false;
+        uint64_t createdAt = 0;
+        int stars = -1;
+        int watchers = -1;
+        int forks = -1;
+        int openIssues = -1;
+        std::string name;
+        std::string owner;
+        std::string language;
+
+        /** Extracts the fields from the given JSON text, returns false if the JSON is not valid.
+
+            Uses the SAX interface of the JSON parser so that only the fields we are interested in are extracted instead of building the whole document.
+         */
+        bool parse(std::string const & json) {
+            Extractor e(*this);
+            return nlohmann::json::sax_parse(json, & e);
+        }
+
+        /** Converts the ISO 8601 time used by GitHub to a timestamp.
+         */
+        static uint64_t ISO8601ToTime(std::string const & str) {
+            struct tm t;
+            memset(& t, 0, sizeof(t));
+            strptime(str.c_str(),"%Y-%m-%dT%H:%M:%SZ",&t);
+            return mktime(&t);
+        }
+
+    private:
+
+        /** SAX handler which stores the interesting top level fields (and the owner's login) in the metadata.
+         */
+        class Extractor : public nlohmann::json_sax<nlohmann::json> {
+        public:
+            Extractor(ProjectMetadata & m):
+                m_(m),
+                depth_(0),
+                inOwner_(false) {
+            }
+
+            bool null() override {
+                return true;
+            }
+
+            bool boolean(bool val) override {
+                if (depth_ != 1)
+                    return true;
+                if (key_ == "fork") {
+                    m_.fork = val;
+                    m_.forkKnown = true;
+                }
+                else if (key_ == "has_downloads")
+                    m_.hasDownloads = val;
+                else if (key_ == "has_wiki")
+                    m_.hasWiki = val;
+                return true;
+            }
+
+            bool number_integer(number_integer_t val) override {
+                number(static_cast<int>(val));
+                return true;
+            }
+
+            bool number_unsigned(number_unsigned_t val) override {
+                number(static_cast<int>(val));
+                return true;
+            }
+
+            bool number_float(number_float_t val, string_t const & s) override {
+                return true;
+            }
+
+            bool string(string_t & val) override {
+                if (depth_ == 1) {
+                    if (key_ == "name")
+                        m_.name = val;
+                    else if (key_ == "language")
+                        m_.language = val;
+                    else if (key_ == "created_at")
+                        m_.createdAt = ISO8601ToTime(val);
+                } else if (depth_ == 2 && inOwner_ && key_ == "login") {
+                    m_.owner = val;
+                }
+                return true;
+            }
+
+            bool start_object(std::size_t elements) override {
+                if (depth_ == 1 && key_ == "owner")
+                    inOwner_ = true;
+                ++depth_;
+                return true;
+            }
+
+            bool key(string_t & val) override {
+                key_ = val;
+                return true;
+            }
+
+            bool end_object() override {
+                --depth_;
+                if (depth_ == 1)
+                    inOwner_ = false;
+                return true;
+            }
+
+            bool start_array(std::size_t elements) override {
+                ++depth_;
+                return true;
+            }
+
+            bool end_array() override {
+                --depth_;
+                return true;
+            }
+
+            bool parse_error(std::size_t position, std::string const & lastToken, nlohmann::detail::exception const & e) override {
+                return false;
+            }
+
+        private:
+
+            void number(int val) {
+                if (depth_ != 1)
+                    return;
+                if (key_ == "stargazers_count")
+                    m_.stars = val;
+                else if (key_ == "watchers_count")
+                    m_.watchers = val;
+                else if (key_ == "forks_count")
+                    m_.forks = val;
+                else if (key_ == "open_issues")
+                    m_.openIssues = val;
+            }
+
+            ProjectMetadata & m_;
+            unsigned depth_;
+            bool inOwner_;
+            std::string key_;
+        }; // ProjectMetadata::Extractor
+
+    }; // ProjectMetadata
+
+    /** Binary table of project metadata indexed by project ids.
+
+        Produced by the build-metadata-table command from a directory of the GitHub metadata JSON files so that the commands which need the metadata do not have to find and parse the JSON file of each project themselves. The table is stored in metadata.bin in the metadata directory and consists of a magic string, the number of records, the fixed size Record for each project id and a heap of zero terminated strings the records point to.
+
+        The whole table is loaded in memory by the reader.
+     */
+    class MetadataTable {
+    public:
+
+        static constexpr size_t MAGIC_SIZE = 8;
+
+        /** Offset of a string which is not present.
+         */
+        static constexpr uint32_t NONE = 0xffffffff;
+
+        static constexpr uint32_t PRESENT = 1;
+        static constexpr uint32_t FORK = 2;
+        static constexpr uint32_t HAS_DOWNLOADS = 4;
+        static constexpr uint32_t HAS_WIKI = 8;
+        static constexpr uint32_t FORK_KNOWN = 16;
+
+        static char const * Magic() {
+            return "DJVMETA1";
+        }
+
+        static std::string File(std::string const & dir) {
+            return dir + "/metadata.bin";
+        }
+
+        /** Metadata of a single project in the table.
+         */
+        class Record {
+        public:
+            uint32_t flags;
+            int32_t stars;
+            int32_t watchers;
+            int32_t forks;
+            int32_t openIssues;
+            uint32_t name;
+            uint32_t owner;
+            uint32_t language;
+            uint64_t createdAt;
+
+            bool present() const {
+                return flags & PRESENT;
+            }
+
+            bool fork() const {
+                return flags & FORK;
+            }
+
+            /** True if the fork field of the metadata was a boolean, i.e. fork() is valid.
+             */
+            bool forkKnown() const {
+                return flags & FORK_KNOWN;
+            }
+
+            bool hasDownloads() const {
+                return flags & HAS_DOWNLOADS;
+            }
+
+            bool hasWiki() const {
+                return flags & HAS_WIKI;
+            }
+        };
+
+        /** Writes the metadata table.
+         */
+        static void Write(std::string const & dir, std::vector<ProjectMetadata *> const & projects) {
+            std::vector<Record> records(projects.size());
+            std::string heap;
+            for (size_t i = 0, e = projects.size(); i != e; ++i) {
+                Record & r = records[i];
+                memset(& r, 0, sizeof(Record));
+                ProjectMetadata * m = projects[i];
+                if (m == nullptr) {
+                    r.stars = r.watchers = r.forks = r.openIssues = -1;
+                    r.name = r.owner = r.language = NONE;
+                    continue;
+                }
+                r.flags = PRESENT | (m->fork ? FORK : 0) | (m->forkKnown ? FORK_KNOWN : 0) | (m->hasDownloads ? HAS_DOWNLOADS : 0) | (m->hasWiki ? HAS_WIKI : 0);
+                r.stars = m->stars;
+                r.watchers = m->watchers;
+                r.forks = m->forks;
+                r.openIssues = m->openIssues;
+                r.name = AddString(heap, m->name);
+                r.owner = AddString(heap, m->owner);
+                r.language = m->language.empty() ? NONE : AddString(heap, m->language);
+                r.createdAt = m->createdAt;
+            }
+            std::ofstream f(File(dir), std::ios::out | std::ios::binary);
+            if (! f.good())
+                ERROR("Unable to open " << File(dir) << " for writing");
+            f.write(Magic(), MAGIC_SIZE);
+            uint64_t n = records.size();
+            f.write(reinterpret_cast<char const *>(& n), sizeof(n));
+            f.write(reinterpret_cast<char const *>(records.data()), n * sizeof(Record));
+            uint64_t heapSize = heap.size();
+            f.write(reinterpret_cast<char const *>(& heapSize), sizeof(heapSize));
+            f.write(heap.data(), heapSize);
+            if (! f.good())
+                ERROR("Unable to write " << File(dir));
+        }
+
+        /** Loads the metadata table from given metadata directory.
+         */
+        MetadataTable(std::string const & dir) {
+            std::ifstream f(File(dir), std::ios::in | std::ios::binary);
+            if (! f.good())
+                ERROR("Unable to open " << File(dir) << ", run build-metadata-table first");
+            char magic[MAGIC_SIZE];
+            f.read(magic, MAGIC_SIZE);
+            if (! f.good() || strncmp(magic, Magic(), MAGIC_SIZE) != 0)
+                ERROR("Invalid metadata table " << File(dir));
+            uint64_t n = 0;
+            f.read(reinterpret_cast<char *>(& n), sizeof(n));
+            records_.resize(n);
+            f.read(reinterpret_cast<char *>(records_.data()), n * sizeof(Record));
+            uint64_t heapSize = 0;
+            f.read(reinterpret_cast<char *>(& heapSize), sizeof(heapSize));
+            heap_.resize(heapSize);
+            f.read(& heap_[0], heapSize);
+            if (! f.good())
+                ERROR("Truncated metadata table " << File(dir));
+        }
+
+        /** Returns true if there is metadata for the given project.
+         */
+        bool has(unsigned projectId) const {
+            return projectId < records_.size() && records_[projectId].present();
+        }
+
+        Record const & operator [] (unsigned projectId) const {
+            return records_[projectId];
+        }
+
+        /** Returns the string at given offset of the heap, or empty string if not present.
+         */
+        char const * str(uint32_t offset) const {
+            return offset == NONE ? "" : heap_.c_str() + offset;
+        }
+
+    private:
+
+        static uint32_t AddString(std::string & heap, std::string const & what) {
+            uint32_t result = heap.size();
+            heap.append(what);
+            heap.push_back(0);
+            return result;
+        }
+
+        std::vector<Record> records_;
+        std::string heap_;
+    }; // MetadataTable
+
+} // namespace dejavu
@@ -9,6 +9,9 @@
 #include <vector>
 #include <unordered_map>
 
+#include "helpers/hash.h"
+#include "helpers/hex.h"
+
 namespace dejavu {
 
     constexpr unsigned UNKNOWN_HASH = -1;
@@ -28,10 +31,10 @@ namespace dejavu {
 
     /** To make sure that the originals are deterministic, this function should be used for checking whether an original value should be updated.
 
-        It expects project to support createdAt field and commit to support time field. 
+        It expects project to support createdAt field and commit to support time field. Paths are usually strings, but can be anything ordered as the paths are, such as their ranks in the path dictionary (see PathDictionary::rank). 
      */
-    template<typename PROJECT, typename COMMIT>
-        bool IsBetterOriginal(PROJECT * originalProject, COMMIT * originalCommit, std::string const & originalPath, PROJECT * project, COMMIT * commit, std::string const & path) {
+    template<typename PROJECT, typename COMMIT, typename PATH>
+        bool IsBetterOriginal(PROJECT * originalProject, COMMIT * originalCommit, PATH const & originalPath, PROJECT * project, COMMIT * commit, PATH const & path) {
         // if the new commit is younger then it is better candidateOB
         if (commit->time < originalCommit->time)
             return true;
@@ -44,8 +47,12 @@ namespace dejavu {
                 if (commit->id < originalCommit->id)
                     return true;
                 // and finally, if even the commit is the same, the we use lexically smaller path
-                if (commit->id == originalCommit->id)
+                if (commit->id == originalCommit->id) {
+                    // and if the paths are the same as well (i.e. forks), the project with smaller id wins so that the original does not depend on the order of the occurences
+                    if (path == originalPath)
+                        return project->id < originalProject->id;
                     return path < originalPath;
+                }
             }
         }
         return false;
@@ -60,44 +67,32 @@ namespace dejavu {
         unsigned char hash[20];
 
         std::string toString() const {
-            std::stringstream s;
-            s << std::hex;
-            for (size_t i = 0; i < 20; ++i) {
-                if (hash[i] < 16)
-                    s << '0';
-                s << (unsigned) hash[i];
-            }
-            return s.str();
+            std::string result(40, '\0');
+            helpers::HexEncode(hash, 20, & result[0]);
+            return result;
         }
 
         bool operator == (SHA1Hash const & other) const {
-            for (size_t i = 0; i < 20; ++i)
-                if (hash[i] != other.hash[i])
-                    return false;
-            return true;
+            return helpers::BytesEqual<20>(hash, other.hash);
+        }
+
+        bool operator != (SHA1Hash const & other) const {
+            return ! (*this == other);
         }
 
         friend std::ostream & operator << (std::ostream & o, SHA1Hash const & hash) {
-            o << hash.toString();
+            char buffer[40];
+            helpers::HexEncode(hash.hash, 20, buffer);
+            o.write(buffer, 40);
             return o;
         }
 
         static SHA1Hash FromHexString(std::string const & str) {
             SHA1Hash result;
-            assert(str.size() == 40);
-            for (auto i = 0; i < 20; ++i) 
-                result.hash[i] = HexDigitToValue(str[i * 2]) * 16 + HexDigitToValue(str[i * 2 + 1]);
+            if (str.size() != 40 || ! helpers::HexDecode(str.c_str(), 20, result.hash))
+                ERROR("Invalid SHA1 hash: " << str);
             return result;
         }
-    private:
-
-        static unsigned char HexDigitToValue(char what) {
-            if (what >= '0' && what <= '9')
-                return what - '0';
-            if (what >= 'a' && what <= 'f')
-                return what - 'a' + 10;
-            assert(false);
-        }
 
     };
     
@@ -260,13 +255,7 @@ namespace std {
     template<>
     struct hash<dejavu::SHA1Hash> {
         size_t operator()(dejavu::SHA1Hash const &hash) const {
-            size_t result = 0;
-            result += *(uint32_t*)(hash.hash);
-            result += *(uint32_t*)(hash.hash + 4);
-            result += *(uint32_t*)(hash.hash + 8);
-            result += *(uint32_t*)(hash.hash + 12);
-            result += *(uint32_t*)(hash.hash + 16);
-            return result;
+            return helpers::HashBytes(hash.hash, 20);
         }
     };
     
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "helpers/helpers.h"
+
+#include "settings.h"
+
+namespace dejavu {
+
+    /** Rows of an output file produced concurrently by multiple threads, written in a deterministic order.
+
+        Instead of appending the rows to the file under a lock in whatever order the threads get to it, each thread collects the rows it produces in its own run, together with a binary sort key. Adding a row therefore never takes a lock. When a run grows over the run size, it is sorted and spilled to a temporary file. Once all rows have been added, the runs are merged (k-way merge) so that the rows come out ordered by their keys, and rows with the same key ordered by their contents, regardless of how many threads produced them and how the threads were scheduled.
+
+        Keys are compared as byte strings, numbers should therefore be appended to keys with AppendKey, which stores them big endian.
+     */
+    class OrderedOutput {
+    public:
+
+        typedef std::pair<std::string, std::string> Row;
+
+        /** Called for the merged rows in order with the key and the row.
+         */
+        typedef std::function<void(std::string const &, std::string const &)> Handler;
+
+        /** Default size of a thread's run (in bytes) before it is spilled to disk.
+         */
+        static constexpr size_t DEFAULT_RUN_SIZE = 64 * 1024 * 1024;
+
+        /** Creates the output, the name is only used for the temporary files.
+         */
+        OrderedOutput(std::string const & name, size_t runSize = DEFAULT_RUN_SIZE, std::string const & tempDir = TempDir.value()):
+            name_(name),
+            tempDir_(tempDir),
+            runSize_(runSize),
+            id_(NextId()++),
+            files_(0) {
+        }
+
+        OrderedOutput(OrderedOutput const &) = delete;
+
+        ~OrderedOutput() {
+            clear();
+            for (Run * r : runs_)
+                delete r;
+        }
+
+        /** Appends given number to the key so that the byte order of keys follows the numeric order.
+         */
+        static void AppendKey(std::string & key, uint32_t value) {
+            for (int shift = 24; shift >= 0; shift -= 8)
+                key.push_back(static_cast<char>((value >> shift) & 0xff));
+        }
+
+        /** Returns the number of rows added so far. Must not be called while threads are adding rows.
+         */
+        size_t size() const {
+            size_t result = 0;
+            for (Run * r : runs_)
+                result += r->size;
+            return result;
+        }
+
+        /** Adds row with given key to the run of the calling thread.
+         */
+        void add(std::string key, std::string row) {
+            Run & r = local();
+            r.bytes += key.size() + row.size() + sizeof(Row);
+            r.rows.push_back(Row(std::move(key), std::move(row)));
+            ++r.size;
+            if (r.bytes >= runSize_)
+                spill(r);
+        }
+
+        /** Merges the runs of all threads and passes the rows to the handler in order.
+
+            Must only be called after all threads finished adding rows. The rows are consumed, i.e. the output is empty afterwards.
+         */
+        void merge(Handler handler) {
+            std::vector<Source *> sources;
+            for (Run * r : runs_) {
+                std::sort(r->rows.begin(), r->rows.end());
+                sources.push_back(new Source(& r->rows));
+                for (std::string const & filename : r->files)
+                    sources.push_back(new Source(filename));
+            }
+            typedef std::pair<Row, size_t> Head;
+            auto cmp = [](Head const & a, Head const & b) {
+                return b.first < a.first;
+            };
+            std::priority_queue<Head, std::vector<Head>, decltype(cmp)> q(cmp);
+            for (size_t i = 0; i < sources.size(); ++i) {
+                Head h;
+                h.second = i;
+                if (sources[i]->next(h.first))
+                    q.push(std::move(h));
+            }
+            while (! q.empty()) {
+                Head h = std::move(const_cast<Head &>(q.top()));
+                q.pop();
+                handler(h.first.first, h.first.second);
+                if (sources[h.second]->next(h.first))
+                    q.push(std::move(h));
+            }
+            for (Source * s : sources)
+                delete s;
+            clear();
+        }
+
+        /** Writes the merged rows to given stream, each on its own line.
+         */
+        void write(std::ostream & s) {
+            merge([&](std::string const & key, std::string const & row) {
+                    s << row << '\n';
+                });
+        }
+
+    private:
+
+        /** Rows added by a single thread and the files its sorted runs were spilled to.
+         */
+        struct Run {
+            std::vector<Row> rows;
+            size_t bytes = 0;
+            size_t size = 0;
+            std::vector<std::string> files;
+        };
+
+        /** Sorted rows, either from memory, or from a spilled run, where each row is stored as key length, row length (both 32bit), key and row.
+         */
+        class Source {
+        public:
+            Source(std::vector<Row> * rows):
+                rows_(rows),
+                pos_(0) {
+            }
+
+            Source(std::string const & filename):
+                rows_(nullptr),
+                f_(filename, std::ios::in | std::ios::binary) {
+                if (! f_.good())
+                    ERROR("Unable to open " << filename);
+            }
+
+            bool next(Row & into) {
+                if (rows_ != nullptr) {
+                    if (pos_ == rows_->size())
+                        return false;
+                    into = std::move((*rows_)[pos_++]);
+                    return true;
+                }
+                uint32_t sizes[2];
+                if (! f_.read(reinterpret_cast<char *>(sizes), sizeof(sizes)))
+                    return false;
+                into.first.resize(sizes[0]);
+                into.second.resize(sizes[1]);
+                f_.read(& into.first[0], sizes[0]);
+                f_.read(& into.second[0], sizes[1]);
+                return true;
+            }
+
+        private:
+            std::vector<Row> * rows_;
+            size_t pos_;
+            std::ifstream f_;
+        };
+
+        static std::atomic<size_t> & NextId() {
+            static std::atomic<size_t> id(0);
+            return id;
+        }
+
+        /** Returns the run of the calling thread, creating it if the thread adds its first row.
+
+            The runs are remembered in a thread local cache indexed by the output ids, which are never reused, so the lock is only taken once per thread and output.
+         */
+        Run & local() {
+            thread_local std::unordered_map<size_t, Run *> cache;
+            auto i = cache.find(id_);
+            if (i != cache.end())
+                return *i->second;
+            Run * r = new Run();
+            {
+                std::lock_guard<std::mutex> g(m_);
+                runs_.push_back(r);
+            }
+            cache.insert(std::make_pair(id_, r));
+            return *r;
+        }
+
+        void spill(Run & r) {
+            std::string filename = STR(tempDir_ << "/" << name_ << "." << getpid() << "." << id_ << "." << files_++ << ".run");
+            std::sort(r.rows.begin(), r.rows.end());
+            std::ofstream f(filename, std::ios::out | std::ios::binary);
+            if (! f.good())
+                ERROR("Unable to open " << filename << " for writing");
+            for (Row const & row : r.rows) {
+                uint32_t sizes[] = { static_cast<uint32_t>(row.first.size()), static_cast<uint32_t>(row.second.size()) };
+                f.write(reinterpret_cast<char const *>(sizes), sizeof(sizes));
+                f.write(row.first.c_str(), row.first.size());
+                f.write(row.second.c_str(), row.second.size());
+            }
+            if (! f.good())
+                ERROR("Unable to write " << filename);
+            r.files.push_back(filename);
+            r.rows.clear();
+            r.bytes = 0;
+        }
+
+        /** Empties the runs and deletes their files.
+         */
+        void clear() {
+            for (Run * r : runs_) {
+                for (std::string const & filename : r->files)
+                    std::remove(filename.c_str());
+                r->files.clear();
+                r->rows.clear();
+                r->rows.shrink_to_fit();
+                r->bytes = 0;
+                r->size = 0;
+            }
+        }
+
+        std::string name_;
+        std::string tempDir_;
+        size_t runSize_;
+        size_t id_;
+        std::atomic<size_t> files_;
+
+        std::vector<Run *> runs_;
+        std::mutex m_;
+
+    }; // OrderedOutput
+
+} // namespace dejavu
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cassert>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "settings.h"
+#include "loaders.h"
+
+namespace dejavu {
+
+    /** Loads the dataset tables in phases, running independent tasks of each phase concurrently.
+
+        Loading the tables one after another makes the startup of a command as long as reading all of them, even though most tables do not depend on each other. Instead, the tasks added to the loader run concurrently, each in its own thread, when run() is called and the phase ends when all of them finish. Typically the first phase parses the tables, each into its own id indexed array, or into plain records if its rows refer to objects from other tables (commit parents and file changes). The records are bucketed by the threads of the linking passes which own them as they are parsed. The second phase then links the objects together in parallel passes (see addPass, LinkParents and LinkChanges), in which each thread only reads its own buckets, so that the startup takes roughly as long as reading the largest table.
+
+        Exceptions thrown by the tasks are rethrown by run() once all tasks of the phase have finished.
+     */
+    class ParallelLoader {
+    public:
+
+        struct CommitParent {
+            unsigned commitId;
+            unsigned parentId;
+        };
+
+        struct FileChange {
+            unsigned projectId;
+            unsigned commitId;
+            unsigned pathId;
+            unsigned contentsId;
+        };
+
+        struct ProjectCommit {
+            unsigned projectId;
+            unsigned commitId;
+        };
+
+        /** Commit parents records, bucketed by the owner of the commit and by the owner of the parent (see Owns).
+
+            Each record is therefore stored twice, so that the threads of LinkParents do not have to scan the records owned by others.
+         */
+        class CommitParents {
+        public:
+            explicit CommitParents(unsigned numThreads = NumThreads.value()):
+                byCommit(numThreads),
+                byParent(numThreads) {
+            }
+
+            size_t size() const {
+                size_t result = 0;
+                for (auto const & b : byCommit)
+                    result += b.size();
+                return result;
+            }
+
+            std::vector<std::vector<CommitParent>> byCommit;
+            std::vector<std::vector<CommitParent>> byParent;
+        };
+
+        /** File changes records bucketed by the owner of their commit and the project commits bucketed by the owner of the project (see Owns).
+
+            A project commit is only stored when it differs from the previous one in its bucket, which for file changes ordered by project and commit makes them a small fraction of the records.
+         */
+        class FileChanges {
+        public:
+            explicit FileChanges(unsigned numThreads = NumThreads.value()):
+                byCommit(numThreads),
+                byProject(numThreads) {
+            }
+
+            size_t size() const {
+                size_t result = 0;
+                for (auto const & b : byCommit)
+                    result += b.size();
+                return result;
+            }
+
+            /** Calls the handler for all records, bucket by bucket.
+             */
+            template<typename HANDLER>
+            void forEach(HANDLER handler) const {
+                for (auto const & b : byCommit)
+                    for (FileChange const & r : b)
+                        handler(r);
+            }
+
+            std::vector<std::vector<FileChange>> byCommit;
+            std::vector<std::vector<ProjectCommit>> byProject;
+        };
+
+        typedef std::function<void()> Task;
+
+        /** Pass over data split between threads, called with the index of the thread and the number of threads.
+         */
+        typedef std::function<void(unsigned, unsigned)> Pass;
+
+        /** Adds task to the current phase. The name (such as "Loading projects") is reported when the phase starts.
+         */
+        ParallelLoader & add(std::string const & name, Task task) {
+            tasks_.push_back(std::make_pair(name, task));
+            return *this;
+        }
+
+        /** Adds pass split between given number of threads to the current phase.
+
+            Each thread must only modify the objects it owns (see Owns), so that the passes do not need any locks.
+         */
+        ParallelLoader & addPass(std::string const & name, Pass pass, unsigned numThreads = NumThreads.value()) {
+            for (unsigned i = 0; i < numThreads; ++i)
+                tasks_.push_back(std::make_pair(i == 0 ? name : std::string(), [pass, i, numThreads]() {
+                            pass(i, numThreads);
+                        }));
+            return *this;
+        }
+
+        /** Runs all tasks of the current phase concurrently and waits for them to finish.
+         */
+        void run() {
+            for (auto const & t : tasks_)
+                if (! t.first.empty())
+                    std::cerr << t.first << " ... " << std::endl;
+            std::exception_ptr error;
+            std::mutex m;
+            std::vector<std::thread> threads;
+            for (auto const & t : tasks_)
+                threads.push_back(std::thread([& t, & error, & m]() {
+                            try {
+                                t.second();
+                            } catch (...) {
+                                std::lock_guard<std::mutex> g(m);
+                                if (! error)
+                                    error = std::current_exception();
+                            }
+                        }));
+            for (auto & i : threads)
+                i.join();
+            tasks_.clear();
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        /** Returns true if the object with given id belongs to given thread of a pass.
+         */
+        static bool Owns(unsigned id, unsigned thread, unsigned numThreads) {
+            return id % numThreads == thread;
+        }
+
+        /** Reads the commit parents records.
+         */
+        static void Load(CommitParents & into) {
+            unsigned n = into.byCommit.size();
+            CommitParentsLoader::Read([& into, n](unsigned id, unsigned parentId) {
+                    into.byCommit[id % n].push_back(CommitParent{id, parentId});
+                    into.byParent[parentId % n].push_back(CommitParent{id, parentId});
+                });
+        }
+
+        /** Reads the file changes records.
+         */
+        static void Load(FileChanges & into) {
+            unsigned n = into.byCommit.size();
+            FileChangeLoader::Read([& into, n](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId) {
+                    into.byCommit[commitId % n].push_back(FileChange{projectId, commitId, pathId, contentsId});
+                    std::vector<ProjectCommit> & b = into.byProject[projectId % n];
+                    if (b.empty() || b.back().projectId != projectId || b.back().commitId != commitId)
+                        b.push_back(ProjectCommit{projectId, commitId});
+                });
+        }
+
+        /** Part of a pass which links commits with their parents, given a function returning commit for its id.
+
+            This is BaseCommit::addParent split by owners: commits owned by the thread get their parents and parents owned by the thread get their children.
+         */
+        template<typename COMMIT_LOOKUP>
+        static void LinkParents(CommitParents const & parents, COMMIT_LOOKUP commit, unsigned thread, unsigned numThreads) {
+            assert(parents.byCommit.size() == numThreads);
+            for (CommitParent const & r : parents.byCommit[thread]) {
+                auto c = commit(r.commitId);
+                assert(c != nullptr);
+                c->parents.insert(commit(r.parentId));
+            }
+            for (CommitParent const & r : parents.byParent[thread]) {
+                auto p = commit(r.parentId);
+                assert(p != nullptr);
+                p->children.insert(commit(r.commitId));
+            }
+        }
+
+        /** Part of a pass which adds file changes to their commits and commits to their projects, given functions returning project and commit for their ids.
+
+            Commits owned by the thread get their changes and projects owned by the thread get their commits.
+         */
+        template<typename PROJECT_LOOKUP, typename COMMIT_LOOKUP>
+        static void LinkChanges(FileChanges const & changes, PROJECT_LOOKUP project, COMMIT_LOOKUP commit, unsigned thread, unsigned numThreads) {
+            assert(changes.byCommit.size() == numThreads);
+            for (FileChange const & r : changes.byCommit[thread]) {
+                auto c = commit(r.commitId);
+                assert(c != nullptr);
+                c->addChange(r.pathId, r.contentsId);
+            }
+            for (ProjectCommit const & r : changes.byProject[thread]) {
+                auto p = project(r.projectId);
+                assert(p != nullptr);
+                p->addCommit(commit(r.commitId));
+            }
+        }
+
+        /** Releases memory of the records once they have been linked.
+         */
+        static void Release(CommitParents & records) {
+            records = CommitParents(records.byCommit.size());
+        }
+
+        static void Release(FileChanges & records) {
+            records = FileChanges(records.byCommit.size());
+        }
+
+    private:
+        std::vector<std::pair<std::string, Task>> tasks_;
+
+    }; // ParallelLoader
+
+} // namespace dejavu
@@ -0,0 +1,296 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "helpers/helpers.h"
+#include "helpers/strings.h"
+
+#include "loaders.h"
+#include "settings.h"
+
+namespace dejavu {
+
+    /** Precomputed attributes of all paths in the dataset, indexed by path ids.
+
+        Produced by the build-path-attributes command so that commands which filter or group paths by whether they are in node_modules, by their NPM package, extension or top folder can do so with array lookups instead of loading and scanning the path strings. For each path id the following attributes are stored in a fixed size Record:
+
+        - whether the path is an NPM path (see IsNPMPath)
+        - the NPM package root, i.e. the path up to and including the segment after the last node_modules folder (node_modules/foo for node_modules/foo/lib/bar.js), or NONE, the same as used by npm-summary. For files directly in a node_modules folder that segment is the file itself, so node_modules/foo.js is its own package root
+        - whether the path is the package.json of its package root
+        - the extension of the file, which is the part of the filename from the last dot, or the whole filename if there is no dot, the same as the extension used by join for the cummulative commit changes
+        - the top folder (first segment) of the path, or NONE for files in the root
+        - the depth, i.e. the number of folders the file is in
+
+        The package roots, extensions and top folders are stored as ids into string tables. The attributes are stored in pathAttributes.bin in the data directory:
+
+            magic numPaths Record[numPaths] roots extensions topFolders
+
+        where each of the string tables is stored as the number of strings, their 64bit offsets (one more than the strings) and the zero padded characters. The file is mapped in memory.
+     */
+    class PathAttributes {
+    public:
+
+        static constexpr size_t MAGIC_SIZE = 8;
+
+        static constexpr uint32_t NONE = 0xffffffff;
+
+        static constexpr uint8_t PRESENT = 1;
+        static constexpr uint8_t NPM = 2;
+        static constexpr uint8_t PACKAGE_JSON = 4;
+
+        static char const * Magic() {
+            return "DJVATTR1";
+        }
+
+        static std::string File(std::string const & dir) {
+            return dir + "/pathAttributes.bin";
+        }
+
+        class Record {
+        public:
+            uint32_t packageRoot;
+            uint32_t extension;
+            uint32_t topFolder;
+            uint16_t depth;
+            uint8_t flags;
+            uint8_t reserved;
+        };
+
+        /** Calculates the attributes of paths, which are added one by one.
+         */
+        class Builder {
+        public:
+
+            void addPath(unsigned id, std::string const & path) {
+                if (id >= records_.size()) {
+                    Record empty;
+                    memset(& empty, 0, sizeof(Record));
+                    empty.packageRoot = empty.extension = empty.topFolder = NONE;
+                    records_.resize(id + 1, empty);
+                }
+                Record & r = records_[id];
+                std::vector<std::string> ps = helpers::Split(path, '/');
+                r.flags = PRESENT | (IsNPMPath(path) ? NPM : 0);
+                r.depth = static_cast<uint16_t>(ps.size() - 1);
+                r.topFolder = ps.size() > 1 ? topFolders_.intern(ps[0]) : NONE;
+                std::string const & filename = ps.back();
+                size_t dot = filename.find_last_of('.');
+                r.extension = extensions_.intern(dot == std::string::npos ? filename : filename.substr(dot));
+                // the package root is the last node_modules folder followed by at least one more segment
+                r.packageRoot = NONE;
+                for (size_t i = ps.size() - 1; i-- > 0; ) {
+                    if (ps[i] == "node_modules") {
+                        std::string root = ps[0];
+                        for (size_t j = 1; j <= i + 1; ++j)
+                            root = root + "/" + ps[j];
+                        r.packageRoot = roots_.intern(root);
+                        if (i + 3 == ps.size() && filename == "package.json")
+                            r.flags |= PACKAGE_JSON;
+                        break;
+                    }
+                }
+            }
+
+            size_t numPaths() const {
+                return records_.size();
+            }
+
+            size_t numPackageRoots() const {
+                return roots_.strings.size();
+            }
+
+            size_t numExtensions() const {
+                return extensions_.strings.size();
+            }
+
+            void write(std::string const & dir) {
+                std::ofstream f(File(dir), std::ios::out | std::ios::binary);
+                if (! f.good())
+                    ERROR("Unable to open " << File(dir) << " for writing");
+                f.write(Magic(), MAGIC_SIZE);
+                uint64_t n = records_.size();
+                f.write(reinterpret_cast<char const *>(& n), sizeof(n));
+                f.write(reinterpret_cast<char const *>(records_.data()), n * sizeof(Record));
+                roots_.write(f);
+                extensions_.write(f);
+                topFolders_.write(f);
+                if (! f.good())
+                    ERROR("Unable to write " << File(dir));
+            }
+
+        private:
+
+            class Strings {
+            public:
+                std::vector<std::string> strings;
+                std::unordered_map<std::string, uint32_t> ids;
+
+                uint32_t intern(std::string const & what) {
+                    auto i = ids.find(what);
+                    if (i == ids.end()) {
+                        i = ids.insert(std::make_pair(what, strings.size())).first;
+                        strings.push_back(what);
+                    }
+                    return i->second;
+                }
+
+                void write(std::ofstream & f) {
+                    uint64_t n = strings.size();
+                    f.write(reinterpret_cast<char const *>(& n), sizeof(n));
+                    uint64_t offset = 0;
+                    f.write(reinterpret_cast<char const *>(& offset), sizeof(offset));
+                    for (std::string const & s : strings) {
+                        offset += s.size();
+                        f.write(reinterpret_cast<char const *>(& offset), sizeof(offset));
+                    }
+                    for (std::string const & s : strings)
+                        f.write(s.c_str(), s.size());
+                    uint64_t padding = 0;
+                    f.write(reinterpret_cast<char const *>(& padding), (8 - offset % 8) % 8);
+                }
+            };
+
+            std::vector<Record> records_;
+            Strings roots_;
+            Strings extensions_;
+            Strings topFolders_;
+        }; // PathAttributes::Builder
+
+        /** Maps the attributes in given directory.
+         */
+        PathAttributes(std::string const & dir = DataDir.value()) {
+            int fd = open(File(dir).c_str(), O_RDONLY);
+            if (fd == -1)
+                ERROR("Unable to open " << File(dir) << ", run build-path-attributes first");
+            struct stat st;
+            fstat(fd, & st);
+            size_ = st.st_size;
+            void * m = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (m == MAP_FAILED)
+                ERROR("Unable to map " << File(dir));
+            base_ = static_cast<char const *>(m);
+            if (size_ < MAGIC_SIZE + sizeof(uint64_t) || strncmp(base_, Magic(), MAGIC_SIZE) != 0)
+                ERROR("Invalid path attributes " << File(dir));
+            char const * x = base_ + MAGIC_SIZE;
+            numPaths_ = * reinterpret_cast<uint64_t const *>(x);
+            records_ = reinterpret_cast<Record const *>(x + sizeof(uint64_t));
+            x = reinterpret_cast<char const *>(records_ + numPaths_);
+            x = roots_.map(x, base_ + size_, File(dir));
+            x = extensions_.map(x, base_ + size_, File(dir));
+            x = topFolders_.map(x, base_ + size_, File(dir));
+            if (x != base_ + size_)
+                ERROR("Invalid path attributes " << File(dir));
+        }
+
+        PathAttributes(PathAttributes const &) = delete;
+
+        ~PathAttributes() {
+            munmap(const_cast<char *>(base_), size_);
+        }
+
+        /** Returns the largest path id + 1.
+         */
+        size_t size() const {
+            return numPaths_;
+        }
+
+        bool has(unsigned pathId) const {
+            return pathId < numPaths_ && (records_[pathId].flags & PRESENT);
+        }
+
+        Record const & operator [] (unsigned pathId) const {
+            assert(pathId < numPaths_);
+            return records_[pathId];
+        }
+
+        bool isNPM(unsigned pathId) const {
+            return pathId < numPaths_ && (records_[pathId].flags & NPM);
+        }
+
+        bool isPackageJson(unsigned pathId) const {
+            return pathId < numPaths_ && (records_[pathId].flags & PACKAGE_JSON);
+        }
+
+        /** Returns the id of the package root of the path, or NONE if the path is not in a package.
+         */
+        unsigned packageRoot(unsigned pathId) const {
+            return pathId < numPaths_ ? records_[pathId].packageRoot : NONE;
+        }
+
+        size_t numPackageRoots() const {
+            return roots_.size;
+        }
+
+        size_t numExtensions() const {
+            return extensions_.size;
+        }
+
+        size_t numTopFolders() const {
+            return topFolders_.size;
+        }
+
+        std::string packageRootName(unsigned id) const {
+            return roots_[id];
+        }
+
+        /** Returns the name of the package, which is the last segment of its root.
+         */
+        std::string packageName(unsigned id) const {
+            std::string root = roots_[id];
+            return root.substr(root.rfind('/') + 1);
+        }
+
+        std::string extensionName(unsigned id) const {
+            return extensions_[id];
+        }
+
+        std::string topFolderName(unsigned id) const {
+            return topFolders_[id];
+        }
+
+    private:
+
+        class Strings {
+        public:
+            uint64_t size = 0;
+            uint64_t const * offsets = nullptr;
+            char const * heap = nullptr;
+
+            char const * map(char const * x, char const * end, std::string const & filename) {
+                if (x + sizeof(uint64_t) > end)
+                    ERROR("Truncated path attributes " << filename);
+                size = * reinterpret_cast<uint64_t const *>(x);
+                offsets = reinterpret_cast<uint64_t const *>(x + sizeof(uint64_t));
+                heap = reinterpret_cast<char const *>(offsets + size + 1);
+                if (heap > end)
+                    ERROR("Truncated path attributes " << filename);
+                return heap + offsets[size] + (8 - offsets[size] % 8) % 8;
+            }
+
+            std::string operator [] (unsigned id) const {
+                assert(id < size);
+                return std::string(heap + offsets[id], offsets[id + 1] - offsets[id]);
+            }
+        };
+
+        char const * base_;
+        size_t size_;
+        uint64_t numPaths_;
+        Record const * records_;
+        Strings roots_;
+        Strings extensions_;
+        Strings topFolders_;
+    }; // PathAttributes
+
+} // namespace dejavu
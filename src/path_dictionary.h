@@ -0,0 +1,326 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "helpers/helpers.h"
+#include "helpers/strings.h"
+
+#include "settings.h"
+
+namespace dejavu {
+
+    /** Memory mapped dictionary of all paths in the dataset which translates path ids to paths and back.
+
+        Produced by the build-path-dictionary command from paths.csv. Since paths share long prefixes (such as node_modules/...), the paths are sorted and front coded in blocks of BLOCK_SIZE paths. The first path of each block is stored in full, every other path only stores the length of the prefix it shares with the previous path and the rest of it. The dictionary is stored in paths.dict in the data directory:
+
+            magic numIds numPaths numBlocks
+            idToRank[numIds] rankToId[numPaths] (padding to 8 bytes)
+            blockOffsets[numBlocks] dataSize
+            data
+
+        where the ranks are the indices of the paths in the sorted order, 0xffffffff for path ids which are not used, the counts, offsets and data size are 64bit and the ranks and ids 32bit. In the data the lengths are unsigned LEB128 varints.
+
+        Translating a path id to the path decodes at most one block, translating a path to its id binary searches the first paths of the blocks and then decodes one block. Since the ranks follow the order of the paths, paths can be compared by their ranks and all paths starting with given prefix have consecutive ranks, so that checking whether a path is in a folder only needs the rank range of the folder (see prefixRange), and no decoding at all. The file is mapped in memory rather than loaded so that opening the dictionary is instant and its pages are shared by all commands running on the same dataset.
+     */
+    class PathDictionary {
+    public:
+
+        static constexpr size_t MAGIC_SIZE = 8;
+
+        static constexpr unsigned BLOCK_SIZE = 16;
+
+        /** Rank of unused ids and the id returned for paths not in the dictionary.
+         */
+        static constexpr uint32_t NONE = 0xffffffff;
+
+        static char const * Magic() {
+            return "DJVPATH1";
+        }
+
+        static std::string File(std::string const & dir) {
+            return dir + "/paths.dict";
+        }
+
+        /** Writes the dictionary of given (path, id) pairs, which are sorted in the process.
+         */
+        static void Write(std::string const & dir, std::vector<std::pair<std::string, unsigned>> & paths) {
+            std::sort(paths.begin(), paths.end());
+            uint64_t numIds = 0;
+            for (auto const & p : paths)
+                numIds = std::max(numIds, static_cast<uint64_t>(p.second) + 1);
+            uint64_t numPaths = paths.size();
+            uint64_t numBlocks = (numPaths + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            std::vector<uint32_t> idToRank(numIds, NONE);
+            std::vector<uint32_t> rankToId(numPaths);
+            std::vector<uint64_t> blockOffsets(numBlocks);
+            std::string data;
+            for (size_t i = 0; i < numPaths; ++i) {
+                std::string const & path = paths[i].first;
+                idToRank[paths[i].second] = i;
+                rankToId[i] = paths[i].second;
+                if (i % BLOCK_SIZE == 0) {
+                    blockOffsets[i / BLOCK_SIZE] = data.size();
+                    AppendVarint(data, path.size());
+                    data.append(path);
+                } else {
+                    std::string const & prev = paths[i - 1].first;
+                    size_t shared = 0;
+                    size_t max = std::min(prev.size(), path.size());
+                    while (shared < max && prev[shared] == path[shared])
+                        ++shared;
+                    AppendVarint(data, shared);
+                    AppendVarint(data, path.size() - shared);
+                    data.append(path, shared, std::string::npos);
+                }
+            }
+            std::ofstream f(File(dir), std::ios::out | std::ios::binary);
+            if (! f.good())
+                ERROR("Unable to open " << File(dir) << " for writing");
+            f.write(Magic(), MAGIC_SIZE);
+            f.write(reinterpret_cast<char const *>(& numIds), sizeof(numIds));
+            f.write(reinterpret_cast<char const *>(& numPaths), sizeof(numPaths));
+            f.write(reinterpret_cast<char const *>(& numBlocks), sizeof(numBlocks));
+            f.write(reinterpret_cast<char const *>(idToRank.data()), numIds * sizeof(uint32_t));
+            f.write(reinterpret_cast<char const *>(rankToId.data()), numPaths * sizeof(uint32_t));
+            uint64_t padding = 0;
+            f.write(reinterpret_cast<char const *>(& padding), Padding(numIds + numPaths));
+            f.write(reinterpret_cast<char const *>(blockOffsets.data()), numBlocks * sizeof(uint64_t));
+            uint64_t dataSize = data.size();
+            f.write(reinterpret_cast<char const *>(& dataSize), sizeof(dataSize));
+            f.write(data.c_str(), data.size());
+            if (! f.good())
+                ERROR("Unable to write " << File(dir));
+        }
+
+        /** Maps the dictionary in given directory.
+         */
+        PathDictionary(std::string const & dir = DataDir.value()) {
+            int fd = open(File(dir).c_str(), O_RDONLY);
+            if (fd == -1)
+                ERROR("Unable to open " << File(dir) << ", run build-path-dictionary first");
+            struct stat st;
+            fstat(fd, & st);
+            size_ = st.st_size;
+            void * m = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (m == MAP_FAILED)
+                ERROR("Unable to map " << File(dir));
+            base_ = static_cast<char const *>(m);
+            if (size_ < MAGIC_SIZE + 3 * sizeof(uint64_t) || strncmp(base_, Magic(), MAGIC_SIZE) != 0)
+                ERROR("Invalid path dictionary " << File(dir));
+            uint64_t const * header = reinterpret_cast<uint64_t const *>(base_ + MAGIC_SIZE);
+            numIds_ = header[0];
+            numPaths_ = header[1];
+            numBlocks_ = header[2];
+            idToRank_ = reinterpret_cast<uint32_t const *>(header + 3);
+            rankToId_ = idToRank_ + numIds_;
+            blockOffsets_ = reinterpret_cast<uint64_t const *>(reinterpret_cast<char const *>(rankToId_ + numPaths_) + Padding(numIds_ + numPaths_));
+            data_ = reinterpret_cast<char const *>(blockOffsets_ + numBlocks_ + 1);
+            if (data_ > base_ + size_ || data_ + blockOffsets_[numBlocks_] != base_ + size_)
+                ERROR("Truncated path dictionary " << File(dir));
+        }
+
+        PathDictionary(PathDictionary const &) = delete;
+
+        ~PathDictionary() {
+            munmap(const_cast<char *>(base_), size_);
+        }
+
+        /** Returns the largest path id + 1.
+         */
+        size_t size() const {
+            return numIds_;
+        }
+
+        /** Returns the number of paths in the dictionary.
+         */
+        size_t numPaths() const {
+            return numPaths_;
+        }
+
+        bool has(unsigned id) const {
+            return id < numIds_ && idToRank_[id] != NONE;
+        }
+
+        /** Range of ranks [first, last) of the paths sharing a prefix.
+         */
+        class Range {
+        public:
+            uint32_t first;
+            uint32_t last;
+
+            bool empty() const {
+                return first == last;
+            }
+        };
+
+        /** Returns the rank of given id, i.e. the index of its path in the sorted order of all paths.
+         */
+        uint32_t rank(unsigned id) const {
+            assert(has(id));
+            return idToRank_[id];
+        }
+
+        /** Returns the range of ranks of all paths which start with given prefix.
+         */
+        Range prefixRange(std::string const & prefix) const {
+            uint32_t first = partitionPoint([&](std::string const & path) {
+                    return path < prefix;
+                });
+            uint32_t last = partitionPoint([&](std::string const & path) {
+                    return path < prefix || helpers::startsWith(path, prefix);
+                });
+            return Range{first, last};
+        }
+
+        /** Returns true if the path of given id is in the range, i.e. starts with the prefix of the range.
+         */
+        bool inRange(unsigned id, Range const & range) const {
+            uint32_t r = rank(id);
+            return r >= range.first && r < range.last;
+        }
+
+        /** Returns the path of given id.
+         */
+        std::string operator [] (unsigned id) const {
+            assert(has(id));
+            uint32_t rank = idToRank_[id];
+            std::string result;
+            char const * i = data_ + blockOffsets_[rank / BLOCK_SIZE];
+            decodeFirst(i, result);
+            for (uint32_t j = rank / BLOCK_SIZE * BLOCK_SIZE; j < rank; ++j)
+                decodeNext(i, result);
+            return result;
+        }
+
+        /** Returns the id of given path, or NONE if the path is not in the dictionary.
+         */
+        unsigned find(std::string const & path) const {
+            if (numPaths_ == 0)
+                return NONE;
+            // find the last block whose first path is not greater than the path
+            size_t lo = 0;
+            size_t hi = numBlocks_;
+            std::string first;
+            while (hi - lo > 1) {
+                size_t mid = (lo + hi) / 2;
+                char const * i = data_ + blockOffsets_[mid];
+                decodeFirst(i, first);
+                if (first <= path)
+                    lo = mid;
+                else
+                    hi = mid;
+            }
+            char const * i = data_ + blockOffsets_[lo];
+            std::string current;
+            decodeFirst(i, current);
+            size_t rank = lo * BLOCK_SIZE;
+            size_t last = std::min(rank + BLOCK_SIZE, static_cast<size_t>(numPaths_));
+            while (true) {
+                if (current == path)
+                    return rankToId_[rank];
+                if (++rank == last)
+                    return NONE;
+                decodeNext(i, current);
+            }
+        }
+
+    private:
+
+        /** Returns the rank of the first path for which the predicate does not hold.
+
+            The predicate must hold for all paths before that rank and for none after it. Binary searches the first paths of the blocks and then decodes a single block.
+         */
+        template<typename PRED>
+        uint32_t partitionPoint(PRED pred) const {
+            // find the first block whose first path does not satisfy the predicate
+            size_t lo = 0;
+            size_t hi = numBlocks_;
+            std::string current;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                char const * i = data_ + blockOffsets_[mid];
+                decodeFirst(i, current);
+                if (pred(current))
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            if (lo == 0)
+                return 0;
+            // the first path of the previous block satisfies the predicate, so the point is in that block, or at its end
+            char const * i = data_ + blockOffsets_[lo - 1];
+            decodeFirst(i, current);
+            size_t rank = (lo - 1) * BLOCK_SIZE;
+            size_t last = std::min(rank + BLOCK_SIZE, static_cast<size_t>(numPaths_));
+            while (++rank < last) {
+                decodeNext(i, current);
+                if (! pred(current))
+                    break;
+            }
+            return rank;
+        }
+
+        /** Number of bytes after the 32bit ranks and ids so that the block offsets are aligned.
+         */
+        static size_t Padding(uint64_t numRanks) {
+            return (numRanks % 2) * sizeof(uint32_t);
+        }
+
+        static void AppendVarint(std::string & buffer, uint64_t value) {
+            while (value >= 0x80) {
+                buffer.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+            buffer.push_back(static_cast<char>(value));
+        }
+
+        static uint64_t ReadVarint(char const * & i) {
+            uint64_t result = 0;
+            unsigned shift = 0;
+            while (true) {
+                uint8_t x = static_cast<uint8_t>(*i++);
+                result |= static_cast<uint64_t>(x & 0x7f) << shift;
+                if ((x & 0x80) == 0)
+                    return result;
+                shift += 7;
+            }
+        }
+
+        static void decodeFirst(char const * & i, std::string & into) {
+            size_t length = ReadVarint(i);
+            into.assign(i, length);
+            i += length;
+        }
+
+        static void decodeNext(char const * & i, std::string & into) {
+            size_t shared = ReadVarint(i);
+            size_t length = ReadVarint(i);
+            into.resize(shared);
+            into.append(i, length);
+            i += length;
+        }
+
+        char const * base_;
+        size_t size_;
+        uint64_t numIds_;
+        uint64_t numPaths_;
+        uint64_t numBlocks_;
+        uint32_t const * idToRank_;
+        uint32_t const * rankToId_;
+        uint64_t const * blockOffsets_;
+        char const * data_;
+    }; // PathDictionary
+
+} // namespace dejavu
@@ -0,0 +1,362 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "helpers/helpers.h"
+#include "helpers/strings.h"
+
+#include "objects.h"
+#include "settings.h"
+
+namespace dejavu {
+
+    /** Memory mapped image of the global directory tree of all paths in the dataset together with the path segments table.
+
+        Produced by the build-path-tree command so that the folder clone commands do not have to split all paths and build the tree of directories every time they run. The image does not contain any pointers, directories and files are referenced by their indices. The children of each directory (both subdirectories and files) are stored contiguously and sorted by their names so that the directory of a path can be found by binary searching the children on the way down. The image is stored in pathTree.bin in the data directory:
+
+            magic numSegments numDirs numFiles numPaths
+            DirRecord[numDirs] FileRecord[numFiles] fileOf[numPaths] (padding to 8 bytes)
+            segmentOffsets[numSegments + 1] segmentHeap
+
+        where the counts and segment offsets are 64bit, the records consist of 32bit unsigned integers and fileOf contains for each path id the index of its file, or NONE if the path id is not used. The root directory is always the first directory, its name is EMPTY_PATH and its parent is NONE.
+
+        The segment ids are assigned in the order of first appearance in paths.csv, which is how the folder clone commands assigned them when they were building the tree themselves.
+     */
+    class PathTree {
+    public:
+
+        static constexpr size_t MAGIC_SIZE = 8;
+
+        static constexpr uint32_t NONE = 0xffffffff;
+
+        static char const * Magic() {
+            return "DJVTREE1";
+        }
+
+        static std::string File(std::string const & dir) {
+            return dir + "/pathTree.bin";
+        }
+
+        class DirRecord {
+        public:
+            uint32_t name;
+            uint32_t parent;
+            uint32_t firstDir;
+            uint32_t numDirs;
+            uint32_t firstFile;
+            uint32_t numFiles;
+        };
+
+        class FileRecord {
+        public:
+            uint32_t pathId;
+            uint32_t name;
+            uint32_t parent;
+        };
+
+        /** Builds the tree from the paths, which are added one by one in the order of paths.csv.
+
+            While building, directories are identified by their parent and name in a single hash map instead of each directory having its own map of children. The final layout with contiguous children is only created when the image is written.
+         */
+        class Builder {
+        public:
+
+            Builder() {
+                segments_.push_back("");
+                segmentIds_.insert(std::make_pair("", EMPTY_PATH));
+                dirs_.push_back(std::make_pair(NONE, EMPTY_PATH));
+            }
+
+            void addPath(unsigned id, std::string const & path) {
+                std::vector<std::string> p = helpers::Split(path, '/');
+                uint32_t d = 0;
+                for (size_t i = 0; i + 1 < p.size(); ++i) {
+                    uint32_t name = segmentId(p[i]);
+                    uint64_t key = (static_cast<uint64_t>(d) << 32) + name;
+                    auto j = dirIds_.find(key);
+                    if (j == dirIds_.end()) {
+                        j = dirIds_.insert(std::make_pair(key, dirs_.size())).first;
+                        dirs_.push_back(std::make_pair(d, name));
+                    }
+                    d = j->second;
+                }
+                FileRecord f;
+                f.pathId = id;
+                f.name = segmentId(p.back());
+                f.parent = d;
+                files_.push_back(f);
+            }
+
+            size_t numSegments() const {
+                return segments_.size();
+            }
+
+            size_t numDirs() const {
+                return dirs_.size();
+            }
+
+            /** Writes the path segments table in the csv format used by the folder clone commands.
+             */
+            void writeSegments(std::string const & filename) {
+                std::ofstream psegs(filename);
+                psegs << "segmentId,str" << std::endl;
+                for (size_t i = 0, e = segments_.size(); i < e; ++i)
+                    psegs << i << "," << helpers::escapeQuotes(segments_[i]) << std::endl;
+            }
+
+            /** Lays out the tree and writes the image.
+             */
+            void write(std::string const & dir) {
+                dirIds_.clear();
+                segmentIds_.clear();
+                // children of each temporary dir, sorted by name so that the final children ranges are sorted as well
+                std::vector<uint32_t> childStart(dirs_.size() + 1, 0);
+                for (size_t i = 1; i < dirs_.size(); ++i)
+                    ++childStart[dirs_[i].first + 1];
+                for (size_t i = 1; i <= dirs_.size(); ++i)
+                    childStart[i] += childStart[i - 1];
+                std::vector<uint32_t> children(dirs_.size() - 1);
+                {
+                    std::vector<uint32_t> next(childStart.begin(), childStart.end() - 1);
+                    for (size_t i = 1; i < dirs_.size(); ++i)
+                        children[next[dirs_[i].first]++] = i;
+                }
+                for (size_t i = 0; i < dirs_.size(); ++i)
+                    std::sort(children.begin() + childStart[i], children.begin() + childStart[i + 1], [this](uint32_t a, uint32_t b) {
+                            return segments_[dirs_[a].second] < segments_[dirs_[b].second];
+                        });
+                // breadth first order makes the children of every directory contiguous
+                std::vector<uint32_t> order;
+                std::vector<uint32_t> finalIndex(dirs_.size());
+                order.reserve(dirs_.size());
+                order.push_back(0);
+                finalIndex[0] = 0;
+                std::vector<DirRecord> dirs(dirs_.size());
+                for (size_t i = 0; i < order.size(); ++i) {
+                    uint32_t t = order[i];
+                    DirRecord & r = dirs[i];
+                    r.name = dirs_[t].second;
+                    r.parent = t == 0 ? NONE : finalIndex[dirs_[t].first];
+                    r.firstDir = order.size();
+                    r.numDirs = childStart[t + 1] - childStart[t];
+                    for (uint32_t j = childStart[t]; j < childStart[t + 1]; ++j) {
+                        finalIndex[children[j]] = order.size();
+                        order.push_back(children[j]);
+                    }
+                    r.numFiles = 0;
+                }
+                // files sorted by their final parents and names
+                for (FileRecord & f : files_)
+                    f.parent = finalIndex[f.parent];
+                std::sort(files_.begin(), files_.end(), [this](FileRecord const & a, FileRecord const & b) {
+                        if (a.parent != b.parent)
+                            return a.parent < b.parent;
+                        return segments_[a.name] < segments_[b.name];
+                    });
+                uint64_t numPaths = 0;
+                for (FileRecord const & f : files_)
+                    numPaths = std::max(numPaths, static_cast<uint64_t>(f.pathId) + 1);
+                std::vector<uint32_t> fileOf(numPaths, NONE);
+                for (size_t i = files_.size(); i > 0; --i) {
+                    FileRecord const & f = files_[i - 1];
+                    fileOf[f.pathId] = i - 1;
+                    dirs[f.parent].firstFile = i - 1;
+                    ++dirs[f.parent].numFiles;
+                }
+                for (DirRecord & r : dirs)
+                    if (r.numFiles == 0)
+                        r.firstFile = 0;
+                std::vector<uint64_t> segmentOffsets;
+                std::string heap;
+                for (std::string const & s : segments_) {
+                    segmentOffsets.push_back(heap.size());
+                    heap.append(s);
+                }
+                segmentOffsets.push_back(heap.size());
+                // and write the image
+                std::ofstream f(File(dir), std::ios::out | std::ios::binary);
+                if (! f.good())
+                    ERROR("Unable to open " << File(dir) << " for writing");
+                f.write(Magic(), MAGIC_SIZE);
+                uint64_t header[] = { segments_.size(), dirs.size(), files_.size(), numPaths };
+                f.write(reinterpret_cast<char const *>(header), sizeof(header));
+                f.write(reinterpret_cast<char const *>(dirs.data()), dirs.size() * sizeof(DirRecord));
+                f.write(reinterpret_cast<char const *>(files_.data()), files_.size() * sizeof(FileRecord));
+                f.write(reinterpret_cast<char const *>(fileOf.data()), fileOf.size() * sizeof(uint32_t));
+                uint64_t padding = 0;
+                f.write(reinterpret_cast<char const *>(& padding), Padding(files_.size(), numPaths));
+                f.write(reinterpret_cast<char const *>(segmentOffsets.data()), segmentOffsets.size() * sizeof(uint64_t));
+                f.write(heap.c_str(), heap.size());
+                if (! f.good())
+                    ERROR("Unable to write " << File(dir));
+            }
+
+        private:
+
+            uint32_t segmentId(std::string const & name) {
+                auto i = segmentIds_.find(name);
+                if (i == segmentIds_.end()) {
+                    i = segmentIds_.insert(std::make_pair(name, segments_.size())).first;
+                    segments_.push_back(name);
+                }
+                return i->second;
+            }
+
+            std::vector<std::string> segments_;
+            std::unordered_map<std::string, uint32_t> segmentIds_;
+            // (parent, name) of the directories in order of creation, root first
+            std::vector<std::pair<uint32_t, uint32_t>> dirs_;
+            std::unordered_map<uint64_t, uint32_t> dirIds_;
+            std::vector<FileRecord> files_;
+        }; // PathTree::Builder
+
+        /** Maps the image in given directory.
+         */
+        PathTree(std::string const & dir = DataDir.value()) {
+            int fd = open(File(dir).c_str(), O_RDONLY);
+            if (fd == -1)
+                ERROR("Unable to open " << File(dir) << ", run build-path-tree first");
+            struct stat st;
+            fstat(fd, & st);
+            size_ = st.st_size;
+            void * m = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (m == MAP_FAILED)
+                ERROR("Unable to map " << File(dir));
+            base_ = static_cast<char const *>(m);
+            if (size_ < MAGIC_SIZE + 4 * sizeof(uint64_t) || strncmp(base_, Magic(), MAGIC_SIZE) != 0)
+                ERROR("Invalid path tree " << File(dir));
+            uint64_t const * header = reinterpret_cast<uint64_t const *>(base_ + MAGIC_SIZE);
+            numSegments_ = header[0];
+            numDirs_ = header[1];
+            numFiles_ = header[2];
+            numPaths_ = header[3];
+            dirs_ = reinterpret_cast<DirRecord const *>(header + 4);
+            files_ = reinterpret_cast<FileRecord const *>(dirs_ + numDirs_);
+            fileOf_ = reinterpret_cast<uint32_t const *>(files_ + numFiles_);
+            segmentOffsets_ = reinterpret_cast<uint64_t const *>(reinterpret_cast<char const *>(fileOf_ + numPaths_) + Padding(numFiles_, numPaths_));
+            heap_ = reinterpret_cast<char const *>(segmentOffsets_ + numSegments_ + 1);
+            if (heap_ > base_ + size_ || heap_ + segmentOffsets_[numSegments_] != base_ + size_)
+                ERROR("Truncated path tree " << File(dir));
+        }
+
+        PathTree(PathTree const &) = delete;
+
+        ~PathTree() {
+            munmap(const_cast<char *>(base_), size_);
+        }
+
+        size_t numSegments() const {
+            return numSegments_;
+        }
+
+        size_t numDirs() const {
+            return numDirs_;
+        }
+
+        size_t numFiles() const {
+            return numFiles_;
+        }
+
+        /** Returns the largest path id + 1.
+         */
+        size_t numPaths() const {
+            return numPaths_;
+        }
+
+        /** Returns the path segment of given id.
+         */
+        std::string segment(unsigned id) const {
+            assert(id < numSegments_);
+            return std::string(heap_ + segmentOffsets_[id], segmentOffsets_[id + 1] - segmentOffsets_[id]);
+        }
+
+        DirRecord const & dir(unsigned index) const {
+            assert(index < numDirs_);
+            return dirs_[index];
+        }
+
+        FileRecord const & file(unsigned index) const {
+            assert(index < numFiles_);
+            return files_[index];
+        }
+
+        /** Returns the index of the file of given path id, or NONE if the path id is not used.
+         */
+        unsigned fileOf(unsigned pathId) const {
+            return pathId < numPaths_ ? fileOf_[pathId] : NONE;
+        }
+
+        /** Returns the names of the directories from the root (inclusive) to the given directory.
+         */
+        std::vector<unsigned> namesOf(unsigned dirIndex) const {
+            std::vector<unsigned> result;
+            while (dirIndex != NONE) {
+                result.push_back(dirs_[dirIndex].name);
+                dirIndex = dirs_[dirIndex].parent;
+            }
+            std::reverse(result.begin(), result.end());
+            return result;
+        }
+
+        /** Returns the index of the directory with given path (without the trailing slash, empty for root), or NONE if there is no such directory.
+         */
+        unsigned findDir(std::string const & path) const {
+            unsigned d = 0;
+            if (path.empty())
+                return d;
+            for (std::string const & name : helpers::Split(path, '/')) {
+                DirRecord const & r = dirs_[d];
+                DirRecord const * first = dirs_ + r.firstDir;
+                DirRecord const * last = first + r.numDirs;
+                DirRecord const * i = std::lower_bound(first, last, name, [this](DirRecord const & x, std::string const & n) {
+                        return compareSegment(x.name, n) < 0;
+                    });
+                if (i == last || compareSegment(i->name, name) != 0)
+                    return NONE;
+                d = i - dirs_;
+            }
+            return d;
+        }
+
+    private:
+
+        /** Number of bytes after the 32bit file records and fileOf array so that the segment offsets are aligned.
+         */
+        static size_t Padding(uint64_t numFiles, uint64_t numPaths) {
+            return ((numFiles * sizeof(FileRecord) + numPaths * sizeof(uint32_t)) % 8);
+        }
+
+        int compareSegment(unsigned id, std::string const & with) const {
+            size_t length = segmentOffsets_[id + 1] - segmentOffsets_[id];
+            int result = memcmp(heap_ + segmentOffsets_[id], with.c_str(), std::min(length, with.size()));
+            if (result != 0)
+                return result;
+            return length < with.size() ? -1 : (length > with.size() ? 1 : 0);
+        }
+
+        char const * base_;
+        size_t size_;
+        uint64_t numSegments_;
+        uint64_t numDirs_;
+        uint64_t numFiles_;
+        uint64_t numPaths_;
+        DirRecord const * dirs_;
+        FileRecord const * files_;
+        uint32_t const * fileOf_;
+        uint64_t const * segmentOffsets_;
+        char const * heap_;
+    }; // PathTree
+
+} // namespace dejavu
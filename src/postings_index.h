@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "helpers/helpers.h"
+
+#include "settings.h"
+
+namespace dejavu {
+
+    /** A single occurrence of a file contents, i.e. a file change record together with the time of its commit.
+     */
+    class Posting {
+    public:
+        unsigned projectId;
+        unsigned commitId;
+        unsigned pathId;
+        unsigned contentsId;
+        uint64_t time;
+
+        Posting() = default;
+
+        Posting(unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId, uint64_t time):
+            projectId(projectId),
+            commitId(commitId),
+            pathId(pathId),
+            contentsId(contentsId),
+            time(time) {
+        }
+
+        bool operator < (Posting const & other) const {
+            return std::tie(projectId, commitId, pathId, contentsId) < std::tie(other.projectId, other.commitId, other.pathId, other.contentsId);
+        }
+    };
+
+    /** On-disk inverted index from contents, path, or project ids to their postings, i.e. all file changes with that id.
+
+        Produced by the build-postings-index command so that questions like where does given contents appear and who had it first can be answered without scanning all file changes. There is a separate index for each key, each consisting of two files in the data directory, e.g. for contents:
+
+        contentsPostings.bin contains the posting lists of all contents ids, one after another. Each list is sorted by project, commit, path and contents ids and is delta compressed:
+
+            LIST := numPostings { id1 id2 id3 time }
+
+        where id1 to id3 are the three ids other than the key in the project, commit, path, contents order. All values are unsigned LEB128 varints. id1 is stored as a difference from id1 of the previous posting. If id1 is the same as in the previous posting, id2 is stored as a difference from the previous id2, otherwise as is, and similarly for id3. The time is stored as a zigzag encoded difference from the previous time.
+
+        contentsPostingsIndex.bin contains the number of ids, followed by n + 1 64bit offsets of the posting lists in the data file so that the list of id i spans from offset i to offset i + 1. Empty lists have both offsets the same.
+
+        Both files start with a magic string which also identifies the version of the format. The reader does not load the index, but only reads the two offsets it needs for each lookup so that lookups are fast even for the largest datasets.
+     */
+    class PostingsIndex {
+    public:
+
+        enum class Key {
+            Contents,
+            Path,
+            Project,
+        };
+
+        static constexpr size_t MAGIC_SIZE = 8;
+
+        static char const * Magic() {
+            return "DJVPOST1";
+        }
+
+        static char const * Name(Key key) {
+            switch (key) {
+            case Key::Contents:
+                return "contents";
+            case Key::Path:
+                return "paths";
+            case Key::Project:
+                return "projects";
+            default:
+                UNREACHABLE;
+            }
+        }
+
+        static std::string DataFile(std::string const & dir, Key key) {
+            return dir + "/" + Name(key) + "Postings.bin";
+        }
+
+        static std::string IndexFile(std::string const & dir, Key key) {
+            return dir + "/" + Name(key) + "PostingsIndex.bin";
+        }
+
+        static unsigned KeyOf(Posting const & p, Key key) {
+            switch (key) {
+            case Key::Contents:
+                return p.contentsId;
+            case Key::Path:
+                return p.pathId;
+            case Key::Project:
+                return p.projectId;
+            default:
+                UNREACHABLE;
+            }
+        }
+
+        /** Builds the posting indices from file changes held in memory.
+
+            The postings are first bucketed by the key with a counting sort. The key space is then split into chunks of roughly the same number of postings, which are sorted and encoded in parallel and written in order.
+         */
+        class Builder {
+        public:
+
+            /** Number of postings in a chunk which is encoded by a single thread.
+             */
+            static constexpr size_t CHUNK_SIZE = 1000000;
+
+            Builder(std::vector<Posting> const & postings, std::string const & dir = DataDir.value()):
+                postings_(postings),
+                dir_(dir) {
+            }
+
+            /** Builds the index for given key, returns the number of ids in the index.
+             */
+            size_t build(Key key, unsigned numThreads) {
+                // counting sort of the postings by their keys
+                size_t n = 0;
+                for (Posting const & p : postings_)
+                    n = std::max(n, static_cast<size_t>(KeyOf(p, key)) + 1);
+                std::vector<uint64_t> start(n + 1, 0);
+                for (Posting const & p : postings_)
+                    ++start[KeyOf(p, key) + 1];
+                for (size_t i = 1; i <= n; ++i)
+                    start[i] += start[i - 1];
+                std::vector<size_t> order(postings_.size());
+                {
+                    std::vector<uint64_t> next(start.begin(), start.end() - 1);
+                    for (size_t i = 0, e = postings_.size(); i != e; ++i)
+                        order[next[KeyOf(postings_[i], key)]++] = i;
+                }
+                // split the keys to chunks
+                std::vector<size_t> chunks;
+                chunks.push_back(0);
+                for (size_t i = 0; i < n; ++i)
+                    if (start[i + 1] - start[chunks.back()] >= CHUNK_SIZE)
+                        chunks.push_back(i + 1);
+                if (chunks.back() != n)
+                    chunks.push_back(n);
+                // encode the chunks, numThreads at a time, and write them in order
+                std::ofstream f(DataFile(dir_, key), std::ios::out | std::ios::binary);
+                if (! f.good())
+                    ERROR("Unable to open " << DataFile(dir_, key) << " for writing");
+                f.write(Magic(), MAGIC_SIZE);
+                std::vector<uint64_t> offsets(n + 1);
+                uint64_t offset = MAGIC_SIZE;
+                for (size_t first = 0; first + 1 < chunks.size(); first += numThreads) {
+                    size_t last = std::min(first + numThreads, chunks.size() - 1);
+                    std::vector<std::string> buffers(last - first);
+                    std::vector<std::thread> threads;
+                    for (size_t c = first; c < last; ++c)
+                        threads.push_back(std::thread([&, c]() {
+                            std::string & buffer = buffers[c - first];
+                            std::vector<Posting> list;
+                            for (size_t i = chunks[c]; i < chunks[c + 1]; ++i) {
+                                // relative to the chunk for now
+                                offsets[i] = buffer.size();
+                                list.clear();
+                                for (uint64_t j = start[i]; j < start[i + 1]; ++j)
+                                    list.push_back(postings_[order[j]]);
+                                Encode(list, key, buffer);
+                            }
+                        }));
+                    for (auto & t : threads)
+                        t.join();
+                    for (size_t c = first; c < last; ++c) {
+                        for (size_t i = chunks[c]; i < chunks[c + 1]; ++i)
+                            offsets[i] += offset;
+                        std::string const & buffer = buffers[c - first];
+                        f.write(buffer.c_str(), buffer.size());
+                        offset += buffer.size();
+                    }
+                    std::cerr << " : " << chunks[last] << "    \r" << std::flush;
+                }
+                offsets[n] = offset;
+                if (! f.good())
+                    ERROR("Unable to write " << DataFile(dir_, key));
+                f.close();
+                std::ofstream idx(IndexFile(dir_, key), std::ios::out | std::ios::binary);
+                if (! idx.good())
+                    ERROR("Unable to open " << IndexFile(dir_, key) << " for writing");
+                idx.write(Magic(), MAGIC_SIZE);
+                uint64_t numIds = n;
+                idx.write(reinterpret_cast<char const *>(& numIds), sizeof(numIds));
+                idx.write(reinterpret_cast<char const *>(offsets.data()), offsets.size() * sizeof(uint64_t));
+                if (! idx.good())
+                    ERROR("Unable to write " << IndexFile(dir_, key));
+                return n;
+            }
+
+        private:
+
+            std::vector<Posting> const & postings_;
+            std::string dir_;
+        }; // PostingsIndex::Builder
+
+        /** Opens the index for given key in given directory.
+         */
+        PostingsIndex(Key key, std::string const & dir = DataDir.value()):
+            key_(key),
+            size_(0) {
+            index_ = open(IndexFile(dir, key).c_str(), O_RDONLY);
+            if (index_ == -1)
+                ERROR("Unable to open " << IndexFile(dir, key) << ", run build-postings-index first");
+            char magic[MAGIC_SIZE];
+            uint64_t offset = 0;
+            readInto(index_, magic, MAGIC_SIZE, offset);
+            if (strncmp(magic, Magic(), MAGIC_SIZE) != 0)
+                ERROR("Invalid postings index " << IndexFile(dir, key));
+            readInto(index_, & size_, sizeof(size_), offset);
+            data_ = open(DataFile(dir, key).c_str(), O_RDONLY);
+            if (data_ == -1)
+                ERROR("Unable to open " << DataFile(dir, key));
+        }
+
+        PostingsIndex(PostingsIndex const &) = delete;
+
+        ~PostingsIndex() {
+            ::close(index_);
+            ::close(data_);
+        }
+
+        /** Returns the largest id + 1 for which the index has an entry.
+         */
+        size_t size() const {
+            return size_;
+        }
+
+        /** Returns the postings of given id, sorted by project, commit, path and contents ids.
+
+            Does not change the reader and so can be called concurrently from multiple threads.
+         */
+        std::vector<Posting> get(unsigned id) const {
+            std::vector<Posting> result;
+            if (id >= size_)
+                return result;
+            uint64_t range[2];
+            uint64_t offset = MAGIC_SIZE + sizeof(uint64_t) + id * sizeof(uint64_t);
+            readInto(index_, range, sizeof(range), offset);
+            if (range[0] == range[1])
+                return result;
+            std::string buffer(range[1] - range[0], '\0');
+            offset = range[0];
+            readInto(data_, & buffer[0], buffer.size(), offset);
+            Decode(buffer, key_, id, result);
+            return result;
+        }
+
+    private:
+
+        static void AppendVarint(std::string & buffer, uint64_t value) {
+            while (value >= 0x80) {
+                buffer.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                value >>= 7;
+            }
+            buffer.push_back(static_cast<char>(value));
+        }
+
+        static uint64_t ReadVarint(char const * & i) {
+            uint64_t result = 0;
+            unsigned shift = 0;
+            while (true) {
+                uint8_t x = static_cast<uint8_t>(*i++);
+                result |= static_cast<uint64_t>(x & 0x7f) << shift;
+                if ((x & 0x80) == 0)
+                    return result;
+                shift += 7;
+            }
+        }
+
+        /** Returns pointers to the three ids of the posting other than the key, in the order they are stored.
+         */
+        template<typename P, typename ID>
+        static void OtherIds(P & p, Key key, ID * ids[3]) {
+            ID * all[] = { & p.projectId, & p.commitId, & p.pathId, & p.contentsId };
+            ID * k = nullptr;
+            switch (key) {
+            case Key::Contents:
+                k = & p.contentsId;
+                break;
+            case Key::Path:
+                k = & p.pathId;
+                break;
+            case Key::Project:
+                k = & p.projectId;
+                break;
+            }
+            unsigned j = 0;
+            for (ID * x : all)
+                if (x != k)
+                    ids[j++] = x;
+        }
+
+        /** Sorts the postings of a single key and appends their encoded list to the buffer.
+         */
+        static void Encode(std::vector<Posting> & list, Key key, std::string & buffer) {
+            if (list.empty())
+                return;
+            std::sort(list.begin(), list.end());
+            AppendVarint(buffer, list.size());
+            unsigned prev[3] = { 0, 0, 0 };
+            uint64_t prevTime = 0;
+            for (Posting const & p : list) {
+                unsigned const * ids[3];
+                OtherIds(p, key, ids);
+                bool same = true;
+                for (unsigned i = 0; i < 3; ++i) {
+                    AppendVarint(buffer, same ? * ids[i] - prev[i] : * ids[i]);
+                    same = same && (* ids[i] == prev[i]);
+                    prev[i] = * ids[i];
+                }
+                int64_t delta = static_cast<int64_t>(p.time - prevTime);
+                AppendVarint(buffer, (static_cast<uint64_t>(delta) << 1) ^ static_cast<uint64_t>(delta >> 63));
+                prevTime = p.time;
+            }
+        }
+
+        static void Decode(std::string const & buffer, Key key, unsigned id, std::vector<Posting> & into) {
+            char const * i = buffer.c_str();
+            uint64_t n = ReadVarint(i);
+            into.resize(n);
+            unsigned prev[3] = { 0, 0, 0 };
+            uint64_t prevTime = 0;
+            for (Posting & p : into) {
+                p.projectId = p.commitId = p.pathId = p.contentsId = id;
+                unsigned * ids[3];
+                OtherIds(p, key, ids);
+                bool same = true;
+                for (unsigned j = 0; j < 3; ++j) {
+                    unsigned x = static_cast<unsigned>(ReadVarint(i));
+                    * ids[j] = same ? prev[j] + x : x;
+                    same = same && (x == 0);
+                    prev[j] = * ids[j];
+                }
+                uint64_t zigzag = ReadVarint(i);
+                int64_t delta = static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1);
+                p.time = prevTime + delta;
+                prevTime = p.time;
+            }
+        }
+
+        static void readInto(int fd, void * into, size_t bytes, uint64_t & offset) {
+            char * x = reinterpret_cast<char *>(into);
+            while (bytes > 0) {
+                ssize_t n = pread(fd, x, bytes, offset);
+                if (n <= 0)
+                    ERROR("Unable to read postings at offset " << offset);
+                x += n;
+                bytes -= n;
+                offset += n;
+            }
+        }
+
+        Key key_;
+        uint64_t size_;
+        int index_;
+        int data_;
+    }; // PostingsIndex
+
+} // namespace dejavu
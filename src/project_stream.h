@@ -0,0 +1,430 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "helpers/helpers.h"
+
+#include "settings.h"
+#include "loaders.h"
+
+namespace dejavu {
+
+    /** File changes sorted by project and commit ids, stored in a binary file so that they can be read one project at a time.
+
+        The file (fileChanges.sorted.bin in the data directory) starts with a magic string identifying the format, followed by the records, each consisting of four 32bit unsigned integers (projectId, commitId, pathId, contentsId).
+
+        The file is created from fileChanges.csv by an external sort whose memory is bounded by the given budget: the changes are read in runs which fit in the budget, each run is sorted and stored in a temporary file and the runs are then merged into the final file. The sorted file is reused as long as it is newer than fileChanges.csv.
+     */
+    class SortedFileChanges {
+    public:
+
+        static constexpr size_t MAGIC_SIZE = 8;
+
+        static char const * Magic() {
+            return "DJVFCS01";
+        }
+
+        struct Record {
+            uint32_t projectId;
+            uint32_t commitId;
+            uint32_t pathId;
+            uint32_t contentsId;
+
+            bool operator < (Record const & other) const {
+                return std::tie(projectId, commitId, pathId, contentsId) < std::tie(other.projectId, other.commitId, other.pathId, other.contentsId);
+            }
+        };
+
+        static std::string Filename(std::string const & dir = DataDir.value()) {
+            return dir + "/fileChanges.sorted.bin";
+        }
+
+        /** Makes sure the sorted file changes exist in the data directory and are up to date, sorting them if necessary.
+         */
+        static void Ensure(size_t memoryBudget) {
+            std::string input = DataDir.value() + "/fileChanges.csv";
+            std::string output = Filename();
+            // for dataset views the changes come from the base dataset, filtered by the view
+            uint64_t inputTime = std::max(ModificationTime(DatasetView::Resolve(input)), ModificationTime(DatasetView::File(DataDir.value())));
+            if (ModificationTime(output) >= inputTime) {
+                std::cerr << "Using sorted file changes in " << output << std::endl;
+                return;
+            }
+            Sort(input, output, memoryBudget, TempDir.value());
+        }
+
+        /** Sorts the file changes in given csv file and stores them in the output file, using at most the given memory budget (in bytes) for the records and temporary files in the given directory.
+         */
+        static void Sort(std::string const & input, std::string const & output, size_t memoryBudget, std::string const & tempDir) {
+            std::cerr << "Sorting file changes (external sort)..." << std::endl;
+            size_t runSize = std::max(memoryBudget / sizeof(Record), MinBuffer());
+            std::vector<std::string> runs;
+            std::vector<Record> buffer;
+            buffer.reserve(runSize);
+            size_t records = 0;
+            FileChangeLoader::Read(input, [&](unsigned projectId, unsigned commitId, unsigned pathId, unsigned contentsId) {
+                    buffer.push_back(Record{projectId, commitId, pathId, contentsId});
+                    ++records;
+                    if (buffer.size() == runSize)
+                        runs.push_back(WriteRun(buffer, tempDir, runs.size()));
+                });
+            std::cerr << "    " << records << " changes read" << std::endl;
+            // if everything fits in a single run, there is no need to go through the temporary files
+            if (runs.empty()) {
+                std::sort(buffer.begin(), buffer.end());
+                Writer w(output);
+                for (Record const & r : buffer)
+                    w.write(r);
+                return;
+            }
+            if (! buffer.empty())
+                runs.push_back(WriteRun(buffer, tempDir, runs.size()));
+            buffer.clear();
+            buffer.shrink_to_fit();
+            std::cerr << "    merging " << runs.size() << " runs..." << std::endl;
+            Merge(runs, output, memoryBudget);
+            for (std::string const & run : runs)
+                std::remove(run.c_str());
+        }
+
+        /** Sequential reader of a file with sorted records.
+         */
+        class Reader {
+        public:
+            Reader(std::string const & filename, size_t bufferSize, bool hasMagic = true):
+                f_(filename, std::ios::in | std::ios::binary),
+                buffer_(std::max(bufferSize, MinBuffer())),
+                size_(0),
+                pos_(0) {
+                if (! f_.good())
+                    ERROR("Unable to open " << filename);
+                if (hasMagic) {
+                    char magic[MAGIC_SIZE];
+                    f_.read(magic, MAGIC_SIZE);
+                    if (! f_.good() || strncmp(magic, Magic(), MAGIC_SIZE) != 0)
+                        ERROR("Invalid sorted file changes " << filename);
+                }
+            }
+
+            /** Reads next record and returns true, or returns false if there are no more records.
+             */
+            bool next(Record & into) {
+                if (pos_ == size_) {
+                    f_.read(reinterpret_cast<char *>(buffer_.data()), buffer_.size() * sizeof(Record));
+                    size_ = f_.gcount() / sizeof(Record);
+                    pos_ = 0;
+                    if (size_ == 0)
+                        return false;
+                }
+                into = buffer_[pos_++];
+                return true;
+            }
+
+        private:
+            std::ifstream f_;
+            std::vector<Record> buffer_;
+            size_t size_;
+            size_t pos_;
+        }; // SortedFileChanges::Reader
+
+    private:
+
+        static size_t MinBuffer() {
+            return 1024;
+        }
+
+        class Writer {
+        public:
+            Writer(std::string const & filename, bool hasMagic = true):
+                f_(filename, std::ios::out | std::ios::binary) {
+                if (! f_.good())
+                    ERROR("Unable to open " << filename << " for writing");
+                if (hasMagic)
+                    f_.write(Magic(), MAGIC_SIZE);
+            }
+
+            void write(Record const & r) {
+                f_.write(reinterpret_cast<char const *>(& r), sizeof(Record));
+            }
+
+        private:
+            std::ofstream f_;
+        };
+
+        static uint64_t ModificationTime(std::string const & filename) {
+            struct stat s;
+            if (stat(filename.c_str(), & s) != 0)
+                return 0;
+            return s.st_mtime;
+        }
+
+        static std::string WriteRun(std::vector<Record> & buffer, std::string const & tempDir, size_t index) {
+            std::string filename = STR(tempDir << "/fileChanges." << getpid() << "." << index << ".run");
+            std::sort(buffer.begin(), buffer.end());
+            Writer w(filename, false);
+            for (Record const & r : buffer)
+                w.write(r);
+            buffer.clear();
+            return filename;
+        }
+
+        /** K-way merge of the sorted runs, the memory budget is split evenly between the buffers of the runs.
+         */
+        static void Merge(std::vector<std::string> const & runs, std::string const & output, size_t memoryBudget) {
+            size_t bufferSize = memoryBudget / sizeof(Record) / runs.size();
+            std::vector<Reader *> readers;
+            typedef std::pair<Record, size_t> Head;
+            auto cmp = [](Head const & a, Head const & b) {
+                return b.first < a.first;
+            };
+            std::priority_queue<Head, std::vector<Head>, decltype(cmp)> q(cmp);
+            for (std::string const & run : runs) {
+                readers.push_back(new Reader(run, bufferSize, false));
+                Record r;
+                if (readers.back()->next(r))
+                    q.push(Head(r, readers.size() - 1));
+            }
+            Writer w(output);
+            while (! q.empty()) {
+                Head h = q.top();
+                q.pop();
+                w.write(h.first);
+                if (readers[h.second]->next(h.first))
+                    q.push(h);
+            }
+            for (Reader * r : readers)
+                delete r;
+        }
+
+    }; // SortedFileChanges
+
+    /** Feeds projects one at a time, with their commits, parents and changes, to a per-project analysis so that the file changes never have to be loaded in memory all at once.
+
+        Only the commit times and parent relations are kept in memory for the whole dataset. The file changes are read from the sorted file changes (see SortedFileChanges), which are created if necessary. For each project, the stream creates its commits, adds them to the project together with their changes, links them with their parents and calls the handler. Parents outside of the project are created as well (but not added to the project) so that the commits have the same number of parents as when the whole dataset is loaded. Once the handler returns, all commits are deleted and removed from the project, so the handler must not keep any pointers to them.
+
+        Projects are analyzed by the given number of threads, while the calling thread reads the file changes. Only as many projects are read ahead as fit in the memory budget, but at least one project is always being analyzed regardless of its size.
+     */
+    template<typename PROJECT, typename COMMIT>
+    class ProjectStream {
+    public:
+
+        typedef SortedFileChanges::Record Record;
+
+        /** Returns the project for given id, or nullptr if the project should be skipped.
+         */
+        typedef std::function<PROJECT *(unsigned)> ProjectLookup;
+
+        typedef std::function<void(PROJECT *)> Handler;
+
+        /** Creates commit with given id and time.
+         */
+        typedef std::function<COMMIT *(unsigned, uint64_t)> CommitFactory;
+
+        /** Estimated memory required by a single file change once it is loaded in a commit.
+         */
+        static constexpr size_t CHANGE_COST = 128;
+
+        ProjectStream(size_t memoryBudget = static_cast<size_t>(MemoryBudget.value()) * 1024 * 1024):
+            memoryBudget_(memoryBudget),
+            factory_([](unsigned id, uint64_t time) {
+                    return new COMMIT(id, time);
+                }) {
+            SortedFileChanges::Ensure(memoryBudget_);
+            std::cerr << "Loading commit times ... " << std::endl;
+            CommitLoader::Read([this](unsigned id, uint64_t authorTime, uint64_t committerTime){
+                    if (id >= times_.size())
+                        times_.resize(id + 1);
+                    times_[id] = authorTime;
+                });
+            std::cerr << "Loading commit parents ... " << std::endl;
+            CommitParentsLoader::Read([this](unsigned id, unsigned parentId){
+                    parents_.push_back(std::make_pair(id, parentId));
+                });
+            std::sort(parents_.begin(), parents_.end());
+            std::cerr << "    " << parents_.size() << " parent records" << std::endl;
+        }
+
+        /** Sets the factory used to create commits, by default the commits are created with their author times.
+         */
+        void setCommitFactory(CommitFactory f) {
+            factory_ = f;
+        }
+
+        /** Reserves given number of bytes of the memory budget for data the analysis keeps for the whole run, so that fewer projects are read ahead.
+
+            Returns false if the reserved memory exceeds the budget, in which case the projects are analyzed one at a time.
+         */
+        bool reserveMemory(size_t bytes) {
+            if (bytes >= memoryBudget_) {
+                memoryBudget_ = 0;
+                return false;
+            }
+            memoryBudget_ -= bytes;
+            return true;
+        }
+
+        uint64_t commitTime(unsigned id) const {
+            assert(id < times_.size());
+            return times_[id];
+        }
+
+        /** Calls the handler for every file change, in the sorted order.
+         */
+        void forEachChange(std::function<void(Record const &)> handler) const {
+            SortedFileChanges::Reader r(SortedFileChanges::Filename(), readBufferSize());
+            Record x;
+            while (r.next(x))
+                handler(x);
+        }
+
+        /** Analyzes all projects in the stream.
+         */
+        void process(ProjectLookup lookup, Handler handler, unsigned numThreads) {
+            std::vector<std::thread> threads;
+            done_ = false;
+            inFlight_ = 0;
+            for (unsigned i = 0; i < std::max(numThreads, 1u); ++i)
+                threads.push_back(std::thread([&, this]() {
+                    while (true) {
+                        Batch * b;
+                        {
+                            std::unique_lock<std::mutex> g(m_);
+                            cvReady_.wait(g, [this]() {
+                                return ! q_.empty() || done_;
+                            });
+                            if (q_.empty())
+                                return;
+                            b = q_.front();
+                            q_.pop_front();
+                        }
+                        PROJECT * p = lookup(b->projectId);
+                        if (p != nullptr)
+                            analyzeProject(p, b->changes, handler);
+                        {
+                            std::lock_guard<std::mutex> g(m_);
+                            inFlight_ -= b->changes.size();
+                        }
+                        cvSpace_.notify_one();
+                        delete b;
+                    }
+                }));
+            Batch * b = nullptr;
+            size_t projects = 0;
+            forEachChange([&](Record const & r) {
+                    if (b != nullptr && b->projectId != r.projectId) {
+                        schedule(b);
+                        b = nullptr;
+                        if (++projects % 1000 == 0)
+                            std::cerr << " : " << projects << "    \r" << std::flush;
+                    }
+                    if (b == nullptr)
+                        b = new Batch(r.projectId);
+                    b->changes.push_back(r);
+                });
+            if (b != nullptr)
+                schedule(b);
+            {
+                std::lock_guard<std::mutex> g(m_);
+                done_ = true;
+            }
+            cvReady_.notify_all();
+            for (auto & i : threads)
+                i.join();
+        }
+
+    private:
+
+        struct Batch {
+            unsigned projectId;
+            std::vector<Record> changes;
+
+            Batch(unsigned projectId):
+                projectId(projectId) {
+            }
+        };
+
+        size_t readBufferSize() const {
+            return memoryBudget_ / 16 / sizeof(Record);
+        }
+
+        /** Waits until the project fits in the memory budget and then queues it for the analysis.
+         */
+        void schedule(Batch * b) {
+            {
+                std::unique_lock<std::mutex> g(m_);
+                cvSpace_.wait(g, [&, this]() {
+                        return inFlight_ == 0 || (inFlight_ + b->changes.size()) * CHANGE_COST <= memoryBudget_;
+                    });
+                inFlight_ += b->changes.size();
+                q_.push_back(b);
+            }
+            cvReady_.notify_one();
+        }
+
+        void analyzeProject(PROJECT * p, std::vector<Record> const & changes, Handler const & handler) {
+            std::unordered_map<unsigned, COMMIT *> commits;
+            for (Record const & r : changes) {
+                COMMIT * & c = commits[r.commitId];
+                if (c == nullptr) {
+                    c = factory_(r.commitId, commitTime(r.commitId));
+                    p->addCommit(c);
+                }
+                c->addChange(r.pathId, r.contentsId);
+            }
+            std::unordered_map<unsigned, COMMIT *> outside;
+            for (auto i : commits) {
+                auto pi = std::lower_bound(parents_.begin(), parents_.end(), std::make_pair(i.first, 0u));
+                for (auto pe = parents_.end(); pi != pe && pi->first == i.first; ++pi) {
+                    auto j = commits.find(pi->second);
+                    if (j != commits.end()) {
+                        i.second->addParent(j->second);
+                    } else {
+                        COMMIT * & parent = outside[pi->second];
+                        if (parent == nullptr)
+                            parent = factory_(pi->second, commitTime(pi->second));
+                        i.second->addParent(parent);
+                    }
+                }
+            }
+            handler(p);
+            p->commits.clear();
+            for (auto i : commits)
+                delete i.second;
+            for (auto i : outside)
+                delete i.second;
+        }
+
+        size_t memoryBudget_;
+        CommitFactory factory_;
+
+        std::vector<uint64_t> times_;
+        // (commitId, parentId) sorted
+        std::vector<std::pair<unsigned, unsigned>> parents_;
+
+        std::deque<Batch *> q_;
+        size_t inFlight_;
+        bool done_;
+        std::mutex m_;
+        std::condition_variable cvReady_;
+        std::condition_variable cvSpace_;
+    }; // ProjectStream
+
+} // namespace dejavu
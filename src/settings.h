@@ -44,6 +44,18 @@ namespace dejavu {
      */
     extern helpers::Option<unsigned> NumThreads;
 
+    /** Projects with at least this many commits are considered large and commands which support it walk their histories with the parallel commit iterator.
+     */
+    extern helpers::Option<unsigned> LargeProjectThreshold;
+
+    /** Memory budget in MB for commands which support the out-of-core project streaming mode (see ProjectStream). If 0, all data is loaded in memory.
+     */
+    extern helpers::Option<unsigned> MemoryBudget;
+
+    /** When true, filter commands write full copies of the filtered tables instead of a dataset view (see DatasetView).
+     */
+    extern helpers::Option<bool> Materialize;
+
     /** Random seed to be used for any operations requiring random numbers. 
      */
     extern helpers::Option<unsigned> Seed;
@@ -68,6 +80,22 @@ namespace dejavu {
      */
     extern helpers::Option<std::string> GitHubPersonalAccessToken;
 
+    /** Base URL of the web service used by the downloading commands, each command sets its own default (i.e. raw.githubusercontent.com, or the GitHub API) so that a local stand-in server can be used for testing.
+     */
+    extern helpers::Option<std::string> BaseUrl;
+
+    /** Maximum number of concurrent transfers of the downloading commands.
+     */
+    extern helpers::Option<unsigned> MaxTransfers;
+
+    /** When true, downloading commands which support it revalidate previously downloaded data instead of skipping it.
+     */
+    extern helpers::Option<bool> Refresh;
+
+    /** When true, file contents added to the content store are compressed (see ContentStore).
+     */
+    extern helpers::Option<bool> CompressContents;
+
     /** A colon-separated list of paths to files containing repository credentials in the form: user/project.
      */
     extern helpers::Option<std::string> RepositoryList;
@@ -0,0 +1,223 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "helpers/csv-reader.h"
+#include "helpers/helpers.h"
+
+#include "dataset_view.h"
+
+namespace dejavu {
+
+    /** Schema of a table, i.e. the types of its columns.
+
+        Only unsigned integer columns (unsigned, uint64_t) are supported, which is what the large tables of the dataset (commits, commit parents, file changes) consist of.
+     */
+    template<typename... COLUMNS>
+    struct Schema {
+    };
+
+    /** Loader of tables with given schema.
+
+        The generic loaders split each row into a vector of strings, convert the columns with std::stoul and call a std::function. For the large tables this dominates the loading time. Instead, the typed loader reads the file in large blocks and parses the columns of each line directly into a tuple of the schema's types, which is then passed to the handler. The handler is a template argument, so that it can be inlined in the parser.
+
+        Numeric columns may be quoted. Empty lines are ignored and invalid rows raise an error. When the table belongs to a dataset view (see DatasetView), the rows are read by the generic parser so that the view can filter them and then converted to the schema's types.
+     */
+    template<typename SCHEMA>
+    class TypedLoader;
+
+    template<typename... COLUMNS>
+    class TypedLoader<Schema<COLUMNS...>> {
+    public:
+
+        typedef std::tuple<COLUMNS...> Row;
+
+        static constexpr size_t NUM_COLUMNS = sizeof...(COLUMNS);
+
+        /** Reads the given table, calling the handler with the columns of each row, and returns the number of rows read.
+         */
+        template<typename HANDLER>
+        static size_t Read(std::string const & filename, HANDLER && handler, bool headers = true) {
+            DatasetView::Table table(filename);
+            if (table.filtered()) {
+                ViewReader<HANDLER> r(table, handler);
+                return r.read(headers);
+            }
+            return ReadFile(table.file(), handler, headers);
+        }
+
+    private:
+
+        template<size_t... I>
+        struct Indices {
+        };
+
+        template<size_t N, size_t... I>
+        struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {
+        };
+
+        template<size_t... I>
+        struct MakeIndices<0, I...> {
+            typedef Indices<I...> type;
+        };
+
+        static constexpr size_t BUFFER_SIZE = 1024 * 1024;
+
+        /** Reads rows of the table selected by its views.
+         */
+        template<typename HANDLER>
+        class ViewReader : public helpers::CSVReader {
+        public:
+            ViewReader(DatasetView::Table & table, HANDLER & handler):
+                table_(table),
+                handler_(handler),
+                selected_(0) {
+            }
+
+            size_t read(bool headers) {
+                parse(table_.file(), headers);
+                return selected_;
+            }
+
+        protected:
+            void row(std::vector<std::string> & row) override {
+                if (! table_.selects(row))
+                    return;
+                if (row.size() != NUM_COLUMNS)
+                    ERROR("Expected " << NUM_COLUMNS << " columns, but " << row.size() << " found at line " << numLines() << " of " << table_.file());
+                Row r;
+                if (! ParseColumns<0>(row, r))
+                    ERROR("Invalid row at line " << numLines() << " of " << table_.file());
+                Call(handler_, r, typename MakeIndices<NUM_COLUMNS>::type());
+                ++selected_;
+            }
+
+        private:
+            DatasetView::Table & table_;
+            HANDLER & handler_;
+            size_t selected_;
+        };
+
+        /** Reads the file in large blocks and parses its lines.
+         */
+        template<typename HANDLER>
+        static size_t ReadFile(std::string const & filename, HANDLER & handler, bool headers) {
+            FILE * f = fopen(filename.c_str(), "rb");
+            if (f == nullptr)
+                ERROR("Unable to openfile " << filename);
+            std::vector<char> buffer(BUFFER_SIZE);
+            // unprocessed part of the buffer
+            size_t start = 0;
+            size_t end = 0;
+            size_t lineNum = 0;
+            size_t rows = 0;
+            bool last = false;
+            while (! last) {
+                // move the incomplete line to the beginning of the buffer, growing it if the line does not fit
+                memmove(buffer.data(), buffer.data() + start, end - start);
+                end -= start;
+                start = 0;
+                if (end == buffer.size())
+                    buffer.resize(buffer.size() * 2);
+                size_t n = fread(buffer.data() + end, 1, buffer.size() - end, f);
+                end += n;
+                last = n == 0;
+                char const * data = buffer.data();
+                while (start != end) {
+                    char const * nl = static_cast<char const *>(memchr(data + start, '\n', end - start));
+                    // unless at the end of file, the line is incomplete
+                    if (nl == nullptr && ! last)
+                        break;
+                    char const * p = data + start;
+                    char const * e = nl == nullptr ? data + end : nl;
+                    start = e - data + (nl == nullptr ? 0 : 1);
+                    ++lineNum;
+                    if (e != p && e[-1] == '\r')
+                        --e;
+                    if (p == e)
+                        continue;
+                    if (headers) {
+                        headers = false;
+                        continue;
+                    }
+                    Row r;
+                    if (! ParseColumns<0>(p, e, r))
+                        ERROR("Invalid row at line " << lineNum << " of " << filename << ": " << std::string(p, e));
+                    Call(handler, r, typename MakeIndices<NUM_COLUMNS>::type());
+                    if (++rows % 1000000 == 0)
+                        std::cout << " : " << (lineNum / 1000) << "k\r" << std::flush;
+                }
+            }
+            fclose(f);
+            return rows;
+        }
+
+        template<typename HANDLER, size_t... I>
+        static void Call(HANDLER & handler, Row const & row, Indices<I...>) {
+            handler(std::get<I>(row)...);
+        }
+
+        template<size_t I>
+        static typename std::enable_if<I == NUM_COLUMNS, bool>::type ParseColumns(char const * & p, char const * e, Row & row) {
+            return p == e;
+        }
+
+        template<size_t I>
+        static typename std::enable_if<I < NUM_COLUMNS, bool>::type ParseColumns(char const * & p, char const * e, Row & row) {
+            if (I > 0) {
+                if (p == e || *p != ',')
+                    return false;
+                ++p;
+            }
+            return ParseColumn(p, e, std::get<I>(row)) && ParseColumns<I + 1>(p, e, row);
+        }
+
+        template<size_t I>
+        static typename std::enable_if<I == NUM_COLUMNS, bool>::type ParseColumns(std::vector<std::string> const & columns, Row & row) {
+            return true;
+        }
+
+        template<size_t I>
+        static typename std::enable_if<I < NUM_COLUMNS, bool>::type ParseColumns(std::vector<std::string> const & columns, Row & row) {
+            char const * p = columns[I].c_str();
+            char const * e = p + columns[I].size();
+            return ParseColumn(p, e, std::get<I>(row)) && p == e && ParseColumns<I + 1>(columns, row);
+        }
+
+        /** Parses unsigned integer, which may be quoted, advancing p past it.
+         */
+        template<typename T>
+        static bool ParseColumn(char const * & p, char const * e, T & into) {
+            static_assert(std::is_unsigned<T>::value, "Only unsigned integer columns are supported");
+            bool quoted = p != e && *p == '"';
+            if (quoted)
+                ++p;
+            char const * digits = p;
+            T result = 0;
+            while (p != e && static_cast<unsigned char>(*p - '0') < 10)
+                result = result * 10 + (*p++ - '0');
+            if (p == digits)
+                return false;
+            if (quoted) {
+                if (p == e || *p != '"')
+                    return false;
+                ++p;
+            }
+            into = result;
+            return true;
+        }
+
+    }; // TypedLoader
+
+    // NUM_COLUMNS is odr-used by ViewReader::row, which fails to link without optimizations unless it is defined
+    template<typename... COLUMNS>
+    constexpr size_t TypedLoader<Schema<COLUMNS...>>::NUM_COLUMNS;
+
+} // namespace dejavu